@@ -231,6 +231,76 @@ batch_job_id_t batch_job_wait_timeout(struct batch_queue * q, struct batch_job_i
 	return q->module->job.wait(q, info, stoptime);
 }
 
+/*
+Collect the jobs that have already completed on every queue, without blocking.
+Queues found to have no more jobs are marked in empty.
+*/
+static int batch_job_collect(struct batch_queue **queues, int nqueues, int *empty, struct batch_job_completion *completions, int n, int max)
+{
+	int i;
+	for(i = 0; i < nqueues; i++) {
+		while(!empty[i] && n < max) {
+			batch_job_id_t jobid = queues[i]->module->job.wait(queues[i], &completions[n].info, time(0));
+			if(jobid > 0) {
+				completions[n].queue = queues[i];
+				completions[n].jobid = jobid;
+				n++;
+			} else if(jobid == 0) {
+				empty[i] = 1;
+			} else {
+				break;
+			}
+		}
+	}
+
+	return n;
+}
+
+int batch_job_wait_any(struct batch_queue **queues, int nqueues, struct batch_job_completion *completions, int max, time_t stoptime)
+{
+	int *empty = xxcalloc(nqueues, sizeof(*empty));
+	int n = 0;
+	int i;
+
+	while(max > 0) {
+		n = batch_job_collect(queues, nqueues, empty, completions, 0, max);
+		if(n > 0)
+			break;
+
+		/* Block on a remote queue if there is one, since it also wakes up
+		 * when a local process completes, while the local queue would not
+		 * notice the completions of the remote queue. */
+		int b = -1;
+		for(i = 0; i < nqueues; i++) {
+			if(empty[i])
+				continue;
+			if(b < 0 || (queues[b]->type == BATCH_QUEUE_TYPE_LOCAL && queues[i]->type != BATCH_QUEUE_TYPE_LOCAL))
+				b = i;
+		}
+
+		if(b < 0)
+			break;
+
+		if(stoptime != 0 && time(0) >= stoptime) {
+			n = -1;
+			break;
+		}
+
+		batch_job_id_t jobid = queues[b]->module->job.wait(queues[b], &completions[0].info, stoptime);
+		if(jobid > 0) {
+			completions[0].queue = queues[b];
+			completions[0].jobid = jobid;
+			n = batch_job_collect(queues, nqueues, empty, completions, 1, max);
+			break;
+		} else if(jobid == 0) {
+			empty[b] = 1;
+		}
+	}
+
+	free(empty);
+	return n;
+}
+
 int batch_job_remove(struct batch_queue *q, batch_job_id_t jobid)
 {
 	return q->module->job.remove(q, jobid);
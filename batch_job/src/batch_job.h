@@ -60,6 +60,13 @@ struct batch_job_info {
 	int disk_allocation_exhausted; /**< Non-zero if the job filled its loop device allocation to capacity, zero otherwise */
 };
 
+/** Describes a batch job returned by @ref batch_job_wait_any. */
+struct batch_job_completion {
+	struct batch_queue *queue;   /**< The queue the job was submitted to. */
+	batch_job_id_t jobid;        /**< The jobid of the completed job. */
+	struct batch_job_info info;  /**< The details of the completed job. */
+};
+
 /** Create a new batch queue.
 @param type The type of the queue.
 @return A new batch queue object on success, null on failure.
@@ -99,6 +106,23 @@ If less than zero, the operation timed out or was interrupted by a system event,
 */
 batch_job_id_t batch_job_wait_timeout(struct batch_queue *q, struct batch_job_info *info, time_t stoptime);
 
+/** Wait for batch jobs to complete on any of several queues.
+Blocks until a job completes on one of the queues or the current time exceeds stoptime,
+and then returns every job that has completed on all of the queues, without waiting for
+each queue in turn. Remote queues return early when a local process completes
+(see @ref process_pending), so a remote queue is preferred over the local queue when blocking.
+@param queues An array of queues to wait on.
+@param nqueues The length of the queues array.
+@param completions Pointer to an array of @ref batch_job_completion structures that will be filled in with the completed jobs.
+@param max The length of the completions array.
+@param stoptime An absolute time at which to stop waiting.  If less than or equal to the current time,
+then this function will check for complete jobs but will not block. If zero, block until a job completes.
+@return If greater than zero, indicates the number of entries filled in the completions array.
+If equal to zero, there were no more jobs to wait for in any of the queues.
+If less than zero, the operation timed out or was interrupted by a system event, but may be tried again.
+*/
+int batch_job_wait_any(struct batch_queue **queues, int nqueues, struct batch_job_completion *completions, int max, time_t stoptime);
+
 /** Remove a batch job.
 This call will start the removal process.
 You must still call @ref batch_job_wait to wait for the removal to complete.
@@ -91,6 +91,11 @@ static batch_job_id_t batch_job_wq_submit (struct batch_queue * q, const char *c
 		work_queue_task_specify_resources(t, resources);
 	}
 
+	const char *priority = hash_table_lookup(q->options, "task-priority");
+	if(priority) {
+		work_queue_task_specify_priority(t, atof(priority));
+	}
+
 	work_queue_submit(q->data, t);
 
 	return t->taskid;
@@ -240,6 +245,8 @@ static void batch_queue_wq_option_update (struct batch_queue *q, const char *wha
 			work_queue_master_preferred_connection(q->data, value);
 		else
 			work_queue_master_preferred_connection(q->data, "by_ip");
+	} else if(strcmp(what, "content-addressed-cache") == 0) {
+		work_queue_tune(q->data, "content-addressed-cache", string_istrue(value));
 	} else if(strcmp(what, "category-limits") == 0) {
 		struct rmsummary *s = rmsummary_parse_string(value);
 		if(s) {
@@ -256,7 +263,17 @@ batch_fs_stub_getcwd(wq);
 batch_fs_stub_mkdir(wq);
 batch_fs_stub_putfile(wq);
 batch_fs_stub_stat(wq);
-batch_fs_stub_unlink(wq);
+
+/* Remove the file from the caches of the workers as well, so that the
+ * space of files deleted by the master is reclaimed across the cluster.
+ * The tasks that still use the file are not affected. */
+static int batch_fs_wq_unlink (struct batch_queue *q, const char *path)
+{
+	if(q->data)
+		work_queue_remove_cached_file(q->data, path);
+
+	return delete_dir(path);
+}
 
 const struct batch_queue_module batch_queue_wq = {
 	BATCH_QUEUE_TYPE_WORK_QUEUE,
@@ -0,0 +1,109 @@
+# Generated at Thu Oct 15 23:38:32 UTC 2026 by root@vm
+
+CCTOOLS_INSTALL_DIR=/root/cctools
+CCTOOLS_PACKAGES= dttools batch_job grow makeflow work_queue apps sand allpairs wavefront ftp_lite parrot resource_monitor chirp weaver umbrella deltadb prune doc
+
+CCTOOLS_CC=@echo COMPILE $@;gcc
+
+CCTOOLS_BASE_CCFLAGS= -D__EXTENSIONS__ -D_LARGEFILE64_SOURCE -D__LARGE64_FILES -Wall -Wextra -Wno-unused-parameter -Wno-unknown-pragmas -Wno-deprecated-declarations -Wno-unused-const-variable -fPIC -I/tmp/zl/include -DHAVE_GMTIME_R -DHAVE_FDATASYNC -DHAS_ISNAN -DHAVE_ISNAN -DSQLITE_HAVE_ISNAN -DHAVE_LOCALTIME_R -DHAS_OPENAT -DHAS_PREAD -DUSE_PREAD -DUSE_PREAD64 -DHAS_PWRITE -DUSE_PWRITE -DUSE_PWRITE64 -DHAVE_STRCHRNUL -DHAS_STRSIGNAL -DHAS_USLEEP -DHAVE_USLEEP -DHAS_UTIME -DHAVE_UTIME -DHAS_UTIMENSAT -DHAS_SYS_XATTR_H -DHAS_IFADDRS -DHAS_INTTYPES_H -DHAVE_INTTYPES_H -DHAS_STDINT_H -DHAVE_STDINT_H -DHAS_SYS_STATFS_H -DHAS_SYS_STATVFS_H -DHAS_SYSLOG_H -DBUILD_DATE='"2026-10-15 23:38:31 +0000"' -DBUILD_HOST='"vm"' -DBUILD_USER='"root"' -DCCTOOLS_COMMIT='""' -DCCTOOLS_CONFIGURE_ARGUMENTS='"--with-zlib-path /tmp/zl"' -DCCTOOLS_CPU_X86_64 -DCCTOOLS_CVMFS_BUILD_FLAGS='" "' -DCCTOOLS_OPSYS_LINUX -DCCTOOLS_RELEASE_DATE='"2026-10-15 23:38:31 +0000"' -DCCTOOLS_SOURCE='""' -DCCTOOLS_SYSTEM_INFORMATION='"Linux vm 6.18.44-fc-v130 \#1 SMP PREEMPT_DYNAMIC @0 x86_64 GNU/Linux"' -DCCTOOLS_VERSION='"7.0.0 "' -DCCTOOLS_VERSION_MAJOR=7 -DCCTOOLS_VERSION_MICRO=0 -DCCTOOLS_VERSION_MINOR=0 -DINSTALL_PATH='"/root/cctools"' -D_GNU_SOURCE -D_REENTRANT -g
+
+CCTOOLS_INTERNAL_CCFLAGS= -DCCTOOLS_WITH_CHIRP -I /root/repo/dttools/src -I /root/repo/batch_job/src -I /root/repo/grow/src -I /root/repo/makeflow/src -I /root/repo/work_queue/src -I /root/repo/sand/src -I /root/repo/allpairs/src -I /root/repo/wavefront/src -I /root/repo/ftp_lite/src -I /root/repo/parrot/src -I /root/repo/resource_monitor/src -I /root/repo/chirp/src -I /root/repo/weaver/src -I /root/repo/umbrella/src -I /root/repo/deltadb/src -I /root/repo/prune/src ${CCTOOLS_BASE_CCFLAGS} -std=c99
+
+CCTOOLS_CCFLAGS=-I${CCTOOLS_INSTALL_DIR}/include/cctools ${CCTOOLS_BASE_CCFLAGS} -std=c99
+
+CCTOOLS_CXX=@echo COMPILE $@;g++
+
+CCTOOLS_BASE_CXXFLAGS=${CCTOOLS_BASE_CCFLAGS}
+
+CCTOOLS_INTERNAL_CXXFLAGS= -DCCTOOLS_WITH_CHIRP -I /root/repo/dttools/src -I /root/repo/batch_job/src -I /root/repo/grow/src -I /root/repo/makeflow/src -I /root/repo/work_queue/src -I /root/repo/sand/src -I /root/repo/allpairs/src -I /root/repo/wavefront/src -I /root/repo/ftp_lite/src -I /root/repo/parrot/src -I /root/repo/resource_monitor/src -I /root/repo/chirp/src -I /root/repo/weaver/src -I /root/repo/umbrella/src -I /root/repo/deltadb/src -I /root/repo/prune/src ${CCTOOLS_BASE_CCFLAGS}
+
+CCTOOLS_CXXFLAGS=-I${CCTOOLS_INSTALL_DIR}/include/cctools ${CCTOOLS_BASE_CCFLAGS}
+
+CCTOOLS_LD = @echo LINK $@;gcc
+
+CCTOOLS_BASE_LDFLAGS = -Xlinker -Bstatic -static-libgcc -Xlinker -Bdynamic -Xlinker --as-needed -L/tmp/zl/lib -g
+
+CCTOOLS_INTERNAL_LDFLAGS = $(CCTOOLS_BASE_LDFLAGS) 
+
+CCTOOLS_EXTERNAL_LINKAGE =  -lrt -ldl -L/tmp/zl/lib -lz -lstdc++ -lpthread -lz -lc -lm
+
+CCTOOLS_LDFLAGS = -L$(CCTOOLS_INSTALL_DIR)/lib $(CCTOOLS_BASE_LDFLAGS)
+
+CCTOOLS_READLINE_LDFLAGS=
+
+CCTOOLS_STATIC=
+
+CCTOOLS_DYNAMIC_SUFFIX=so
+CCTOOLS_DYNAMIC_FLAG=-shared
+
+CC=$(CCTOOLS_CC)
+CCFLAGS=$(CCTOOLS_CCFLAGS)
+LD=$(CCTOOLS_LD)
+LDFLAGS=$(CCTOOLS_LDFLAGS)
+CXX=$(CCTOOLS_CXX)
+CXXFLAGS=$(CCTOOLS_CXXFLAGS)
+
+CCTOOLS_AR=ar
+
+CCTOOLS_CHIRP=chirp
+
+CCTOOLS_SWIG=
+
+CCTOOLS_PERL=/usr/bin/perl
+CCTOOLS_PERL_CCFLAGS= -D_REENTRANT -D_GNU_SOURCE -DDEBIAN -fwrapv -fno-strict-aliasing -pipe -I/usr/local/include -D_LARGEFILE_SOURCE -D_FILE_OFFSET_BITS=64  -I/usr/lib/x86_64-linux-gnu/perl/5.36/CORE 
+CCTOOLS_PERL_LDFLAGS=-Wl,-E  -fstack-protector-strong -L/usr/local/lib  -L/usr/lib/x86_64-linux-gnu/perl/5.36/CORE -lperl -ldl -lm -lpthread -lc -lcrypt
+CCTOOLS_PERL_VERSION=5.36.0
+
+CCTOOLS_PYTHON=$(CCTOOLS_PYTHON2)
+CCTOOLS_PYTHON_CCFLAGS=$(CCTOOLS_PYTHON2_CCFLAGS)
+CCTOOLS_PYTHON_LDFLAGS=$(CCTOOLS_PYTHON2_LDFLAGS)
+CCTOOLS_PYTHON_VERSION=$(CCTOOLS_PYTHON2_VERSION)
+CCTOOLS_PYTHON_PATH=$(CCTOOLS_INSTALL_DIR)/lib/python$(CCTOOLS_PYTHON_VERSION)/site-packages
+
+CCTOOLS_PYTHON2=0
+CCTOOLS_PYTHON2_CCFLAGS=
+CCTOOLS_PYTHON2_LDFLAGS=
+CCTOOLS_PYTHON2_VERSION=.
+CCTOOLS_PYTHON2_PATH=$(CCTOOLS_INSTALL_DIR)/lib/python$(CCTOOLS_PYTHON2_VERSION)/site-packages
+
+CCTOOLS_PYTHON3=0
+CCTOOLS_PYTHON3_CCFLAGS=
+CCTOOLS_PYTHON3_LDFLAGS=
+CCTOOLS_PYTHON3_VERSION=.
+CCTOOLS_PYTHON3_2TO3=
+CCTOOLS_PYTHON3_PATH=$(CCTOOLS_INSTALL_DIR)/lib/python$(CCTOOLS_PYTHON3_VERSION)/site-packages
+
+CCTOOLS_SWIG_BINDINGS=
+
+CCTOOLS_SGE_PARAMETERS=
+
+CCTOOLS_DOCTARGETS= htmlpages
+
+CCTOOLS_M4_ARGS=-DCCTOOLS_VERSION="7.0.0 " -DCCTOOLS_RELEASE_DATE=""
+
+CCTOOLS_BUILD_LIB64PARROT_HELPER=yes
+CCTOOLS_BUILD_LIB32PARROT_HELPER=no
+
+CCTOOLS_VERSION=7.0.0 
+CCTOOLS_RELEASEDATE=
+
+CCTOOLS_IRODS_LDFLAGS=
+CCTOOLS_IRODS_CCFLAGS=
+
+CCTOOLS_MYSQL_LDFLAGS=
+CCTOOLS_MYSQL_CCFLAGS=
+
+CCTOOLS_XROOTD_LDFLAGS=
+CCTOOLS_XROOTD_CCFLAGS=
+
+CCTOOLS_CVMFS_LDFLAGS=
+CCTOOLS_CVMFS_CCFLAGS=
+
+CCTOOLS_FUSE_AVAILABLE=
+CCTOOLS_FUSE_LDFLAGS=
+CCTOOLS_FUSE_CCFLAGS=
+
+CCTOOLS_GLOBUS_LDFLAGS=
+CCTOOLS_GLOBUS_CCFLAGS=
+
+export CCTOOLS_TEST_CCFLAGS=
@@ -56,6 +56,8 @@ OPTION_ITEM(`-R, --retry')Automatically retry failed batch jobs up to 100 times.
 OPTION_TRIPLET(-r, retry-count, n)Automatically retry failed batch jobs up to n times.
 OPTION_PAIR(--wait-for-files-upto, #)Wait for output files to be created upto this many seconds (e.g., to deal with NFS semantics).
 OPTION_TRIPLET(-S, submission-timeout, timeout)Time to retry failed batch job submission. (default is 3600s)
+OPTION_PAIR(--submission-order, order)Order in which to submit the rules ready to run: rule, the last rule of the makeflow first, depth, the rules deepest in a chain of rules first, or critical-path, the rules with the longest chain of rules after them first, weighted by the runtimes found in the log of a previous run. (default is rule)
+OPTION_ITEM(`--fuse-chains')Run each chain of rules, in which every rule has a single consumer that has no other producer, as a single job. Only the inputs and outputs of the chain are transferred, and each rule is still recorded in the makeflow log.
 OPTION_TRIPLET(-T, batch-type, type)Batch system type: local, dryrun, condor, sge, pbs, torque, blue_waters, slurm, moab, cluster, wq, amazon, mesos. (default is local)
 OPTIONS_END
 
@@ -85,6 +87,7 @@ OPTION_TRIPLET(-P, priority, integer)Priority. Higher the value, higher the prio
 OPTION_TRIPLET(-W, wq-schedule, mode)WorkQueue scheduling algorithm. (time|files|fcfs)
 OPTION_TRIPLET(-s, password, pwfile)Password file for authenticating workers.
 OPTION_ITEM(`--disable-cache')Disable file caching (currently only Work Queue, default is false)
+OPTION_ITEM(`--wq-content-addressed-cache')Cache input files in the workers under the names of their contents. (default is false)
 OPTION_PAIR(--work-queue-preferred-connection,connection)Indicate preferred connection. Chose one of by_ip or by_hostname. (default is by_ip)
 OPTIONS_END
 
@@ -52,6 +52,7 @@ OPTION_PAIR(--foreman-port, port[:highport]) Set the port for the foreman to lis
 OPTION_TRIPLET(-Z, foreman-port-file, file)Select port to listen to at random and write to this file.  Implies --foreman.
 OPTION_TRIPLET(-F, fast-abort, mult)Set the fast abort multiplier for foreman (default=disabled).
 OPTION_PAIR(--specify-log, logfile)Send statistics about foreman to this file.
+OPTION_PAIR(--foreman-schedule, mode)Foreman scheduling algorithm: files, time, fcfs, rand or worst. (default=files)
 OPTION_TRIPLET(-P, password, pwfile)Password file for authenticating to the master.
 OPTION_TRIPLET(-t, timeout, time)Abort after this amount of idle time. (default=900s)
 OPTION_TRIPLET(-w, tcp-window-size, size)Set TCP window size.
@@ -9,6 +9,7 @@ See the file COPYING for details.
 #include "debug.h"
 #include "domain_name.h"
 #include "full_io.h"
+#include "itable.h"
 #include "link.h"
 #include "macros.h"
 #include "stringtools.h"
@@ -25,6 +26,11 @@ See the file COPYING for details.
 #include <sys/un.h>
 #include <sys/utsname.h>
 
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
+
 #include <fcntl.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -60,6 +66,20 @@ struct link {
 	char buffer[1<<16];
 	char raddr[LINK_ADDRESS_MAX];
 	int rport;
+	struct link_set *set;
+	int set_events;
+};
+
+struct link_set {
+	struct itable *members;      /* fd -> link registered in the set. */
+	struct itable *buffered;     /* fd -> member link that may have data in its user-space buffer. */
+	struct link_info *table;     /* scratch table for link_poll when epoll is not available. */
+	int table_size;
+#ifdef CCTOOLS_OPSYS_LINUX
+	int epfd;
+	struct epoll_event *events;
+	int events_size;
+#endif
 };
 
 static int link_send_window = 65536;
@@ -283,6 +303,8 @@ static struct link *link_create()
 	link->raddr[0] = 0;
 	link->rport = 0;
 	link->type = LINK_TYPE_STANDARD;
+	link->set = 0;
+	link->set_events = 0;
 
 	return link;
 }
@@ -418,7 +440,10 @@ struct link *link_serve_address(const char *addr, int port)
 		break;
 	}
 
-	success = listen(link->fd, 5);
+	// Many clients may connect at once, as when a batch of workers starts.
+	// With a short backlog, the connections that do not fit wait for the
+	// retransmission of their SYN, about a second later.
+	success = listen(link->fd, SOMAXCONN);
 	if(success < 0)
 		goto failure;
 
@@ -562,6 +587,8 @@ static ssize_t fill_buffer(struct link *link, time_t stoptime)
 			link->read += chunk;
 			link->buffer_start = link->buffer;
 			link->buffer_length = chunk;
+			if(link->set)
+				itable_insert(link->set->buffered, link->fd, link);
 			return chunk;
 		} else if(chunk == 0) {
 			link->buffer_start = link->buffer;
@@ -819,6 +846,8 @@ ssize_t link_putfstring(struct link *link, const char *fmt, time_t stoptime, ...
 void link_close(struct link *link)
 {
 	if(link) {
+		if(link->set)
+			link_set_remove(link->set, link);
 		if(link->fd >= 0)
 			close(link->fd);
 		if(link->rport)
@@ -830,6 +859,8 @@ void link_close(struct link *link)
 void link_detach(struct link *link)
 {
 	if(link) {
+		if(link->set)
+			link_set_remove(link->set, link);
 		free(link);
 	}
 }
@@ -920,7 +951,7 @@ ssize_t link_stream_to_buffer(struct link * link, char **buffer, time_t stoptime
 	return total;
 }
 
-int64_t link_stream_to_fd(struct link * link, int fd, int64_t length, time_t stoptime)
+static int64_t link_stream_to_fd_copy(struct link * link, int fd, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
 
@@ -945,7 +976,7 @@ int64_t link_stream_to_fd(struct link * link, int fd, int64_t length, time_t sto
 	return total;
 }
 
-int64_t link_stream_to_file(struct link * link, FILE * file, int64_t length, time_t stoptime)
+static int64_t link_stream_from_fd_copy(struct link * link, int fd, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
 
@@ -953,11 +984,11 @@ int64_t link_stream_to_file(struct link * link, FILE * file, int64_t length, tim
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
 
-		ssize_t ractual = link_read(link, buffer, chunk, stoptime);
+		ssize_t ractual = full_read(fd, buffer, chunk);
 		if(ractual <= 0)
 			break;
 
-		ssize_t wactual = full_fwrite(file, buffer, ractual);
+		ssize_t wactual = link_write(link, buffer, ractual, stoptime);
 		if(wactual != ractual) {
 			total = -1;
 			break;
@@ -970,7 +1001,139 @@ int64_t link_stream_to_file(struct link * link, FILE * file, int64_t length, tim
 	return total;
 }
 
-int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t stoptime)
+#ifdef CCTOOLS_OPSYS_LINUX
+
+/*
+On Linux, data is moved between sockets and files inside the kernel with
+sendfile and splice, rather than being copied through user space. These
+return -1 with errno set to EINVAL if the descriptors involved do not
+support it before any data was moved, in which case the caller falls back to
+the copy loop.
+*/
+
+#define LINK_ZERO_COPY_CHUNK (1<<24)
+
+static int64_t link_stream_from_fd_sendfile(struct link * link, int fd, int64_t length, time_t stoptime)
+{
+	int64_t total = 0;
+
+	while(length > 0) {
+		ssize_t chunk = sendfile(link->fd, fd, NULL, MIN(length, LINK_ZERO_COPY_CHUNK));
+		if(chunk > 0) {
+			link->written += chunk;
+			total += chunk;
+			length -= chunk;
+		} else if(chunk == 0) {
+			break;
+		} else if(errno_is_temporary(errno)) {
+			if(!link_sleep(link, stoptime, 0, 1))
+				return -1;
+		} else if(total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+			errno = EINVAL;
+			return -1;
+		} else {
+			return -1;
+		}
+	}
+
+	return total;
+}
+
+/* Write all the data in the pipe to fd, which must hold exactly length bytes. */
+static int link_drain_pipe(int pipefd, int fd, ssize_t length)
+{
+	while(length > 0) {
+		ssize_t chunk = splice(pipefd, NULL, fd, NULL, length, SPLICE_F_MOVE);
+		if(chunk > 0) {
+			length -= chunk;
+		} else if(chunk < 0 && errno == EINTR) {
+			continue;
+		} else if(chunk < 0 && errno == EINVAL) {
+			/* fd cannot be spliced into (e.g. opened with O_APPEND), so copy the rest. */
+			char buffer[1<<16];
+			ssize_t ractual = read(pipefd, buffer, MIN((ssize_t) sizeof(buffer), length));
+			if(ractual <= 0 || full_write(fd, buffer, ractual) != ractual)
+				return 0;
+			length -= ractual;
+		} else {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int64_t link_stream_to_fd_splice(struct link * link, int fd, int64_t length, time_t stoptime)
+{
+	int64_t total = 0;
+	int pipefd[2];
+
+	if(pipe(pipefd) < 0)
+		return -1;
+
+	while(length > 0) {
+		ssize_t chunk = splice(link->fd, NULL, pipefd[1], NULL, MIN(length, LINK_ZERO_COPY_CHUNK), SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if(chunk > 0) {
+			link->read += chunk;
+			if(!link_drain_pipe(pipefd[0], fd, chunk)) {
+				total = -1;
+				break;
+			}
+			total += chunk;
+			length -= chunk;
+		} else if(chunk == 0) {
+			break;
+		} else if(errno_is_temporary(errno)) {
+			if(!link_sleep(link, stoptime, 1, 0))
+				break;
+		} else if(total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+			total = -1;
+			errno = EINVAL;
+			break;
+		} else {
+			break;
+		}
+	}
+
+	int saved_errno = errno;
+	close(pipefd[0]);
+	close(pipefd[1]);
+	errno = saved_errno;
+
+	return total;
+}
+
+#endif
+
+int64_t link_stream_to_fd(struct link * link, int fd, int64_t length, time_t stoptime)
+{
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(link->type == LINK_TYPE_STANDARD && length > 0) {
+		int64_t total = 0;
+
+		/* data already read into the link buffer has to be copied out first. */
+		if(link->buffer_length > 0) {
+			total = link_stream_to_fd_copy(link, fd, MIN((int64_t) link->buffer_length, length), stoptime);
+			if(total < 0)
+				return total;
+			length -= total;
+			if(length == 0)
+				return total;
+		}
+
+		int64_t spliced = link_stream_to_fd_splice(link, fd, length, stoptime);
+		if(spliced >= 0)
+			return total + spliced;
+		if(errno != EINVAL)
+			return spliced;
+		return total + link_stream_to_fd_copy(link, fd, length, stoptime);
+	}
+#endif
+
+	return link_stream_to_fd_copy(link, fd, length, stoptime);
+}
+
+int64_t link_stream_to_file(struct link * link, FILE * file, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
 
@@ -978,11 +1141,11 @@ int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t s
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
 
-		ssize_t ractual = full_read(fd, buffer, chunk);
+		ssize_t ractual = link_read(link, buffer, chunk, stoptime);
 		if(ractual <= 0)
 			break;
 
-		ssize_t wactual = link_write(link, buffer, ractual, stoptime);
+		ssize_t wactual = full_fwrite(file, buffer, ractual);
 		if(wactual != ractual) {
 			total = -1;
 			break;
@@ -995,6 +1158,19 @@ int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t s
 	return total;
 }
 
+int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t stoptime)
+{
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(link->type == LINK_TYPE_STANDARD && length > 0) {
+		int64_t total = link_stream_from_fd_sendfile(link, fd, length, stoptime);
+		if(total >= 0 || errno != EINVAL)
+			return total;
+	}
+#endif
+
+	return link_stream_from_fd_copy(link, fd, length, stoptime);
+}
+
 int64_t link_stream_from_file(struct link * link, FILE * file, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
@@ -1121,4 +1297,228 @@ int link_poll(struct link_info *links, int nlinks, int msec)
 	return result;
 }
 
+struct link_set *link_set_create(void)
+{
+	struct link_set *s = malloc(sizeof(*s));
+	if(!s)
+		return 0;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	s->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(s->epfd < 0) {
+		free(s);
+		return 0;
+	}
+	s->events = 0;
+	s->events_size = 0;
+#endif
+
+	s->members = itable_create(0);
+	s->buffered = itable_create(0);
+	s->table = 0;
+	s->table_size = 0;
+
+	return s;
+}
+
+void link_set_delete(struct link_set *s)
+{
+	uint64_t fd;
+	struct link *link;
+
+	if(!s)
+		return;
+
+	itable_firstkey(s->members);
+	while(itable_nextkey(s->members, &fd, (void **) &link)) {
+		link->set = 0;
+	}
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	close(s->epfd);
+	free(s->events);
+#endif
+
+	itable_delete(s->members);
+	itable_delete(s->buffered);
+	free(s->table);
+	free(s);
+}
+
+int link_set_add(struct link_set *s, struct link *link, int events)
+{
+	if(link->set && link->set != s) {
+		errno = EBUSY;
+		return 0;
+	}
+
+	if(link->set == s && link->set_events == events)
+		return 1;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = link_to_poll(events);
+	ev.data.ptr = link;
+
+	if(epoll_ctl(s->epfd, link->set ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, link->fd, &ev) < 0) {
+		debug(D_TCP, "could not add fd %d to epoll set: %s", link->fd, strerror(errno));
+		return 0;
+	}
+#endif
+
+	link->set = s;
+	link->set_events = events;
+	itable_insert(s->members, link->fd, link);
+
+	if(link->buffer_length > 0)
+		itable_insert(s->buffered, link->fd, link);
+
+	return 1;
+}
+
+void link_set_remove(struct link_set *s, struct link *link)
+{
+	if(link->set != s)
+		return;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	/* the event argument is ignored, but old kernels require it to be non-null. */
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(s->epfd, EPOLL_CTL_DEL, link->fd, &ev);
+#endif
+
+	itable_remove(s->members, link->fd);
+	itable_remove(s->buffered, link->fd);
+	link->set = 0;
+	link->set_events = 0;
+}
+
+int link_set_size(struct link_set *s)
+{
+	return itable_size(s->members);
+}
+
+/* Fill ready with the links that have data in their user-space buffers,
+ * which the kernel does not know about. Links whose buffers have been
+ * drained since they were marked are forgotten. */
+static int link_set_buffered(struct link_set *s, struct link_info *ready, int nready)
+{
+	uint64_t fd;
+	struct link *link;
+	int n = 0;
+
+	itable_firstkey(s->buffered);
+	while(itable_nextkey(s->buffered, &fd, (void **) &link)) {
+		if(link->buffer_length < 1) {
+			itable_remove(s->buffered, fd);
+			itable_firstkey(s->buffered);
+			n = 0;
+			continue;
+		}
+
+		if(n < nready) {
+			ready[n].link = link;
+			ready[n].events = link->set_events;
+			ready[n].revents = LINK_READ;
+		}
+		n++;
+	}
+
+	return MIN(n, nready);
+}
+
+static int link_set_find(struct link_info *ready, int n, struct link *link)
+{
+	int i;
+	for(i = 0; i < n; i++) {
+		if(ready[i].link == link)
+			return i;
+	}
+	return -1;
+}
+
+int link_set_wait(struct link_set *s, struct link_info *ready, int nready, int msec)
+{
+	int n = link_set_buffered(s, ready, nready);
+	int nbuffered = n;
+
+	// If there's data already waiting, don't sit in the poll
+	if(n > 0)
+		msec = 0;
+
+	if(n >= nready)
+		return n;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(s->events_size < nready) {
+		free(s->events);
+		s->events = malloc(nready * sizeof(*s->events));
+		if(!s->events) {
+			s->events_size = 0;
+			return -1;
+		}
+		s->events_size = nready;
+	}
+
+	int result = epoll_wait(s->epfd, s->events, nready - n, msec);
+	if(result < 0)
+		return nbuffered ? nbuffered : result;
+
+	int i;
+	for(i = 0; i < result; i++) {
+		struct link *link = s->events[i].data.ptr;
+		int revents = poll_to_link(s->events[i].events);
+		if(s->events[i].events & EPOLLERR)
+			revents |= LINK_READ;
+
+		int j = link_set_find(ready, nbuffered, link);
+		if(j >= 0) {
+			ready[j].revents |= revents;
+		} else {
+			ready[n].link = link;
+			ready[n].events = link->set_events;
+			ready[n].revents = revents;
+			n++;
+		}
+	}
+#else
+	int size = itable_size(s->members);
+	if(s->table_size < size) {
+		free(s->table);
+		s->table = malloc(size * sizeof(*s->table));
+		if(!s->table) {
+			s->table_size = 0;
+			return -1;
+		}
+		s->table_size = size;
+	}
+
+	uint64_t fd;
+	struct link *link;
+	int i = 0;
+	itable_firstkey(s->members);
+	while(itable_nextkey(s->members, &fd, (void **) &link)) {
+		s->table[i].link = link;
+		s->table[i].events = link->set_events;
+		s->table[i].revents = 0;
+		i++;
+	}
+
+	int result = link_poll(s->table, size, msec);
+	if(result < 0)
+		return nbuffered ? nbuffered : result;
+
+	for(i = 0; i < size && n < nready; i++) {
+		if(!s->table[i].revents || link_set_find(ready, nbuffered, s->table[i].link) >= 0)
+			continue;
+		ready[n] = s->table[i];
+		n++;
+	}
+#endif
+
+	return n;
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -346,4 +346,54 @@ Wait for a activity on a an array of links.
 
 int link_poll(struct link_info *array, int nlinks, int msec);
 
+/** A persistent set of links to be polled for activity.
+Unlike @ref link_poll, the cost of @ref link_set_wait depends on the number of
+links that are ready, rather than on the number of links in the set. Links are
+registered once with @ref link_set_add, and are automatically removed from the
+set when closed. On Linux, the set is implemented with epoll. Elsewhere, it
+falls back to @ref link_poll.
+*/
+struct link_set;
+
+/** Create an empty link set.
+@return A pointer to a new link set, or null on failure.
+*/
+struct link_set *link_set_create(void);
+
+/** Delete a link set. The links in the set are not closed.
+@param s The link set to delete.
+*/
+void link_set_delete(struct link_set *s);
+
+/** Add a link to a set, or change the events of interest of a link already in the set.
+A link may belong to at most one set at a time.
+@param s The link set.
+@param link The link to add.
+@param events The events to wait for (@ref LINK_READ or @ref LINK_WRITE).
+@return One on success, zero on failure.
+*/
+int link_set_add(struct link_set *s, struct link *link, int events);
+
+/** Remove a link from a set.
+@param s The link set.
+@param link The link to remove.
+*/
+void link_set_remove(struct link_set *s, struct link *link);
+
+/** Return the number of links in a set.
+@param s The link set.
+@return The number of links in the set.
+*/
+int link_set_size(struct link_set *s);
+
+/** Wait for activity on the links of a set.
+Links with data already buffered in user space are always reported as ready to read.
+@param s The link set.
+@param ready Pointer to an array of @ref link_info structures, which upon return is filled with the links that are ready, and the events that occurred in the revents field.
+@param nready The length of the ready array.
+@param msec The number of milliseconds to wait for activity.  Zero indicates do not wait at all, while -1 indicates wait forever.
+@return The number of entries filled in the ready array, or -1 on failure.
+*/
+int link_set_wait(struct link_set *s, struct link_info *ready, int nready, int msec);
+
 #endif
@@ -0,0 +1,180 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Compares the cost of waiting for activity on a large number of mostly idle
+connections with link_poll, which is given the whole table of links every
+time, and with a persistent link_set. In each round a single connection
+becomes active, which is what a master with many idle workers sees.
+*/
+
+#include "link.h"
+#include "timestamp.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static void show_help(const char *cmd)
+{
+	printf("Use: %s [rounds] [connections ...]\n", cmd);
+	printf("Defaults to 1000 rounds, with 1000, 5000, and 20000 connections.\n");
+}
+
+static int raise_fd_limit(int needed)
+{
+	struct rlimit r;
+
+	if(getrlimit(RLIMIT_NOFILE, &r) < 0)
+		return 0;
+
+	if(r.rlim_cur >= (rlim_t) needed)
+		return 1;
+
+	if(r.rlim_max != RLIM_INFINITY && r.rlim_max < (rlim_t) needed)
+		return 0;
+
+	r.rlim_cur = needed;
+	return setrlimit(RLIMIT_NOFILE, &r) == 0;
+}
+
+/* Build the link_info table from scratch, as the master did on every pass. */
+static double bench_link_poll(struct link **links, int *peers, int n, int rounds)
+{
+	struct link_info *table = malloc(n * sizeof(*table));
+	char c;
+	int i, r;
+
+	timestamp_t start = timestamp_get();
+
+	for(r = 0; r < rounds; r++) {
+		int active = r % n;
+		write(peers[active], "x", 1);
+
+		for(i = 0; i < n; i++) {
+			table[i].link = links[i];
+			table[i].events = LINK_READ;
+			table[i].revents = 0;
+		}
+
+		link_poll(table, n, -1);
+
+		for(i = 0; i < n; i++) {
+			if(table[i].revents)
+				link_read(table[i].link, &c, 1, LINK_FOREVER);
+		}
+	}
+
+	timestamp_t elapsed = timestamp_get() - start;
+	free(table);
+
+	return (double) elapsed / rounds;
+}
+
+static double bench_link_set(struct link **links, int *peers, int n, int rounds)
+{
+	struct link_set *s = link_set_create();
+	struct link_info ready[64];
+	char c;
+	int i, r;
+
+	for(i = 0; i < n; i++)
+		link_set_add(s, links[i], LINK_READ);
+
+	timestamp_t start = timestamp_get();
+
+	for(r = 0; r < rounds; r++) {
+		int active = r % n;
+		write(peers[active], "x", 1);
+
+		int nready = link_set_wait(s, ready, 64, -1);
+
+		for(i = 0; i < nready; i++) {
+			link_read(ready[i].link, &c, 1, LINK_FOREVER);
+		}
+	}
+
+	timestamp_t elapsed = timestamp_get() - start;
+	link_set_delete(s);
+
+	return (double) elapsed / rounds;
+}
+
+static int bench(int n, int rounds)
+{
+	struct link **links;
+	int *peers;
+	int i;
+
+	if(!raise_fd_limit(2*n + 64)) {
+		printf("%8d connections: skipped, cannot open %d file descriptors\n", n, 2*n);
+		return 0;
+	}
+
+	links = malloc(n * sizeof(*links));
+	peers = malloc(n * sizeof(*peers));
+
+	for(i = 0; i < n; i++) {
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+			fprintf(stderr, "could not create socket pair %d: %s\n", i, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		links[i] = link_attach_to_fd(fds[0]);
+		peers[i] = fds[1];
+	}
+
+	double poll_usec = bench_link_poll(links, peers, n, rounds);
+	double set_usec = bench_link_set(links, peers, n, rounds);
+
+	printf("%8d connections: link_poll %10.2f us/round, link_set %10.2f us/round, speedup %6.1fx\n", n, poll_usec, set_usec, poll_usec / set_usec);
+
+	for(i = 0; i < n; i++) {
+		link_close(links[i]);
+		close(peers[i]);
+	}
+
+	free(links);
+	free(peers);
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int default_sizes[] = { 1000, 5000, 20000 };
+	int rounds = 1000;
+	int i;
+
+	if(argc > 1) {
+		if(!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+			show_help(argv[0]);
+			return EXIT_SUCCESS;
+		}
+		rounds = atoi(argv[1]);
+		if(rounds < 1) {
+			show_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(argc > 2) {
+		for(i = 2; i < argc; i++)
+			bench(atoi(argv[i]), rounds);
+	} else {
+		for(i = 0; i < (int) (sizeof(default_sizes) / sizeof(default_sizes[0])); i++)
+			bench(default_sizes[i], rounds);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,253 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "priority_queue.h"
+#include "xxmalloc.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+struct priority_queue_node {
+	void *item;
+	double priority;
+	uint64_t sequence;  /* order of the push, to keep items of equal priority in order. */
+	int index;          /* position in the heap. */
+	int removed;        /* removed during a visit, but still in the heap. */
+};
+
+/* A heap of nodes, ordered by node_before. */
+struct node_heap {
+	struct priority_queue_node **nodes;
+	int size;
+	int capacity;
+};
+
+struct priority_queue {
+	struct node_heap heap;
+	uint64_t next_sequence;
+
+	/* Nodes removed during a visit stay in the heap until the visit ends, so
+	 * that the shape of the heap does not change under the visit. */
+	struct priority_queue_node **removed;
+	int removed_size;
+	int removed_capacity;
+
+	/* The nodes next to be visited: the children of the nodes already
+	 * visited. Their own index is not used by this heap. */
+	struct node_heap visit;
+	int visiting;
+};
+
+static int node_before(struct priority_queue_node *a, struct priority_queue_node *b)
+{
+	if(a->priority != b->priority)
+		return a->priority > b->priority;
+
+	return a->sequence < b->sequence;
+}
+
+static void heap_grow(struct node_heap *h)
+{
+	if(h->size < h->capacity)
+		return;
+
+	h->capacity = h->capacity ? 2 * h->capacity : 64;
+	h->nodes = xxrealloc(h->nodes, h->capacity * sizeof(*h->nodes));
+}
+
+static void heap_set(struct node_heap *h, int index, struct priority_queue_node *n, int track)
+{
+	h->nodes[index] = n;
+	if(track)
+		n->index = index;
+}
+
+static void heap_sift_up(struct node_heap *h, int index, int track)
+{
+	struct priority_queue_node *n = h->nodes[index];
+
+	while(index > 0) {
+		int parent = (index - 1) / 2;
+		if(!node_before(n, h->nodes[parent]))
+			break;
+		heap_set(h, index, h->nodes[parent], track);
+		index = parent;
+	}
+
+	heap_set(h, index, n, track);
+}
+
+static void heap_sift_down(struct node_heap *h, int index, int track)
+{
+	struct priority_queue_node *n = h->nodes[index];
+
+	while(1) {
+		int child = 2 * index + 1;
+		if(child >= h->size)
+			break;
+		if(child + 1 < h->size && node_before(h->nodes[child + 1], h->nodes[child]))
+			child++;
+		if(!node_before(h->nodes[child], n))
+			break;
+		heap_set(h, index, h->nodes[child], track);
+		index = child;
+	}
+
+	heap_set(h, index, n, track);
+}
+
+static void heap_push(struct node_heap *h, struct priority_queue_node *n, int track)
+{
+	heap_grow(h);
+	h->nodes[h->size++] = n;
+	heap_sift_up(h, h->size - 1, track);
+}
+
+static void heap_remove_at(struct node_heap *h, int index, int track)
+{
+	struct priority_queue_node *last = h->nodes[--h->size];
+
+	if(index == h->size)
+		return;
+
+	heap_set(h, index, last, track);
+
+	if(index > 0 && node_before(last, h->nodes[(index - 1) / 2])) {
+		heap_sift_up(h, index, track);
+	} else {
+		heap_sift_down(h, index, track);
+	}
+}
+
+/* End the current visit, and drop the nodes removed during it. */
+static void end_visit(struct priority_queue *pq)
+{
+	int i;
+
+	pq->visiting = 0;
+	pq->visit.size = 0;
+
+	for(i = 0; i < pq->removed_size; i++) {
+		heap_remove_at(&pq->heap, pq->removed[i]->index, 1);
+		free(pq->removed[i]);
+	}
+
+	pq->removed_size = 0;
+}
+
+struct priority_queue *priority_queue_create(void)
+{
+	return xxcalloc(1, sizeof(struct priority_queue));
+}
+
+void priority_queue_delete(struct priority_queue *pq)
+{
+	int i;
+
+	if(!pq)
+		return;
+
+	for(i = 0; i < pq->heap.size; i++)
+		free(pq->heap.nodes[i]);
+
+	free(pq->heap.nodes);
+	free(pq->visit.nodes);
+	free(pq->removed);
+	free(pq);
+}
+
+int priority_queue_size(struct priority_queue *pq)
+{
+	return pq->heap.size - pq->removed_size;
+}
+
+struct priority_queue_node *priority_queue_push(struct priority_queue *pq, void *item, double priority)
+{
+	end_visit(pq);
+
+	struct priority_queue_node *n = xxmalloc(sizeof(*n));
+	n->item = item;
+	n->priority = priority;
+	n->sequence = pq->next_sequence++;
+	n->removed = 0;
+
+	heap_push(&pq->heap, n, 1);
+
+	return n;
+}
+
+void *priority_queue_peek_head(struct priority_queue *pq)
+{
+	end_visit(pq);
+
+	if(pq->heap.size < 1)
+		return NULL;
+
+	return pq->heap.nodes[0]->item;
+}
+
+void *priority_queue_pop_head(struct priority_queue *pq)
+{
+	end_visit(pq);
+
+	if(pq->heap.size < 1)
+		return NULL;
+
+	return priority_queue_remove(pq, pq->heap.nodes[0]);
+}
+
+void *priority_queue_remove(struct priority_queue *pq, struct priority_queue_node *n)
+{
+	void *item = n->item;
+
+	if(pq->visiting) {
+		if(!n->removed) {
+			n->removed = 1;
+			if(pq->removed_size == pq->removed_capacity) {
+				pq->removed_capacity = pq->removed_capacity ? 2 * pq->removed_capacity : 16;
+				pq->removed = xxrealloc(pq->removed, pq->removed_capacity * sizeof(*pq->removed));
+			}
+			pq->removed[pq->removed_size++] = n;
+		}
+		return item;
+	}
+
+	heap_remove_at(&pq->heap, n->index, 1);
+	free(n);
+
+	return item;
+}
+
+void priority_queue_first_item(struct priority_queue *pq)
+{
+	end_visit(pq);
+
+	pq->visiting = 1;
+	if(pq->heap.size > 0)
+		heap_push(&pq->visit, pq->heap.nodes[0], 0);
+}
+
+void *priority_queue_next_item(struct priority_queue *pq)
+{
+	while(pq->visiting && pq->visit.size > 0) {
+		struct priority_queue_node *n = pq->visit.nodes[0];
+		heap_remove_at(&pq->visit, 0, 0);
+
+		/* the children of a node come after it, so they may be next only once it is visited. */
+		int child = 2 * n->index + 1;
+		if(child < pq->heap.size)
+			heap_push(&pq->visit, pq->heap.nodes[child], 0);
+		if(child + 1 < pq->heap.size)
+			heap_push(&pq->visit, pq->heap.nodes[child + 1], 0);
+
+		if(!n->removed)
+			return n->item;
+	}
+
+	return NULL;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,99 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PRIORITY_QUEUE_H
+#define PRIORITY_QUEUE_H
+
+/** @file priority_queue.h A priority queue.
+Items are kept in a binary heap, ordered from the highest priority to the
+lowest. Items of equal priority are kept in the order they were pushed.
+Pushing, popping, and removing an item are O(log n).
+Pushing returns a handle with which the item may be removed later:
+<pre>
+struct priority_queue *pq = priority_queue_create();
+
+struct priority_queue_node *handle = priority_queue_push(pq, item, 10);
+priority_queue_push(pq, other, 20);
+
+priority_queue_remove(pq, handle);
+
+assert(priority_queue_pop_head(pq) == other);
+</pre>
+
+To visit the items from the highest priority to the lowest, use
+@ref priority_queue_first_item and @ref priority_queue_next_item. Visiting k
+items costs O(k log k), however many items the queue holds:
+
+<pre>
+priority_queue_first_item(pq);
+while((item = priority_queue_next_item(pq))) {
+	...
+}
+</pre>
+
+While visiting, items may be removed with @ref priority_queue_remove, and are
+not returned by the visit anymore. Any other use of the queue ends the
+visit.
+*/
+
+/** A handle to an item in a priority queue. */
+struct priority_queue_node;
+
+/** Create a new priority queue.
+@return A pointer to an empty priority queue.
+*/
+struct priority_queue *priority_queue_create(void);
+
+/** Delete a priority queue. The items in the queue are not deleted.
+@param pq A pointer to a priority queue.
+*/
+void priority_queue_delete(struct priority_queue *pq);
+
+/** Count the items in a priority queue.
+@param pq A pointer to a priority queue.
+@return The number of items in the queue.
+*/
+int priority_queue_size(struct priority_queue *pq);
+
+/** Push an item into a priority queue.
+@param pq A pointer to a priority queue.
+@param item The item to push.
+@param priority The priority of the item. Items of higher priority are popped first.
+@return A handle to the item, valid until the item leaves the queue.
+*/
+struct priority_queue_node *priority_queue_push(struct priority_queue *pq, void *item, double priority);
+
+/** Look at the item of highest priority.
+@param pq A pointer to a priority queue.
+@return The item of highest priority, or null if the queue is empty.
+*/
+void *priority_queue_peek_head(struct priority_queue *pq);
+
+/** Remove the item of highest priority.
+@param pq A pointer to a priority queue.
+@return The item of highest priority, or null if the queue is empty.
+*/
+void *priority_queue_pop_head(struct priority_queue *pq);
+
+/** Remove an item from a priority queue.
+@param pq A pointer to a priority queue.
+@param node The handle returned when the item was pushed.
+@return The removed item.
+*/
+void *priority_queue_remove(struct priority_queue *pq, struct priority_queue_node *node);
+
+/** Begin visiting the items of a priority queue, from the highest priority to the lowest.
+@param pq A pointer to a priority queue.
+*/
+void priority_queue_first_item(struct priority_queue *pq);
+
+/** Continue visiting the items of a priority queue.
+@param pq A pointer to a priority queue.
+@return The next item, or null at the end of the queue or if the visit ended.
+*/
+void *priority_queue_next_item(struct priority_queue *pq);
+
+#endif
@@ -0,0 +1,109 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="link_set.test"
+
+prepare()
+{
+	gcc -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "link.h"
+
+#define N 16
+
+int main(int argc, char **argv)
+{
+  struct link *links[N];
+  int peers[N];
+  struct link_info ready[N];
+  char line[64];
+  int i;
+
+  struct link_set *s = link_set_create();
+  assert(s);
+
+  for(i = 0; i < N; i++) {
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    links[i] = link_attach_to_fd(fds[0]);
+    peers[i] = fds[1];
+    assert(link_set_add(s, links[i], LINK_READ));
+  }
+  assert(link_set_size(s) == N);
+
+  /* nothing to read yet. */
+  assert(link_set_wait(s, ready, N, 0) == 0);
+
+  /* only the links written to are reported. */
+  assert(write(peers[3], "a\nb\n", 4) == 4);
+  assert(write(peers[7], "c\n", 2) == 2);
+  assert(link_set_wait(s, ready, N, 1000) == 2);
+  assert((ready[0].link == links[3] && ready[1].link == links[7]) || (ready[0].link == links[7] && ready[1].link == links[3]));
+  assert(ready[0].revents & LINK_READ);
+
+  /* reading one line from links[3] leaves the second one in the user-space
+   * buffer, which must still be reported as ready. */
+  assert(link_readline(links[3], line, sizeof(line), LINK_FOREVER));
+  assert(!strcmp(line, "a"));
+  assert(link_readline(links[7], line, sizeof(line), LINK_FOREVER));
+  assert(!strcmp(line, "c"));
+  assert(link_set_wait(s, ready, N, 0) == 1);
+  assert(ready[0].link == links[3]);
+  assert(link_readline(links[3], line, sizeof(line), LINK_FOREVER));
+  assert(!strcmp(line, "b"));
+  assert(link_set_wait(s, ready, N, 0) == 0);
+
+  /* removed and closed links are not reported. */
+  assert(write(peers[5], "d\n", 2) == 2);
+  link_set_remove(s, links[5]);
+  assert(link_set_wait(s, ready, N, 0) == 0);
+  assert(write(peers[6], "e\n", 2) == 2);
+  link_close(links[6]);
+  links[6] = 0;
+  assert(link_set_size(s) == N - 2);
+  assert(link_set_wait(s, ready, N, 0) == 0);
+
+  /* a closed peer is reported as readable. */
+  close(peers[9]);
+  peers[9] = -1;
+  assert(link_set_wait(s, ready, N, 1000) == 1);
+  assert(ready[0].link == links[9]);
+
+  link_set_delete(s);
+
+  for(i = 0; i < N; i++) {
+    if(links[i])
+      link_close(links[i]);
+    if(peers[i] >= 0)
+      close(peers[i]);
+  }
+
+  return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,104 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="link_stream.test"
+input="link_stream.input"
+output="link_stream.output"
+
+prepare()
+{
+	dd if=/dev/urandom of="$input" bs=1024 count=3000 > /dev/null 2>&1 || return 1
+
+	gcc -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "link.h"
+
+int main(int argc, char **argv)
+{
+  struct stat info;
+  char line[64];
+  char addr[LINK_ADDRESS_MAX];
+  int port;
+
+  assert(stat(argv[1], &info) == 0);
+
+  struct link *server = link_serve_address("127.0.0.1", 0);
+  assert(server);
+  assert(link_address_local(server, addr, &port));
+
+  pid_t pid = fork();
+  assert(pid >= 0);
+
+  if(pid == 0) {
+    struct link *sender = link_connect("127.0.0.1", port, time(0) + 30);
+    assert(sender);
+
+    /* a header line, followed by the file, as in a put message. */
+    int in = open(argv[1], O_RDONLY);
+    assert(in >= 0);
+    link_putfstring(sender, "file %lld\n", LINK_FOREVER, (long long) info.st_size);
+    assert(link_stream_from_fd(sender, in, info.st_size, LINK_FOREVER) == info.st_size);
+    close(in);
+    link_close(sender);
+    _exit(0);
+  }
+
+  struct link *receiver = link_accept(server, time(0) + 30);
+  assert(receiver);
+
+  /* reading the header may leave part of the file in the link buffer. */
+  long long length;
+  assert(link_readline(receiver, line, sizeof(line), LINK_FOREVER));
+  assert(sscanf(line, "file %lld", &length) == 1);
+  assert(length == info.st_size);
+
+  int out = open(argv[2], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  assert(out >= 0);
+  assert(link_stream_to_fd(receiver, out, length, LINK_FOREVER) == length);
+  close(out);
+
+  /* the sender closed the link, so nothing more can be read. */
+  out = open(argv[2], O_WRONLY|O_APPEND);
+  assert(link_stream_to_fd(receiver, out, 10, LINK_FOREVER) == 0);
+  close(out);
+
+  int status;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  link_close(receiver);
+  link_close(server);
+
+  return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe" "$input" "$output" || return 1
+	cmp "$input" "$output"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe" "$input" "$output"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
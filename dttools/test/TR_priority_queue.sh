@@ -0,0 +1,125 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="priority_queue.test"
+
+prepare()
+{
+	gcc -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "priority_queue.h"
+
+#define N 10000
+
+struct item {
+	int id;
+	double priority;
+	struct priority_queue_node *node;
+	int removed;
+};
+
+/* a must come out before b: higher priority first, then in the order pushed. */
+static void check_order(struct item *a, struct item *b)
+{
+	assert(a->priority > b->priority || (a->priority == b->priority && a->id < b->id));
+}
+
+int main(int argc, char **argv)
+{
+	static struct item items[N];
+	struct item *i, *last;
+	int n;
+
+	struct priority_queue *pq = priority_queue_create();
+	assert(priority_queue_size(pq) == 0);
+	assert(!priority_queue_peek_head(pq));
+	assert(!priority_queue_pop_head(pq));
+
+	/* few distinct priorities, so that many are equal. */
+	srand(17);
+	for(n = 0; n < N; n++) {
+		items[n].id = n;
+		items[n].priority = rand() % 10;
+		items[n].node = priority_queue_push(pq, &items[n], items[n].priority);
+	}
+	assert(priority_queue_size(pq) == N);
+
+	/* remove every third item by its handle. */
+	int left = N;
+	for(n = 0; n < N; n += 3) {
+		assert(priority_queue_remove(pq, items[n].node) == &items[n]);
+		items[n].removed = 1;
+		left--;
+	}
+	assert(priority_queue_size(pq) == left);
+
+	/* a visit returns the items in order, and skips items removed during it. */
+	int visited = 0;
+	last = NULL;
+	priority_queue_first_item(pq);
+	while((i = priority_queue_next_item(pq))) {
+		assert(!i->removed);
+		if(last)
+			check_order(last, i);
+		last = i;
+		visited++;
+
+		if(i->id % 3 == 1) {
+			priority_queue_remove(pq, i->node);
+			i->removed = 1;
+			left--;
+		}
+		if(i->id % 3 == 2 && i->id + 1 < N && !items[i->id + 1].removed) {
+			priority_queue_remove(pq, items[i->id + 1].node);
+			items[i->id + 1].removed = 1;
+			left--;
+		}
+	}
+	assert(priority_queue_size(pq) == left);
+
+	/* a visit may stop early, and the queue is left consistent. */
+	priority_queue_first_item(pq);
+	assert(priority_queue_next_item(pq) == priority_queue_peek_head(pq));
+	assert(!priority_queue_next_item(pq));
+
+	/* popping returns the remaining items in order. */
+	last = NULL;
+	n = 0;
+	while((i = priority_queue_pop_head(pq))) {
+		assert(!i->removed);
+		if(last)
+			check_order(last, i);
+		last = i;
+		n++;
+	}
+	assert(n == left);
+	assert(priority_queue_size(pq) == 0);
+
+	priority_queue_delete(pq);
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -17,6 +17,7 @@ See the file COPYING for details.
 #include "hash_table.h"
 #include "list.h"
 #include "set.h"
+#include "priority_queue.h"
 #include "stringtools.h"
 #include "rmsummary.h"
 
@@ -43,6 +44,7 @@ struct dag *dag_create()
 	d->special_vars = set_create(0);
 	d->completed_files = 0;
 	d->deleted_files = 0;
+	d->collect_list = list_create();
 
 	d->categories   = hash_table_create(0, 0);
 	d->default_category = makeflow_category_lookup_or_create(d, "default");
@@ -161,6 +163,34 @@ struct dag_file *dag_file_from_name(struct dag *d, const char *filename)
 	return (struct dag_file *) hash_table_lookup(d->files, filename);
 }
 
+/* Free the tables of the dag, the queues of its ready rules, and the list of
+ * files to collect. The rules and files themselves are not freed, as they are
+ * only released on exit. */
+void dag_delete(struct dag *d)
+{
+	if(!d)
+		return;
+
+	itable_delete(d->node_table);
+	itable_delete(d->local_job_table);
+	itable_delete(d->remote_job_table);
+	hash_table_delete(d->files);
+	set_delete(d->inputs);
+	set_delete(d->outputs);
+	set_delete(d->export_vars);
+	set_delete(d->special_vars);
+
+	if(d->local_ready)
+		priority_queue_delete(d->local_ready);
+	if(d->remote_ready)
+		priority_queue_delete(d->remote_ready);
+	list_delete(d->collect_list);
+
+	free(d->filename);
+	free(d->cache_dir);
+	free(d);
+}
+
 /* Returns the list of dag_file's which are not the target of any
  * node */
 struct list *dag_input_files(struct dag *d)
@@ -196,6 +226,91 @@ void dag_count_states(struct dag *d)
 	}
 }
 
+static struct priority_queue *dag_ready_queue(struct dag *d, struct dag_node *n)
+{
+	if(n->local_job && d->local_ready_separate) {
+		return d->local_ready;
+	} else {
+		return d->remote_ready;
+	}
+}
+
+/* Add n to the ready queue, or take it out, according to its current state. */
+static void dag_ready_update(struct dag *d, struct dag_node *n)
+{
+	int ready = n->state == DAG_NODE_STATE_WAITING && n->source_files_missing == 0;
+
+	if(ready && !n->ready_handle) {
+		n->ready_handle = priority_queue_push(dag_ready_queue(d, n), n, n->priority);
+	} else if(!ready && n->ready_handle) {
+		priority_queue_remove(dag_ready_queue(d, n), n->ready_handle);
+		n->ready_handle = NULL;
+	}
+}
+
+void dag_ready_init(struct dag *d, int local_separate)
+{
+	struct dag_node *n;
+	struct dag_file *f;
+
+	d->local_ready_separate = local_separate;
+	d->local_ready  = priority_queue_create();
+	d->remote_ready = priority_queue_create();
+
+	for(n = d->nodes; n; n = n->next) {
+		n->source_files_missing = 0;
+		n->ready_handle = NULL;
+
+		list_first_item(n->source_files);
+		while((f = list_next_item(n->source_files))) {
+			if(!dag_file_should_exist(f))
+				n->source_files_missing++;
+		}
+
+		dag_ready_update(d, n);
+	}
+}
+
+void dag_ready_node_state_changed(struct dag *d, struct dag_node *n)
+{
+	if(!d->remote_ready)
+		return;
+
+	dag_ready_update(d, n);
+}
+
+void dag_ready_file_state_changed(struct dag *d, struct dag_file *f, int existed)
+{
+	struct dag_node *n;
+
+	if(!d->remote_ready)
+		return;
+
+	int exists = dag_file_should_exist(f);
+	if(existed == exists)
+		return;
+
+	list_first_item(f->needed_by);
+	while((n = list_next_item(f->needed_by))) {
+		n->source_files_missing += exists ? -1 : 1;
+		dag_ready_update(d, n);
+	}
+}
+
+struct dag_node *dag_ready_pop(struct dag *d, int local)
+{
+	struct priority_queue *q = (local && d->local_ready_separate) ? d->local_ready : d->remote_ready;
+
+	if(!q)
+		return NULL;
+
+	struct dag_node *n = priority_queue_pop_head(q);
+	if(n)
+		n->ready_handle = NULL;
+
+	return n;
+}
+
 /**
  * If the return value is x, a positive integer, that means at least x tasks
  * can be run in parallel during a certain point of the execution of the
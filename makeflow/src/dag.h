@@ -41,8 +41,12 @@ struct dag {
 
 	struct itable *local_job_table;     /* Mapping from unique integers dag_node->jobid to nodes, rules with prefix LOCAL. */
 	struct itable *remote_job_table;    /* Mapping from unique integers dag_node->jobid to nodes. */
+	struct priority_queue *local_ready;  /* Waiting nodes with all their sources, to run in the local queue. */
+	struct priority_queue *remote_ready; /* Waiting nodes with all their sources, to run in the remote queue. */
+	int local_ready_separate;           /* Whether local jobs go to their own queue, or with the remote jobs. */
 	int completed_files;                /* Keeps a count of the rules in state recieved or beyond. */
 	int deleted_files;                  /* Keeps a count of the files delete in GC. */
+	struct list *collect_list;          /* Files no longer needed by any rule, in the order they can be garbage collected. */
 
 	char *cache_dir;                    /* The dirname of the cache storing all the deps specified in the mountfile */
 
@@ -53,6 +57,7 @@ struct dag {
 };
 
 struct dag *dag_create();
+void dag_delete(struct dag *d);
 
 struct list *dag_input_files( struct dag *d );
 
@@ -68,6 +73,17 @@ int dag_depth( struct dag *d );
 int dag_width_guaranteed_max( struct dag *d );
 int dag_width_uniform_task( struct dag *d );
 
+/* The nodes ready to run are tracked incrementally: each node counts its
+ * source files that do not exist yet, and the count is updated as the files
+ * change state. Waiting nodes whose count reaches zero enter a ready queue,
+ * ordered by dag_node->priority. Tracking starts with dag_ready_init, after
+ * the states of the nodes and files are recovered from the log. Local nodes
+ * get a queue of their own if local_separate is set. */
+void dag_ready_init( struct dag *d, int local_separate );
+void dag_ready_node_state_changed( struct dag *d, struct dag_node *n );
+void dag_ready_file_state_changed( struct dag *d, struct dag_file *f, int existed );
+struct dag_node *dag_ready_pop( struct dag *d, int local );
+
 int dag_remote_jobs_running( struct dag *d );
 int dag_local_jobs_running( struct dag *d );
 
@@ -41,6 +41,8 @@ struct dag_node *dag_node_create(struct dag *d, int linenum)
 	n->ancestors = set_create(0);
 
 	n->ancestor_depth = -1;
+	n->previous_runtime = -1;
+	n->critical_path = -1;
 
 	n->resources_requested = rmsummary_create(-1);
 	n->resources_measured  = NULL;
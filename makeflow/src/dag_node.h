@@ -12,6 +12,7 @@ See the file COPYING for details.
 #include "set.h"
 #include "hash_table.h"
 #include "itable.h"
+#include "priority_queue.h"
 
 typedef enum {
 	DAG_NODE_STATE_WAITING = 0,
@@ -74,6 +75,15 @@ struct dag_node {
 	dag_node_state_t state;             /* Enum: DAG_NODE_STATE_{WAITING,RUNNING,...} */
 	int failure_count;                  /* How many times has this rule failed? (see -R and -r) */
 	time_t previous_completion;
+	time_t previous_runtime;            /* Seconds the rule ran for in a previous run, from the log, or -1. */
+	double critical_path;               /* Estimated seconds from the start of the rule to the end of the workflow, or -1. */
+
+	/* readiness to run, see dag_ready_init */
+	int source_files_missing;           /* Number of source files that do not exist yet. */
+	double priority;                    /* Ready nodes are submitted from the highest priority. */
+	struct priority_queue_node *ready_handle; /* Position in the ready queue of the dag, or NULL. */
+
+	struct dag_node *fused_next;        /* The next rule of a chain that runs in the same job, see dag_fuse_chains. */
 
 	const char *umbrella_spec;          /* the umbrella spec file for executing this job */
 	
@@ -1273,4 +1273,54 @@ struct jx *dag_to_json(struct dag *d) {
 	return result;
 }
 
+/* Whether m can run in the same job as n, right after it. */
+
+static int dag_node_can_fuse(struct dag_node *n, struct dag_node *m)
+{
+	if(set_size(n->descendants) != 1 || set_size(m->ancestors) != 1)
+		return 0;
+
+	if(n->local_job != m->local_job || n->nested_job || m->nested_job)
+		return 0;
+
+	/* The job is submitted with the category, variables and file names of the first rule. */
+	if(n->category != m->category)
+		return 0;
+
+	if(hash_table_size(n->variables) > 0 || hash_table_size(m->variables) > 0)
+		return 0;
+
+	if(itable_size(n->remote_names) > 0 || itable_size(m->remote_names) > 0)
+		return 0;
+
+	if(n->umbrella_spec != m->umbrella_spec && (!n->umbrella_spec || !m->umbrella_spec || strcmp(n->umbrella_spec, m->umbrella_spec)))
+		return 0;
+
+	return 1;
+}
+
+int dag_fuse_chains(struct dag *d)
+{
+	struct dag_node *n, *m;
+	int fused = 0;
+
+	dag_compile_ancestors(d);
+
+	for(n = d->nodes; n; n = n->next) {
+		if(set_size(n->descendants) != 1)
+			continue;
+
+		set_first_element(n->descendants);
+		m = set_next_element(n->descendants);
+
+		if(dag_node_can_fuse(n, m)) {
+			debug(D_MAKEFLOW_RUN, "rule %d runs in the same job as rule %d", m->nodeid, n->nodeid);
+			n->fused_next = m;
+			fused++;
+		}
+	}
+
+	return fused;
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -40,4 +40,10 @@ void dag_to_cyto(struct dag *d, int condense_display, int change_size);
  */
 struct jx *dag_to_json(struct dag *d);
 
+/* The dag_fuse_chains function links each rule with its only descendant,
+ * when that descendant has no other ancestor, so that the chains of rules
+ * formed run as a single job. Returns the number of rules linked.
+ */
+int dag_fuse_chains(struct dag *d);
+
 #endif
@@ -93,6 +93,7 @@ an example.
 */
 
 #define MAX_REMOTE_JOBS_DEFAULT 100
+#define MAKEFLOW_MAX_COMPLETIONS 100
 
 static sig_atomic_t makeflow_abort_flag = 0;
 static int makeflow_failed_flag = 0;
@@ -119,6 +120,18 @@ static struct batch_queue *remote_queue = 0;
 static int local_jobs_max = 1;
 static int remote_jobs_max = MAX_REMOTE_JOBS_DEFAULT;
 
+/* Order in which ready nodes are submitted, see makeflow_node_prioritize. */
+typedef enum {
+	MAKEFLOW_ORDER_RULE,     /* the last rule of the makeflow first, as they are listed in the dag. */
+	MAKEFLOW_ORDER_DEPTH,    /* the rules with the most ancestors in a chain first. */
+	MAKEFLOW_ORDER_CRITICAL_PATH /* the rules with the longest estimated time to the end of the workflow first. */
+} makeflow_order_t;
+
+static makeflow_order_t submission_order = MAKEFLOW_ORDER_RULE;
+
+/* Run chains of rules that only feed each other as single jobs, see dag_fuse_chains. */
+static int fuse_chains = 0;
+
 static char *project = NULL;
 static int port = 0;
 static int output_len_check = 0;
@@ -191,6 +204,112 @@ static struct list *makeflow_generate_output_files( struct dag_node *n )
 	return result;
 }
 
+/*
+A file stays within the job of a fused chain of rules when it is an intermediate
+file created by one rule of the chain and used only by the next rule.
+*/
+
+static int makeflow_file_is_fused( struct dag_node *n, struct dag_file *f )
+{
+	struct dag_node *m;
+
+	if(!n->fused_next || f->created_by != n || f->type != DAG_FILE_TYPE_INTERMEDIATE)
+		return 0;
+
+	list_first_item(f->needed_by);
+	while((m = list_next_item(f->needed_by))) {
+		if(m != n->fused_next)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+The input files of the job of a chain of rules are those of its first rule,
+and those of the rest of the rules that are not created within the chain.
+*/
+
+static struct list *makeflow_chain_input_files( struct dag_node *n )
+{
+	struct list *result = makeflow_generate_input_files(n);
+	struct dag_node *m, *p;
+	struct dag_file *f;
+
+	for(m = n->fused_next; m; m = m->fused_next) {
+		list_first_item(m->source_files);
+		while((f = list_next_item(m->source_files))) {
+			for(p = n; p != m; p = p->fused_next) {
+				if(f->created_by == p)
+					break;
+			}
+			if(p == m) {
+				list_remove(result, f);
+				list_push_tail(result, f);
+			}
+		}
+	}
+
+	return result;
+}
+
+/*
+The output files of the job of a chain of rules are those of all of its
+rules, except the files that stay within the job.
+*/
+
+static struct list *makeflow_chain_output_files( struct dag_node *n )
+{
+	struct list *result = makeflow_generate_output_files(n);
+	struct dag_node *m;
+	struct dag_file *f;
+
+	if(!n->fused_next)
+		return result;
+
+	for(m = n; m; m = m->fused_next) {
+		list_first_item(m->target_files);
+		while((f = list_next_item(m->target_files))) {
+			list_remove(result, f);
+			if(!makeflow_file_is_fused(m, f))
+				list_push_tail(result, f);
+		}
+	}
+
+	return result;
+}
+
+/*
+The command of a chain of rules runs the command of each rule in turn,
+stopping at the first one that fails.
+*/
+
+static char *makeflow_chain_command( struct dag_node *n )
+{
+	struct dag_node *m;
+
+	if(!n->fused_next)
+		return xxstrdup(n->command);
+
+	char *command = string_format("( %s )", n->command);
+	for(m = n->fused_next; m; m = m->fused_next) {
+		command = string_combine_multi(command, " && ( ", m->command, " )", 0);
+	}
+
+	return command;
+}
+
+/* Log the state change of every rule that runs in the job of n. */
+
+static void makeflow_chain_state_change( struct dag *d, struct dag_node *n, int state )
+{
+	struct dag_node *m;
+
+	for(m = n; m; m = m->fused_next) {
+		makeflow_log_state_change(d, m, state);
+	}
+}
+
 /*
 Abort one job in a given batch queue.
 */
@@ -200,9 +319,9 @@ static void makeflow_abort_job( struct dag *d, struct dag_node *n, struct batch_
 	printf("aborting %s job %" PRIu64 "\n", name, jobid);
 
 	batch_job_remove(q, jobid);
-	makeflow_log_state_change(d, n, DAG_NODE_STATE_ABORTED);
+	makeflow_chain_state_change(d, n, DAG_NODE_STATE_ABORTED);
 
-	struct list *outputs = makeflow_generate_output_files(n);
+	struct list *outputs = makeflow_chain_output_files(n);
 	struct dag_file *f;
 	list_first_item(outputs);
 
@@ -515,11 +634,11 @@ static void makeflow_node_expand( struct dag_node *n, struct batch_queue *queue,
 	makeflow_wrapper_umbrella_set_input_files(umbrella, queue, n);
 
 	if (*input_list == NULL) {
-		*input_list  = makeflow_generate_input_files(n);
+		*input_list  = makeflow_chain_input_files(n);
 	}
 
 	if (*output_list == NULL) {
-		*output_list = makeflow_generate_output_files(n);
+		*output_list = makeflow_chain_output_files(n);
 	}
 
 	/* Create strings for all the files mentioned by this node. */
@@ -527,7 +646,7 @@ static void makeflow_node_expand( struct dag_node *n, struct batch_queue *queue,
 	*output_files = makeflow_file_list_format(n, 0, *output_list, queue);
 
 	/* Expand the command according to each of the wrappers */
-	*command = strdup(n->command);
+	*command = makeflow_chain_command(n);
 	*command = makeflow_wrap_wrapper(*command, n, wrapper);
 	*command = makeflow_wrap_enforcer(*command, n, enforcer, *input_list, *output_list);
 	*command = makeflow_wrap_umbrella(*command, n, umbrella, queue, *input_files, *output_files);
@@ -573,6 +692,14 @@ static void makeflow_node_submit(struct dag *d, struct dag_node *n)
 
 	batch_queue_set_int_option(queue, "task-id", n->nodeid);
 
+	/* With an explicit submission order, let the batch system dispatch the
+	 * jobs it holds in that order too. Otherwise it keeps its own order. */
+	if(submission_order != MAKEFLOW_ORDER_RULE) {
+		char *priority = string_format("%.0f", n->priority);
+		batch_queue_set_option(queue, "task-priority", priority);
+		free(priority);
+	}
+
 	/* Generate the environment vars specific to this node. */
 	struct jx *envlist = dag_node_env_create(d,n);
 
@@ -598,14 +725,17 @@ static void makeflow_node_submit(struct dag *d, struct dag_node *n)
 
 		/* Update all of the necessary data structures. */
 		if(n->jobid >= 0) {
-			makeflow_log_state_change(d, n, DAG_NODE_STATE_RUNNING);
+			struct dag_node *m;
+			for(m = n->fused_next; m; m = m->fused_next)
+				m->jobid = n->jobid;
+			makeflow_chain_state_change(d, n, DAG_NODE_STATE_RUNNING);
 			if(n->local_job && local_queue) {
 				itable_insert(d->local_job_table, n->jobid, n);
 			} else {
 				itable_insert(d->remote_job_table, n->jobid, n);
 			}
 		} else {
-			makeflow_log_state_change(d, n, DAG_NODE_STATE_FAILED);
+			makeflow_chain_state_change(d, n, DAG_NODE_STATE_FAILED);
 			makeflow_failed_flag = 1;
 		}
 	}
@@ -624,47 +754,128 @@ static void makeflow_node_submit(struct dag *d, struct dag_node *n)
 	jx_delete(envlist);
 }
 
-static int makeflow_node_ready(struct dag *d, struct dag_node *n)
+/* Runtimes of the rules of a category found in the log of a previous run. */
+struct makeflow_category_runtime {
+	time_t total;
+	int count;
+};
+
+/*
+Estimate in whole seconds how long a rule runs: the time it ran in a previous run,
+or else the mean time the rules of its category ran, or else one second.
+*/
+
+static time_t makeflow_node_runtime_estimate(struct dag_node *n, struct hash_table *runtimes)
 {
-	struct dag_file *f;
+	if(n->previous_runtime >= 0)
+		return n->previous_runtime;
 
-	if(n->state != DAG_NODE_STATE_WAITING)
-		return 0;
+	struct makeflow_category_runtime *r = hash_table_lookup(runtimes, n->category->name);
+	if(r)
+		return (r->total + r->count/2) / r->count;
 
-	if(n->local_job && local_queue) {
-		if(dag_local_jobs_running(d) >= local_jobs_max)
-			return 0;
-	} else {
-		if(dag_remote_jobs_running(d) >= remote_jobs_max)
-			return 0;
+	return 1;
+}
+
+static double makeflow_node_critical_path(struct dag_node *n, struct hash_table *runtimes)
+{
+	struct dag_node *m;
+	double longest = 0;
+
+	if(n->critical_path >= 0)
+		return n->critical_path;
+
+	set_first_element(n->descendants);
+	while((m = set_next_element(n->descendants))) {
+		longest = MAX(longest, makeflow_node_critical_path(m, runtimes));
 	}
 
-	list_first_item(n->source_files);
-	while((f = list_next_item(n->source_files))) {
-		if(dag_file_should_exist(f)) {
+	n->critical_path = makeflow_node_runtime_estimate(n, runtimes) + longest;
+	debug(D_MAKEFLOW_RUN, "rule %d critical path: %.0fs", n->nodeid, n->critical_path);
+
+	return n->critical_path;
+}
+
+/*
+Compute for each node the estimated time of the longest chain of rules
+from its start to the end of the workflow.
+*/
+
+static void makeflow_find_critical_path(struct dag *d)
+{
+	struct hash_table *runtimes = hash_table_create(0, 0);
+	struct makeflow_category_runtime *r;
+	struct dag_node *n;
+	char *name;
+
+	for(n = d->nodes; n; n = n->next) {
+		if(n->previous_runtime < 0)
 			continue;
-		} else {
-			return 0;
+
+		r = hash_table_lookup(runtimes, n->category->name);
+		if(!r) {
+			r = calloc(1, sizeof(*r));
+			hash_table_insert(runtimes, n->category->name, r);
 		}
+		r->total += n->previous_runtime;
+		r->count++;
 	}
 
-	return 1;
+	dag_compile_ancestors(d);
+
+	for(n = d->nodes; n; n = n->next) {
+		makeflow_node_critical_path(n, runtimes);
+	}
+
+	hash_table_firstkey(runtimes);
+	while(hash_table_nextkey(runtimes, &name, (void **) &r)) {
+		free(r);
+	}
+	hash_table_delete(runtimes);
 }
 
 /*
-Find all jobs ready to be run, then submit them.
+Give each node the priority with which it is submitted once ready.
+Ties between rules are broken by the order of the rules.
 */
 
-static void makeflow_dispatch_ready_jobs(struct dag *d)
+static void makeflow_node_prioritize(struct dag *d)
 {
 	struct dag_node *n;
 
+	if(submission_order == MAKEFLOW_ORDER_DEPTH) {
+		dag_compile_ancestors(d);
+		dag_find_ancestor_depth(d);
+	} else if(submission_order == MAKEFLOW_ORDER_CRITICAL_PATH) {
+		makeflow_find_critical_path(d);
+	}
+
 	for(n = d->nodes; n; n = n->next) {
-		if(dag_remote_jobs_running(d) >= remote_jobs_max && dag_local_jobs_running(d) >= local_jobs_max) {
-			break;
+		n->priority = n->nodeid;
+		if(submission_order == MAKEFLOW_ORDER_DEPTH) {
+			n->priority += (double) n->ancestor_depth * d->nodeid_counter;
+		} else if(submission_order == MAKEFLOW_ORDER_CRITICAL_PATH) {
+			n->priority += n->critical_path * d->nodeid_counter;
 		}
+	}
+}
+
+/*
+Submit the jobs ready to run, while the batch queues have room for them.
+The ready nodes are kept by the dag as their source files are created,
+so this costs only as much as the jobs submitted.
+*/
+
+static void makeflow_dispatch_ready_jobs(struct dag *d)
+{
+	struct dag_node *n;
+
+	while(dag_remote_jobs_running(d) < remote_jobs_max && (n = dag_ready_pop(d, 0))) {
+		makeflow_node_submit(d, n);
+	}
 
-		if(makeflow_node_ready(d, n)) {
+	if(local_queue) {
+		while(dag_local_jobs_running(d) < local_jobs_max && (n = dag_ready_pop(d, 1))) {
 			makeflow_node_submit(d, n);
 		}
 	}
@@ -718,7 +929,9 @@ Mark the given task as completing, using the batch_job_info completion structure
 
 static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct batch_queue *queue, struct batch_job_info *info)
 {
+	struct dag_node *m;
 	struct dag_file *f;
+	struct stat buf;
 	int job_failed = 0;
 	int monitor_retried = 0;
 
@@ -749,7 +962,7 @@ static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct bat
 		free(summary_name);
 	}
 
-	struct list *outputs = makeflow_generate_output_files(n);
+	struct list *outputs = makeflow_chain_output_files(n);
 
 	if(info->disk_allocation_exhausted) {
 		job_failed = 1;
@@ -772,7 +985,7 @@ static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct bat
 	}
 
 	if(job_failed) {
-		makeflow_log_state_change(d, n, DAG_NODE_STATE_FAILED);
+		makeflow_chain_state_change(d, n, DAG_NODE_STATE_FAILED);
 
 		/* Clean files created in node. Clean existing and expected and record deletion. */
 		list_first_item(outputs);
@@ -784,6 +997,15 @@ static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct bat
 			}
 		}
 
+		/* Clean the files that a fused chain of rules left behind. */
+		for(m = n; m; m = m->fused_next) {
+			list_first_item(m->target_files);
+			while((f = list_next_item(m->target_files))) {
+				if(makeflow_file_is_fused(m, f))
+					makeflow_clean_file(d, remote_queue, f, 0);
+			}
+		}
+
 		if(info->disk_allocation_exhausted) {
 			fprintf(stderr, "\nrule %d failed because it exceeded its loop device allocation capacity.\n", n->nodeid);
 			if(n->resources_measured)
@@ -798,7 +1020,7 @@ static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct bat
 				debug(D_MAKEFLOW_RUN, "Rule %d resubmitted using new resource allocation.\n", n->nodeid);
 				n->resource_request = next;
 				fprintf(stderr, "\nrule %d resubmitting with maximum resources.\n", n->nodeid);
-				makeflow_log_state_change(d, n, DAG_NODE_STATE_WAITING);
+				makeflow_chain_state_change(d, n, DAG_NODE_STATE_WAITING);
 				if(monitor) { monitor_retried = 1; }
 			}
 		}
@@ -818,7 +1040,7 @@ static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct bat
 			if(next != CATEGORY_ALLOCATION_ERROR) {
 				debug(D_MAKEFLOW_RUN, "Rule %d resubmitted using new resource allocation.\n", n->nodeid);
 				n->resource_request = next;
-				makeflow_log_state_change(d, n, DAG_NODE_STATE_WAITING);
+				makeflow_chain_state_change(d, n, DAG_NODE_STATE_WAITING);
 				monitor_retried = 1;
 			}
 		}
@@ -831,7 +1053,7 @@ static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct bat
 					makeflow_failed_flag = 1;
 				} else {
 					notice(D_MAKEFLOW_RUN, "will retry failed job %s", n->command);
-					makeflow_log_state_change(d, n, DAG_NODE_STATE_WAITING);
+					makeflow_chain_state_change(d, n, DAG_NODE_STATE_WAITING);
 				}
 			}
 			else
@@ -844,31 +1066,55 @@ static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct bat
 			makeflow_failed_flag = 1;
 		}
 	} else {
-		/* Mark source files that have been used by this node */
-		list_first_item(n->source_files);
-		while((f = list_next_item(n->source_files))) {
-			f->reference_count+= -1;
-			if(f->reference_count == 0 && f->state == DAG_FILE_STATE_EXISTS)
-				makeflow_log_file_state_change(d, f, DAG_FILE_STATE_COMPLETE);
-		}
+		for(m = n; m; m = m->fused_next) {
+			/* The files that stayed within the job of a chain of rules
+			 * are gone with it, unless the batch system shares its
+			 * working directory with makeflow. */
+			list_first_item(m->target_files);
+			while((f = list_next_item(m->target_files))) {
+				if(!makeflow_file_is_fused(m, f))
+					continue;
 
-		/* store node into archiving directory  */
-		if (d->should_write_to_archive) {
-			printf("archiving node within archiving directory\n");
-			struct list *input_list = NULL;
-			char *input_files = NULL, *output_files = NULL, *command = NULL;
+				if(batch_fs_stat(remote_queue, f->filename, &buf) == 0) {
+					f->actual_size = buf.st_size;
+					makeflow_log_file_state_change(d, f, DAG_FILE_STATE_EXISTS);
+				} else {
+					makeflow_log_file_state_change(d, f, DAG_FILE_STATE_DELETE);
+				}
+			}
+
+			/* Mark source files that have been used by this node */
+			list_first_item(m->source_files);
+			while((f = list_next_item(m->source_files))) {
+				f->reference_count+= -1;
+				if(f->reference_count == 0 && f->state == DAG_FILE_STATE_EXISTS)
+					makeflow_log_file_state_change(d, f, DAG_FILE_STATE_COMPLETE);
+			}
+
+			/* store node into archiving directory  */
+			if (d->should_write_to_archive) {
+				printf("archiving node within archiving directory\n");
+				struct list *input_list = NULL;
+				char *input_files = NULL, *output_files = NULL, *command = NULL;
 
-			makeflow_node_expand(n, queue, &input_list, &outputs, &input_files, &output_files, &command);
+				makeflow_node_expand(m, queue, &input_list, &outputs, &input_files, &output_files, &command);
 
-			makeflow_archive_populate(d, n, command, input_list, outputs, info);
+				makeflow_archive_populate(d, m, command, input_list, outputs, info);
 
-			free(command);
-			free(input_files);
-			free(output_files);
-			list_delete(input_list);
+				free(command);
+				free(input_files);
+				free(output_files);
+				list_delete(input_list);
+			}
+
+			makeflow_log_state_change(d, m, DAG_NODE_STATE_COMPLETE);
 		}
 
-		makeflow_log_state_change(d, n, DAG_NODE_STATE_COMPLETE);
+		/* With reference counting, the files this job was the last
+		 * consumer of are deleted right away, instead of waiting for
+		 * the next garbage collection barrier. */
+		if(makeflow_gc_method == MAKEFLOW_GC_COUNT)
+			makeflow_gc(d, remote_queue, makeflow_gc_method, makeflow_gc_size, makeflow_gc_count);
 	}
 	list_delete(outputs);
 }
@@ -981,8 +1227,7 @@ Main loop for running a makeflow: submit jobs, wait for completion, keep going u
 static void makeflow_run( struct dag *d )
 {
 	struct dag_node *n;
-	batch_job_id_t jobid;
-	struct batch_job_info info;
+	struct batch_job_completion completions[MAKEFLOW_MAX_COMPLETIONS];
         timestamp_t last_time = timestamp_get();
         timestamp_t start = timestamp_get();
         int first_report = 1;
@@ -992,6 +1237,9 @@ static void makeflow_run( struct dag *d )
             makeflow_catalog_summary(d, project, batch_queue_type, start);
         }
 
+	makeflow_node_prioritize(d);
+	dag_ready_init(d, local_queue != 0);
+
 	while(!makeflow_abort_flag) {
 		did_find_archived_job = 0;
 		makeflow_dispatch_ready_jobs(d);
@@ -1003,35 +1251,34 @@ static void makeflow_run( struct dag *d )
 		if(dag_local_jobs_running(d)==0 && dag_remote_jobs_running(d)==0 && did_find_archived_job == 0 )
 			break;
 
-		if(dag_remote_jobs_running(d)) {
-			int tmp_timeout = 5;
-			jobid = batch_job_wait_timeout(remote_queue, &info, time(0) + tmp_timeout);
-			if(jobid > 0) {
-				printf("job %"PRIbjid" completed\n",jobid);
-				debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
-				n = itable_remove(d->remote_job_table, jobid);
-				if(n)
-					makeflow_node_complete(d, n, remote_queue, &info);
-			}
-		}
+		/* Wait on the local and remote queues together, and complete
+		 * every job that has returned from either of them. */
+		struct batch_queue *queues[2];
+		int nqueues = 0;
+
+		if(dag_remote_jobs_running(d))
+			queues[nqueues++] = remote_queue;
+		if(dag_local_jobs_running(d))
+			queues[nqueues++] = local_queue;
+
+		int ncompleted = batch_job_wait_any(queues, nqueues, completions, MAKEFLOW_MAX_COMPLETIONS, time(0) + 5);
 
-		if(dag_local_jobs_running(d)) {
-			time_t stoptime;
-			int tmp_timeout = 5;
+		int i;
+		for(i = 0; i < ncompleted; i++) {
+			struct batch_job_completion *c = &completions[i];
+			struct itable *job_table;
 
-			if(dag_remote_jobs_running(d)) {
-				stoptime = time(0);
+			if(c->queue == remote_queue) {
+				printf("job %"PRIbjid" completed\n", c->jobid);
+				job_table = d->remote_job_table;
 			} else {
-				stoptime = time(0) + tmp_timeout;
+				job_table = d->local_job_table;
 			}
 
-			jobid = batch_job_wait_timeout(local_queue, &info, stoptime);
-			if(jobid > 0) {
-				debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
-				n = itable_remove(d->local_job_table, jobid);
-				if(n)
-					makeflow_node_complete(d, n, local_queue, &info);
-			}
+			debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", c->jobid);
+			n = itable_remove(job_table, c->jobid);
+			if(n)
+				makeflow_node_complete(d, n, c->queue, &c->info);
 		}
 
 		/* Make periodic report to catalog. */
@@ -1143,6 +1390,9 @@ static void show_help_run(const char *cmd)
 	printf(" %-30s Automatically retry failed batch jobs up to n times.\n", "-r,--retry-count=<n>");
 	printf(" %-30s Wait for output files to be created upto n seconds (e.g., to deal with NFS semantics).\n", "   --wait-for-files-upto=<n>");
 	printf(" %-30s Time to retry failed batch job submission.  (default is %ds)\n", "-S,--submission-timeout=<#>", makeflow_submit_timeout);
+	printf(" %-30s Order in which to submit ready rules: rule, depth, or critical-path. (default is rule)\n", "   --submission-order=<order>");
+	printf(" %-30s Run each chain of rules that only feed each other as a single job.\n", "   --fuse-chains");
+	printf(" %-30s Work Queue caches input files under the names of their contents.\n", "   --wq-content-addressed-cache");
 	printf(" %-30s Work Queue keepalive timeout.			   (default is %ds)\n", "-t,--wq-keepalive-timeout=<#>", WORK_QUEUE_DEFAULT_KEEPALIVE_TIMEOUT);
 	printf(" %-30s Work Queue keepalive interval.			  (default is %ds)\n", "-u,--wq-keepalive-interval=<#>", WORK_QUEUE_DEFAULT_KEEPALIVE_INTERVAL);
 	printf(" %-30s Umbrella binary for running every rule in a makeflow.\n", "   --umbrella-binary=<file>");
@@ -1213,6 +1463,7 @@ int main(int argc, char *argv[])
 	const char *priority = NULL;
 	char *work_queue_password = NULL;
 	char *wq_wait_queue_size = 0;
+	int wq_content_addressed_cache = 0;
 	int did_explicit_auth = 0;
 	char *chirp_tickets = NULL;
 	char *working_dir = NULL;
@@ -1278,6 +1529,7 @@ int main(int argc, char *argv[])
 		LONG_OPT_WORKING_DIR,
 		LONG_OPT_PREFERRED_CONNECTION,
 		LONG_OPT_WQ_WAIT_FOR_WORKERS,
+		LONG_OPT_WQ_CONTENT_ADDRESSED_CACHE,
 		LONG_OPT_WRAPPER,
 		LONG_OPT_WRAPPER_INPUT,
 		LONG_OPT_WRAPPER_OUTPUT,
@@ -1303,7 +1555,9 @@ int main(int argc, char *argv[])
 		LONG_OPT_ARCHIVE_WRITE_ONLY,
 		LONG_OPT_MESOS_MASTER,
 		LONG_OPT_MESOS_PATH,
-		LONG_OPT_MESOS_PRELOAD
+		LONG_OPT_MESOS_PRELOAD,
+		LONG_OPT_SUBMISSION_ORDER,
+		LONG_OPT_FUSE_CHAINS
 	};
 
 	static const struct option long_options_run[] = {
@@ -1345,6 +1599,8 @@ int main(int argc, char *argv[])
 		{"retry", no_argument, 0, 'R'},
 		{"retry-count", required_argument, 0, 'r'},
 		{"shared-fs", required_argument, 0, LONG_OPT_SHARED_FS},
+		{"submission-order", required_argument, 0, LONG_OPT_SUBMISSION_ORDER},
+		{"fuse-chains", no_argument, 0, LONG_OPT_FUSE_CHAINS},
 		{"show-output", no_argument, 0, 'O'},
 		{"submission-timeout", required_argument, 0, 'S'},
 		{"summary-log", required_argument, 0, 'f'},
@@ -1358,6 +1614,7 @@ int main(int argc, char *argv[])
 		{"umbrella-mode", required_argument, 0, LONG_OPT_UMBRELLA_MODE},
 		{"umbrella-spec", required_argument, 0, LONG_OPT_UMBRELLA_SPEC},
 		{"work-queue-preferred-connection", required_argument, 0, LONG_OPT_PREFERRED_CONNECTION},
+		{"wq-content-addressed-cache", no_argument, 0, LONG_OPT_WQ_CONTENT_ADDRESSED_CACHE},
 		{"wq-estimate-capacity", no_argument, 0, 'E'},
 		{"wq-fast-abort", required_argument, 0, 'F'},
 		{"wq-keepalive-interval", required_argument, 0, 'u'},
@@ -1444,8 +1701,6 @@ int main(int argc, char *argv[])
 					makeflow_gc_method = MAKEFLOW_GC_NONE;
 				} else if(strcasecmp(optarg, "ref_count") == 0) {
 					makeflow_gc_method = MAKEFLOW_GC_COUNT;
-					if(makeflow_gc_count < 0)
-						makeflow_gc_count = 16;	/* Try to collect at most 16 files. */
 				} else if(strcasecmp(optarg, "on_demand") == 0) {
 					makeflow_gc_method = MAKEFLOW_GC_ON_DEMAND;
 					if(makeflow_gc_count < 0)
@@ -1595,6 +1850,9 @@ int main(int argc, char *argv[])
 			case LONG_OPT_WQ_WAIT_FOR_WORKERS:
 				wq_wait_queue_size = optarg;
 				break;
+			case LONG_OPT_WQ_CONTENT_ADDRESSED_CACHE:
+				wq_content_addressed_cache = 1;
+				break;
 			case LONG_OPT_WORKING_DIR:
 				free(working_dir);
 				working_dir = xxstrdup(optarg);
@@ -1634,6 +1892,20 @@ int main(int argc, char *argv[])
 			case LONG_OPT_SKIP_FILE_CHECK:
 				skip_file_check = 1;
 				break;
+			case LONG_OPT_SUBMISSION_ORDER:
+				if(!strcmp(optarg, "rule")) {
+					submission_order = MAKEFLOW_ORDER_RULE;
+				} else if(!strcmp(optarg, "depth")) {
+					submission_order = MAKEFLOW_ORDER_DEPTH;
+				} else if(!strcmp(optarg, "critical-path")) {
+					submission_order = MAKEFLOW_ORDER_CRITICAL_PATH;
+				} else {
+					fatal("Submission order '%s' is not valid. Use one of: rule depth critical-path", optarg);
+				}
+				break;
+			case LONG_OPT_FUSE_CHAINS:
+				fuse_chains = 1;
+				break;
 			case LONG_OPT_DOCKER_TAR:
 				container_image_tar = xxstrdup(optarg);
 				break;
@@ -1880,6 +2152,7 @@ int main(int argc, char *argv[])
 	batch_queue_set_option(remote_queue, "keepalive-timeout", work_queue_keepalive_timeout);
 	batch_queue_set_option(remote_queue, "caching", cache_mode ? "yes" : "no");
 	batch_queue_set_option(remote_queue, "wait-queue-size", wq_wait_queue_size);
+	batch_queue_set_option(remote_queue, "content-addressed-cache", wq_content_addressed_cache ? "yes" : "no");
 	batch_queue_set_option(remote_queue, "amazon-credentials", amazon_credentials);
 	batch_queue_set_option(remote_queue, "amazon-ami", amazon_ami);
 	batch_queue_set_option(remote_queue, "working-dir", working_dir);
@@ -2066,6 +2339,12 @@ int main(int argc, char *argv[])
 	d->should_read_archive = should_read_archive;
 	d->should_write_to_archive = should_write_to_archive;
 
+	if(fuse_chains) {
+		if(should_read_archive || should_write_to_archive)
+			fatal("Chains of rules cannot be fused when archiving.");
+		printf("fused %d rules into the jobs of the rules before them.\n", dag_fuse_chains(d));
+	}
+
 	makeflow_run(d);
 	time_completed = timestamp_get();
 	runtime = time_completed - runtime;
@@ -2099,23 +2378,26 @@ int main(int argc, char *argv[])
             unlink(CONTAINER_SINGULARITY_SH);
         }
 
+	int exit_status;
+
 	if(makeflow_abort_flag) {
 		makeflow_log_aborted_event(d);
 		fprintf(stderr, "workflow was aborted.\n");
-		exit(EXIT_FAILURE);
+		exit_status = EXIT_FAILURE;
 	} else if(makeflow_failed_flag) {
 		makeflow_log_failed_event(d);
 		fprintf(stderr, "workflow failed.\n");
-		exit(EXIT_FAILURE);
+		exit_status = EXIT_FAILURE;
 	} else {
 		makeflow_log_completed_event(d);
 		printf("nothing left to do.\n");
-		exit(EXIT_SUCCESS);
+		exit_status = EXIT_SUCCESS;
 	}
 
+	dag_delete(d);
 	free(archive_directory);
 
-	return 0;
+	exit(exit_status);
 }
 
 /* vim: set noexpandtab tabstop=4: */
@@ -7,6 +7,7 @@ See the file COPYING for details.
 #include "debug.h"
 #include "xxmalloc.h"
 #include "set.h"
+#include "list.h"
 #include "timestamp.h"
 #include "host_disk_info.h"
 #include "stringtools.h"
@@ -238,28 +239,33 @@ int makeflow_clean(struct dag *d, struct batch_queue *queue, makeflow_clean_dept
 	return 0;
 }
 
+/* A file may be collected once no rule needs it, unless it is an input or output of the workflow. */
+
+static int makeflow_file_is_collectable( struct dag *d, struct dag_file *f )
+{
+	return f->state == DAG_FILE_STATE_COMPLETE
+		&& !dag_file_is_source(f)
+		&& !set_lookup(d->outputs, f)
+		&& !set_lookup(d->inputs, f);
+}
+
 /* Collect available garbage, up to a limit of maxfiles. */
 
 static void makeflow_gc_all( struct dag *d, struct batch_queue *queue, int maxfiles )
 {
 	int collected = 0;
 	struct dag_file *f;
-	char *name;
 
 	timestamp_t start_time, stop_time;
 
-	/* This will walk the table of files to collect and will remove any
-	 * that are below or equal to the threshold. */
+	/* Files enter the collect list when their reference count falls to
+	 * zero, so only the files that may be freed are visited, rather than
+	 * the whole table of files. Entries whose state changed since are
+	 * simply dropped. */
 	start_time = timestamp_get();
-	hash_table_firstkey(d->files);
-	while(hash_table_nextkey(d->files, &name, (void **) &f) && collected < maxfiles) {
-		if(f->state == DAG_FILE_STATE_COMPLETE
-			&& !dag_file_is_source(f)
-			&& !set_lookup(d->outputs, f)
-			&& !set_lookup(d->inputs, f)
-			&& makeflow_clean_file(d, queue, f, 0)){
+	while(collected < maxfiles && (f = list_pop_head(d->collect_list))) {
+		if(makeflow_file_is_collectable(d, f) && makeflow_clean_file(d, queue, f, 0) == 0)
 			collected++;
-		}
 	}
 
 	stop_time = timestamp_get();
@@ -281,8 +287,8 @@ void makeflow_gc( struct dag *d, struct batch_queue *queue, makeflow_gc_method_t
 	case MAKEFLOW_GC_NONE:
 		break;
 	case MAKEFLOW_GC_COUNT:
-		debug(D_MAKEFLOW_RUN, "Performing incremental file (%d) garbage collection", count);
-		makeflow_gc_all(d, queue, count);
+		debug(D_MAKEFLOW_RUN, "Performing reference count garbage collection");
+		makeflow_gc_all(d, queue, INT_MAX);
 		break;
 	case MAKEFLOW_GC_ON_DEMAND:
 		if(d->completed_files - d->deleted_files > count || directory_low_disk(".",size)){
@@ -164,6 +164,7 @@ void makeflow_log_state_change( struct dag *d, struct dag_node *n, int newstate
 	}
 	n->state = newstate;
 	d->node_states[n->state]++;
+	dag_ready_node_state_changed(d, n);
 
 	fprintf(d->logfile, "%" PRIu64 " %d %d %" PRIbjid " %d %d %d %d %d %d\n", timestamp_get(), n->nodeid, newstate, n->jobid, d->node_states[0], d->node_states[1], d->node_states[2], d->node_states[3], d->node_states[4], d->nodeid_counter);
 
@@ -174,13 +175,17 @@ void makeflow_log_file_state_change( struct dag *d, struct dag_file *f, int news
 {
 	debug(D_MAKEFLOW_RUN, "file %s %s -> %s\n", f->filename, dag_file_state_name(f->state), dag_file_state_name(newstate));
 
+	int existed = dag_file_should_exist(f);
 	f->state = newstate;
+	dag_ready_file_state_changed(d, f, existed);
 
 	timestamp_t time = timestamp_get();
 	fprintf(d->logfile, "# FILE %" PRIu64 " %s %d %" PRIu64 "\n", time, f->filename, f->state, dag_file_size(f));
 	if(f->state == DAG_FILE_STATE_EXISTS){
 		d->completed_files += 1;
 		f->creation_logged = (time_t) (time / 1000000);
+	} else if(f->state == DAG_FILE_STATE_COMPLETE) {
+		list_push_tail(d->collect_list, f);
 	} else if(f->state == DAG_FILE_STATE_DELETE) {
 		d->deleted_files += 1;
 	}
@@ -238,6 +243,8 @@ int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode,
 				if(file_state == DAG_FILE_STATE_EXISTS){
 					d->completed_files += 1;
 					f->creation_logged = (time_t) (previous_completion_time / 1000000);
+				} else if(file_state == DAG_FILE_STATE_COMPLETE){
+					list_push_tail(d->collect_list, f);
 				} else if(file_state == DAG_FILE_STATE_DELETE){
 					d->deleted_files += 1;
 				}
@@ -287,10 +294,16 @@ int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode,
 			if(sscanf(line, "%" SCNu64 " %d %d %d", &previous_completion_time, &nodeid, &state, &jobid) == 4) {
 				n = itable_lookup(d->node_table, nodeid);
 				if(n) {
+					/* Log timestamp is in microseconds, we need seconds for diff. */
+					time_t t = (time_t) (previous_completion_time / 1000000);
+
+					/* previous_completion is the time the rule started running. */
+					if(n->state == DAG_NODE_STATE_RUNNING && state != DAG_NODE_STATE_RUNNING)
+						n->previous_runtime = t - n->previous_completion;
+
 					n->state = state;
 					n->jobid = jobid;
-					/* Log timestamp is in microseconds, we need seconds for diff. */
-					n->previous_completion = (time_t) (previous_completion_time / 1000000);
+					n->previous_completion = t;
 					free(line);
 					continue;
 				}
@@ -0,0 +1,91 @@
+#!/bin/sh
+
+# Test that with reference counting the intermediate files are also
+# removed from the cache of the workers once no rule needs them, both when
+# files are cached under their paths and under their contents.
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+prepare()
+{
+	for mode in path content
+	do
+		mkdir -p $test_dir/$mode
+		ln -sf ../../syntax/collect.makeflow $test_dir/$mode
+	done
+	exit 0
+}
+
+# Print the names of the files the worker stored in its cache and that the
+# master did not remove afterwards.
+cached_files_left()
+{
+	sed -n -e 's/.*rx from master: put \([^ ]*\).*/\1/p' -e 's/.*rx from master: outfile \([^ ]*\).*/\1/p' $1 | sort -u > cached.list
+	sed -n -e 's/.*rx from master: unlink \([^ ]*\).*/\1/p' $1 | sort -u > unlinked.list
+	comm -23 cached.list unlinked.list
+}
+
+run_mode()
+{
+	mode=$1
+	shift
+
+	echo "running with files cached by $mode"
+	cd $test_dir/$mode
+
+	../../../src/makeflow -d all -o makeflow.debug -T wq -Z master.port -g ref_count "$@" collect.makeflow &
+	pid=$!
+
+	run_local_worker master.port worker.log
+
+	wait $pid || exit 1
+
+	echo "checking that the intermediate files were deleted"
+	for i in 0 1 2 3 4 5 6
+	do
+		if [ -f _collect.$i ]
+		then
+			echo "_collect.$i was not deleted!"
+			exit 1
+		fi
+	done
+	[ -f _collect.7 ] || exit 1
+
+	echo "checking that the worker used the expected cached names"
+	if [ $mode = content ]
+	then
+		grep -q "rx from master: put hash-" worker.log || exit 1
+	else
+		grep -q "rx from master: put hash-" worker.log && exit 1
+	fi
+
+	echo "checking that only the final output was left in the cache of the worker"
+	left=`cached_files_left worker.log`
+	echo "$left"
+	if [ -z "$left" ] || echo "$left" | grep -v -q -- "-_collect\.7$"
+	then
+		echo "the worker kept files that are no longer needed!"
+		exit 1
+	fi
+
+	cd ../..
+}
+
+run()
+{
+	run_mode path
+	run_mode content --wq-content-addressed-cache
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
\ No newline at end of file
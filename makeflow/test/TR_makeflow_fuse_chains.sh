@@ -0,0 +1,78 @@
+#!/bin/sh
+
+# Test that a chain of rules that only feed each other runs as a single
+# job, while every rule of the chain is still logged as complete.
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+
+	printf "c\nb\na\nb\n" > input.txt
+
+cat > chain.makeflow <<EOF
+split.txt: input.txt
+	cat input.txt > split.txt
+
+filter.txt: split.txt
+	grep -v c split.txt > filter.txt
+
+sorted.txt: filter.txt
+	sort filter.txt > sorted.txt
+
+final.txt: sorted.txt
+	uniq sorted.txt > final.txt
+
+other.txt: input.txt
+	wc -l < input.txt > other.txt
+EOF
+
+	printf "a\nb\n" > expected.txt
+
+	exit 0
+}
+
+run()
+{
+	cd $test_dir
+
+	./makeflow --fuse-chains chain.makeflow > makeflow.out 2>&1 || exit 1
+
+	require_identical_files final.txt expected.txt || exit 1
+
+	echo "checking that the chain ran as a single job"
+	jobs=`grep -c "^submitted job" makeflow.out`
+	if [ "$jobs" != 2 ]
+	then
+		echo "$jobs jobs were submitted instead of 2!"
+		exit 1
+	fi
+
+	echo "checking that every rule was logged as complete"
+	complete=`grep -v "^#" chain.makeflow.makeflowlog | awk '$3 == 2 {print $2}' | sort -u | wc -l`
+	if [ "$complete" != 5 ]
+	then
+		echo "only $complete of the rules were logged as complete!"
+		exit 1
+	fi
+
+	echo "checking that a rerun finds nothing to do"
+	./makeflow --fuse-chains chain.makeflow | grep -q "nothing left to do" || exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,60 @@
+#!/bin/sh
+
+# Test that a workflow mixing local and remote rules completes, with
+# the jobs of both queues returned by the same wait.
+
+. ../../dttools/test/test_runner_common.sh
+
+TEST_DIR=local_remote.test.dir
+
+prepare()
+{
+	mkdir -p $TEST_DIR
+	cd $TEST_DIR
+	cat > test.mf <<EOF
+a.txt:
+	LOCAL echo a > a.txt
+
+b.txt: a.txt
+	cat a.txt > b.txt; echo b >> b.txt
+
+c.txt: b.txt
+	LOCAL cat b.txt > c.txt; echo c >> c.txt
+
+slow.txt:
+	sleep 2; echo slow > slow.txt
+
+local.txt:
+	LOCAL sleep 1; echo local > local.txt
+EOF
+
+	printf "a\nb\nc\n" > expected.txt
+	exit 0
+}
+
+run()
+{
+	cd $TEST_DIR
+
+	../../src/makeflow -d all -T wq -Z master.port test.mf &
+	pid=$!
+
+	run_local_worker master.port worker.log
+
+	wait $pid || exit 1
+
+	require_identical_files c.txt expected.txt || exit 1
+
+	[ -f slow.txt ] && [ -f local.txt ]
+	exit $?
+}
+
+clean()
+{
+	rm -rf ${TEST_DIR}
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
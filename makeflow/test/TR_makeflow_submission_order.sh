@@ -0,0 +1,93 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+
+	# c1 is submitted first, and then its chain competes with the i rules.
+cat > order.makeflow <<EOF
+c2: c1
+	echo c2 >> order.txt; touch c2
+
+c3: c2
+	echo c3 >> order.txt; touch c3
+
+i1:
+	echo i1 >> order.txt; touch i1
+
+i2:
+	echo i2 >> order.txt; touch i2
+
+i3:
+	echo i3 >> order.txt; touch i3
+
+c1:
+	echo c1 >> order.txt; touch c1
+EOF
+
+	# slow takes longer than the rest of the rules put together.
+cat > weight.makeflow <<EOF
+slow:
+	sleep 3; echo slow >> order.txt; touch slow
+
+fast:
+	echo fast >> order.txt; touch fast
+EOF
+
+	exit 0
+}
+
+run_order()
+{
+	rm -f order.txt c1 c2 c3 i1 i2 i3 order.makeflow.makeflowlog order.makeflow.batchlog
+
+	run_makeflow $1 order.makeflow "$2"
+}
+
+run_makeflow()
+{
+	./makeflow -j 1 -J 1 --submission-order=$1 $2 || return 1
+
+	order=`cat order.txt | tr '\n' ' '`
+	echo "$1 order: $order"
+
+	[ "$order" = "$3" ]
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "checking that by default the last rules are submitted first"
+	run_order rule "c1 i3 i2 i1 c2 c3 " || exit 1
+
+	echo "checking that the depth order follows the chain first"
+	run_order depth "c1 c2 c3 i3 i2 i1 " || exit 1
+
+	echo "checking that the critical path order follows the longest chain first"
+	run_order critical-path "c1 c2 i3 i2 i1 c3 " || exit 1
+
+	echo "checking that the critical path order uses the runtimes of the previous run"
+	rm -f order.txt slow fast weight.makeflow.makeflowlog weight.makeflow.batchlog
+	run_makeflow critical-path weight.makeflow "fast slow " || exit 1
+	rm -f order.txt slow fast
+	run_makeflow critical-path weight.makeflow "slow fast " || exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
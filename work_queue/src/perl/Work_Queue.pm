@@ -137,6 +137,16 @@ sub activate_fast_abort_category {
 	return work_queue_activate_fast_abort_category($self->{_work_queue}, $name, $multiplier);
 }
 
+sub activate_speculation {
+	my ($self, $percentile, $max_duplicates) = @_;
+	return work_queue_activate_speculation($self->{_work_queue}, $percentile, $max_duplicates);
+}
+
+sub activate_speculation_category {
+	my ($self, $name, $percentile, $max_duplicates) = @_;
+	return work_queue_activate_speculation_category($self->{_work_queue}, $name, $percentile, $max_duplicates);
+}
+
 sub empty {
 	my ($self) = @_;
 	return work_queue_empty($self->{_work_queue});
@@ -570,6 +580,56 @@ the "default" category.
 =back
 
 
+=head3 C<activate_speculation>
+
+Turn on or off speculative execution for a given queue for tasks without an
+explicit category. While no task is waiting for a worker, a task whose running
+time is larger than the given percentile of the recent execution times of its
+category is duplicated on another worker. The first execution to succeed gives
+the result of the task, and the other execution is canceled. The values
+specified here apply to all the categories for which
+activate_speculation_category was not explicitely called.
+
+=over 12
+
+=item percentile
+
+The percentile, between 0 and 100, of the execution times at which a task is
+duplicated; if zero or less, speculation is deactivated (the default).
+
+=item max_duplicates
+
+The maximum number of duplicates of tasks of a category that may run at once.
+
+=back
+
+
+=head3 C<activate_speculation_category>
+
+Turn on or off speculative execution for a given category. The values
+specified here apply only to tasks in the given category.  (Note:
+work_queue_activate_speculation_category(q, "default", p, n) is the same as
+work_queue_activate_speculation(q, p, n).)
+
+=over 12
+
+=item name
+
+The name of the category.
+
+=item percentile
+
+The percentile, between 0 and 100, of the execution times at which a task is
+duplicated; if zero, speculation is deactivated. If less than zero (default),
+use the speculation of the "default" category.
+
+=item max_duplicates
+
+The maximum number of duplicates of tasks of the category that may run at once.
+
+=back
+
+
 =head3 C<empty>
 
 Determine whether there are any known tasks queued, running, or waiting to be collected.
@@ -930,6 +990,38 @@ Set the minimum number of seconds to wait before sending new keepalive checks to
 
 Set the minimum number of seconds to wait for a keepalive response from worker before marking it as dead. (default=30)
 
+=item "dispatch-batch-size"
+
+Set the maximum number of dispatches to workers in one scheduling pass. Each dispatch may carry a bundle of tasks for the same worker, see "max-task-bundle". (default=1)
+
+=item "max-task-bundle"
+
+Set the maximum number of tasks sent to a worker in one dispatch. Tasks are bundled only once they are measured to run much shorter than a second, and only as many as fit the resources of the worker. (default=16)
+
+=item "max-async-transfers"
+
+Set the maximum number of input files sent to workers in the background at once; if zero, files are sent synchronously. (default=64)
+
+=item "max-async-transfers-per-worker"
+
+Set the maximum number of input files queued in the background for a single worker. (default=4)
+
+=item "compress-transfers"
+
+If set to 1, files are compressed when sent between the master and the workers. Data that does not compress is sent as is. (default=0)
+
+=item "binary-frames"
+
+If set to 1, workers that offer binary frames use them for tasks, results, resource updates, and keepalives, instead of text messages. (default=1)
+
+=item "content-addressed-cache"
+
+If set to 1, cached input files are named after a hash of their contents, so that copies of the same contents are transferred and stored once, and a file changed in place is sent again. (default=0)
+
+=item "peer-transfer-fanout"
+
+Set the maximum number of transfers of a cached input file that a worker holding it may serve to other workers at once; if zero, the master sends all input files itself, and workers do not serve files to each other. (default=0)
+
 =item value The value to set the parameter to.
 
 =back
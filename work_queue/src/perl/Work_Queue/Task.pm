@@ -72,6 +72,11 @@ sub specify_command {
 	return work_queue_task_specify_command($self->{_task});;
 }
 
+sub specify_library {
+	my ($self, $library) = @_;
+	return work_queue_task_specify_library($self->{_task}, $library);
+}
+
 sub specify_algorithm {
 	my ($self, $algorithm) = @_;
 	return work_queue_task_specify_algorithm($self->{_task}, $algorithm);
@@ -488,6 +493,20 @@ The command to be executed.
 
 =back
 
+=head3 C<specify_library>
+
+Run the task as an invocation of a library, rather than as a shell command.
+The library is started once on each worker slot and kept running, and the
+command of the task is given to it as the arguments of the invocation.
+
+=over 12
+
+=item library
+
+The shell command that starts the library.
+
+=back
+
 =head3 C<specify_algorithm>
 
 Set the worker selection algorithm for task.
@@ -79,6 +79,18 @@ class Task(_object):
     def specify_command(self, command):
         return work_queue_task_specify_command(self._task, command)
 
+    ##
+    # Run the task as an invocation of a library, rather than as a shell
+    # command. The library is started once on each worker slot and kept
+    # running, and the command of the task is given to it as the arguments of
+    # the invocation. See @ref work_queue_task_specify_library for the
+    # protocol between the worker and the library.
+    #
+    # @param self       Reference to the current task object.
+    # @param library    The shell command that starts the library.
+    def specify_library(self, library):
+        return work_queue_task_specify_library(self._task, library)
+
     ##
     # Set the worker selection algorithm for task.
     #
@@ -924,6 +936,30 @@ class WorkQueue(_object):
     def activate_fast_abort_category(self, name, multiplier):
         return work_queue_activate_fast_abort_category(self._work_queue, name, multiplier)
 
+    ##
+    # Turn on or off speculative execution for a given queue for tasks in
+    # the "default" category, and for task which category does not set
+    # explicit speculation. While no task is waiting for a worker, a task
+    # that runs longer than the given percentile of the recent execution
+    # times of its category is duplicated on another worker, and the first
+    # execution to succeed gives the result of the task.
+    #
+    # @param self           Reference to the current work queue object.
+    # @param percentile     The percentile, between 0 and 100, of the execution times at which a task is duplicated; if zero or less (the default) speculation is deactivated.
+    # @param max_duplicates The maximum number of duplicates of tasks of a category that may run at once.
+    def activate_speculation(self, percentile, max_duplicates):
+        return work_queue_activate_speculation(self._work_queue, percentile, max_duplicates)
+
+    ##
+    # Turn on or off speculative execution for a given category.
+    #
+    # @param self           Reference to the current work queue object.
+    # @param name           Name of the category.
+    # @param percentile     The percentile, between 0 and 100, of the execution times at which a task is duplicated; if zero, deactivate for the category, negative (the default), use the one for the "default" category (see @ref activate_speculation)
+    # @param max_duplicates The maximum number of duplicates of tasks of the category that may run at once.
+    def activate_speculation_category(self, name, percentile, max_duplicates):
+        return work_queue_activate_speculation_category(self._work_queue, name, percentile, max_duplicates)
+
     ##
     # Determine whether there are any known tasks queued, running, or waiting to be collected.
     #
@@ -1229,6 +1265,14 @@ class WorkQueue(_object):
     #              - "fast-abort-multiplier" Set the multiplier of the average task time at which point to abort; if negative or zero fast_abort is deactivated. (default=0)
     #              - "keepalive-interval" Set the minimum number of seconds to wait before sending new keepalive checks to workers. (default=300)
     #              - "keepalive-timeout" Set the minimum number of seconds to wait for a keepalive response from worker before marking it as dead. (default=30)
+    #              - "dispatch-batch-size" Set the maximum number of dispatches to workers in one scheduling pass. Each dispatch may carry a bundle of tasks for the same worker, see "max-task-bundle". (default=1)
+    #              - "max-task-bundle" Set the maximum number of tasks sent to a worker in one dispatch. Tasks are bundled only once they are measured to run much shorter than a second, and only as many as fit the resources of the worker. (default=16)
+    #              - "max-async-transfers" Set the maximum number of input files sent to workers in the background at once; if zero, files are sent synchronously. (default=64)
+    #              - "max-async-transfers-per-worker" Set the maximum number of input files queued in the background for a single worker. (default=4)
+    #              - "compress-transfers" If set to 1, files are compressed when sent between the master and the workers. Data that does not compress is sent as is. (default=0)
+    #              - "binary-frames" If set to 1, workers that offer binary frames use them for tasks, results, resource updates, and keepalives, instead of text messages. (default=1)
+    #              - "content-addressed-cache" If set to 1, cached input files are named after a hash of their contents, so that copies of the same contents are transferred and stored once, and a file changed in place is sent again. (default=0)
+    #              - "peer-transfer-fanout" Set the maximum number of transfers of a cached input file that a worker holding it may serve to other workers at once; if zero, the master sends all input files itself, and workers do not serve files to each other. (default=0)
     # @param value The value to set the parameter to.
     # @return 0 on succes, -1 on failure.
     #
@@ -14,6 +14,9 @@ The following major problems must be fixed:
 #include "work_queue_protocol.h"
 #include "work_queue_internal.h"
 #include "work_queue_resources.h"
+#include "work_queue_compress.h"
+#include "work_queue_frame.h"
+#include "work_queue_stream.h"
 
 #include "cctools.h"
 #include "int_sizes.h"
@@ -28,9 +31,12 @@ The following major problems must be fixed:
 #include "interfaces_address.h"
 #include "itable.h"
 #include "list.h"
+#include "priority_queue.h"
 #include "macros.h"
+#include "set.h"
 #include "username.h"
 #include "create_dir.h"
+#include "full_io.h"
 #include "xxmalloc.h"
 #include "load_average.h"
 #include "buffer.h"
@@ -120,6 +126,57 @@ int wq_option_scheduler = WORK_QUEUE_SCHEDULE_TIME;
 /* default timeout for slow workers to come back to the pool */
 double wq_option_blacklist_slow_workers_timeout = 900;
 
+#define TASK_STATE_MAX (WORK_QUEUE_TASK_CANCELED + 1)
+
+/* Number of submitted tasks in each state, and with each resource allocation. */
+struct task_state_counts {
+	int states[TASK_STATE_MAX];
+	int requests[CATEGORY_ALLOCATION_ERROR + 1];
+};
+
+/*
+Each submitted task has an entry that links it into the list of tasks in its
+state, and that remembers under which counters the task is counted. Thus
+counting and finding tasks by state does not scan all the tasks. Entries are
+updated only by change_task_state, and are dropped once a task is done or
+canceled.
+*/
+
+struct task_state_entry {
+	struct work_queue_task *task;
+	work_queue_task_state_t state;
+	category_allocation_t request;         // allocation the task is counted under.
+	struct task_state_counts *counts;      // counts of the category of the task.
+	struct priority_queue_node *ready_node; // position in the ready queue, while ready.
+	int uncounted;                         // duplicates of speculated tasks are listed, but not counted.
+	struct task_state_entry *prev;
+	struct task_state_entry *next;
+};
+
+struct task_state_list {
+	struct task_state_entry *head;
+	struct task_state_entry *tail;
+};
+
+/*
+Speculative execution settings and recent execution times of a category. A
+running task slower than the given percentile of the recent execution times
+of its category may be duplicated on another worker.
+*/
+
+#define SPECULATION_SAMPLES 100
+#define SPECULATION_MIN_SAMPLES 10
+
+struct speculation {
+	double percentile;                        // 0 deactivated, < 0 as the "default" category.
+	int max_duplicates;                       // duplicates of the category that may run at once.
+	int running;                              // duplicates of the category running now.
+	timestamp_t threshold;                    // execution time past which tasks are duplicated, 0 if none.
+	timestamp_t samples[SPECULATION_SAMPLES]; // execution times of the last successful tasks.
+	int samples_count;
+	int samples_next;
+};
+
 struct work_queue {
 	char *name;
 	int port;
@@ -131,20 +188,38 @@ struct work_queue {
 	char workingdir[PATH_MAX];
 
 	struct link      *master_link;   // incoming tcp connection for workers.
-	struct link_info *poll_table;
+	struct link_set  *poll_set;      // master, foreman uplink, and worker links registered for polling.
+	struct link_info *poll_table;    // links found ready by the last poll.
 	int poll_table_size;
+	int master_link_active;          // whether the last poll found new connections at master_link.
 
 	struct itable *tasks;           // taskid -> task
 	struct itable *task_state_map;  // taskid -> state
-	struct list   *ready_list;      // ready to be sent to a worker
+	struct priority_queue *ready_queue; // ready to be sent to a worker
+
+	struct itable *task_state_entries;                      // taskid -> struct task_state_entry, for submitted tasks.
+	struct task_state_list task_state_lists[TASK_STATE_MAX]; // submitted tasks in each state.
+	struct task_state_counts task_counts;                   // counts over all submitted tasks.
+	struct hash_table *category_task_counts;                // category name -> struct task_state_counts
 
 	struct hash_table *worker_table;
 	struct hash_table *worker_blacklist;
 	struct itable  *worker_task_map;
+	struct itable  *workers_by_free_resources;  // packed free resources -> set of workers, used to prune worker selection.
+	struct hash_table *file_holders;        // cached_name -> itable of worker -> struct stat of the cached copy.
+	struct hash_table *file_sources;        // cached_name -> itable of workers that may serve the file to other workers.
+	struct hash_table *content_hashes;      // local path -> struct content_hash, memoized content cached names.
 
 	struct hash_table *categories;
 
+	struct hash_table *speculations;       // category name -> struct speculation
+	struct itable *speculation_duplicates; // taskid -> running duplicate of the task.
+	struct itable *speculation_originals;  // taskid of a duplicate -> task it duplicates.
+	struct list *speculation_dropped;      // finished duplicates, freed at the next speculation pass.
+	timestamp_t speculation_last_check;
+
 	struct hash_table *workers_with_available_results;
+	struct hash_table *workers_with_pushed_results;
 
 	struct work_queue_stats *stats;
 	struct work_queue_stats *stats_measure;
@@ -154,6 +229,9 @@ struct work_queue {
 	int worker_selection_algorithm;
 	int task_ordering;
 	int process_pending_check;
+	int dispatch_batch_size;	// maximum number of dispatches to workers in one scheduling pass
+	int max_task_bundle;		// maximum number of tasks sent to a worker in one dispatch
+	timestamp_t average_execute_time;	// moving average of the execution time of tasks, to size bundles
 
 	int short_timeout;		// timeout to send/recv a brief message from worker
 	int long_timeout;		// timeout to send/recv a brief message from a foreman
@@ -197,6 +275,19 @@ struct work_queue {
 
 	char *password;
 	double bandwidth;
+	double bandwidth_tokens;               // bytes that may be transferred now under the bandwidth limit.
+	timestamp_t bandwidth_refill_time;     // last time bandwidth_tokens was refilled.
+
+	struct hash_table *workers_with_pending_sends;
+	int async_transfers;                   // files currently being sent in the background.
+	int max_async_transfers;               // maximum of files sent in the background over all workers.
+	int max_async_transfers_per_worker;    // maximum of files queued in the background for a single worker.
+
+	int peer_transfer_fanout;              // maximum of transfers to other workers served at once by a worker, or 0 to disable.
+
+	int content_addressed_cache;           // if set, cached input files are named after their contents.
+	int compress_transfers;                // if set, files are compressed when sent to and from workers.
+	int binary_frames;                     // if set, workers that offer binary frames may use them.
 };
 
 struct work_queue_worker {
@@ -216,6 +307,22 @@ struct work_queue_worker {
 	struct link *link;
 	struct itable *current_tasks;
 	struct itable *current_tasks_boxes;
+	int64_t free_resources_index;             // bucket in q->workers_by_free_resources, or -1 if not indexed.
+	struct list *pending_sends;               // messages and files waiting to be written to the worker, in order.
+	int pending_send_files;                   // number of files in pending_sends.
+	buffer_t bundle;                          // task messages written to the worker in one go at the end of a dispatch.
+	int bundling;                             // if set, messages to the worker are held in bundle.
+	int bundle_tasks;                         // number of tasks in bundle.
+	int peer_transfers;                       // 1 if the worker offers to serve cached files to other workers, 2 once it does.
+	char transfer_addr[LINK_ADDRESS_MAX];     // address and port where the worker serves cached files to other workers.
+	int transfer_port;
+	struct list *peer_gets_served;            // struct peer_get of the transfers to other workers currently served.
+	struct hash_table *peer_gets;             // cached_name -> struct peer_get, for files being fetched from other workers.
+	int frames;                               // if set, frequent messages to and from the worker are binary frames.
+	int putdir;                               // if set, the worker takes input directories as a single stream.
+	int compress;                             // if set, the worker takes and sends compressed files.
+	struct work_queue_frame frame;            // last frame received from the worker.
+	struct list *pushed_results;              // results pushed by the worker, read but not yet processed.
 	int finished_tasks;
 	int64_t total_tasks_complete;
 	int64_t total_bytes_transferred;
@@ -242,6 +349,9 @@ struct blacklist_host_info {
 };
 
 static void handle_worker_failure(struct work_queue *q, struct work_queue_worker *w);
+static work_queue_result_code_t queue_pushed_result(struct work_queue *q, struct work_queue_worker *w, const struct work_queue_frame *f);
+static void process_pushed_results(struct work_queue *q, struct work_queue_worker *w);
+static void discard_pushed_results(struct work_queue *q, struct work_queue_worker *w);
 static void handle_app_failure(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t);
 static void remove_worker(struct work_queue *q, struct work_queue_worker *w);
 
@@ -255,7 +365,24 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 static void find_max_worker(struct work_queue *q);
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w);
 
-static void push_task_to_ready_list( struct work_queue *q, struct work_queue_task *t );
+static void worker_index_update(struct work_queue *q, struct work_queue_worker *w);
+static void worker_index_remove(struct work_queue *q, struct work_queue_worker *w);
+
+static void worker_file_insert(struct work_queue *q, struct work_queue_worker *w, const char *cached_name, struct stat *remote_info);
+static void worker_file_remove(struct work_queue *q, struct work_queue_worker *w, const char *cached_name);
+static void worker_file_ready(struct work_queue *q, struct work_queue_worker *w, const char *cached_name);
+static int finish_peer_get(struct work_queue *q, struct work_queue_worker *w, const char *cached_name, int resend, int source_failed);
+static void forget_peer_gets_served(struct work_queue_worker *w);
+static int is_content_cached_name(const char *cached_name);
+static work_queue_result_code_t send_input_file(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, struct work_queue_file *f);
+
+static void push_task_to_ready_queue( struct work_queue *q, struct work_queue_task *t );
+
+static int get_transfer_wait_time(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, int64_t length);
+static int flush_pending_sends(struct work_queue *q, struct work_queue_worker *w);
+
+static void speculation_add_sample(struct work_queue *q, struct work_queue_task *t);
+static void finish_duplicate(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *dup);
 
 /* returns old state */
 static work_queue_task_state_t change_task_state( struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state);
@@ -272,8 +399,9 @@ static int task_state_count( struct work_queue *q, const char *category, work_qu
 /* number of tasks with the resource allocation request */
 static int task_request_count( struct work_queue *q, const char *category, category_allocation_t request);
 
-static work_queue_result_code_t get_result(struct work_queue *q, struct work_queue_worker *w, const char *line);
+static work_queue_result_code_t get_result(struct work_queue *q, struct work_queue_worker *w, const struct work_queue_frame *f);
 static work_queue_result_code_t get_available_results(struct work_queue *q, struct work_queue_worker *w);
+static void update_average_execute_time(struct work_queue *q, timestamp_t execute_time);
 
 static int update_task_result(struct work_queue_task *t, work_queue_result_t new_result);
 
@@ -487,6 +615,286 @@ static void link_to_hash_key(struct link *link, char *key)
 	sprintf(key, "0x%p", link);
 }
 
+/*
+Bandwidth limiting uses a token bucket. Tokens are bytes, refilled at the
+rate of q->bandwidth, and holding at most one second worth of transfer.
+Transfers done in the foreground may leave the bucket in debt. The master
+never sleeps to pay it: the wait loop defers the background sends and the
+retrieval of results until the bucket is replenished.
+*/
+
+static void bandwidth_refill(struct work_queue *q)
+{
+	timestamp_t current_time = timestamp_get();
+	timestamp_t elapsed = current_time - q->bandwidth_refill_time;
+
+	q->bandwidth_tokens = MIN(q->bandwidth, q->bandwidth_tokens + (q->bandwidth * elapsed) / 1000000);
+	q->bandwidth_refill_time = current_time;
+}
+
+/* Returns how many of the wanted bytes may be sent right away. */
+static int64_t bandwidth_request(struct work_queue *q, int64_t wanted)
+{
+	if(!q->bandwidth)
+		return wanted;
+
+	bandwidth_refill(q);
+
+	int64_t granted = MIN(wanted, (int64_t) q->bandwidth_tokens);
+	if(granted < 1)
+		return 0;
+
+	q->bandwidth_tokens -= granted;
+
+	return granted;
+}
+
+/* Account for bytes already transferred. */
+static void bandwidth_charge(struct work_queue *q, int64_t bytes)
+{
+	if(!q->bandwidth)
+		return;
+
+	bandwidth_refill(q);
+	q->bandwidth_tokens -= bytes;
+}
+
+/* 1 if transfers should wait for the bucket to be replenished, 0 otherwise. */
+static int bandwidth_exhausted(struct work_queue *q)
+{
+	if(!q->bandwidth)
+		return 0;
+
+	bandwidth_refill(q);
+
+	return q->bandwidth_tokens < 1;
+}
+
+/*
+Data for a worker is normally written to its link right away. While a file is
+being sent in the background, anything else for that worker is queued behind
+it, so that the worker sees the same stream of messages it would otherwise.
+The queue is advanced by the wait loop when the link is writable, and is
+flushed only before waiting for a reply from the worker, since the worker
+answers a request only after reading everything sent before it.
+*/
+
+#define PENDING_SEND_CHUNK (1<<16)
+
+struct pending_send {
+	int fd;                   // file being sent, or -1 for a message.
+	int64_t remaining;        // bytes of the file not yet read.
+	char *data;               // the message, or the chunk of the file being sent.
+	size_t data_length;
+	size_t data_sent;
+	struct work_queue_compress *z;  // set if the file is sent compressed.
+	char *plain;              // chunk of the file read, before it is compressed.
+	int64_t chunk_bytes;      // bytes of the file in the chunk being sent, counted once written.
+	uint64_t taskid;          // task the file is sent for, or 0.
+	time_t stoptime;          // set once the send is at the head of the queue.
+	timestamp_t start_time;
+};
+
+static void pending_send_delete(struct pending_send *p)
+{
+	if(p->fd >= 0)
+		close(p->fd);
+	free(p->data);
+	free(p->plain);
+	free(p->z);
+	free(p);
+}
+
+static void enqueue_pending_send(struct work_queue *q, struct work_queue_worker *w, struct pending_send *p)
+{
+	if(list_size(w->pending_sends) < 1) {
+		hash_table_insert(q->workers_with_pending_sends, w->hashkey, w);
+	}
+
+	list_push_tail(w->pending_sends, p);
+
+	if(p->fd >= 0) {
+		w->pending_send_files++;
+		q->async_transfers++;
+	}
+}
+
+static void discard_pending_sends(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct pending_send *p;
+	while((p = list_pop_head(w->pending_sends))) {
+		if(p->fd >= 0)
+			q->async_transfers--;
+		pending_send_delete(p);
+	}
+
+	w->pending_send_files = 0;
+	hash_table_remove(q->workers_with_pending_sends, w->hashkey);
+}
+
+/* Count the bytes of a file once they are written to the worker. */
+static void account_pending_send(struct work_queue *q, struct work_queue_worker *w, struct pending_send *p)
+{
+	if(p->chunk_bytes < 1)
+		return;
+
+	w->total_bytes_transferred += p->chunk_bytes;
+	q->stats->bytes_sent += p->chunk_bytes;
+
+	struct work_queue_task *t = p->taskid ? itable_lookup(q->tasks, p->taskid) : NULL;
+	if(t) {
+		t->bytes_sent        += p->chunk_bytes;
+		t->bytes_transferred += p->chunk_bytes;
+	}
+
+	p->chunk_bytes = 0;
+}
+
+/* Write as much of the pending sends of w as possible. If blocking, wait until
+ * all of them are written. Returns 1 if all were written, 0 if some are left,
+ * and -1 on failure. */
+static int progress_pending_sends(struct work_queue *q, struct work_queue_worker *w, int blocking)
+{
+	struct pending_send *p;
+
+	while((p = list_peek_head(w->pending_sends))) {
+		if(!p->stoptime) {
+			p->stoptime = time(0) + get_transfer_wait_time(q, w, NULL, p->fd >= 0 ? p->remaining : (int64_t) p->data_length);
+			p->start_time = timestamp_get();
+		}
+
+		if(p->data_sent == p->data_length) {
+			if(p->fd >= 0 && p->remaining > 0) {
+				int64_t wanted = MIN(p->remaining, PENDING_SEND_CHUNK);
+				int64_t granted = blocking ? wanted : bandwidth_request(q, wanted);
+				if(granted < 1)
+					return 0;
+
+				ssize_t actual = full_read(p->fd, p->z ? p->plain : p->data, granted);
+				if(actual <= 0) {
+					debug(D_WQ, "Failed to read file for %s (%s): %s", w->hostname, w->addrport, actual < 0 ? strerror(errno) : "file is shorter than expected");
+					return -1;
+				}
+
+				if(blocking)
+					bandwidth_charge(q, actual);
+
+				p->remaining -= actual;
+				p->chunk_bytes = actual;
+				p->data_length = p->z ? work_queue_compress_block(p->z, p->plain, actual, p->data) : (size_t) actual;
+				p->data_sent = 0;
+			} else {
+				if(p->z && p->z->plain_bytes > 0) {
+					debug(D_WQ, "%s (%s) was sent a file compressed to %.1f%%", w->hostname, w->addrport, 100.0 * p->z->wire_bytes / p->z->plain_bytes);
+				}
+				if(p->fd >= 0) {
+					w->total_transfer_time += timestamp_get() - p->start_time;
+					w->pending_send_files--;
+					q->async_transfers--;
+				}
+				list_pop_head(w->pending_sends);
+				pending_send_delete(p);
+				continue;
+			}
+		}
+
+		ssize_t actual = write(link_fd(w->link), p->data + p->data_sent, p->data_length - p->data_sent);
+		if(actual > 0) {
+			p->data_sent += actual;
+			if(p->data_sent == p->data_length)
+				account_pending_send(q, w, p);
+		} else if(actual < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+			if(blocking) {
+				if(!link_sleep(w->link, p->stoptime, 0, 1)) {
+					debug(D_WQ, "Timed out sending data to %s (%s)", w->hostname, w->addrport);
+					return -1;
+				}
+			} else if(time(0) > p->stoptime) {
+				debug(D_WQ, "Timed out sending data to %s (%s)", w->hostname, w->addrport);
+				return -1;
+			} else {
+				return 0;
+			}
+		} else {
+			debug(D_WQ, "Failed to send data to %s (%s): %s", w->hostname, w->addrport, strerror(errno));
+			return -1;
+		}
+	}
+
+	hash_table_remove(q->workers_with_pending_sends, w->hashkey);
+	link_set_add(q->poll_set, w->link, LINK_READ);
+
+	/* a keepalive check may have waited in the queue, so count its time from now. */
+	if(w->last_update_msg_time >= w->last_msg_recv_time) {
+		w->last_update_msg_time = timestamp_get();
+	}
+
+	return 1;
+}
+
+/* Write data to a worker, behind any of its pending sends. */
+static int write_worker_data(struct work_queue *q, struct work_queue_worker *w, const char *data, size_t length, time_t stoptime)
+{
+	if(list_size(w->pending_sends) > 0) {
+		struct pending_send *p = calloc(1, sizeof(*p));
+		p->fd = -1;
+		p->data = xxmalloc(length);
+		memcpy(p->data, data, length);
+		p->data_length = length;
+		enqueue_pending_send(q, w, p);
+		return length;
+	}
+
+	return link_putlstring(w->link, data, length, stoptime);
+}
+
+/*
+The messages describing the tasks of a dispatch are held in the bundle of the
+worker, so that several tasks cost a single write. The bundle is written
+before anything else is sent to, or read from, the worker.
+*/
+
+static int flush_worker_bundle(struct work_queue *q, struct work_queue_worker *w)
+{
+	size_t length;
+	const char *data = buffer_tolstring(&w->bundle, &length);
+
+	if(length < 1)
+		return 1;
+
+	time_t stoptime = time(0) + (w->foreman ? q->long_timeout : q->short_timeout);
+	ssize_t actual = write_worker_data(q, w, data, length, stoptime);
+
+	buffer_rewind(&w->bundle, 0);
+
+	return actual == (ssize_t) length ? 1 : -1;
+}
+
+static int flush_pending_sends(struct work_queue *q, struct work_queue_worker *w)
+{
+	if(flush_worker_bundle(q, w) < 0)
+		return -1;
+
+	if(list_size(w->pending_sends) < 1)
+		return 1;
+
+	return progress_pending_sends(q, w, 1);
+}
+
+/* Send data to a worker, after any of its bundled or pending sends. */
+static int send_worker_data(struct work_queue *q, struct work_queue_worker *w, const char *data, size_t length, time_t stoptime)
+{
+	if(w->bundling) {
+		buffer_putlstring(&w->bundle, data, length);
+		return length;
+	}
+
+	if(flush_worker_bundle(q, w) < 0)
+		return -1;
+
+	return write_worker_data(q, w, data, length, stoptime);
+}
+
 /**
  * This function sends a message to the worker and records the time the message is
  * successfully sent. This timestamp is used to determine when to send keepalive checks.
@@ -513,13 +921,65 @@ static int send_worker_msg( struct work_queue *q, struct work_queue_worker *w, c
 	else
 		stoptime = time(0) + q->short_timeout;
 
-	int result = link_putlstring(w->link, buffer_tostring(B), buffer_pos(B), stoptime);
+	int result = send_worker_data(q, w, buffer_tostring(B), buffer_pos(B), stoptime);
 
 	buffer_free(B);
 
 	return result;
 }
 
+/* As send_worker_msg, for a worker that accepted binary frames. */
+static int send_worker_frame( struct work_queue *q, struct work_queue_worker *w, const struct work_queue_frame *f )
+{
+	char data[WORK_QUEUE_FRAME_MAX];
+	size_t length = work_queue_frame_encode(f, data);
+
+	debug(D_WQ, "tx to %s (%s): %s", w->hostname, w->addrport, work_queue_frame_name(f->type));
+
+	time_t stoptime = time(0) + (w->foreman ? q->long_timeout : q->short_timeout);
+
+	return send_worker_data(q, w, data, length, stoptime);
+}
+
+/* Files are compressed on the link to a worker only if the master asks for it
+ * with the compress-transfers tune, and the worker offered to take them. */
+static int compress_transfers_to(struct work_queue *q, struct work_queue_worker *w)
+{
+	return q->compress_transfers && w->compress;
+}
+
+/* Files are sent in the background unless either limit of asynchronous
+ * transfers is zero. */
+static int async_transfers_enabled(struct work_queue *q)
+{
+	return q->max_async_transfers > 0 && q->max_async_transfers_per_worker > 0;
+}
+
+/* Send a put message for the contents of fd, and queue the contents to be
+ * written to the worker in the background. */
+static void send_file_in_background(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, int fd, const char *remotename, int64_t length, int mode, int flags)
+{
+	int compress = compress_transfers_to(q, w);
+
+	send_worker_msg(q,w, "%s %s %"PRId64" 0%o %d\n", compress ? "zput" : "put", remotename, length, mode, flags);
+
+	struct pending_send *p = calloc(1, sizeof(*p));
+	p->fd = fd;
+	p->remaining = length;
+	p->taskid = t ? t->taskid : 0;
+
+	if(compress) {
+		p->z = malloc(sizeof(*p->z));
+		work_queue_compress_init(p->z);
+		p->plain = xxmalloc(PENDING_SEND_CHUNK);
+		p->data = xxmalloc(work_queue_compress_bound(PENDING_SEND_CHUNK));
+	} else {
+		p->data = xxmalloc(PENDING_SEND_CHUNK);
+	}
+
+	enqueue_pending_send(q, w, p);
+}
+
 void work_queue_broadcast_message(struct work_queue *q, const char *msg) {
 	if(!q)
 		return;
@@ -543,6 +1003,21 @@ work_queue_msg_code_t process_name(struct work_queue *q, struct work_queue_worke
 	return MSG_PROCESSED;
 }
 
+/*
+Workers offer to serve cached files to other workers, and start doing so only
+when asked, so that no worker listens for other workers unless the master
+enables transfers between them with the peer-transfer-fanout tune.
+*/
+
+static void start_peer_transfers(struct work_queue *q, struct work_queue_worker *w)
+{
+	if(q->peer_transfer_fanout < 1 || w->peer_transfers != 1)
+		return;
+
+	send_worker_msg(q, w, "peer_transfers\n");
+	w->peer_transfers = 2;
+}
+
 work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worker *w, char *line)
 {
 	char field[WORK_QUEUE_LINE_MAX];
@@ -581,6 +1056,21 @@ work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worke
 		free(w->workerid);
 		w->workerid = xxstrdup(value);
 		write_transaction_worker(q, w, 0);
+	} else if(string_prefix_is(field, "peer-transfers")) {
+		w->peer_transfers = atoi(value) ? 1 : 0;
+		start_peer_transfers(q, w);
+	} else if(string_prefix_is(field, "transfer-port")) {
+		w->transfer_port = atoi(value);
+		w->peer_transfers = 2;
+	} else if(string_prefix_is(field, "compress")) {
+		w->compress = atoi(value) > 0;
+	} else if(string_prefix_is(field, "putdir")) {
+		w->putdir = atoi(value) > 0;
+	} else if(string_prefix_is(field, "frames")) {
+		if(q->binary_frames && atoi(value) == WORK_QUEUE_FRAME_VERSION) {
+			w->frames = 1;
+			send_worker_msg(q, w, "frames\n");
+		}
 	}
 
 	//Note we always mark info messages as processed, as they are optional.
@@ -588,6 +1078,136 @@ work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worke
 }
 
 
+/*
+The worker has a cached file in place, either from the master or from another
+worker, and may now serve it to other workers.
+*/
+
+static work_queue_msg_code_t process_cache_update(struct work_queue *q, struct work_queue_worker *w, const char *line)
+{
+	char cached_name[WORK_QUEUE_LINE_MAX];
+	int64_t length;
+
+	if(sscanf(line, "cache-update %s %" SCNd64, cached_name, &length) != 2)
+		return MSG_FAILURE;
+
+	finish_peer_get(q, w, cached_name, 0, 0);
+
+	// Files named after their contents are kept by the worker from previous
+	// masters, and are valid whatever their local name.
+	if(!hash_table_lookup(w->current_files, cached_name) && is_content_cached_name(cached_name)) {
+		struct stat *remote_info = calloc(1, sizeof(*remote_info));
+		remote_info->st_size = length;
+		worker_file_insert(q, w, cached_name, remote_info);
+	}
+
+	worker_file_ready(q, w, cached_name);
+
+	return MSG_PROCESSED;
+}
+
+/*
+The worker evicted a file from its cache. A task may already be on its way
+to the worker with the file, which the worker holds back until the file is
+sent again. Returns 0 if the file could not be sent.
+*/
+
+static int resend_evicted_file(struct work_queue *q, struct work_queue_worker *w, const char *cached_name)
+{
+	struct work_queue_task *t;
+	struct work_queue_file *f;
+	uint64_t taskid;
+
+	itable_firstkey(w->current_tasks);
+	while(itable_nextkey(w->current_tasks, &taskid, (void **) &t)) {
+		if(!t->input_files) continue;
+
+		list_first_item(t->input_files);
+		while((f = list_next_item(t->input_files))) {
+			if(!strcmp(f->cached_name, cached_name)) {
+				debug(D_WQ, "%s (%s) evicted %s, which task %d needs", w->hostname, w->addrport, cached_name, t->taskid);
+				return send_input_file(q, w, t, f) == SUCCESS;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/*
+The worker evicted a file from its cache.
+*/
+
+static work_queue_msg_code_t process_cache_invalid(struct work_queue *q, struct work_queue_worker *w, const char *line)
+{
+	char cached_name[WORK_QUEUE_LINE_MAX];
+
+	if(sscanf(line, "cache-invalid %s", cached_name) != 1)
+		return MSG_FAILURE;
+
+	if(!hash_table_lookup(w->peer_gets, cached_name)) {
+		worker_file_remove(q, w, cached_name);
+		if(!resend_evicted_file(q, w, cached_name)) {
+			// tasks waiting for the file cannot run on this worker.
+			return MSG_FAILURE;
+		}
+	} else if(!finish_peer_get(q, w, cached_name, 1, 0)) {
+		// tasks waiting for the file cannot run on this worker.
+		return MSG_FAILURE;
+	}
+
+	return MSG_PROCESSED;
+}
+
+/*
+The worker could not fetch a cached file from another worker, so the master
+sends the file itself. The reason is "source" if the other worker could not
+be reached or did not send the file, and "local" if the worker failed on its
+own, e.g. when short of disk. Only the first kind counts against the source.
+*/
+
+static work_queue_msg_code_t process_peer_failed(struct work_queue *q, struct work_queue_worker *w, const char *line)
+{
+	char cached_name[WORK_QUEUE_LINE_MAX];
+	char reason[WORK_QUEUE_LINE_MAX];
+
+	if(sscanf(line, "peer-failed %s %s", cached_name, reason) != 2)
+		return MSG_FAILURE;
+
+	if(!finish_peer_get(q, w, cached_name, 1, !strcmp(reason, "source"))) {
+		// tasks waiting for the file cannot run on this worker.
+		return MSG_FAILURE;
+	}
+
+	return MSG_PROCESSED;
+}
+
+/*
+Binary frames carry the same updates as the alive and resource messages.
+Workers that use frames send the results of tasks as soon as they are
+ready, without waiting for a send_results message, so a result frame is
+read wherever it arrives, and queued until handle_worker processes it.
+*/
+
+static work_queue_msg_code_t process_frame(struct work_queue *q, struct work_queue_worker *w, const struct work_queue_frame *f)
+{
+	switch(f->type) {
+		case WORK_QUEUE_FRAME_ALIVE:
+			w->stats->tasks_running = f->fields[WORK_QUEUE_FRAME_ALIVE_TASKS_RUNNING];
+			return MSG_PROCESSED;
+		case WORK_QUEUE_FRAME_RESOURCES:
+			/* inuse is computed by the master, and it is kept by work_queue_frame_to_resources. */
+			work_queue_frame_to_resources(f, w->resources);
+			count_worker_resources(q, w);
+			write_transaction_worker_resources(q, w);
+			return MSG_PROCESSED;
+		case WORK_QUEUE_FRAME_RESULT:
+			return queue_pushed_result(q, w, f) == SUCCESS ? MSG_PROCESSED : MSG_FAILURE;
+		default:
+			return MSG_NOT_PROCESSED;
+	}
+}
+
 /**
  * This function receives a message from worker and records the time a message is successfully
  * received. This timestamp is used in keepalive timeout computations.
@@ -602,7 +1222,7 @@ static work_queue_msg_code_t recv_worker_msg(struct work_queue *q, struct work_q
 	else
 		stoptime = time(0) + q->short_timeout;
 
-	int result = link_readline(w->link, line, length, stoptime);
+	int result = work_queue_frame_recv(w->link, &w->frame, line, length, stoptime);
 
 	if (result <= 0) {
 		return MSG_FAILURE;
@@ -612,6 +1232,10 @@ static work_queue_msg_code_t recv_worker_msg(struct work_queue *q, struct work_q
 
 	debug(D_WQ, "rx from %s (%s): %s", w->hostname, w->addrport, line);
 
+	if(w->frame.type != WORK_QUEUE_FRAME_NONE) {
+		return process_frame(q, w, &w->frame);
+	}
+
 	// Check for status updates that can be consumed here.
 	if(string_prefix_is(line, "alive")) {
 		result = MSG_PROCESSED;
@@ -634,6 +1258,12 @@ static work_queue_msg_code_t recv_worker_msg(struct work_queue *q, struct work_q
 		result = process_name(q, w, line);
 	} else if (string_prefix_is(line, "info")) {
 		result = process_info(q, w, line);
+	} else if (string_prefix_is(line, "cache-update")) {
+		result = process_cache_update(q, w, line);
+	} else if (string_prefix_is(line, "cache-invalid")) {
+		result = process_cache_invalid(q, w, line);
+	} else if (string_prefix_is(line, "peer-failed")) {
+		result = process_peer_failed(q, w, line);
 	} else {
 		// Message is not a status update: return it to the user.
 		result = MSG_NOT_PROCESSED;
@@ -652,6 +1282,12 @@ work_queue_msg_code_t recv_worker_msg_retry( struct work_queue *q, struct work_q
 {
 	work_queue_msg_code_t result = MSG_PROCESSED;
 
+	// This waits for the reply to a request, which the worker sends only
+	// after reading everything queued before the request.
+	if(flush_pending_sends(q, w) < 0) {
+		return MSG_FAILURE;
+	}
+
 	do {
 		result = recv_worker_msg(q, w,line,length);
 	} while(result == MSG_PROCESSED);
@@ -795,10 +1431,17 @@ static void cleanup_worker(struct work_queue *q, struct work_queue_worker *w)
 
 	if(!q || !w) return;
 
+	hash_table_firstkey(w->peer_gets);
+	while(hash_table_nextkey(w->peer_gets, &key, (void **) &value)) {
+		finish_peer_get(q, w, key, 0, 0);
+		hash_table_firstkey(w->peer_gets);
+	}
+
+	forget_peer_gets_served(w);
+
 	hash_table_firstkey(w->current_files);
 	while(hash_table_nextkey(w->current_files, &key, (void **) &value)) {
-		hash_table_remove(w->current_files, key);
-		free(value);
+		worker_file_remove(q, w, key);
 		hash_table_firstkey(w->current_files);
 	}
 
@@ -869,8 +1512,14 @@ static void remove_worker(struct work_queue *q, struct work_queue_worker *w)
 
 	cleanup_worker(q, w);
 
+	worker_index_remove(q, w);
+	discard_pending_sends(q, w);
+	list_delete(w->pending_sends);
+	buffer_free(&w->bundle);
 	hash_table_remove(q->worker_table, w->hashkey);
 	hash_table_remove(q->workers_with_available_results, w->hashkey);
+	discard_pushed_results(q, w);
+	list_delete(w->pushed_results);
 
 	record_removed_worker_stats(q, w);
 
@@ -880,6 +1529,8 @@ static void remove_worker(struct work_queue *q, struct work_queue_worker *w)
 	itable_delete(w->current_tasks);
 	itable_delete(w->current_tasks_boxes);
 	hash_table_delete(w->current_files);
+	hash_table_delete(w->peer_gets);
+	list_delete(w->peer_gets_served);
 	work_queue_resources_delete(w->resources);
 
 	free(w->workerid);
@@ -953,6 +1604,19 @@ static void add_worker(struct work_queue *q)
 	w->current_files = hash_table_create(0, 0);
 	w->current_tasks = itable_create(0);
 	w->current_tasks_boxes = itable_create(0);
+	w->free_resources_index = -1;
+	w->pending_sends = list_create();
+	w->pending_send_files = 0;
+	buffer_init(&w->bundle);
+	buffer_abortonfailure(&w->bundle, 1);
+	w->bundling = 0;
+	w->bundle_tasks = 0;
+	w->peer_gets = hash_table_create(0, 0);
+	w->peer_gets_served = list_create();
+	w->frames = 0;
+	w->pushed_results = list_create();
+	w->putdir = 0;
+	w->compress = 0;
 	w->finished_tasks = 0;
 	w->start_time = timestamp_get();
 
@@ -965,7 +1629,9 @@ static void add_worker(struct work_queue *q)
 	w->stats     = calloc(1, sizeof(struct work_queue_stats));
 	link_to_hash_key(link, w->hashkey);
 	sprintf(w->addrport, "%s:%d", addr, port);
+	strcpy(w->transfer_addr, addr);
 	hash_table_insert(q->worker_table, w->hashkey, w);
+	link_set_add(q->poll_set, link, LINK_READ);
 	q->stats->workers_joined++;
 
 	debug(D_WQ, "%d workers are connected in total now", hash_table_size(q->worker_table));
@@ -976,14 +1642,8 @@ static void add_worker(struct work_queue *q)
 /*
 Get a single file from a remote worker.
 */
-static work_queue_result_code_t get_file( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *local_name, int64_t length, int64_t * total_bytes)
+static work_queue_result_code_t get_file( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *local_name, int64_t length, int mode, int compressed, int64_t * total_bytes)
 {
-	// If a bandwidth limit is in effect, choose the effective stoptime.
-	timestamp_t effective_stoptime = 0;
-	if(q->bandwidth) {
-		effective_stoptime = (length/q->bandwidth)*1000000 + timestamp_get();
-	}
-
 	// Choose the actual stoptime.
 	time_t stoptime = time(0) + get_transfer_wait_time(q, w, t, length);
 
@@ -1006,15 +1666,25 @@ static work_queue_result_code_t get_file( struct work_queue *q, struct work_queu
 		return APP_FAILURE;
 	}
 
-	int fd = open(local_name, O_WRONLY | O_TRUNC | O_CREAT, 0777);
+	int fd = open(local_name, O_WRONLY | O_TRUNC | O_CREAT, mode);
 	if(fd < 0) {
 		debug(D_NOTICE, "Cannot open file %s for writing: %s", local_name, strerror(errno));
 		link_soak(w->link, length, stoptime);
 		return APP_FAILURE;
 	}
 
+	/* an existing file keeps its mode on open, so set it here. */
+	if(mode != 0777) {
+		fchmod(fd, mode);
+	}
+
 	// Write the data on the link to file.
-	int64_t actual = link_stream_to_fd(w->link, fd, length, stoptime);
+	int64_t actual;
+	if(compressed) {
+		actual = work_queue_compress_recv(w->link, fd, length, stoptime);
+	} else {
+		actual = link_stream_to_fd(w->link, fd, length, stoptime);
+	}
 
 	close(fd);
 
@@ -1026,11 +1696,8 @@ static work_queue_result_code_t get_file( struct work_queue *q, struct work_queu
 
 	*total_bytes += length;
 
-	// If the transfer was too fast, slow things down.
-	timestamp_t current_time = timestamp_get();
-	if(effective_stoptime && effective_stoptime > current_time) {
-		usleep(effective_stoptime - current_time);
-	}
+	// Count the transfer against the bandwidth limit.
+	bandwidth_charge(q, length);
 
 	return SUCCESS;
 }
@@ -1050,7 +1717,7 @@ static work_queue_result_code_t get_file_or_directory( struct work_queue *q, str
 
 	// Send the name of the file/dir name to fetch
 	debug(D_WQ, "%s (%s) sending back %s to %s", w->hostname, w->addrport, remote_name, local_name);
-	send_worker_msg(q,w, "get %s 1\n",remote_name);
+	send_worker_msg(q,w, "get %s 1 %d\n",remote_name, compress_transfers_to(q, w));
 
 	work_queue_result_code_t result = SUCCESS; //return success unless something fails below
 
@@ -1060,15 +1727,17 @@ static work_queue_result_code_t get_file_or_directory( struct work_queue *q, str
 		char tmp_remote_path[WORK_QUEUE_LINE_MAX];
 		int64_t length;
 		int errnum;
+		int mode = 0777;
+		int compressed = 0;
 
 		if(recv_worker_msg_retry(q, w, line, sizeof(line)) == MSG_FAILURE) {
 			result = WORKER_FAILURE;
 			break;
 		}
 
-		if(sscanf(line,"dir %s", tmp_remote_path)==1) {
+		if(sscanf(line,"dir %s %o", tmp_remote_path, &mode)>=1) {
 			char *tmp_local_name = string_format("%s%s",local_name,&tmp_remote_path[remote_name_len]);
-			int result_dir = create_dir(tmp_local_name,0777);
+			int result_dir = create_dir(tmp_local_name,mode|0700);
 			if(!result_dir) {
 				debug(D_WQ, "Could not create directory - %s (%s)", tmp_local_name, strerror(errno));
 				result = APP_FAILURE;
@@ -1076,9 +1745,9 @@ static work_queue_result_code_t get_file_or_directory( struct work_queue *q, str
 				break;
 			}
 			free(tmp_local_name);
-		} else if(sscanf(line,"file %s %"SCNd64, tmp_remote_path, &length)==2) {
+		} else if(sscanf(line,"file %s %"SCNd64" %o", tmp_remote_path, &length, &mode)>=2 || (compressed = sscanf(line,"zfile %s %"SCNd64" %o", tmp_remote_path, &length, &mode)>=2)) {
 			char *tmp_local_name = string_format("%s%s",local_name,&tmp_remote_path[remote_name_len]);
-			result = get_file(q,w,t,tmp_local_name,length,total_bytes);
+			result = get_file(q,w,t,tmp_local_name,length,mode|0600,compressed,total_bytes);
 			free(tmp_local_name);
 			//Return if worker failure. Else wait for end message from worker.
 			if(result == WORKER_FAILURE) break;
@@ -1177,6 +1846,84 @@ char *make_cached_name( const struct work_queue_task *t, const struct work_queue
 	}
 }
 
+static int is_content_cached_name(const char *cached_name)
+{
+	return string_prefix_is(cached_name, WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX);
+}
+
+/*
+With the content addressed cache, cached input files are named after the md5
+of their contents, so that copies of the same contents are sent and stored
+only once, and a file changed in place cannot be mistaken for the cached
+version. The hash of each file is computed once, and computed again only if
+its modification time or size change.
+*/
+
+struct content_hash {
+	time_t mtime;
+	off_t size;
+	char *cached_name;
+};
+
+/* Set the cached name of f from its contents. Returns 0 if the file cannot be read. */
+static int update_content_cached_name(struct work_queue *q, struct work_queue_file *f, struct stat *info)
+{
+	if(f->type != WORK_QUEUE_FILE || !(f->flags & WORK_QUEUE_CACHE) || (f->flags & WORK_QUEUE_THIRDGET))
+		return 1;
+
+	/* names that depend on the worker, and directories, keep their usual names. */
+	if(strchr(f->payload, '$') || !S_ISREG(info->st_mode))
+		return 1;
+
+	struct content_hash *ch = hash_table_lookup(q->content_hashes, f->payload);
+
+	if(!ch || ch->mtime != info->st_mtime || ch->size != info->st_size) {
+		unsigned char digest[MD5_DIGEST_LENGTH];
+
+		timestamp_t start = timestamp_get();
+		if(!md5_file(f->payload, digest)) {
+			debug(D_WQ, "Could not compute the hash of %s: %s", f->payload, strerror(errno));
+			return 0;
+		}
+		debug(D_WQ, "hashed %s (%lld bytes) in %.02lfs", f->payload, (long long) info->st_size, (timestamp_get() - start) / 1000000.0);
+
+		if(!ch) {
+			ch = calloc(1, sizeof(*ch));
+			hash_table_insert(q->content_hashes, f->payload, ch);
+		}
+
+		free(ch->cached_name);
+		ch->cached_name = string_format("%s%s", WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX, md5_string(digest));
+		ch->mtime = info->st_mtime;
+		ch->size = info->st_size;
+	}
+
+	if(strcmp(f->cached_name, ch->cached_name)) {
+		free(f->cached_name);
+		f->cached_name = xxstrdup(ch->cached_name);
+	}
+
+	return 1;
+}
+
+/* Name the cached input files of t after their contents when the task is
+ * submitted, so that the workers that hold them are found when the task is
+ * scheduled. The names are checked again when the files are sent. */
+static void update_content_cached_names(struct work_queue *q, struct work_queue_task *t)
+{
+	struct work_queue_file *f;
+	struct stat info;
+
+	if(!q->content_addressed_cache || !t->input_files)
+		return;
+
+	list_first_item(t->input_files);
+	while((f = list_next_item(t->input_files))) {
+		if(f->type == WORK_QUEUE_FILE && stat(f->payload, &info) == 0)
+			update_content_cached_name(q, f, &info);
+	}
+}
+
 /*
 This function stores an output file from the remote cache directory
 to a third-party location, which can be either a remote filesystem
@@ -1249,7 +1996,7 @@ static work_queue_result_code_t get_output_file( struct work_queue *q, struct wo
 				return APP_FAILURE;
 			}
 			memcpy(remote_info, &local_info, sizeof(local_info));
-			hash_table_insert(w->current_files, f->cached_name, remote_info);
+			worker_file_insert(q, w, f->cached_name, remote_info);
 		} else {
 			debug(D_NOTICE, "Cannot stat file %s: %s", f->payload, strerror(errno));
 		}
@@ -1304,10 +2051,215 @@ static work_queue_result_code_t get_monitor_output_file( struct work_queue *q, s
 	return result;
 }
 
+/*
+The master keeps an inverted index of the cached files, from cached name to
+the workers that hold a copy, so that locality scheduling and invalidation
+only visit the workers that are relevant to a file. All changes to
+w->current_files should go through these two functions.
+*/
+
+static void worker_file_insert(struct work_queue *q, struct work_queue_worker *w, const char *cached_name, struct stat *remote_info)
+{
+	worker_file_remove(q, w, cached_name);
+
+	hash_table_insert(w->current_files, cached_name, remote_info);
+
+	struct itable *holders = hash_table_lookup(q->file_holders, cached_name);
+	if(!holders) {
+		holders = itable_create(0);
+		hash_table_insert(q->file_holders, cached_name, holders);
+	}
+
+	itable_insert(holders, (uintptr_t) w, remote_info);
+}
+
+static void worker_file_remove(struct work_queue *q, struct work_queue_worker *w, const char *cached_name)
+{
+	struct stat *remote_info = hash_table_remove(w->current_files, cached_name);
+	if(!remote_info)
+		return;
+
+	struct itable *holders = hash_table_lookup(q->file_holders, cached_name);
+	if(holders) {
+		itable_remove(holders, (uintptr_t) w);
+		if(itable_size(holders) < 1) {
+			hash_table_remove(q->file_holders, cached_name);
+			itable_delete(holders);
+		}
+	}
+
+	struct itable *sources = hash_table_lookup(q->file_sources, cached_name);
+	if(sources) {
+		itable_remove(sources, (uintptr_t) w);
+		if(itable_size(sources) < 1) {
+			hash_table_remove(q->file_sources, cached_name);
+			itable_delete(sources);
+		}
+	}
+
+	free(remote_info);
+}
+
+/*
+Workers may fetch cached input files from other workers that hold them,
+rather than from the master. A holder becomes a source once it confirms that
+the file is in place, and serves at most peer_transfer_fanout transfers at
+once, so that copies spread out as a tree. If a transfer fails, the receiving
+worker reports it, and the master sends the file itself.
+*/
+
+struct peer_get {
+	struct work_queue_worker *source; // worker serving the file, or NULL if it is gone.
+	char *local_name;
+	int64_t offset;
+	int64_t length;
+	int mode;
+	int flags;
+};
+
+static void worker_file_ready(struct work_queue *q, struct work_queue_worker *w, const char *cached_name)
+{
+	if(!hash_table_lookup(w->current_files, cached_name))
+		return;
+
+	struct itable *sources = hash_table_lookup(q->file_sources, cached_name);
+	if(!sources) {
+		sources = itable_create(0);
+		hash_table_insert(q->file_sources, cached_name, sources);
+	}
+
+	itable_insert(sources, (uintptr_t) w, w);
+}
+
+/* Returns the least busy source of the same version of the file, or null. */
+static struct work_queue_worker *find_peer_source(struct work_queue *q, struct work_queue_worker *w, const char *cached_name, struct stat *local_info)
+{
+	struct itable *sources = hash_table_lookup(q->file_sources, cached_name);
+	if(!sources)
+		return NULL;
+
+	struct work_queue_worker *best = NULL;
+	struct work_queue_worker *source;
+	uint64_t key;
+
+	itable_firstkey(sources);
+	while(itable_nextkey(sources, &key, (void **) &source)) {
+		if(source == w || source->transfer_port < 1 || list_size(source->peer_gets_served) >= q->peer_transfer_fanout)
+			continue;
+
+		struct stat *remote_info = hash_table_lookup(source->current_files, cached_name);
+		if(!remote_info)
+			continue;
+
+		if(!is_content_cached_name(cached_name) && (remote_info->st_mtime != local_info->st_mtime || remote_info->st_size != local_info->st_size))
+			continue;
+
+		if(!best || list_size(source->peer_gets_served) < list_size(best->peer_gets_served))
+			best = source;
+	}
+
+	return best;
+}
+
+/* Ask w to fetch the file from another worker. Returns 1 if the transfer was
+ * arranged, and 0 if the master should send the file itself. */
+static int send_file_from_peer(struct work_queue *q, struct work_queue_worker *w, struct work_queue_file *tf, const char *local_name, struct stat *local_info)
+{
+	if(q->peer_transfer_fanout < 1 || !(tf->flags & WORK_QUEUE_CACHE) || w->foreman || w->peer_transfers < 1)
+		return 0;
+
+	if(hash_table_lookup(w->peer_gets, tf->cached_name))
+		return 0;
+
+	struct work_queue_worker *source = find_peer_source(q, w, tf->cached_name, local_info);
+	if(!source)
+		return 0;
+
+	struct peer_get *pg = calloc(1, sizeof(*pg));
+	pg->source = source;
+	pg->local_name = xxstrdup(local_name);
+	pg->offset = tf->offset;
+	pg->length = tf->piece_length ? tf->piece_length : (int64_t) local_info->st_size;
+	pg->mode = (local_info->st_mode | 0600) & 0777;
+	pg->flags = tf->flags;
+
+	debug(D_WQ, "%s (%s) fetches file %s from %s (%s)", w->hostname, w->addrport, tf->cached_name, source->hostname, source->addrport);
+
+	send_worker_msg(q, w, "peer_get %s %"PRId64" 0%o %s %d\n", tf->cached_name, pg->length, pg->mode, source->transfer_addr, source->transfer_port);
+
+	hash_table_insert(w->peer_gets, tf->cached_name, pg);
+	list_push_tail(source->peer_gets_served, pg);
+
+	return 1;
+}
+
+/* Send the file of a failed peer transfer from the master, in the background. */
+static int resend_peer_get_file(struct work_queue *q, struct work_queue_worker *w, const char *cached_name, struct peer_get *pg)
+{
+	debug(D_WQ, "%s (%s) could not fetch file %s from another worker, sending it from the master", w->hostname, w->addrport, cached_name);
+
+	int fd = open(pg->local_name, O_RDONLY, 0);
+	if(fd < 0) {
+		debug(D_NOTICE, "Cannot open file %s: %s", pg->local_name, strerror(errno));
+		return 0;
+	}
+
+	if(lseek(fd, pg->offset, SEEK_SET) == -1) {
+		debug(D_NOTICE, "Cannot seek file %s to offset %lld: %s", pg->local_name, (long long) pg->offset, strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	send_file_in_background(q, w, NULL, fd, cached_name, pg->length, pg->mode, pg->flags);
+
+	return 1;
+}
+
+/* The workers fetching files from w, which is going away, find out that it is
+ * gone and report the failure, after which the master sends the files itself. */
+static void forget_peer_gets_served(struct work_queue_worker *w)
+{
+	struct peer_get *pg;
+
+	while((pg = list_pop_head(w->peer_gets_served))) {
+		pg->source = NULL;
+	}
+}
+
+/* Forget about a peer transfer to w, and if resend, send the file from the
+ * master. If source_failed, the source no longer serves other workers.
+ * Returns 0 if the file could not be sent. */
+static int finish_peer_get(struct work_queue *q, struct work_queue_worker *w, const char *cached_name, int resend, int source_failed)
+{
+	struct peer_get *pg = hash_table_remove(w->peer_gets, cached_name);
+	if(!pg)
+		return 1;
+
+	struct work_queue_worker *source = pg->source;
+	if(source) {
+		list_remove(source->peer_gets_served, pg);
+
+		// do not keep sending workers to a source that failed them.
+		if(source_failed) {
+			debug(D_WQ, "%s (%s) no longer serves files to other workers", source->hostname, source->addrport);
+			source->transfer_port = 0;
+		}
+	}
+
+	int result = 1;
+	if(resend)
+		result = resend_peer_get_file(q, w, cached_name, pg);
+
+	free(pg->local_name);
+	free(pg);
+
+	return result;
+}
+
 static void delete_worker_file( struct work_queue *q, struct work_queue_worker *w, const char *filename, int flags, int except_flags ) {
 	if(!(flags & except_flags)) {
 		send_worker_msg(q,w, "unlink %s\n", filename);
-		hash_table_remove(w->current_files, filename);
+		worker_file_remove(q, w, filename);
 	}
 }
 
@@ -1468,6 +2420,13 @@ static void fetch_output_from_worker(struct work_queue *q, struct work_queue_wor
 
 	delete_uncacheable_files(q,w,t);
 
+	// The result of a duplicate is the result of the task it duplicates.
+	if(itable_lookup(q->speculation_originals, t->taskid)) {
+		t->time_when_done = timestamp_get();
+		finish_duplicate(q, w, t);
+		return;
+	}
+
 	/* if q is monitoring, append the task summary to the single
 	 * queue summary, update t->resources_used, and delete the task summary. */
 	if(q->monitor_mode) {
@@ -1483,6 +2442,9 @@ static void fetch_output_from_worker(struct work_queue *q, struct work_queue_wor
 
 	work_queue_accumulate_task(q, t);
 
+	if(t->result == WORK_QUEUE_RESULT_SUCCESS)
+		speculation_add_sample(q, t);
+
 	// At this point, a task is completed.
 	reap_task_from_worker(q, w, t, WORK_QUEUE_TASK_RETRIEVED);
 
@@ -1549,28 +2511,22 @@ static void expire_waiting_task(struct work_queue *q, struct work_queue_task *t)
 
 static int expire_waiting_tasks(struct work_queue *q)
 {
-	struct work_queue_task *t;
+	struct task_state_entry *e, *next;
 	int expired = 0;
-	int count;
 
 	timestamp_t current_time = timestamp_get();
-	count = task_state_count(q, NULL, WORK_QUEUE_TASK_READY);
 
-	while(count > 0)
+	for(e = q->task_state_lists[WORK_QUEUE_TASK_READY].head; e; e = next)
 	{
-		count--;
-
-		t = list_pop_head(q->ready_list);
+		// expiring the task moves its entry to another list.
+		next = e->next;
 
+		struct work_queue_task *t = e->task;
 		if(t->resources_requested->end > 0 && (uint64_t) t->resources_requested->end <= current_time)
 		{
 			expire_waiting_task(q, t);
 			expired++;
 		}
-		else
-		{
-			list_push_tail(q->ready_list, t);
-		}
 	}
 
 	return expired;
@@ -1721,100 +2677,73 @@ static work_queue_result_code_t get_update( struct work_queue *q, struct work_qu
 }
 
 /*
-Failure to store result is treated as success so we continue to retrieve the
-output files of the task.
+A text result message from a worker that does not use binary frames is parsed
+into the fields of a result frame, so that both are handled the same.
 */
-static work_queue_result_code_t get_result(struct work_queue *q, struct work_queue_worker *w, const char *line) {
-
-	if(!q || !w || !line) 
-		return WORKER_FAILURE;
-
-	struct work_queue_task *t;
-
-	int task_status, exit_status;
-	uint64_t taskid;
-	int64_t output_length, retrieved_output_length;
-	timestamp_t execution_time;
-
-	int64_t actual;
-
-	timestamp_t observed_execution_time;
-	timestamp_t effective_stoptime = 0;
-	time_t stoptime;
-
+static int parse_result(const char *line, struct work_queue_frame *f)
+{
 	//Format: task completion status, exit status (exit code or signal), output length, execution time, taskid
 	char items[5][WORK_QUEUE_PROTOCOL_FIELD_MAX];
-	int n = sscanf(line, "result %s %s %s %s %" SCNd64"", items[0], items[1], items[2], items[3], &taskid);
-
-	if(n < 5) {
-		debug(D_WQ, "Invalid message from worker %s (%s): %s", w->hostname, w->addrport, line);
-		return WORKER_FAILURE;
-	}
-
-	task_status = atoi(items[0]);
-	exit_status   = atoi(items[1]);
-	output_length = atoll(items[2]);
-
-	t = itable_lookup(w->current_tasks, taskid);
-	if(!t) {
-		debug(D_WQ, "Unknown task result from worker %s (%s): no task %" PRId64" assigned to worker.  Ignoring result.", w->hostname, w->addrport, taskid);
-		stoptime = time(0) + get_transfer_wait_time(q, w, 0, output_length);
-		link_soak(w->link, output_length, stoptime);
-		return SUCCESS;
-	}
-
-	if(task_status == WORK_QUEUE_RESULT_FORSAKEN) {
-		/* task will be resubmitted, so we do not update any of the execution stats */
-		reap_task_from_worker(q, w, t, WORK_QUEUE_TASK_READY);
+	int64_t taskid;
 
-		return SUCCESS;
-	}
+	int n = sscanf(line, "result %s %s %s %s %" SCNd64"", items[0], items[1], items[2], items[3], &taskid);
+	if(n < 5)
+		return 0;
 
-	observed_execution_time = timestamp_get() - t->time_when_commit_end;
+	work_queue_frame_init(f, WORK_QUEUE_FRAME_RESULT);
+	f->fields[WORK_QUEUE_FRAME_RESULT_STATUS]         = atoi(items[0]);
+	f->fields[WORK_QUEUE_FRAME_RESULT_EXIT_STATUS]    = atoi(items[1]);
+	f->fields[WORK_QUEUE_FRAME_RESULT_OUTPUT_LENGTH]  = atoll(items[2]);
+	f->fields[WORK_QUEUE_FRAME_RESULT_EXECUTION_TIME] = atoll(items[3]);
+	f->fields[WORK_QUEUE_FRAME_RESULT_TASKID]         = taskid;
 
-	execution_time = atoll(items[3]);
-	t->time_workers_execute_last = observed_execution_time > execution_time ? execution_time : observed_execution_time;
+	return 1;
+}
 
-	t->time_workers_execute_all += t->time_workers_execute_last;
+/*
+Read the stdout of a task from the worker. The output is kept up to
+MAX_TASK_STDOUT_STORAGE bytes, and the rest is read and discarded.
+*/
+static work_queue_result_code_t recv_result_output(struct work_queue *q, struct work_queue_worker *w, const struct work_queue_frame *f, char **output, int *truncated)
+{
+	int64_t output_length, retrieved_output_length;
+	int64_t actual;
+	uint64_t taskid;
+	time_t stoptime;
 
-	if(task_status == WORK_QUEUE_RESULT_DISK_ALLOC_FULL) {
-		t->disk_allocation_exhausted = 1;
-	}
-	else {
-		t->disk_allocation_exhausted = 0;
-	}
+	output_length = f->fields[WORK_QUEUE_FRAME_RESULT_OUTPUT_LENGTH];
+	taskid        = f->fields[WORK_QUEUE_FRAME_RESULT_TASKID];
 
-	if(q->bandwidth) {
-		effective_stoptime = (output_length/q->bandwidth)*1000000 + timestamp_get();
-	}
+	*output    = NULL;
+	*truncated = 0;
 
 	if(output_length <= MAX_TASK_STDOUT_STORAGE) {
 		retrieved_output_length = output_length;
 	} else {
 		retrieved_output_length = MAX_TASK_STDOUT_STORAGE;
 		fprintf(stderr, "warning: stdout of task %"PRId64" requires %2.2lf GB of storage. This exceeds maximum supported size of %d GB. Only %d GB will be retreived.\n", taskid, ((double) output_length)/MAX_TASK_STDOUT_STORAGE, MAX_TASK_STDOUT_STORAGE/GIGABYTE, MAX_TASK_STDOUT_STORAGE/GIGABYTE);
-		update_task_result(t, WORK_QUEUE_RESULT_STDOUT_MISSING);
+		*truncated = 1;
 	}
 
-	t->output = malloc(retrieved_output_length+1);
-	if(t->output == NULL) {
+	*output = malloc(retrieved_output_length+1);
+	if(*output == NULL) {
 		fprintf(stderr, "error: allocating memory of size %"PRId64" bytes failed for storing stdout of task %"PRId64".\n", retrieved_output_length, taskid);
 		//drop the entire length of stdout on the link
-		stoptime = time(0) + get_transfer_wait_time(q, w, t, output_length);
+		stoptime = time(0) + get_transfer_wait_time(q, w, 0, output_length);
 		link_soak(w->link, output_length, stoptime);
-		retrieved_output_length = 0;
-		update_task_result(t, WORK_QUEUE_RESULT_STDOUT_MISSING);
+		return SUCCESS;
 	}
 
 	if(retrieved_output_length > 0) {
 		debug(D_WQ, "Receiving stdout of task %"PRId64" (size: %"PRId64" bytes) from %s (%s) ...", taskid, retrieved_output_length, w->addrport, w->hostname);
 
 		//First read the bytes we keep.
-		stoptime = time(0) + get_transfer_wait_time(q, w, t, retrieved_output_length);
-		actual = link_read(w->link, t->output, retrieved_output_length, stoptime);
+		stoptime = time(0) + get_transfer_wait_time(q, w, 0, retrieved_output_length);
+		actual = link_read(w->link, *output, retrieved_output_length, stoptime);
 		if(actual != retrieved_output_length) {
 			debug(D_WQ, "Failure: actual received stdout size (%"PRId64" bytes) is different from expected (%"PRId64" bytes).", actual, retrieved_output_length);
-			t->output[actual] = '\0';
+			free(*output);
+			*output = NULL;
 			return WORKER_FAILURE;
 		}
 		debug(D_WQ, "Retrieved %"PRId64" bytes from %s (%s)", actual, w->hostname, w->addrport);
@@ -1822,30 +2751,82 @@ static work_queue_result_code_t get_result(struct work_queue *q, struct work_que
 		//Then read the bytes we need to throw away.
 		if(output_length > retrieved_output_length) {
 			debug(D_WQ, "Dropping the remaining %"PRId64" bytes of the stdout of task %"PRId64" since stdout length is limited to %d bytes.\n", (output_length-MAX_TASK_STDOUT_STORAGE), taskid, MAX_TASK_STDOUT_STORAGE);
-			stoptime = time(0) + get_transfer_wait_time(q, w, t, (output_length-retrieved_output_length));
+			stoptime = time(0) + get_transfer_wait_time(q, w, 0, (output_length-retrieved_output_length));
 			link_soak(w->link, (output_length-retrieved_output_length), stoptime);
 
 			//overwrite the last few bytes of buffer to signal truncated stdout.
 			char *truncate_msg = string_format("\n>>>>>> WORK QUEUE HAS TRUNCATED THE STDOUT AFTER THIS POINT.\n>>>>>> MAXIMUM OF %d BYTES REACHED, %" PRId64 " BYTES TRUNCATED.", MAX_TASK_STDOUT_STORAGE, output_length - retrieved_output_length);
-			strncpy(t->output+MAX_TASK_STDOUT_STORAGE-strlen(truncate_msg), truncate_msg, strlen(truncate_msg));
+			strncpy(*output+MAX_TASK_STDOUT_STORAGE-strlen(truncate_msg), truncate_msg, strlen(truncate_msg));
 			free(truncate_msg);
 		}
 
-		timestamp_t current_time = timestamp_get();
-		if(effective_stoptime && effective_stoptime > current_time) {
-			usleep(effective_stoptime - current_time);
-		}
+		bandwidth_charge(q, output_length);
 	} else {
 		actual = 0;
 	}
 
-	if(t->output)
-		t->output[actual] = 0;
+	(*output)[actual] = 0;
+
+	return SUCCESS;
+}
+
+/*
+Update the task with a result already read from the worker. The task
+takes ownership of output.
+*/
+static void apply_result(struct work_queue *q, struct work_queue_worker *w, const struct work_queue_frame *f, char *output, int truncated)
+{
+	struct work_queue_task *t;
+
+	int task_status, exit_status;
+	uint64_t taskid;
+	timestamp_t execution_time;
+	timestamp_t observed_execution_time;
+
+	task_status   = f->fields[WORK_QUEUE_FRAME_RESULT_STATUS];
+	exit_status   = f->fields[WORK_QUEUE_FRAME_RESULT_EXIT_STATUS];
+	taskid        = f->fields[WORK_QUEUE_FRAME_RESULT_TASKID];
+
+	t = itable_lookup(w->current_tasks, taskid);
+	if(!t) {
+		debug(D_WQ, "Unknown task result from worker %s (%s): no task %" PRId64" assigned to worker.  Ignoring result.", w->hostname, w->addrport, taskid);
+		free(output);
+		return;
+	}
+
+	if(task_status == WORK_QUEUE_RESULT_FORSAKEN) {
+		/* task will be resubmitted, so we do not update any of the execution stats */
+		free(output);
+		reap_task_from_worker(q, w, t, WORK_QUEUE_TASK_READY);
+		return;
+	}
+
+	observed_execution_time = timestamp_get() - t->time_when_commit_end;
+
+	execution_time = f->fields[WORK_QUEUE_FRAME_RESULT_EXECUTION_TIME];
+	t->time_workers_execute_last = observed_execution_time > execution_time ? execution_time : observed_execution_time;
+
+	t->time_workers_execute_all += t->time_workers_execute_last;
+
+	if(task_status == WORK_QUEUE_RESULT_DISK_ALLOC_FULL) {
+		t->disk_allocation_exhausted = 1;
+	}
+	else {
+		t->disk_allocation_exhausted = 0;
+	}
+
+	if(truncated || !output) {
+		update_task_result(t, WORK_QUEUE_RESULT_STDOUT_MISSING);
+	}
+
+	free(t->output);
+	t->output = output;
 
 	t->result        = task_status;
 	t->return_status = exit_status;
 
 	q->stats->time_workers_execute += t->time_workers_execute_last;
+	update_average_execute_time(q, t->time_workers_execute_last);
 
 	w->finished_tasks++;
 
@@ -1859,15 +2840,86 @@ static work_queue_result_code_t get_result(struct work_queue *q, struct work_que
 	}
 
 	change_task_state(q, t, WORK_QUEUE_TASK_WAITING_RETRIEVAL);
-
-	return SUCCESS;
 }
 
-static work_queue_result_code_t get_available_results(struct work_queue *q, struct work_queue_worker *w)
-{
-
-	//max_count == -1, tells the worker to send all available results.
-	send_worker_msg(q, w, "send_results %d\n", -1);
+/*
+Failure to store result is treated as success so we continue to retrieve the
+output files of the task.
+*/
+static work_queue_result_code_t get_result(struct work_queue *q, struct work_queue_worker *w, const struct work_queue_frame *f) {
+
+	if(!q || !w || !f)
+		return WORKER_FAILURE;
+
+	char *output;
+	int truncated;
+
+	if(recv_result_output(q, w, f, &output, &truncated) != SUCCESS)
+		return WORKER_FAILURE;
+
+	apply_result(q, w, f, output, truncated);
+
+	return SUCCESS;
+}
+
+struct pushed_result {
+	struct work_queue_frame frame;
+	char *output;
+	int truncated;
+};
+
+/*
+A result frame may arrive while the master waits for the answer to some
+other request to the worker, e.g. in the middle of sending a task. Its
+output is read right away to keep the link in sync, but the task is only
+updated later by process_pushed_results, so that no task changes state
+under the feet of the caller.
+*/
+static work_queue_result_code_t queue_pushed_result(struct work_queue *q, struct work_queue_worker *w, const struct work_queue_frame *f)
+{
+	struct pushed_result *r = malloc(sizeof(*r));
+
+	r->frame = *f;
+	if(recv_result_output(q, w, f, &r->output, &r->truncated) != SUCCESS) {
+		free(r);
+		return WORKER_FAILURE;
+	}
+
+	list_push_tail(w->pushed_results, r);
+	hash_table_insert(q->workers_with_pushed_results, w->hashkey, w);
+
+	return SUCCESS;
+}
+
+static void process_pushed_results(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct pushed_result *r;
+
+	hash_table_remove(q->workers_with_pushed_results, w->hashkey);
+
+	while((r = list_pop_head(w->pushed_results))) {
+		apply_result(q, w, &r->frame, r->output, r->truncated);
+		free(r);
+	}
+}
+
+static void discard_pushed_results(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct pushed_result *r;
+
+	hash_table_remove(q->workers_with_pushed_results, w->hashkey);
+
+	while((r = list_pop_head(w->pushed_results))) {
+		free(r->output);
+		free(r);
+	}
+}
+
+static work_queue_result_code_t get_available_results(struct work_queue *q, struct work_queue_worker *w)
+{
+
+	//max_count == -1, tells the worker to send all available results.
+	send_worker_msg(q, w, "send_results %d\n", -1);
 	debug(D_WQ, "Reading result(s) from %s (%s)", w->hostname, w->addrport);
 
 	char line[WORK_QUEUE_LINE_MAX];
@@ -1882,7 +2934,12 @@ static work_queue_result_code_t get_available_results(struct work_queue *q, stru
 		}
 
 		if(string_prefix_is(line,"result")) {
-			result = get_result(q, w, line);
+			if(!parse_result(line, &w->frame)) {
+				debug(D_WQ, "Invalid message from worker %s (%s): %s", w->hostname, w->addrport, line);
+				result = WORKER_FAILURE;
+				break;
+			}
+			result = get_result(q, w, &w->frame);
 			if(result != SUCCESS) break;
 			i++;
 		} else if(string_prefix_is(line,"update")) {
@@ -1954,10 +3011,10 @@ static struct jx *blacklisted_to_json( struct work_queue  *q ) {
 
 static struct rmsummary *largest_waiting_declared_resources(struct work_queue *q, const char *category) {
 	struct rmsummary *max_resources_waiting = rmsummary_create(-1);
-	struct work_queue_task *t;
+	struct task_state_entry *e;
 
-	list_first_item(q->ready_list);
-	while((t = list_next_item(q->ready_list))) {
+	for(e = q->task_state_lists[WORK_QUEUE_TASK_READY].head; e; e = e->next) {
+		struct work_queue_task *t = e->task;
 
 		if(!category || (t->category && !strcmp(t->category, category))) {
 			rmsummary_merge_max(max_resources_waiting, t->resources_requested);
@@ -1974,14 +3031,13 @@ static struct rmsummary *largest_waiting_declared_resources(struct work_queue *q
 
 static struct rmsummary  *total_resources_needed(struct work_queue *q) {
 
-	struct work_queue_task *t;
+	struct task_state_entry *e;
 
 	struct rmsummary *total = rmsummary_create(0);
 
 	/* for waiting tasks, we use what they would request if dispatched right now. */
-	list_first_item(q->ready_list);
-	while((t = list_next_item(q->ready_list))) {
-		const struct rmsummary *s = task_min_resources(q, t);
+	for(e = q->task_state_lists[WORK_QUEUE_TASK_READY].head; e; e = e->next) {
+		const struct rmsummary *s = task_min_resources(q, e->task);
 		rmsummary_add(total, s);
 	}
 
@@ -2006,10 +3062,10 @@ static struct rmsummary  *total_resources_needed(struct work_queue *q) {
 
 static struct rmsummary *largest_waiting_measured_resources(struct work_queue *q, const char *category) {
 	struct rmsummary *max_resources_waiting = rmsummary_create(-1);
-	struct work_queue_task *t;
+	struct task_state_entry *e;
 
-	list_first_item(q->ready_list);
-	while((t = list_next_item(q->ready_list))) {
+	for(e = q->task_state_lists[WORK_QUEUE_TASK_READY].head; e; e = e->next) {
+		struct work_queue_task *t = e->task;
 
 		if(!category || (t->category && !strcmp(t->category, category))) {
 			const struct rmsummary *r = task_min_resources(q, t);
@@ -2205,6 +3261,9 @@ static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplin
 	jx_insert_integer(j,"tasks_failed",info.tasks_failed);
 	jx_insert_integer(j,"tasks_cancelled",info.tasks_cancelled);
 	jx_insert_integer(j,"tasks_exhausted_attempts",info.tasks_exhausted_attempts);
+	jx_insert_integer(j,"tasks_speculating",info.tasks_speculating);
+	jx_insert_integer(j,"tasks_speculated",info.tasks_speculated);
+	jx_insert_integer(j,"tasks_speculated_won",info.tasks_speculated_won);
 
 	// tasks_complete is deprecated, but the old work_queue_status expects it.
 	jx_insert_integer(j,"tasks_complete",info.tasks_done);
@@ -2287,6 +3346,7 @@ static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplin
 	jx_insert_integer(j,"tasks_total_cores",total->cores);
 	jx_insert_integer(j,"tasks_total_memory",total->memory);
 	jx_insert_integer(j,"tasks_total_disk",total->disk);
+	rmsummary_delete(total);
 
 	return j;
 }
@@ -2526,65 +3586,17 @@ static work_queue_result_code_t handle_worker(struct work_queue *q, struct link
 		return WORKER_FAILURE;
 	}
 
-	return SUCCESS;
-}
-
-static int build_poll_table(struct work_queue *q, struct link *master)
-{
-	int n = 0;
-	char *key;
-	struct work_queue_worker *w;
-
-	// Allocate a small table, if it hasn't been done yet.
-	if(!q->poll_table) {
-		q->poll_table = malloc(sizeof(*q->poll_table) * q->poll_table_size);
-		if(!q->poll_table) {
-			//if we can't allocate a poll table, we can't do anything else.
-			fatal("allocating memory for poll table failed.");
-		}
-	}
-
-	// The first item in the poll table is the master link, which accepts new connections.
-	q->poll_table[0].link = q->master_link;
-	q->poll_table[0].events = LINK_READ;
-	q->poll_table[0].revents = 0;
-	n = 1;
-
-	if(master) {
-		/* foreman uplink */
-		q->poll_table[1].link = master;
-		q->poll_table[1].events = LINK_READ;
-		q->poll_table[1].revents = 0;
-		n++;
+	if(list_size(w->pushed_results) > 0) {
+		process_pushed_results(q, w);
 	}
 
-	// For every worker in the hash table, add an item to the poll table
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		// If poll table is not large enough, reallocate it
-		if(n >= q->poll_table_size) {
-			q->poll_table_size *= 2;
-			q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
-			if(q->poll_table == NULL) {
-				//if we can't allocate a poll table, we can't do anything else.
-				fatal("reallocating memory for poll table failed.");
-			}
-		}
-
-		q->poll_table[n].link = w->link;
-		q->poll_table[n].events = LINK_READ;
-		q->poll_table[n].revents = 0;
-		n++;
-	}
-
-	return n;
+	return SUCCESS;
 }
 
 static int send_file( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *localname, const char *remotename, off_t offset, int64_t length, int64_t *total_bytes, int flags)
 {
 	struct stat local_info;
 	time_t stoptime;
-	timestamp_t effective_stoptime = 0;
 	int64_t actual = 0;
 
 	if(stat(localname, &local_info) < 0) {
@@ -2620,32 +3632,58 @@ static int send_file( struct work_queue *q, struct work_queue_worker *w, struct
 		return APP_FAILURE;
 	}
 
-	if(q->bandwidth) {
-		effective_stoptime = (length/q->bandwidth)*1000000 + timestamp_get();
+	// Send the file in the background. The wait loop writes it as the
+	// worker link becomes writable. The limits of asynchronous transfers are
+	// kept by dispatching tasks only to workers with room for more files (see
+	// check_hand_against_task and send_tasks), so a task goes over them only
+	// with its own files.
+	if(async_transfers_enabled(q)) {
+		send_file_in_background(q, w, t, fd, remotename, length, local_info.st_mode, flags);
+
+		/* the bytes are counted as they are written, see account_pending_send. */
+		return SUCCESS;
+	}
+
+	if(flush_pending_sends(q, w) < 0) {
+		close(fd);
+		return WORKER_FAILURE;
 	}
 
 	stoptime = time(0) + get_transfer_wait_time(q, w, t, length);
-	send_worker_msg(q,w, "put %s %"PRId64" 0%o %d\n",remotename, length, local_info.st_mode, flags);
-	actual = link_stream_from_fd(w->link, fd, length, stoptime);
+	int compress = compress_transfers_to(q, w);
+
+	send_worker_msg(q,w, "%s %s %"PRId64" 0%o %d\n", compress ? "zput" : "put", remotename, length, local_info.st_mode, flags);
+
+	struct work_queue_compress z;
+	work_queue_compress_init(&z);
+
+	if(compress) {
+		actual = work_queue_compress_send(&z, w->link, fd, length, stoptime);
+	} else {
+		actual = link_stream_from_fd(w->link, fd, length, stoptime);
+	}
 	close(fd);
 
+	if(actual > 0)
+		bandwidth_charge(q, compress ? z.wire_bytes : actual);
+
+	if(compress && z.plain_bytes > 0) {
+		debug(D_WQ, "%s (%s) was sent %s compressed to %.1f%%", w->hostname, w->addrport, localname, 100.0 * z.wire_bytes / z.plain_bytes);
+	}
+
 	*total_bytes += actual;
 
 	if(actual != length)
 		return WORKER_FAILURE;
 
-	timestamp_t current_time = timestamp_get();
-	if(effective_stoptime && effective_stoptime > current_time) {
-		usleep(effective_stoptime - current_time);
-	}
-
 	return SUCCESS;
 }
 
 /*
-Send a directory and all of its contentss.
+Send a directory and all of its contents one file at a time, to workers that
+do not take directory streams.
 */
-static work_queue_result_code_t send_directory( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *dirname, const char *remotedirname, int64_t * total_bytes, int flags )
+static work_queue_result_code_t send_directory_by_files( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *dirname, const char *remotedirname, int64_t * total_bytes, int flags )
 {
 	DIR *dir = opendir(dirname);
 	if(!dir) {
@@ -2667,7 +3705,7 @@ static work_queue_result_code_t send_directory( struct work_queue *q, struct wor
 		struct stat local_info;
 		if(stat(localpath, &local_info)>=0) {
 			if(S_ISDIR(local_info.st_mode))  {
-				result = send_directory( q, w, t, localpath, remotepath, total_bytes, flags );
+				result = send_directory_by_files( q, w, t, localpath, remotepath, total_bytes, flags );
 			} else {
 				result = send_file( q, w, t, localpath, remotepath, 0, 0, total_bytes, flags );
 			}
@@ -2686,6 +3724,50 @@ static work_queue_result_code_t send_directory( struct work_queue *q, struct wor
 	return result;
 }
 
+/*
+Send a directory and all of its contents as a single stream, which the
+worker unpacks as it arrives. See work_queue_stream.h for its format.
+Workers that did not offer putdir get the files one at a time.
+*/
+static work_queue_result_code_t send_directory( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *dirname, const char *remotedirname, int64_t * total_bytes, int flags )
+{
+	// A stream is written to the link right away, thus behind files queued
+	// for the worker, the files of the directory are queued one at a time.
+	if(!w->putdir || list_size(w->pending_sends) > 0)
+		return send_directory_by_files(q, w, t, dirname, remotedirname, total_bytes, flags);
+
+	if(flush_worker_bundle(q, w) < 0)
+		return WORKER_FAILURE;
+
+	struct work_queue_stream s;
+	work_queue_stream_init(&s, w->link, compress_transfers_to(q, w), get_transfer_wait_time(q, w, t, WORK_QUEUE_STREAM_BUFFER));
+
+	timestamp_t start_time = timestamp_get();
+
+	send_worker_msg(q,w, "putdir %s\n", remotedirname);
+	int result = work_queue_stream_put(&s, dirname, remotedirname, 1);
+	if(result >= 0)
+		result = work_queue_stream_flush(&s);
+	if(result >= 0 && send_worker_msg(q,w, "end\n") < 0)
+		result = -1;
+
+	timestamp_t elapsed = timestamp_get() - start_time;
+	debug(D_WQ, "%s (%s) was sent %s: %"PRId64" items, %"PRId64" bytes in %.3lfs", w->hostname, w->addrport, dirname, s.items, s.wire_bytes, elapsed / 1000000.0);
+
+	*total_bytes += s.plain_bytes;
+	bandwidth_charge(q, s.wire_bytes);
+
+	work_queue_stream_delete(&s);
+
+	if(result < 0) {
+		return WORKER_FAILURE;
+	} else if(result == 0) {
+		return APP_FAILURE;
+	} else {
+		return SUCCESS;
+	}
+}
+
 /*
 Send a file or directory to a remote worker, if it is not already cached.
 The local file name should already have been expanded by the caller.
@@ -2708,13 +3790,15 @@ static work_queue_result_code_t send_file_or_directory( struct work_queue *q, st
 	/* If it is in the worker, but a new version is available, warn and return.
 	   We do not want to rewrite the file while some other task may be using
 	   it. */
-	if(remote_info && (remote_info->st_mtime != local_info.st_mtime || remote_info->st_size != local_info.st_size)) {
+	if(remote_info && !is_content_cached_name(tf->cached_name) && (remote_info->st_mtime != local_info.st_mtime || remote_info->st_size != local_info.st_size)) {
 		debug(D_NOTICE|D_WQ, "File %s changed locally. Task %d will be executed with an older version.", expanded_local_name, t->taskid);
 	}
 	else if(!remote_info) {
-		/* If not on the worker, send it. */
+		/* If not on the worker, send it, or have it fetched from another worker. */
 		if(S_ISDIR(local_info.st_mode)) {
 			result = send_directory(q, w, t, expanded_local_name, tf->cached_name, total_bytes, tf->flags);
+		} else if(send_file_from_peer(q, w, tf, expanded_local_name, &local_info)) {
+			result = SUCCESS;
 		} else {
 			result = send_file(q, w, t, expanded_local_name, tf->cached_name, tf->offset, tf->piece_length, total_bytes, tf->flags);
 		}
@@ -2723,7 +3807,7 @@ static work_queue_result_code_t send_file_or_directory( struct work_queue *q, st
 			remote_info = malloc(sizeof(*remote_info));
 			if(remote_info) {
 				memcpy(remote_info, &local_info, sizeof(local_info));
-				hash_table_insert(w->current_files, tf->cached_name, remote_info);
+				worker_file_insert(q, w, tf->cached_name, remote_info);
 			} else {
 				debug(D_NOTICE, "Cannot allocate memory for cache entry for input file %s at %s (%s)", expanded_local_name, w->hostname, w->addrport);
 			}
@@ -2822,7 +3906,7 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 		debug(D_WQ, "%s (%s) needs literal as %s", w->hostname, w->addrport, f->remote_name);
 		time_t stoptime = time(0) + get_transfer_wait_time(q, w, t, f->length);
 		send_worker_msg(q,w, "put %s %d %o %d\n",f->cached_name, f->length, 0777, f->flags);
-		actual = link_putlstring(w->link, f->payload, f->length, stoptime);
+		actual = send_worker_data(q, w, f->payload, f->length, stoptime);
 		if(actual!=f->length) {
 			result = WORKER_FAILURE;
 		}
@@ -2837,7 +3921,7 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 	case WORK_QUEUE_URL:
 		debug(D_WQ, "%s (%s) needs %s from the url, %s %d", w->hostname, w->addrport, f->cached_name, f->payload, f->length);
 		send_worker_msg(q,w, "url %s %d 0%o %d\n",f->cached_name, f->length, 0777, f->flags);
-		link_putlstring(w->link, f->payload, f->length, time(0) + q->short_timeout);
+		send_worker_data(q, w, f->payload, f->length, time(0) + q->short_timeout);
 		break;
 
 	case WORK_QUEUE_DIRECTORY:
@@ -2933,6 +4017,11 @@ static work_queue_result_code_t send_input_files( struct work_queue *q, struct w
 					return APP_FAILURE;
 				}
 				free(expanded_payload);
+
+				if(q->content_addressed_cache && !update_content_cached_name(q, f, &s)) {
+					update_task_result(t, WORK_QUEUE_RESULT_INPUT_MISSING);
+					return APP_FAILURE;
+				}
 			}
 		}
 	}
@@ -2979,8 +4068,10 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 	 * about resources. */
 	struct rmsummary *limits = task_worker_box_size(q, w, t);
 
+	/* invocations of a library are not wrapped, as their command line is
+	 * given to the library as it is. */
 	char *command_line;
-	if(q->monitor_mode) {
+	if(q->monitor_mode && !t->library) {
 		command_line = work_queue_monitor_wrap(q, w, t, limits);
 	} else {
 		command_line = xxstrdup(t->command_line);
@@ -2993,30 +4084,60 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		return result;
 	}
 
-	send_worker_msg(q,w, "task %lld\n",  (long long) t->taskid);
-
 	long long cmd_len = strlen(command_line);
-	send_worker_msg(q,w, "cmd %lld\n", (long long) cmd_len);
-	link_putlstring(w->link, command_line, cmd_len, /* stoptime */ time(0) + (w->foreman ? q->long_timeout : q->short_timeout));
-	debug(D_WQ, "%s\n", command_line);
-	free(command_line);
 
-	send_worker_msg(q,w, "category %s\n", t->category);
+	/* the description of the task is held in the bundle of the worker,
+	 * which send_tasks writes once it is full, or at the end of the pass. */
+	w->bundling = 1;
+
+	if(w->frames) {
+		/* the identity, command length and limits of the task are sent in a
+		 * single frame, and the rest of the task as text lines. */
+		struct work_queue_frame f;
+		work_queue_frame_init(&f, WORK_QUEUE_FRAME_TASK);
+		f.fields[WORK_QUEUE_FRAME_TASK_TASKID]         = t->taskid;
+		f.fields[WORK_QUEUE_FRAME_TASK_COMMAND_LENGTH] = cmd_len;
+		f.fields[WORK_QUEUE_FRAME_TASK_CORES]          = limits->cores;
+		f.fields[WORK_QUEUE_FRAME_TASK_MEMORY]         = limits->memory;
+		f.fields[WORK_QUEUE_FRAME_TASK_DISK]           = limits->disk;
+		f.fields[WORK_QUEUE_FRAME_TASK_GPUS]           = limits->gpus;
+		f.fields[WORK_QUEUE_FRAME_TASK_END_TIME]       = q->monitor_mode == MON_DISABLED ? (int64_t) limits->end : -1;
+		f.fields[WORK_QUEUE_FRAME_TASK_WALL_TIME]      = q->monitor_mode == MON_DISABLED ? (int64_t) limits->wall_time : -1;
+		send_worker_frame(q, w, &f);
+		send_worker_data(q, w, command_line, cmd_len, /* stoptime */ time(0) + (w->foreman ? q->long_timeout : q->short_timeout));
+		debug(D_WQ, "%s\n", command_line);
+		free(command_line);
+
+		send_worker_msg(q,w, "category %s\n", t->category);
+	} else {
+		send_worker_msg(q,w, "task %lld\n",  (long long) t->taskid);
+
+		send_worker_msg(q,w, "cmd %lld\n", (long long) cmd_len);
+		send_worker_data(q, w, command_line, cmd_len, /* stoptime */ time(0) + (w->foreman ? q->long_timeout : q->short_timeout));
+		debug(D_WQ, "%s\n", command_line);
+		free(command_line);
+
+		send_worker_msg(q,w, "category %s\n", t->category);
 
-	send_worker_msg(q,w, "cores %"PRId64"\n",  limits->cores);
-	send_worker_msg(q,w, "memory %"PRId64"\n", limits->memory);
-	send_worker_msg(q,w, "disk %"PRId64"\n",   limits->disk);
-	send_worker_msg(q,w, "gpus %"PRId64"\n",   limits->gpus);
+		send_worker_msg(q,w, "cores %"PRId64"\n",  limits->cores);
+		send_worker_msg(q,w, "memory %"PRId64"\n", limits->memory);
+		send_worker_msg(q,w, "disk %"PRId64"\n",   limits->disk);
+		send_worker_msg(q,w, "gpus %"PRId64"\n",   limits->gpus);
 
-	/* Do not specify end, wall_time if running the resource monitor. We let the monitor police these resources. */
-	if(q->monitor_mode == MON_DISABLED) {
-		send_worker_msg(q,w, "end_time %"PRIu64"\n",  limits->end);
-		send_worker_msg(q,w, "wall_time %"PRIu64"\n", limits->wall_time);
+		/* Do not specify end, wall_time if running the resource monitor. We let the monitor police these resources. */
+		if(q->monitor_mode == MON_DISABLED) {
+			send_worker_msg(q,w, "end_time %"PRIu64"\n",  limits->end);
+			send_worker_msg(q,w, "wall_time %"PRIu64"\n", limits->wall_time);
+		}
 	}
 
 	itable_insert(w->current_tasks_boxes, t->taskid, limits);
 	rmsummary_merge_override(t->resources_allocated, limits);
 
+	if(t->library) {
+		send_worker_msg(q, w, "library %zu\n%s\n", strlen(t->library), t->library);
+	}
+
 	/* Note that even when environment variables after resources, values for
 	 * CORES, MEMORY, etc. will be set at the worker to the values of
 	 * specify_*, if used. */
@@ -3055,6 +4176,8 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 	// message we sent to the worker (other messages may have failed above).
 	int result_msg = send_worker_msg(q,w, "end\n");
 
+	w->bundling = 0;
+
 	if(result_msg > -1)
 	{
 		debug(D_WQ, "%s (%s) busy on '%s'", w->hostname, w->addrport, t->command_line);
@@ -3152,6 +4275,8 @@ static void compute_capacity(const struct work_queue *q, struct work_queue_stats
 	s->capacity_cores  = DIV_INT_ROUND_UP(capacity.resources->cores  * ratio, count);
 	s->capacity_memory = DIV_INT_ROUND_UP(capacity.resources->memory * ratio, count);
 	s->capacity_disk   = DIV_INT_ROUND_UP(capacity.resources->disk   * ratio, count);
+
+	rmsummary_delete(capacity.resources);
 }
 
 static int check_hand_against_task(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t) {
@@ -3164,6 +4289,11 @@ static int check_hand_against_task(struct work_queue *q, struct work_queue_worke
 		return 0;
 	}
 
+	/* worker still has its queue of files sent in the background full. */
+	if(async_transfers_enabled(q) && w->pending_send_files >= q->max_async_transfers_per_worker) {
+		return 0;
+	}
+
 	if(!w->foreman) {
 		struct blacklist_host_info *info = hash_table_lookup(q->worker_blacklist, w->hostname);
 		if (info && info->blacklisted) {
@@ -3196,67 +4326,242 @@ static int check_hand_against_task(struct work_queue *q, struct work_queue_worke
 	return ok;
 }
 
-static struct work_queue_worker *find_worker_by_files(struct work_queue *q, struct work_queue_task *t)
+/*
+Workers are indexed by the resources they have available, so that selecting a
+worker for a task only considers the workers that could possibly fit it,
+rather than every connected worker. The key of a bucket packs the free cores
+and gpus, and the power of two classes of the free memory and disk, so that
+every dimension checked by check_hand_against_task prunes whole buckets. The
+index is refreshed whenever the resources in use at a worker are recounted.
+*/
+
+#define WORKER_INDEX_CORES_SHIFT  40
+#define WORKER_INDEX_GPUS_SHIFT   32
+#define WORKER_INDEX_MEMORY_SHIFT  8
+#define WORKER_INDEX_DISK_SHIFT    0
+
+#define WORKER_INDEX_CORES_MAX 0xFFFF
+#define WORKER_INDEX_GPUS_MAX  0xFF
+
+/* Number of bits of value, so that class k holds the values in [2^(k-1), 2^k). */
+static uint64_t worker_index_class(int64_t value)
+{
+	uint64_t class = 0;
+	while(value > 0) {
+		class++;
+		value >>= 1;
+	}
+	return class;
+}
+
+/* Largest value a bucket may hold for a dimension, or -1 if unbounded. */
+static int64_t worker_index_exact_max(uint64_t value, uint64_t limit)
+{
+	return value < limit ? (int64_t) value : -1;
+}
+
+static int64_t worker_index_class_max(uint64_t class)
+{
+	return class < 63 ? (int64_t) ((((uint64_t) 1) << class) - 1) : -1;
+}
+
+static int64_t worker_index_key(struct work_queue *q, struct work_queue_worker *w)
+{
+	int64_t cores  = overcommitted_resource_total(q, w->resources->cores.total, 1)  - w->resources->cores.inuse;
+	int64_t memory = overcommitted_resource_total(q, w->resources->memory.total, 0) - w->resources->memory.inuse;
+	int64_t disk   = w->resources->disk.total - w->resources->disk.inuse; /* No overcommit disk */
+	int64_t gpus   = overcommitted_resource_total(q, w->resources->gpus.total, 0)   - w->resources->gpus.inuse;
+
+	uint64_t key = 0;
+	key |= ((uint64_t) MIN(MAX(cores, 0), WORKER_INDEX_CORES_MAX)) << WORKER_INDEX_CORES_SHIFT;
+	key |= ((uint64_t) MIN(MAX(gpus, 0),  WORKER_INDEX_GPUS_MAX))  << WORKER_INDEX_GPUS_SHIFT;
+	key |= worker_index_class(memory) << WORKER_INDEX_MEMORY_SHIFT;
+	key |= worker_index_class(disk)   << WORKER_INDEX_DISK_SHIFT;
+
+	return key;
+}
+
+/* Whether some worker of the bucket may have the resources needed. */
+static int worker_index_bucket_fits(uint64_t key, const struct rmsummary *needed)
+{
+	int64_t cores  = worker_index_exact_max((key >> WORKER_INDEX_CORES_SHIFT) & WORKER_INDEX_CORES_MAX, WORKER_INDEX_CORES_MAX);
+	int64_t gpus   = worker_index_exact_max((key >> WORKER_INDEX_GPUS_SHIFT)  & WORKER_INDEX_GPUS_MAX,  WORKER_INDEX_GPUS_MAX);
+	int64_t memory = worker_index_class_max((key >> WORKER_INDEX_MEMORY_SHIFT) & 0xFF);
+	int64_t disk   = worker_index_class_max((key >> WORKER_INDEX_DISK_SHIFT)   & 0xFF);
+
+	if(cores  > -1 && needed->cores  > cores)  return 0;
+	if(gpus   > -1 && needed->gpus   > gpus)   return 0;
+	if(memory > -1 && needed->memory > memory) return 0;
+	if(disk   > -1 && needed->disk   > disk)   return 0;
+
+	return 1;
+}
+
+static void worker_index_remove(struct work_queue *q, struct work_queue_worker *w)
+{
+	if(w->free_resources_index < 0)
+		return;
+
+	struct set *bucket = itable_lookup(q->workers_by_free_resources, w->free_resources_index);
+	if(bucket) {
+		set_remove(bucket, w);
+		if(set_size(bucket) < 1) {
+			itable_remove(q->workers_by_free_resources, w->free_resources_index);
+			set_delete(bucket);
+		}
+	}
+
+	w->free_resources_index = -1;
+}
+
+static void worker_index_update(struct work_queue *q, struct work_queue_worker *w)
+{
+	/* workers that cannot run tasks are not indexed. */
+	if(w->resources->tag < 0 || w->resources->workers.total < 1) {
+		worker_index_remove(q, w);
+		return;
+	}
+
+	int64_t key = worker_index_key(q, w);
+	if(key == w->free_resources_index)
+		return;
+
+	worker_index_remove(q, w);
+
+	struct set *bucket = itable_lookup(q->workers_by_free_resources, key);
+	if(!bucket) {
+		bucket = set_create(0);
+		itable_insert(q->workers_by_free_resources, key, bucket);
+	}
+
+	set_insert(bucket, w);
+	w->free_resources_index = key;
+}
+
+static void worker_index_rebuild(struct work_queue *q)
 {
 	char *key;
 	struct work_queue_worker *w;
+
+	hash_table_firstkey(q->worker_table);
+	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+		worker_index_update(q, w);
+	}
+}
+
+/* Visit the workers that have enough resources available for the task,
+ * other than exclude. If candidates is NULL, return the first one found.
+ * Otherwise append all of them to candidates, and return the first one. */
+static struct work_queue_worker *worker_index_search(struct work_queue *q, struct work_queue_task *t, struct list *candidates, struct work_queue_worker *exclude)
+{
+	/* lower bound of the resources the task would take from any worker (see
+	 * task_worker_box_size). */
+	const struct rmsummary *min = task_min_resources(q, t);
+	const struct rmsummary *max = task_max_resources(q, t);
+
+	struct rmsummary needed;
+	needed.cores  = max->cores  > -1 ? max->cores  : MAX(min->cores,  0);
+	needed.memory = max->memory > -1 ? max->memory : MAX(min->memory, 0);
+	needed.disk   = max->disk   > -1 ? max->disk   : MAX(min->disk,   0);
+	needed.gpus   = max->gpus   > -1 ? max->gpus   : MAX(min->gpus,   0);
+
+	uint64_t key;
+	struct set *bucket;
+
+	itable_firstkey(q->workers_by_free_resources);
+	while(itable_nextkey(q->workers_by_free_resources, &key, (void **) &bucket)) {
+		if(!worker_index_bucket_fits(key, &needed))
+			continue;
+
+		struct work_queue_worker *w;
+		set_first_element(bucket);
+		while((w = set_next_element(bucket))) {
+			if(w != exclude && check_hand_against_task(q, w, t)) {
+				if(!candidates)
+					return w;
+				list_push_tail(candidates, w);
+			}
+		}
+	}
+
+	return candidates ? list_peek_head(candidates) : NULL;
+}
+
+/* Returns the list of workers that have enough resources available for the
+ * task. The caller should delete the list. */
+static struct list *find_worker_candidates(struct work_queue *q, struct work_queue_task *t)
+{
+	struct list *candidates = list_create();
+	worker_index_search(q, t, candidates, NULL);
+
+	return candidates;
+}
+
+static struct work_queue_worker *find_worker_by_fcfs(struct work_queue *q, struct work_queue_task *t);
+
+static struct work_queue_worker *find_worker_by_files(struct work_queue *q, struct work_queue_task *t)
+{
+	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = 0;
 	int64_t most_task_cached_bytes = 0;
-	int64_t task_cached_bytes;
+	int64_t *task_cached_bytes;
 	struct stat *remote_info;
 	struct work_queue_file *tf;
+	struct itable *holders;
+	uint64_t wkey;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if( check_hand_against_task(q, w, t) ) {
-			task_cached_bytes = 0;
-			list_first_item(t->input_files);
-			while((tf = list_next_item(t->input_files))) {
-				if((tf->type == WORK_QUEUE_FILE || tf->type == WORK_QUEUE_FILE_PIECE) && (tf->flags & WORK_QUEUE_CACHE)) {
-					remote_info = hash_table_lookup(w->current_files, tf->cached_name);
-					if(remote_info)
-						task_cached_bytes += remote_info->st_size;
+	/* cached bytes of the task at each worker holding at least one of its inputs. */
+	struct itable *cached_bytes = itable_create(0);
+
+	list_first_item(t->input_files);
+	while((tf = list_next_item(t->input_files))) {
+		if((tf->type == WORK_QUEUE_FILE || tf->type == WORK_QUEUE_FILE_PIECE) && (tf->flags & WORK_QUEUE_CACHE)) {
+			holders = hash_table_lookup(q->file_holders, tf->cached_name);
+			if(!holders)
+				continue;
+
+			itable_firstkey(holders);
+			while(itable_nextkey(holders, &wkey, (void **) &remote_info)) {
+				task_cached_bytes = itable_lookup(cached_bytes, wkey);
+				if(!task_cached_bytes) {
+					task_cached_bytes = calloc(1, sizeof(*task_cached_bytes));
+					itable_insert(cached_bytes, wkey, task_cached_bytes);
 				}
+				*task_cached_bytes += remote_info->st_size;
 			}
+		}
+	}
 
-			if(!best_worker || task_cached_bytes > most_task_cached_bytes) {
-				best_worker = w;
-				most_task_cached_bytes = task_cached_bytes;
-			}
+	itable_firstkey(cached_bytes);
+	while(itable_nextkey(cached_bytes, &wkey, (void **) &task_cached_bytes)) {
+		w = (struct work_queue_worker *) (uintptr_t) wkey;
+		if((!best_worker || *task_cached_bytes > most_task_cached_bytes) && check_hand_against_task(q, w, t)) {
+			best_worker = w;
+			most_task_cached_bytes = *task_cached_bytes;
 		}
+		free(task_cached_bytes);
 	}
 
+	itable_delete(cached_bytes);
+
+	/* no worker that fits the task has any of its files cached. */
+	if(!best_worker)
+		best_worker = find_worker_by_fcfs(q, t);
+
 	return best_worker;
 }
 
 static struct work_queue_worker *find_worker_by_fcfs(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
-	struct work_queue_worker *w;
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
-		if( check_hand_against_task(q, w, t) ) {
-			return w;
-		}
-	}
-	return NULL;
+	return worker_index_search(q, t, NULL, NULL);
 }
 
 static struct work_queue_worker *find_worker_by_random(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w = NULL;
 	int random_worker;
-	struct list *valid_workers = list_create();
-
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
-		if(check_hand_against_task(q, w, t)) {
-			list_push_tail(valid_workers, w);
-		}
-	}
+	struct list *valid_workers = find_worker_candidates(q, t);
 
-	w = NULL;
 	if(list_size(valid_workers) > 0) {
 		random_worker = (rand() % list_size(valid_workers)) + 1;
 
@@ -3307,7 +4612,6 @@ static int compare_worst_fit(struct work_queue_resources *a, struct work_queue_r
 
 static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = NULL;
 
@@ -3317,52 +4621,55 @@ static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q,
 	memset(&bres, 0, sizeof(struct work_queue_resources));
 	memset(&wres, 0, sizeof(struct work_queue_resources));
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if( check_hand_against_task(q, w, t) ) {
+	struct list *candidates = find_worker_candidates(q, t);
 
-			//Use total field on bres, wres to indicate free resources.
-			wres.cores.total   = w->resources->cores.total   - w->resources->cores.inuse;
-			wres.memory.total  = w->resources->memory.total  - w->resources->memory.inuse;
-			wres.disk.total    = w->resources->disk.total    - w->resources->disk.inuse;
-			wres.gpus.total    = w->resources->gpus.total    - w->resources->gpus.inuse;
+	list_first_item(candidates);
+	while((w = list_next_item(candidates))) {
+		//Use total field on bres, wres to indicate free resources.
+		wres.cores.total   = w->resources->cores.total   - w->resources->cores.inuse;
+		wres.memory.total  = w->resources->memory.total  - w->resources->memory.inuse;
+		wres.disk.total    = w->resources->disk.total    - w->resources->disk.inuse;
+		wres.gpus.total    = w->resources->gpus.total    - w->resources->gpus.inuse;
 
-			if(!best_worker || compare_worst_fit(&bres, &wres))
-			{
-				best_worker = w;
-				memcpy(&bres, &wres, sizeof(struct work_queue_resources));
-			}
+		if(!best_worker || compare_worst_fit(&bres, &wres))
+		{
+			best_worker = w;
+			memcpy(&bres, &wres, sizeof(struct work_queue_resources));
 		}
 	}
 
+	list_delete(candidates);
+
 	return best_worker;
 }
 
 static struct work_queue_worker *find_worker_by_time(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = 0;
 	double best_time = HUGE_VAL;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if(check_hand_against_task(q, w, t)) {
-			if(w->total_tasks_complete > 0) {
-				double t = (w->total_task_time + w->total_transfer_time) / w->total_tasks_complete;
-				if(!best_worker || t < best_time) {
-					best_worker = w;
-					best_time = t;
-				}
+	struct list *candidates = find_worker_candidates(q, t);
+
+	list_first_item(candidates);
+	while((w = list_next_item(candidates))) {
+		if(w->total_tasks_complete > 0) {
+			double t = (w->total_task_time + w->total_transfer_time) / w->total_tasks_complete;
+			if(!best_worker || t < best_time) {
+				best_worker = w;
+				best_time = t;
 			}
 		}
 	}
 
-	if(best_worker) {
-		return best_worker;
-	} else {
-		return find_worker_by_fcfs(q, t);
+	/* if no worker has completed a task yet, fall back to first come first serve. */
+	if(!best_worker) {
+		best_worker = list_peek_head(candidates);
 	}
+
+	list_delete(candidates);
+
+	return best_worker;
 }
 
 // use task-specific algorithm if set, otherwise default to the queue's setting.
@@ -3401,18 +4708,18 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 
 	update_max_worker(q, w);
 
-	if(w->resources->workers.total < 1)
+	if(w->resources->workers.total > 0)
 	{
-		return;
+		itable_firstkey(w->current_tasks_boxes);
+		while(itable_nextkey(w->current_tasks_boxes, &taskid, (void **)& box)) {
+			w->resources->cores.inuse     += box->cores;
+			w->resources->memory.inuse    += box->memory;
+			w->resources->disk.inuse      += box->disk;
+			w->resources->gpus.inuse      += box->gpus;
+		}
 	}
 
-	itable_firstkey(w->current_tasks_boxes);
-	while(itable_nextkey(w->current_tasks_boxes, &taskid, (void **)& box)) {
-		w->resources->cores.inuse     += box->cores;
-		w->resources->memory.inuse    += box->memory;
-		w->resources->disk.inuse      += box->disk;
-		w->resources->gpus.inuse      += box->gpus;
-	}
+	worker_index_update(q, w);
 }
 
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w) {
@@ -3508,47 +4815,129 @@ static void reap_task_from_worker(struct work_queue *q, struct work_queue_worker
 	count_worker_resources(q, w);
 }
 
-static int send_one_task( struct work_queue *q )
+/*
+Tasks much shorter than a dispatch are sent to a worker in bundles, so that
+the cost of the dispatch is shared among them. A bundle holds about
+TASK_BUNDLE_TIME of work, as measured from the tasks that already ran, and
+at most q->max_task_bundle tasks.
+*/
+
+#define TASK_BUNDLE_TIME 1000000
+
+static void update_average_execute_time(struct work_queue *q, timestamp_t execute_time)
+{
+	if(q->average_execute_time < 1) {
+		q->average_execute_time = MAX(execute_time, 1);
+	} else {
+		q->average_execute_time = MAX((7*q->average_execute_time + execute_time) / 8, 1);
+	}
+}
+
+static int task_bundle_size(struct work_queue *q)
+{
+	// Until some task runs, send tasks one by one as placed by the scheduler.
+	if(q->average_execute_time < 1)
+		return 1;
+
+	int64_t size = TASK_BUNDLE_TIME / q->average_execute_time;
+
+	return MAX(1, MIN(size, q->max_task_bundle));
+}
+
+/* Write the tasks bundled for w in one go. */
+static void send_worker_bundle( struct work_queue *q, struct work_queue_worker *w )
+{
+	debug(D_WQ, "Sending %d task(s) to %s (%s) in one dispatch", w->bundle_tasks, w->hostname, w->addrport);
+	w->bundle_tasks = 0;
+	if(flush_worker_bundle(q, w) < 0) {
+		debug(D_WQ, "Failed to send tasks to worker %s (%s).", w->hostname, w->addrport);
+		handle_worker_failure(q, w);
+	}
+}
+
+/*
+Dispatch to up to q->dispatch_batch_size workers in a single pass over the
+ready list, rather than restarting the scan (and the rest of the wait loop)
+after every task. Each task goes to the worker chosen by the scheduling
+algorithm, and joins the bundle of tasks of that worker. The messages of a
+bundle are written to the worker in one go, once it holds the tasks of a
+bundle, or at the end of the pass. Returns the number of tasks dispatched.
+*/
+static int send_tasks( struct work_queue *q )
 {
 	struct work_queue_task *t;
 	struct work_queue_worker *w;
+	struct hash_table *bundled_workers = hash_table_create(0, 0);
+	char hashkey[WORKER_HASHKEY_MAX];
+	char *key;
+	void *value;
+	int bundle_size = task_bundle_size(q);
+	int sent = 0;
 
 	// Consider each task in the order of priority:
-	list_first_item(q->ready_list);
-	while( (t = list_next_item(q->ready_list))) {
+	priority_queue_first_item(q->ready_queue);
+	while((t = priority_queue_next_item(q->ready_queue))) {
+
+		// Tasks wait while as many files as allowed are sent in the background.
+		if(async_transfers_enabled(q) && q->async_transfers >= q->max_async_transfers)
+			break;
 
-		// Find the best worker for the task at the head of the list
 		w = find_best_worker(q,t);
 
 		// If there is no suitable worker, consider the next task.
 		if(!w) continue;
 
-		// Otherwise, remove it from the ready list and start it:
+		if(!hash_table_lookup(bundled_workers, w->hashkey)) {
+			if(hash_table_size(bundled_workers) >= q->dispatch_batch_size)
+				break;
+			hash_table_insert(bundled_workers, w->hashkey, (void *) 1);
+		}
+
+		// Remove the task from the ready queue and start it. Removing the
+		// task does not end the visit of the queue, but requeueing tasks of
+		// a failed worker does, and then the loop stops.
+		strcpy(hashkey, w->hashkey);
+		w->bundle_tasks++;
+		sent++;
 		commit_task_to_worker(q,w,t);
 
-		return 1;
+		// The worker may have been removed if the task could not be sent.
+		w = hash_table_lookup(q->worker_table, hashkey);
+		if(w && w->bundle_tasks >= bundle_size)
+			send_worker_bundle(q, w);
 	}
 
-	return 0;
+	// Write the rest of the bundles to the workers that are still connected.
+	hash_table_firstkey(bundled_workers);
+	while(hash_table_nextkey(bundled_workers, &key, &value)) {
+		w = hash_table_lookup(q->worker_table, key);
+		if(w && w->bundle_tasks > 0)
+			send_worker_bundle(q, w);
+	}
+	hash_table_delete(bundled_workers);
+
+	return sent;
 }
 
 static int receive_one_task( struct work_queue *q )
 {
 	struct work_queue_task *t;
-
 	struct work_queue_worker *w;
-	uint64_t taskid;
 
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, WORK_QUEUE_TASK_WAITING_RETRIEVAL) ) {
-			w = itable_lookup(q->worker_task_map, taskid);
-			fetch_output_from_worker(q, w, taskid);
-			return 1;
-		}
-	}
+	// Results are retrieved once the bandwidth limit is replenished.
+	if(bandwidth_exhausted(q))
+		return 0;
 
-	return 0;
+	// Duplicates of tasks are not in q->tasks, thus look in the list of
+	// tasks waiting for retrieval.
+	t = task_state_any(q, WORK_QUEUE_TASK_WAITING_RETRIEVAL);
+	if(!t)
+		return 0;
+
+	w = itable_lookup(q->worker_task_map, t->taskid);
+	fetch_output_from_worker(q, w, t->taskid);
+
+	return 1;
 }
 
 //Sends keepalives to check if connected workers are responsive, and ask for updates If not, removes those workers.
@@ -3559,6 +4948,12 @@ static void ask_for_workers_updates(struct work_queue *q) {
 
 	hash_table_firstkey(q->worker_table);
 	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+		// a worker receiving a file cannot answer, and its transfer is
+		// already limited by a timeout.
+		if(list_size(w->pending_sends) > 0) {
+			continue;
+		}
+
 		if(q->keepalive_interval > 0) {
 
 			/* we have not received workqueue message from worker yet, so we
@@ -3577,7 +4972,15 @@ static void ask_for_workers_updates(struct work_queue *q) {
 			if(w->last_msg_recv_time > w->last_update_msg_time) {
 				int64_t last_update_elapsed_time = (int64_t)(current_time - w->last_update_msg_time)/1000000;
 				if(last_update_elapsed_time >= q->keepalive_interval) {
-					if(send_worker_msg(q,w, "check\n")<0) {
+					int sent;
+					if(w->frames) {
+						struct work_queue_frame f;
+						work_queue_frame_init(&f, WORK_QUEUE_FRAME_CHECK);
+						sent = send_worker_frame(q, w, &f);
+					} else {
+						sent = send_worker_msg(q,w, "check\n");
+					}
+					if(sent<0) {
 						debug(D_WQ, "Failed to send keepalive check to worker %s (%s).", w->hostname, w->addrport);
 						handle_worker_failure(q, w);
 					} else {
@@ -3642,45 +5045,333 @@ static int abort_slow_workers(struct work_queue *q)
 	itable_firstkey(q->tasks);
 	while(itable_nextkey(q->tasks, &taskid, (void **) &t)) {
 
-		c = work_queue_category_lookup_or_create(q, t->category);
-		/* Fast abort deactivated for this category */
-		if(c->fast_abort == 0)
-			continue;
+		c = work_queue_category_lookup_or_create(q, t->category);
+		/* Fast abort deactivated for this category */
+		if(c->fast_abort == 0)
+			continue;
+
+		timestamp_t runtime = current - t->time_when_commit_start;
+		timestamp_t average_task_time = c->average_task_time;
+
+		/* Not enough samples, skip the task. */
+		if(average_task_time < 1)
+			continue;
+
+		double multiplier;
+		if(c->fast_abort > 0) {
+			multiplier = c->fast_abort;
+		}
+		else if(c_def->fast_abort > 0) {
+			/* This category uses the default fast abort. (< 0 use default, 0 deactivate). */
+			multiplier = c_def->fast_abort;
+		}
+		else {
+			/* Fast abort also deactivated for the defaut category. */
+			continue;
+		}
+
+		if(runtime >= (average_task_time * multiplier)) {
+			w = itable_lookup(q->worker_task_map, t->taskid);
+			if(w && !w->foreman)
+			{
+				debug(D_WQ, "Removing worker %s (%s): takes too long to execute the current task - %.02lf s (average task execution time by other workers is %.02lf s)", w->hostname, w->addrport, runtime / 1000000.0, average_task_time / 1000000.0);
+				work_queue_blacklist_add_with_timeout(q, w->hostname, wq_option_blacklist_slow_workers_timeout);
+				remove_worker(q, w);
+				q->stats->workers_fast_aborted++;
+				removed++;
+			}
+		}
+	}
+
+	return removed;
+}
+
+/*
+Speculative execution: while no task waits for a worker, a task that has run
+longer than a percentile of the recent execution times of its category is
+duplicated on another worker. The first of the two executions to succeed
+gives the result of the task, and the other is canceled. A duplicate is not
+a submitted task: it is never requeued nor returned to the application, and
+it is freed at the next speculation pass once it is done or canceled.
+*/
+
+#define SPECULATION_INTERVAL 1000000
+
+static struct speculation *speculation_lookup_or_create(struct work_queue *q, const char *category)
+{
+	struct speculation *s = hash_table_lookup(q->speculations, category);
+
+	if(!s) {
+		s = calloc(1, sizeof(*s));
+		s->percentile = strcmp(category, "default") ? -1 : 0;
+		hash_table_insert(q->speculations, category, s);
+	}
+
+	return s;
+}
+
+/* Returns the settings that apply to a category, or NULL if speculation is deactivated for it. */
+static struct speculation *speculation_settings(struct work_queue *q, struct speculation *s)
+{
+	if(s->percentile < 0)
+		s = speculation_lookup_or_create(q, "default");
+
+	return s->percentile > 0 ? s : NULL;
+}
+
+static void speculation_add_sample(struct work_queue *q, struct work_queue_task *t)
+{
+	struct speculation *s = speculation_lookup_or_create(q, t->category);
+
+	s->samples[s->samples_next] = t->time_workers_execute_last;
+	s->samples_next = (s->samples_next + 1) % SPECULATION_SAMPLES;
+	s->samples_count = MIN(s->samples_count + 1, SPECULATION_SAMPLES);
+}
+
+static int compare_timestamps(const void *a, const void *b)
+{
+	timestamp_t x = *(const timestamp_t *) a;
+	timestamp_t y = *(const timestamp_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Execution time at the given percentile of the samples of a category, or 0 if there are too few samples. */
+static timestamp_t speculation_threshold(struct speculation *s, double percentile)
+{
+	timestamp_t sorted[SPECULATION_SAMPLES];
+
+	if(s->samples_count < SPECULATION_MIN_SAMPLES)
+		return 0;
+
+	memcpy(sorted, s->samples, s->samples_count * sizeof(timestamp_t));
+	qsort(sorted, s->samples_count, sizeof(timestamp_t), compare_timestamps);
+
+	int index = (int) ceil(percentile * s->samples_count / 100.0) - 1;
+	index = MAX(0, MIN(index, s->samples_count - 1));
+
+	return MAX(sorted[index], 1);
+}
+
+/* Forgets a duplicate as such, and returns the task it duplicated, or NULL if it was not a duplicate. */
+static struct work_queue_task *speculation_unpair(struct work_queue *q, struct work_queue_task *dup)
+{
+	struct work_queue_task *t = itable_remove(q->speculation_originals, dup->taskid);
+
+	if(t) {
+		itable_remove(q->speculation_duplicates, t->taskid);
+		speculation_lookup_or_create(q, dup->category)->running--;
+	}
+
+	return t;
+}
+
+/* Called by change_task_state before a change of state, returns the state a duplicate takes instead. */
+static work_queue_task_state_t speculation_filter_state(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state)
+{
+	if(itable_lookup(q->speculation_originals, t->taskid)) {
+		if(new_state == WORK_QUEUE_TASK_READY || new_state == WORK_QUEUE_TASK_RETRIEVED)
+			return WORK_QUEUE_TASK_CANCELED;
+	}
+
+	return new_state;
+}
+
+/* Called by change_task_state after a change of state. */
+static void speculation_state_changed(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state)
+{
+	if(new_state == WORK_QUEUE_TASK_DONE || new_state == WORK_QUEUE_TASK_CANCELED) {
+		if(speculation_unpair(q, t)) {
+			list_push_tail(q->speculation_dropped, t);
+			return;
+		}
+	}
+
+	// Once a task has a result, its duplicate is not needed.
+	if(new_state == WORK_QUEUE_TASK_RETRIEVED || new_state == WORK_QUEUE_TASK_DONE || new_state == WORK_QUEUE_TASK_CANCELED) {
+		struct work_queue_task *dup = itable_lookup(q->speculation_duplicates, t->taskid);
+		if(dup) {
+			debug(D_WQ, "Canceling duplicate %d of task %d", dup->taskid, t->taskid);
+			cancel_task_on_worker(q, dup, WORK_QUEUE_TASK_CANCELED);
+		}
+	}
+}
+
+static void finish_duplicate(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *dup)
+{
+	w->finished_tasks--;
+	w->total_tasks_complete++;
+
+	if(dup->result != WORK_QUEUE_RESULT_SUCCESS) {
+		debug(D_WQ, "Duplicate %d failed on %s (%s), its task keeps running", dup->taskid, w->hostname, w->addrport);
+		reap_task_from_worker(q, w, dup, WORK_QUEUE_TASK_CANCELED);
+		return;
+	}
+
+	// Unpair first, so that the task can be stopped without canceling the duplicate.
+	struct work_queue_task *t = speculation_unpair(q, dup);
+	list_push_tail(q->speculation_dropped, dup);
+
+	debug(D_WQ, "Duplicate %d of task %d finished first on %s (%s)", dup->taskid, t->taskid, w->hostname, w->addrport);
+
+	reap_task_from_worker(q, w, dup, WORK_QUEUE_TASK_DONE);
+
+	// The output files of the task were already received from the duplicate.
+	t->result        = dup->result;
+	t->return_status = dup->return_status;
+
+	free(t->output);
+	t->output = dup->output;
+	dup->output = NULL;
+
+	free(t->host);
+	free(t->hostname);
+	t->host     = xxstrdup(dup->host);
+	t->hostname = xxstrdup(dup->hostname);
+
+	t->time_when_commit_start    = dup->time_when_commit_start;
+	t->time_when_commit_end      = dup->time_when_commit_end;
+	t->time_when_retrieval       = dup->time_when_retrieval;
+	t->time_when_done            = dup->time_when_done;
+	t->time_workers_execute_last = dup->time_workers_execute_last;
+	t->time_workers_execute_all += dup->time_workers_execute_last;
+	t->bytes_sent               += dup->bytes_sent;
+	t->bytes_received           += dup->bytes_received;
+
+	cancel_task_on_worker(q, t, WORK_QUEUE_TASK_RETRIEVED);
+
+	if(q->monitor_mode)
+		read_measured_resources(q, t);
+
+	work_queue_accumulate_task(q, t);
+	speculation_add_sample(q, t);
+
+	q->stats->tasks_speculated_won++;
+	work_queue_category_lookup_or_create(q, t->category)->wq_stats->tasks_speculated_won++;
+
+	add_task_report(q, t);
+}
+
+/* Starts a duplicate of t on a worker other than the one running t. Returns 1 if started. */
+static int speculate_task(struct work_queue *q, struct work_queue_task *t)
+{
+	struct speculation *s = speculation_lookup_or_create(q, t->category);
+	struct speculation *settings = speculation_settings(q, s);
+
+	if(!settings || s->running >= settings->max_duplicates)
+		return 0;
+
+	struct work_queue_worker *running_on = itable_lookup(q->worker_task_map, t->taskid);
+
+	struct work_queue_task *dup = work_queue_task_clone(t);
+
+	// Clear what the clone got from the execution of t.
+	free(dup->output);
+	free(dup->host);
+	free(dup->hostname);
+	dup->output   = NULL;
+	dup->host     = NULL;
+	dup->hostname = NULL;
+
+	if(dup->resources_measured) {
+		rmsummary_delete(dup->resources_measured);
+		dup->resources_measured = NULL;
+	}
+
+	struct work_queue_worker *w = worker_index_search(q, dup, NULL, running_on);
+	if(!w) {
+		work_queue_task_delete(dup);
+		return 0;
+	}
+
+	dup->taskid = q->next_taskid;
+	q->next_taskid++;
+
+	itable_insert(q->speculation_duplicates, t->taskid, dup);
+	itable_insert(q->speculation_originals, dup->taskid, t);
+	s->running++;
+
+	q->stats->tasks_speculated++;
+	work_queue_category_lookup_or_create(q, t->category)->wq_stats->tasks_speculated++;
+
+	debug(D_WQ, "Task %d runs longer than %.02lfs, starting duplicate %d on %s (%s)", t->taskid, s->threshold / 1000000.0, dup->taskid, w->hostname, w->addrport);
+
+	// As in send_tasks, the task is written to the worker after it is
+	// committed, unless the worker was removed as the task could not be sent.
+	char *hashkey = xxstrdup(w->hashkey);
+	commit_task_to_worker(q, w, dup);
+
+	w = hash_table_lookup(q->worker_table, hashkey);
+	if(w && flush_worker_bundle(q, w) < 0) {
+		debug(D_WQ, "Failed to send duplicate %d to worker %s (%s).", dup->taskid, w->hostname, w->addrport);
+		handle_worker_failure(q, w);
+	}
+	free(hashkey);
+
+	return 1;
+}
+
+static int speculate_slow_tasks(struct work_queue *q)
+{
+	struct work_queue_task *t;
+
+	while((t = list_pop_head(q->speculation_dropped))) {
+		itable_remove(q->task_state_map, t->taskid);
+		work_queue_task_delete(t);
+	}
+
+	timestamp_t current = timestamp_get();
+	if(current - q->speculation_last_check < SPECULATION_INTERVAL)
+		return 0;
+
+	q->speculation_last_check = current;
+
+	// Duplicates only use the capacity that no waiting task can use.
+	if(task_state_count(q, NULL, WORK_QUEUE_TASK_READY) > 0)
+		return 0;
+
+	struct speculation *s, *settings;
+	char *category;
+	int active = 0;
+
+	hash_table_firstkey(q->speculations);
+	while(hash_table_nextkey(q->speculations, &category, (void **) &s)) {
+		settings = speculation_settings(q, s);
+		s->threshold = settings ? speculation_threshold(s, settings->percentile) : 0;
+		if(s->threshold > 0)
+			active = 1;
+	}
+
+	if(!active)
+		return 0;
+
+	// Choose the tasks first, as starting a duplicate changes the list of running tasks.
+	struct list *slow = list_create();
+	struct task_state_entry *e;
 
-		timestamp_t runtime = current - t->time_when_commit_start;
-		timestamp_t average_task_time = c->average_task_time;
+	for(e = q->task_state_lists[WORK_QUEUE_TASK_RUNNING].head; e; e = e->next) {
+		t = e->task;
 
-		/* Not enough samples, skip the task. */
-		if(average_task_time < 1)
+		if(itable_lookup(q->speculation_originals, t->taskid) || itable_lookup(q->speculation_duplicates, t->taskid))
 			continue;
 
-		double multiplier;
-		if(c->fast_abort > 0) {
-			multiplier = c->fast_abort;
-		}
-		else if(c_def->fast_abort > 0) {
-			/* This category uses the default fast abort. (< 0 use default, 0 deactivate). */
-			multiplier = c_def->fast_abort;
-		}
-		else {
-			/* Fast abort also deactivated for the defaut category. */
+		s = hash_table_lookup(q->speculations, t->category);
+		if(!s || s->threshold < 1)
 			continue;
-		}
 
-		if(runtime >= (average_task_time * multiplier)) {
-			w = itable_lookup(q->worker_task_map, t->taskid);
-			if(w && !w->foreman)
-			{
-				debug(D_WQ, "Removing worker %s (%s): takes too long to execute the current task - %.02lf s (average task execution time by other workers is %.02lf s)", w->hostname, w->addrport, runtime / 1000000.0, average_task_time / 1000000.0);
-				work_queue_blacklist_add_with_timeout(q, w->hostname, wq_option_blacklist_slow_workers_timeout);
-				remove_worker(q, w);
-				q->stats->workers_fast_aborted++;
-				removed++;
-			}
-		}
+		if(current - t->time_when_commit_end > s->threshold)
+			list_push_tail(slow, t);
 	}
 
-	return removed;
+	int started = 0;
+	while((t = list_pop_head(slow))) {
+		// Workers may have been lost while starting other duplicates.
+		if(task_state_is(q, t->taskid, WORK_QUEUE_TASK_RUNNING))
+			started += speculate_task(q, t);
+	}
+	list_delete(slow);
+
+	return started;
 }
 
 static int shut_down_worker(struct work_queue *q, struct work_queue_worker *w)
@@ -3849,24 +5540,25 @@ struct work_queue_task *work_queue_task_clone(const struct work_queue_task *task
   new->env_list     = work_queue_task_env_list_clone(task->env_list);
 
   if(task->resources_requested) {
-	  new->resources_requested = malloc(sizeof(struct rmsummary));
-	  memcpy(new->resources_requested, task->resources_requested, sizeof(sizeof(struct rmsummary)));
+	  new->resources_requested = rmsummary_copy(task->resources_requested);
   }
 
   if(task->resources_measured) {
-	  new->resources_measured = malloc(sizeof(struct rmsummary));
-	  memcpy(new->resources_measured, task->resources_measured, sizeof(sizeof(struct rmsummary)));
+	  new->resources_measured = rmsummary_copy(task->resources_measured);
   }
 
   if(task->resources_allocated) {
-	  new->resources_allocated = malloc(sizeof(struct rmsummary));
-	  memcpy(new->resources_allocated, task->resources_allocated, sizeof(sizeof(struct rmsummary)));
+	  new->resources_allocated = rmsummary_copy(task->resources_allocated);
   }
 
   if(task->monitor_output_directory) {
 	new->monitor_output_directory = xxstrdup(task->monitor_output_directory);
   }
 
+  if(task->library) {
+	new->library = xxstrdup(task->library);
+  }
+
   if(task->output) {
 	new->output = xxstrdup(task->output);
   }
@@ -3889,6 +5581,12 @@ void work_queue_task_specify_command( struct work_queue_task *t, const char *cmd
 	t->command_line = xxstrdup(cmd);
 }
 
+void work_queue_task_specify_library( struct work_queue_task *t, const char *library )
+{
+	if(t->library) free(t->library);
+	t->library = xxstrdup(library);
+}
+
 void work_queue_task_specify_enviroment_variable( struct work_queue_task *t, const char *name, const char *value )
 {
 	if(value) {
@@ -4432,13 +6130,21 @@ void work_queue_invalidate_cached_file(struct work_queue *q, const char *local_n
 }
 
 void work_queue_invalidate_cached_file_internal(struct work_queue *q, const char *filename) {
-	char *key;
-	struct work_queue_worker *w;
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
-		if(!hash_table_lookup(w->current_files, filename))
-			continue;
+	struct itable *holders = hash_table_lookup(q->file_holders, filename);
+	if(!holders)
+		return;
+
+	/* copy the holders, as canceling tasks and deleting the file modify the index. */
+	struct list *workers = list_create();
+	uint64_t wkey;
+	void *remote_info;
+	itable_firstkey(holders);
+	while(itable_nextkey(holders, &wkey, &remote_info)) {
+		list_push_tail(workers, (void *) (uintptr_t) wkey);
+	}
 
+	struct work_queue_worker *w;
+	while((w = list_pop_head(workers))) {
 		if(w->foreman) {
 			send_worker_msg(q, w, "invalidate-file %s\n", filename);
 		}
@@ -4468,8 +6174,90 @@ void work_queue_invalidate_cached_file_internal(struct work_queue *q, const char
 
 		delete_worker_file(q, w, filename, 0, 0);
 	}
+
+	list_delete(workers);
+}
+
+/* Return true if a task of w, running or waiting for retrieval, uses the cached file. */
+static int worker_tasks_use_file(struct work_queue_worker *w, const char *cached_name)
+{
+	struct work_queue_task *t;
+	struct work_queue_file *tf;
+	uint64_t taskid;
+
+	itable_firstkey(w->current_tasks);
+	while(itable_nextkey(w->current_tasks, &taskid, (void **) &t)) {
+		list_first_item(t->input_files);
+		while((tf = list_next_item(t->input_files))) {
+			if(!strcmp(cached_name, tf->cached_name))
+				return 1;
+		}
+
+		list_first_item(t->output_files);
+		while((tf = list_next_item(t->output_files))) {
+			if(!strcmp(cached_name, tf->cached_name))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+void work_queue_remove_cached_file(struct work_queue *q, const char *local_name)
+{
+	struct work_queue_file *f = work_queue_file_create(NULL, local_name, local_name, WORK_QUEUE_FILE, WORK_QUEUE_CACHE);
+	work_queue_remove_cached_file_internal(q, f->cached_name);
+	work_queue_file_delete(f);
+
+	/* the file may also have been sent under the name of its contents. */
+	struct content_hash *ch = hash_table_remove(q->content_hashes, local_name);
+	if(!ch)
+		return;
+
+	int shared = 0;
+	char *key;
+	struct content_hash *other;
+	hash_table_firstkey(q->content_hashes);
+	while(hash_table_nextkey(q->content_hashes, &key, (void **) &other)) {
+		if(!strcmp(ch->cached_name, other->cached_name)) {
+			shared = 1;
+			break;
+		}
+	}
+
+	if(!shared)
+		work_queue_remove_cached_file_internal(q, ch->cached_name);
+
+	free(ch->cached_name);
+	free(ch);
 }
 
+void work_queue_remove_cached_file_internal(struct work_queue *q, const char *filename)
+{
+	struct itable *holders = hash_table_lookup(q->file_holders, filename);
+	if(!holders)
+		return;
+
+	/* copy the holders, as deleting the file modifies the index. */
+	struct list *workers = list_create();
+	uint64_t wkey;
+	void *remote_info;
+	itable_firstkey(holders);
+	while(itable_nextkey(holders, &wkey, &remote_info)) {
+		list_push_tail(workers, (void *) (uintptr_t) wkey);
+	}
+
+	struct work_queue_worker *w;
+	while((w = list_pop_head(workers))) {
+		if(worker_tasks_use_file(w, filename)) {
+			debug(D_WQ, "%s (%s) keeps %s, as one of its tasks uses it.", w->hostname, w->addrport, filename);
+			continue;
+		}
+		delete_worker_file(q, w, filename, 0, 0);
+	}
+
+	list_delete(workers);
+}
 
 void work_queue_task_delete(struct work_queue_task *t)
 {
@@ -4515,6 +6303,8 @@ void work_queue_task_delete(struct work_queue_task *t)
 			rmsummary_delete(t->resources_allocated);
 		if(t->monitor_output_directory)
 			free(t->monitor_output_directory);
+		if(t->library)
+			free(t->library);
 
 		free(t);
 	}
@@ -4593,15 +6383,21 @@ struct work_queue *work_queue_create(int port)
 
 	q->next_taskid = 1;
 
-	q->ready_list = list_create();
+	q->ready_queue = priority_queue_create();
 
 	q->tasks          = itable_create(0);
 
 	q->task_state_map = itable_create(0);
+	q->task_state_entries = itable_create(0);
+	q->category_task_counts = hash_table_create(0, 0);
 
 	q->worker_table = hash_table_create(0, 0);
 	q->worker_blacklist = hash_table_create(0, 0);
 	q->worker_task_map = itable_create(0);
+	q->workers_by_free_resources = itable_create(0);
+	q->file_holders = hash_table_create(0, 0);
+	q->file_sources = hash_table_create(0, 0);
+	q->content_hashes = hash_table_create(0, 0);
 
 	q->measured_local_resources   = rmsummary_create(-1);
 	q->current_max_worker         = rmsummary_create(-1);
@@ -4611,15 +6407,28 @@ struct work_queue *work_queue_create(int port)
 	q->stats_measure              = calloc(1, sizeof(struct work_queue_stats));
 
 	q->workers_with_available_results = hash_table_create(0, 0);
+	q->workers_with_pushed_results = hash_table_create(0, 0);
+	q->workers_with_pending_sends = hash_table_create(0, 0);
+	q->max_async_transfers = 64;
+	q->max_async_transfers_per_worker = 4;
+	q->binary_frames = 1;
 
-	// The poll table is initially null, and will be created
-	// (and resized) as needed by build_poll_table.
-	q->poll_table_size = 8;
+	// Links are registered in the poll set as they connect. The poll
+	// table is initially null, and will be created (and resized) as
+	// needed by poll_active_workers.
+	q->poll_set = link_set_create();
+	if(!q->poll_set || !link_set_add(q->poll_set, q->master_link, LINK_READ)) {
+		fatal("creating the poll set failed: %s", strerror(errno));
+	}
+	q->poll_table_size = 0;
 
 	q->worker_selection_algorithm = wq_option_scheduler;
 	q->process_pending_check = 0;
 
 	q->short_timeout = 5;
+	q->dispatch_batch_size = 1;
+	q->max_task_bundle = 16;
+	q->average_execute_time = 0;
 	q->long_timeout = 3600;
 
 	q->stats->time_when_started = timestamp_get();
@@ -4641,6 +6450,12 @@ struct work_queue *work_queue_create(int port)
 	// fast abort depends on categories, thus set after them.
 	work_queue_activate_fast_abort(q, -1);
 
+	q->speculations = hash_table_create(0, 0);
+	q->speculation_duplicates = itable_create(0);
+	q->speculation_originals = itable_create(0);
+	q->speculation_dropped = list_create();
+	q->speculation_last_check = 0;
+
 	q->password = 0;
 
 	q->asynchrony_multiplier = 1.0;
@@ -4757,6 +6572,31 @@ int work_queue_activate_fast_abort(struct work_queue *q, double multiplier)
 	return work_queue_activate_fast_abort_category(q, "default", multiplier);
 }
 
+int work_queue_activate_speculation_category(struct work_queue *q, const char *category, double percentile, int max_duplicates)
+{
+	struct speculation *s = speculation_lookup_or_create(q, category);
+
+	if(percentile > 0) {
+		s->percentile = MIN(percentile, 100);
+		s->max_duplicates = MAX(max_duplicates, 1);
+		debug(D_WQ, "Enabling speculation for '%s': percentile %3.3lf, up to %d duplicates\n", category, s->percentile, s->max_duplicates);
+		return 0;
+	} else if(percentile == 0 || !strcmp(category, "default")) {
+		debug(D_WQ, "Disabling speculation for '%s'.\n", category);
+		s->percentile = 0;
+		return 1;
+	} else {
+		debug(D_WQ, "Using default speculation for '%s'.\n", category);
+		s->percentile = -1;
+		return 0;
+	}
+}
+
+int work_queue_activate_speculation(struct work_queue *q, double percentile, int max_duplicates)
+{
+	return work_queue_activate_speculation_category(q, "default", percentile, max_duplicates);
+}
+
 int work_queue_port(struct work_queue *q)
 {
 	char addr[LINK_ADDRESS_MAX];
@@ -4881,6 +6721,17 @@ void work_queue_delete(struct work_queue *q)
 		hash_table_delete(q->worker_table);
 		hash_table_delete(q->worker_blacklist);
 		itable_delete(q->worker_task_map);
+		itable_delete(q->workers_by_free_resources);
+		hash_table_delete(q->file_holders);
+		hash_table_delete(q->file_sources);
+
+		struct content_hash *ch;
+		hash_table_firstkey(q->content_hashes);
+		while(hash_table_nextkey(q->content_hashes, &key, (void **) &ch)) {
+			free(ch->cached_name);
+			free(ch);
+		}
+		hash_table_delete(q->content_hashes);
 
 		struct category *c;
 		hash_table_firstkey(q->categories);
@@ -4889,13 +6740,51 @@ void work_queue_delete(struct work_queue *q)
 		}
 		hash_table_delete(q->categories);
 
-		list_delete(q->ready_list);
+		// duplicates belong to the queue, unlike submitted tasks.
+		struct work_queue_task *t;
+		uint64_t dupid;
+		itable_firstkey(q->speculation_originals);
+		while(itable_nextkey(q->speculation_originals, &dupid, (void **) &t)) {
+			list_push_tail(q->speculation_dropped, itable_lookup(q->speculation_duplicates, t->taskid));
+		}
+		while((t = list_pop_head(q->speculation_dropped))) {
+			work_queue_task_delete(t);
+		}
+		list_delete(q->speculation_dropped);
+		itable_delete(q->speculation_duplicates);
+		itable_delete(q->speculation_originals);
+
+		struct speculation *sp;
+		hash_table_firstkey(q->speculations);
+		while(hash_table_nextkey(q->speculations, &key, (void **) &sp)) {
+			free(sp);
+		}
+		hash_table_delete(q->speculations);
+
+		priority_queue_delete(q->ready_queue);
 
 		itable_delete(q->tasks);
 
 		itable_delete(q->task_state_map);
 
+		struct task_state_entry *e;
+		uint64_t taskid;
+		itable_firstkey(q->task_state_entries);
+		while(itable_nextkey(q->task_state_entries, &taskid, (void **) &e)) {
+			free(e);
+		}
+		itable_delete(q->task_state_entries);
+
+		struct task_state_counts *counts;
+		hash_table_firstkey(q->category_task_counts);
+		while(hash_table_nextkey(q->category_task_counts, &key, (void **) &counts)) {
+			free(counts);
+		}
+		hash_table_delete(q->category_task_counts);
+
 		hash_table_delete(q->workers_with_available_results);
+		hash_table_delete(q->workers_with_pushed_results);
+		hash_table_delete(q->workers_with_pending_sends);
 
 		list_free(q->task_reports);
 		list_delete(q->task_reports);
@@ -4912,6 +6801,7 @@ void work_queue_delete(struct work_queue *q)
 
 		free(q->poll_table);
 		link_close(q->master_link);
+		link_set_delete(q->poll_set);
 		if(q->logfile) {
 			fclose(q->logfile);
 		}
@@ -5053,25 +6943,22 @@ char *work_queue_monitor_wrap(struct work_queue *q, struct work_queue_worker *w,
 	return wrap_cmd;
 }
 
-/* Put a given task on the ready list, taking into account the task priority and the queue schedule. */
+/* Put a given task on the ready queue, taking into account the task priority and the queue schedule. */
 
-void push_task_to_ready_list( struct work_queue *q, struct work_queue_task *t )
+void push_task_to_ready_queue( struct work_queue *q, struct work_queue_task *t )
 {
 	int by_priority = 1;
 
 	if(t->result == WORK_QUEUE_RESULT_RESOURCE_EXHAUSTION) {
 		/* when a task is resubmitted given resource exhaustion, we
-		 * push it at the head of the list, so it gets to run as soon
+		 * push it ahead of any priority, so it gets to run as soon
 		 * as possible. This avoids the issue in which all 'big' tasks
 		 * fail because the first allocation is too small. */
 		by_priority = 0;
 	}
 
-	if(by_priority) {
-		list_push_priority(q->ready_list,t,t->priority);
-	} else {
-		list_push_head(q->ready_list,t);
-	}
+	struct task_state_entry *e = itable_lookup(q->task_state_entries, t->taskid);
+	e->ready_node = priority_queue_push(q->ready_queue, t, by_priority ? t->priority : HUGE_VAL);
 
 	/* If the task has been used before, clear out accumulated state. */
 	clean_task_state(t);
@@ -5110,10 +6997,97 @@ static void fill_deprecated_tasks_stats(struct work_queue_task *t) {
 }
 
 
+static struct task_state_counts *category_task_counts(struct work_queue *q, const char *category)
+{
+	struct task_state_counts *counts = hash_table_lookup(q->category_task_counts, category);
+
+	if(!counts) {
+		counts = calloc(1, sizeof(*counts));
+		hash_table_insert(q->category_task_counts, category, counts);
+	}
+
+	return counts;
+}
+
+static void task_state_entry_link(struct work_queue *q, struct task_state_entry *e)
+{
+	struct task_state_list *l = &q->task_state_lists[e->state];
+
+	e->prev = l->tail;
+	e->next = NULL;
+	if(l->tail) {
+		l->tail->next = e;
+	} else {
+		l->head = e;
+	}
+	l->tail = e;
+
+	if(e->uncounted)
+		return;
+
+	q->task_counts.states[e->state]++;
+	q->task_counts.requests[e->request]++;
+	e->counts->states[e->state]++;
+	e->counts->requests[e->request]++;
+}
+
+static void task_state_entry_unlink(struct work_queue *q, struct task_state_entry *e)
+{
+	struct task_state_list *l = &q->task_state_lists[e->state];
+
+	if(e->prev) {
+		e->prev->next = e->next;
+	} else {
+		l->head = e->next;
+	}
+	if(e->next) {
+		e->next->prev = e->prev;
+	} else {
+		l->tail = e->prev;
+	}
+	e->prev = e->next = NULL;
+
+	if(e->uncounted)
+		return;
+
+	q->task_counts.states[e->state]--;
+	q->task_counts.requests[e->request]--;
+	e->counts->states[e->state]--;
+	e->counts->requests[e->request]--;
+}
+
+static void update_task_state_entry(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state)
+{
+	struct task_state_entry *e = itable_lookup(q->task_state_entries, t->taskid);
+
+	if(e) {
+		task_state_entry_unlink(q, e);
+	} else {
+		e = calloc(1, sizeof(*e));
+		e->task = t;
+		e->counts = category_task_counts(q, t->category);
+		e->uncounted = itable_lookup(q->speculation_originals, t->taskid) != NULL;
+		itable_insert(q->task_state_entries, t->taskid, e);
+	}
+
+	if(new_state == WORK_QUEUE_TASK_DONE || new_state == WORK_QUEUE_TASK_CANCELED) {
+		itable_remove(q->task_state_entries, t->taskid);
+		free(e);
+		return;
+	}
+
+	/* the allocation of a task may have changed since its last change of state. */
+	e->state = new_state;
+	e->request = t->resource_request;
+	task_state_entry_link(q, e);
+}
+
 /* Changes task state. Returns old state */
 /* State of the task. One of WORK_QUEUE_TASK(UNKNOWN|READY|RUNNING|WAITING_RETRIEVAL|RETRIEVED|DONE) */
 static work_queue_task_state_t change_task_state( struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state ) {
 
+	new_state = speculation_filter_state(q, t, new_state);
+
 	work_queue_task_state_t old_state = (uintptr_t) itable_lookup(q->task_state_map, t->taskid);
 	itable_insert(q->task_state_map, t->taskid, (void *) new_state);
 
@@ -5121,16 +7095,20 @@ static work_queue_task_state_t change_task_state( struct work_queue *q, struct w
 
 	if( old_state == WORK_QUEUE_TASK_READY ) {
 		// Treat WORK_QUEUE_TASK_READY specially, as it has the order of the tasks
-		list_remove(q->ready_list, t);
+		struct task_state_entry *e = itable_lookup(q->task_state_entries, t->taskid);
+		priority_queue_remove(q->ready_queue, e->ready_node);
+		e->ready_node = NULL;
 	}
 
+	update_task_state_entry(q, t, new_state);
+
 	// insert to corresponding table
 	debug(D_WQ, "Task %d state change: %s (%d) to %s (%d)\n", t->taskid, task_state_str(old_state), old_state, task_state_str(new_state), new_state);
 
 	switch(new_state) {
 		case WORK_QUEUE_TASK_READY:
 			update_task_result(t, WORK_QUEUE_RESULT_UNKNOWN);
-			push_task_to_ready_list(q, t);
+			push_task_to_ready_queue(q, t);
 			break;
 		case WORK_QUEUE_TASK_DONE:
 		case WORK_QUEUE_TASK_CANCELED:
@@ -5145,6 +7123,8 @@ static work_queue_task_state_t change_task_state( struct work_queue *q, struct w
 
 	write_transaction_task(q, t);
 
+	speculation_state_changed(q, t, new_state);
+
 	return old_state;
 }
 
@@ -5226,54 +7206,29 @@ static int task_state_is( struct work_queue *q, uint64_t taskid, work_queue_task
 	return itable_lookup(q->task_state_map, taskid) == (void *) state;
 }
 
+/* Returns the task that has been in the state the longest. */
 static struct work_queue_task *task_state_any(struct work_queue *q, work_queue_task_state_t state) {
-	struct work_queue_task *t;
-	uint64_t taskid;
-
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, state) ) {
-			return t;
-		}
-	}
+	struct task_state_entry *e = q->task_state_lists[state].head;
 
-	return NULL;
+	return e ? e->task : NULL;
 }
 
 static int task_state_count(struct work_queue *q, const char *category, work_queue_task_state_t state) {
-	struct work_queue_task *t;
-	uint64_t taskid;
-
-	int count = 0;
+	if(!category)
+		return q->task_counts.states[state];
 
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, state) ) {
-			if(!category || strcmp(category, t->category) == 0) {
-				count++;
-			}
-		}
-	}
+	struct task_state_counts *counts = hash_table_lookup(q->category_task_counts, category);
 
-	return count;
+	return counts ? counts->states[state] : 0;
 }
 
 static int task_request_count( struct work_queue *q, const char *category, category_allocation_t request) {
-	struct work_queue_task *t;
-	uint64_t taskid;
-
-	int count = 0;
+	if(!category)
+		return q->task_counts.requests[request];
 
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if(t->resource_request == request) {
-			if(!category || strcmp(category, t->category) == 0) {
-				count++;
-			}
-		}
-	}
+	struct task_state_counts *counts = hash_table_lookup(q->category_task_counts, category);
 
-	return count;
+	return counts ? counts->requests[request] : 0;
 }
 
 int work_queue_submit_internal(struct work_queue *q, struct work_queue_task *t)
@@ -5283,6 +7238,8 @@ int work_queue_submit_internal(struct work_queue *q, struct work_queue_task *t)
 	/* Ensure category structure is created. */
 	work_queue_category_lookup_or_create(q, t->category);
 
+	update_content_cached_names(q, t);
+
 	change_task_state(q, t, WORK_QUEUE_TASK_READY);
 
 	t->time_when_submitted = timestamp_get();
@@ -5412,11 +7369,44 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 {
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	int n = build_poll_table(q, foreman_uplink);
+	if(foreman_uplink) {
+		link_set_add(q->poll_set, foreman_uplink, LINK_READ);
+	}
+
+	// Make room for every registered link to be reported as ready.
+	int size = link_set_size(q->poll_set);
+	if(size > q->poll_table_size) {
+		q->poll_table_size = MAX(size, 2*q->poll_table_size);
+		q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
+		if(q->poll_table == NULL) {
+			//if we can't allocate a poll table, we can't do anything else.
+			fatal("reallocating memory for poll table failed.");
+		}
+	}
 
 	// We poll in at most small time segments (of a second). This lets
 	// promptly dispatch tasks, while avoiding busy waiting.
 	int msec = q->busy_waiting_flag ? 1000 : 0;
+
+	// If the bandwidth limit has been reached, wait only until it is
+	// replenished, as transfers are deferred until then.
+	int exhausted = bandwidth_exhausted(q);
+	if(exhausted) {
+		msec = MIN(msec, 10);
+	}
+
+	// Wake up when workers with pending sends can take more data.
+	if(hash_table_size(q->workers_with_pending_sends) > 0) {
+		int events = exhausted ? LINK_READ : LINK_READ|LINK_WRITE;
+
+		char *key;
+		struct work_queue_worker *w;
+		hash_table_firstkey(q->workers_with_pending_sends);
+		while(hash_table_nextkey(q->workers_with_pending_sends, &key, (void **) &w)) {
+			link_set_add(q->poll_set, w->link, events);
+		}
+	}
+
 	if(stoptime) {
 		msec = MIN(msec, (stoptime - time(0)) * 1000);
 	}
@@ -5429,19 +7419,13 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	// Poll all links for activity.
-	link_poll(q->poll_table, n, msec);
+	// Poll all links for activity. Only the links that are ready are returned.
+	int n = link_set_wait(q->poll_set, q->poll_table, q->poll_table_size, msec);
 	q->link_poll_end = timestamp_get();
 
-	int i, j = 1;
-	// Consider the foreman_uplink passed into the function and disregard if inactive.
+	q->master_link_active = 0;
 	if(foreman_uplink) {
-		if(q->poll_table[1].revents) {
-			*foreman_uplink_active = 1; //signal that the master link saw activity
-		} else {
-			*foreman_uplink_active = 0;
-		}
-		j++;
+		*foreman_uplink_active = 0;
 	}
 
 	END_ACCUM_TIME(q, time_polling);
@@ -5449,14 +7433,63 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 
 	BEGIN_ACCUM_TIME(q, time_status_msgs);
 
+	int i;
 	int workers_removed = 0;
-	// Then consider all existing active workers
-	for(i = j; i < n; i++) {
-		if(q->poll_table[i].revents) {
-			if(handle_worker(q, q->poll_table[i].link) == WORKER_FAILURE) {
+	for(i = 0; i < n; i++) {
+		struct link *l = q->poll_table[i].link;
+		if(!q->poll_table[i].revents) {
+			continue;
+		}
+
+		if(l == q->master_link) {
+			q->master_link_active = 1;
+		} else if(l == foreman_uplink) {
+			*foreman_uplink_active = 1; //signal that the master link saw activity
+		} else {
+			char key[WORK_QUEUE_LINE_MAX];
+			link_to_hash_key(l, key);
+			if(!hash_table_lookup(q->worker_table, key)) {
+				/* worker removed while handling an earlier link of this poll. */
+				continue;
+			}
+
+			if((q->poll_table[i].revents & LINK_READ) && handle_worker(q, l) == WORKER_FAILURE) {
+				workers_removed++;
+			}
+		}
+	}
+
+	// Advance the background sends. This also notices sends that timed out.
+	if(hash_table_size(q->workers_with_pending_sends) > 0) {
+		char *key;
+		struct work_queue_worker *w;
+		struct list *pending = list_create();
+
+		hash_table_firstkey(q->workers_with_pending_sends);
+		while(hash_table_nextkey(q->workers_with_pending_sends, &key, (void **) &w)) {
+			list_push_tail(pending, w);
+		}
+
+		while((w = list_pop_head(pending))) {
+			if(progress_pending_sends(q, w, 0) < 0) {
+				handle_worker_failure(q, w);
 				workers_removed++;
 			}
 		}
+
+		list_delete(pending);
+	}
+
+	// Process the results pushed while the master was busy with another
+	// request to the worker, and not by handle_worker.
+	if(hash_table_size(q->workers_with_pushed_results) > 0) {
+		char *key;
+		struct work_queue_worker *w;
+		hash_table_firstkey(q->workers_with_pushed_results);
+		while(hash_table_nextkey(q->workers_with_pushed_results, &key, (void **) &w)) {
+			process_pushed_results(q, w);
+			hash_table_firstkey(q->workers_with_pushed_results);
+		}
 	}
 
 	if(hash_table_size(q->workers_with_available_results) > 0) {
@@ -5483,7 +7516,8 @@ static int connect_new_workers(struct work_queue *q, int stoptime, int max_new_w
 	// If the master link was awake, then accept at most max_new_workers.
 	// Note we are using the information gathered in poll_active_workers, which
 	// is a little ugly.
-	if(q->poll_table[0].revents) {
+	if(q->master_link_active) {
+		q->master_link_active = 0;
 		do {
 			add_worker(q);
 			new_workers++;
@@ -5502,7 +7536,7 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
    - update catalog if appropiate
    - retrieve workers status messages
    - tasks waiting to be retrieved?          Yes: retrieve one task and go to S.
-   - tasks waiting to be dispatched?         Yes: dispatch one task and go to S.
+   - tasks waiting to be dispatched?         Yes: dispatch a batch of tasks and go to S.
    - send keepalives to appropiate workers
    - fast-abort workers
    - if new workers, connect n of them
@@ -5592,7 +7626,7 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 
 		// tasks waiting to be dispatched?
 		BEGIN_ACCUM_TIME(q, time_send);
-		result = send_one_task(q);
+		result = send_tasks(q);
 		END_ACCUM_TIME(q, time_send);
 		if(result) {
 			// sent at least one task
@@ -5616,6 +7650,16 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 			continue;
 		}
 
+		// If speculation is enabled, duplicate tasks slower than their category.
+		BEGIN_ACCUM_TIME(q, time_internal);
+		result = speculate_slow_tasks(q);
+		END_ACCUM_TIME(q, time_internal);
+		if(result) {
+			// started at least one duplicate
+			events++;
+			continue;
+		}
+
 		// if new workers, connect n of them
 		BEGIN_ACCUM_TIME(q, time_status_msgs);
 		result = connect_new_workers(q, stoptime, MAX_NEW_WORKERS);
@@ -5646,6 +7690,11 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 		if(done)
 			break;
 
+		// a zero timeout checks once for events, rather than polling
+		// until the clock ticks over to the next second.
+		if(timeout == 0)
+			break;
+
 		/* if we got here, no events were triggered. we set the busy_waiting
 		 * flag so that link_poll waits for some time the next time around. */
 		q->busy_waiting_flag = 1;
@@ -5844,9 +7893,11 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 
 	if(!strcmp(name, "asynchrony-multiplier")) {
 		q->asynchrony_multiplier = MAX(value, 1.0);
+		worker_index_rebuild(q);
 
 	} else if(!strcmp(name, "asynchrony-modifier")) {
 		q->asynchrony_modifier = MAX(value, 0);
+		worker_index_rebuild(q);
 
 	} else if(!strcmp(name, "min-transfer-timeout")) {
 		q->minimum_transfer_timeout = (int)value;
@@ -5872,6 +7923,37 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 	} else if(!strcmp(name, "short-timeout")) {
 		q->short_timeout = MAX(1, (int)value);
 
+	} else if(!strcmp(name, "dispatch-batch-size")) {
+		q->dispatch_batch_size = MAX(1, (int)value);
+
+	} else if(!strcmp(name, "max-task-bundle")) {
+		q->max_task_bundle = MAX(1, (int)value);
+
+	} else if(!strcmp(name, "max-async-transfers")) {
+		q->max_async_transfers = MAX(0, (int)value);
+
+	} else if(!strcmp(name, "max-async-transfers-per-worker")) {
+		q->max_async_transfers_per_worker = MAX(0, (int)value);
+
+	} else if(!strcmp(name, "compress-transfers")) {
+		q->compress_transfers = !!((int)value);
+
+	} else if(!strcmp(name, "binary-frames")) {
+		q->binary_frames = !!((int)value);
+
+	} else if(!strcmp(name, "content-addressed-cache")) {
+		q->content_addressed_cache = !!((int)value);
+
+	} else if(!strcmp(name, "peer-transfer-fanout")) {
+		q->peer_transfer_fanout = MAX(0, (int)value);
+
+		char *key;
+		struct work_queue_worker *w;
+		hash_table_firstkey(q->worker_table);
+		while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+			start_peer_transfers(q, w);
+		}
+
 	} else if(!strcmp(name, "category-steady-n-tasks")) {
 		category_tune_bucket_size("category-steady-n-tasks", (int) value);
 
@@ -5971,6 +8053,7 @@ void work_queue_get_stats(struct work_queue *q, struct work_queue_stats *s)
 	s->tasks_waiting      = task_state_count(q, NULL, WORK_QUEUE_TASK_READY);
 	s->tasks_on_workers   = task_state_count(q, NULL, WORK_QUEUE_TASK_RUNNING) + task_state_count(q, NULL, WORK_QUEUE_TASK_WAITING_RETRIEVAL);
 	s->tasks_with_results = task_state_count(q, NULL, WORK_QUEUE_TASK_WAITING_RETRIEVAL);
+	s->tasks_speculating  = itable_size(q->speculation_duplicates);
 
 	{
 		//accumulate tasks running, from workers:
@@ -6108,6 +8191,11 @@ void work_queue_get_stats_category(struct work_queue *q, const char *category, s
 	s->tasks_running      = task_state_count(q, category, WORK_QUEUE_TASK_RUNNING) + task_state_count(q, category, WORK_QUEUE_TASK_WAITING_RETRIEVAL);
 	s->tasks_with_results = task_state_count(q, category, WORK_QUEUE_TASK_WAITING_RETRIEVAL);
 
+	struct speculation *sp = speculation_lookup_or_create(q, category);
+	struct speculation *settings = speculation_settings(q, sp);
+	s->tasks_speculating  = sp->running;
+	s->speculation_budget = settings ? settings->max_duplicates : 0;
+
 	struct rmsummary *rmax = largest_waiting_measured_resources(q, c->name);
 
 	s->workers_able  = count_workers_for_waiting_tasks(q, rmax);
@@ -6331,6 +8419,7 @@ static void write_transaction_worker_resources(struct work_queue *q, struct work
 
 	buffer_free(&B);
 	free(rjx);
+	rmsummary_delete(s);
 }
 
 
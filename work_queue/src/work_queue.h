@@ -148,6 +148,7 @@ struct work_queue_task {
 	struct rmsummary *resources_measured;                  /**< When monitoring is enabled, it points to the measured resources used by the task in its latest attempt. */
 	struct rmsummary *resources_requested;                 /**< Number of cores, disk, memory, time, etc. the task requires. */
 	char *monitor_output_directory;                        /**< Custom output directory for the monitoring output files. If NULL, save to directory from @ref work_queue_enable_monitoring */
+	char *library;                                         /**< If set, the command that starts the library of which the task is an invocation. See @ref work_queue_task_specify_library. */
 
 	/* deprecated fields */
 	//int total_submissions;                                 /**< @deprecated Use try_count. */
@@ -204,6 +205,8 @@ struct work_queue_stats {
 	int tasks_on_workers;     /**< Number of tasks currently dispatched to some worker. */
 	int tasks_running;        /**< Number of tasks currently executing at some worker. */
 	int tasks_with_results;   /**< Number of tasks with retrieved results and waiting to be returned to user. */
+	int tasks_speculating;    /**< Number of duplicates of slow tasks currently dispatched to some worker. (see @ref work_queue_activate_speculation) */
+	int speculation_budget;   /**< Number of duplicates that may be dispatched at once. Only set by @ref work_queue_get_stats_category. */
 
 	/* Cumulative stats for tasks: */
 	int tasks_submitted;           /**< Total number of tasks submitted to the queue. */
@@ -212,6 +215,8 @@ struct work_queue_stats {
 	int tasks_failed;              /**< Total number of tasks completed and returned to user with result other than WQ_RESULT_SUCCESS. */
 	int tasks_cancelled;           /**< Total number of tasks cancelled. */
 	int tasks_exhausted_attempts;  /**< Total number of task executions that failed given resource exhaustion. */
+	int tasks_speculated;          /**< Total number of duplicates started for tasks slower than the rest of their category. */
+	int tasks_speculated_won;      /**< Total number of tasks whose result came from their duplicate rather than from their first execution. */
 
 	/* All times in microseconds */
 	/* A time_when_* refers to an instant in time, otherwise it refers to a length of time. */
@@ -331,6 +336,26 @@ struct work_queue_task *work_queue_task_clone(const struct work_queue_task *task
 */
 void work_queue_task_specify_command( struct work_queue_task *t, const char *cmd );
 
+/** Run the task as an invocation of a library, rather than as a shell command.
+A library is a program started once on a worker and kept running, so that
+tasks which share a costly startup, such as loading an interpreter and its
+modules, pay it once per worker slot rather than once per task. The worker
+starts one instance of the library for each invocation that runs at once, and
+reuses idle instances for later invocations. The resources of the task are
+accounted to each invocation, as for a shell command.
+The command line of the task is passed to the library as the arguments of the
+invocation, and the environment variables of the task are not applied.
+A library reads invocations from its standard input, each as the line
+"invoke <taskid> <sandbox_length> <length>" followed by sandbox_length bytes
+with the path of the directory with the input files of the task, where its
+output files are expected, and then by length bytes of arguments. For each invocation, it writes to its standard
+output the line "result <exit_status> <length>" followed by length bytes,
+which become the output of the task.
+@param t A task object.
+@param library The shell command that starts the library. This string will be duplicated by this call, so the argument may be freed or re-used afterward.
+*/
+void work_queue_task_specify_library( struct work_queue_task *t, const char *library );
+
 /** Add a file to a task.
 @param t A task object.
 @param local_name The name of the file on local disk or shared filesystem.
@@ -615,6 +640,7 @@ the workers' cache, so that a newer version may be used. Any running task using
 the file is canceled and resubmitted. Completed tasks waiting for retrieval are
 not affected.
 (Currently anonymous buffers and file pieces cannot be deleted once cached in a worker.)
+With the "content-addressed-cache" option of @ref work_queue_tune, files changed in place are sent again without this call.
 @param q A work queue object.
 @param local_name The name of the file on local disk or shared filesystem, or uri.
 @param type One of:
@@ -624,6 +650,19 @@ not affected.
 */
 void work_queue_invalidate_cached_file(struct work_queue *q, const char *local_name, work_queue_file_t type);
 
+/** Remove a cached file from the workers.
+The copies of the file with the given local name are deleted from the workers'
+cache, to free their disk once no task will need the file again. Unlike
+@ref work_queue_invalidate_cached_file, no task is canceled: a worker running
+or holding the results of a task that uses the file keeps its copy.
+With the "content-addressed-cache" option of @ref work_queue_tune, the copy named
+after the contents of the file is deleted as well, unless another file of the
+queue has the same contents.
+@param q A work queue object.
+@param local_name The name of the file on local disk or shared filesystem.
+*/
+void work_queue_remove_cached_file(struct work_queue *q, const char *local_name);
+
 
 /** Wait for a task to complete.
 This call will block until either a task has completed, the timeout has expired, or the queue is empty.
@@ -636,7 +675,7 @@ If the task could not, then the <tt>result</tt> field will be non-zero and the
 <tt>return_status</tt> field will be undefined.
 
 @param q A work queue object.
-@param timeout The number of seconds to wait for a completed task before returning.  Use an integer time to set the timeout or the constant @ref WORK_QUEUE_WAITFORTASK to block until a task has completed.
+@param timeout The number of seconds to wait for a completed task before returning.  Use an integer time to set the timeout, zero to check for a completed task without blocking, or the constant @ref WORK_QUEUE_WAITFORTASK to block until a task has completed.
 @returns A completed task description, or null if the queue is empty, or the timeout was reached without a completed task, or there is completed child process (call @ref process_wait to retrieve the status of the completed child process).
 */
 struct work_queue_task *work_queue_wait(struct work_queue *q, int timeout);
@@ -741,6 +780,32 @@ multiplier.  The value specified here applies only to tasks in the given categor
 */
 int work_queue_activate_fast_abort_category(struct work_queue *q, const char *category, double multiplier);
 
+/** Turn on or off speculative execution for a given queue for tasks without
+an explicit category. While no task is waiting for a worker, a task whose running
+time is larger than the given percentile of the recent execution times of its
+category is duplicated on another worker. The first execution to succeed gives
+the result of the task, and the other execution is canceled. Unlike fast abort,
+no worker is removed. The value specified here applies to all the categories for
+which @ref work_queue_activate_speculation_category was not explicitely called.
+@param q A work queue object.
+@param percentile The percentile, between 0 and 100, of the execution times at which a task is duplicated; if zero or less, speculation is deactivated (the default).
+@param max_duplicates The maximum number of duplicates of tasks of a category that may run at once.
+@returns 0 if activated, 1 if deactivated.
+*/
+int work_queue_activate_speculation(struct work_queue *q, double percentile, int max_duplicates);
+
+/** Turn on or off speculative execution for a given category. The values
+specified here apply only to tasks in the given category. (Note:
+work_queue_activate_speculation_category(q, "default", p, n) is the same as
+work_queue_activate_speculation(q, p, n).)
+@param q A work queue object.
+@param category A category name.
+@param percentile The percentile, between 0 and 100, of the execution times at which a task is duplicated; if zero, speculation is deactivated. If less than zero (default), use the speculation settings of the "default" category.
+@param max_duplicates The maximum number of duplicates of tasks of the category that may run at once.
+@returns 0 if activated, 1 if deactivated.
+*/
+int work_queue_activate_speculation_category(struct work_queue *q, const char *category, double percentile, int max_duplicates);
+
 /** Turn on or off first-allocation labeling for a given category. By default, only cores, memory, and disk are labeled. Turn on/off other specific resources use @ref work_queue_specify_category_autolabel_resource.
 @param q A work queue object.
 @param category A category name.
@@ -898,6 +963,14 @@ void work_queue_master_preferred_connection(struct work_queue *q, const char *pr
  - "fast-abort-multiplier" Set the multiplier of the average task time at which point to abort; if negative or zero fast_abort is deactivated. (default=0)
  - "keepalive-interval" Set the minimum number of seconds to wait before sending new keepalive checks to workers. (default=300)
  - "keepalive-timeout" Set the minimum number of seconds to wait for a keepalive response from worker before marking it as dead. (default=30)
+ - "dispatch-batch-size" Set the maximum number of dispatches to workers in one scheduling pass. Each dispatch may carry a bundle of tasks for the same worker, see "max-task-bundle". (default=1)
+ - "max-task-bundle" Set the maximum number of tasks sent to a worker in one dispatch. Tasks are bundled only once they are measured to run much shorter than a second, and only as many as fit the resources of the worker. (default=16)
+ - "max-async-transfers" Set the maximum number of input files sent to workers in the background at once. Tasks wait to be dispatched while it is reached. If zero, files are sent synchronously. (default=64)
+ - "max-async-transfers-per-worker" Set the maximum number of input files queued in the background for a single worker. Tasks are not dispatched to a worker while it is reached. If zero, files are sent synchronously. (default=4)
+ - "compress-transfers" If set to 1, files are compressed when sent between the master and the workers. Data that does not compress is sent as is. (default=0)
+ - "binary-frames" If set to 1, workers that offer binary frames use them for tasks, results, resource updates, and keepalives, instead of text messages. (default=1)
+ - "content-addressed-cache" If set to 1, cached input files are named after a hash of their contents, so that copies of the same contents are transferred and stored once, and a file changed in place is sent again. (default=0)
+ - "peer-transfer-fanout" Set the maximum number of transfers of a cached input file that a worker holding it may serve to other workers at once; if zero, the master sends all input files itself, and workers do not serve files to each other. (default=0)
 @param value The value to set the parameter to.
 @return 0 on succes, -1 on failure.
 */
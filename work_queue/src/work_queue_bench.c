@@ -0,0 +1,862 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Measures how fast a real master dispatches tasks, without real workers. The
+program forks a simulator that connects many workers to the master over
+local connections. Each simulated worker speaks the text protocol of
+work_queue_worker: it reports its resources and cache contents, consumes the
+files and tasks it is sent, and answers results and output files, but runs
+nothing. It offers none of the optional features that workers negotiate
+with "info" messages, so the simulator stops at once if the master sends it
+one of their messages. A task lasts the time given by its command, "sleep <seconds>", and
+every message from a worker is delayed by the simulated network latency.
+
+Once the workers have connected, the parent submits the tasks and waits for
+them, and then reports the tasks completed and dispatched per second, the
+latency of each call to work_queue_wait, the memory of the master per worker
+and per task, and its CPU time. A profiler may be attached to the master
+during the run with -P.
+*/
+
+#include "work_queue.h"
+#include "work_queue_protocol.h"
+#include "work_queue_resources.h"
+
+#include "cctools.h"
+#include "create_dir.h"
+#include "debug.h"
+#include "itable.h"
+#include "link.h"
+#include "list.h"
+#include "macros.h"
+#include "md5.h"
+#include "path.h"
+#include "priority_queue.h"
+#include "stringtools.h"
+#include "timestamp.h"
+#include "unlink_recursive.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define SIM_TIMEOUT 60
+
+struct bench_config {
+	int workers;
+	int cores;
+	int64_t memory;
+	int64_t disk;
+	int tasks;
+	int task_cores;
+	double duration_min;         // seconds
+	double duration_max;         // seconds
+	int latency;                 // milliseconds
+	int inputs;                  // shared input files, each task reads one.
+	int64_t input_size;          // bytes
+	int64_t output_size;         // bytes, 0 for no output file.
+	double cached_fraction;      // fraction of workers that hold the inputs when they connect.
+	const char *profile_command;
+	char dir[PATH_MAX];
+	char **input_cached_names;
+};
+
+/* Simulated worker. */
+struct sim_worker {
+	int id;
+	struct link *link;
+	struct itable *tasks;        // taskid -> task, for tasks not yet killed by the master.
+	struct list *results;        // struct sim_task, complete tasks not yet reported.
+	struct list *outbox;         // struct sim_message, delayed by the latency.
+	int64_t soak;                // bytes of a file being put still to be read.
+	int notified;                // available_results sent, and send_results not yet received.
+	int closed;
+};
+
+struct sim_task {
+	int taskid;
+	timestamp_t duration;
+	int done;
+};
+
+struct sim_message {
+	timestamp_t due;
+	char *data;
+	size_t length;
+};
+
+typedef enum {
+	SIM_TASK_DONE,
+	SIM_SEND
+} sim_event_t;
+
+struct sim_event {
+	sim_event_t type;
+	timestamp_t due;
+	struct sim_worker *worker;
+	int taskid;
+};
+
+static struct bench_config config;
+static struct priority_queue *sim_events;
+static timestamp_t sim_start;
+
+static int raise_fd_limit(int needed)
+{
+	struct rlimit r;
+
+	if(getrlimit(RLIMIT_NOFILE, &r) < 0)
+		return 0;
+
+	if(r.rlim_cur >= (rlim_t) needed)
+		return 1;
+
+	if(r.rlim_max != RLIM_INFINITY && r.rlim_max < (rlim_t) needed)
+		return 0;
+
+	r.rlim_cur = needed;
+	return setrlimit(RLIMIT_NOFILE, &r) == 0;
+}
+
+static void sim_event_push(sim_event_t type, timestamp_t due, struct sim_worker *w, int taskid)
+{
+	struct sim_event *e = xxmalloc(sizeof(*e));
+	e->type = type;
+	e->due = due;
+	e->worker = w;
+	e->taskid = taskid;
+
+	/* the earliest event has the highest priority. */
+	priority_queue_push(sim_events, e, -((double) (due - sim_start)));
+}
+
+static void sim_worker_close(struct sim_worker *w)
+{
+	if(w->closed)
+		return;
+
+	link_close(w->link);
+	w->link = NULL;
+	w->closed = 1;
+}
+
+static void sim_write(struct sim_worker *w, const char *data, size_t length)
+{
+	if(w->closed)
+		return;
+
+	if(link_putlstring(w->link, data, length, time(0) + SIM_TIMEOUT) != (ssize_t) length)
+		sim_worker_close(w);
+}
+
+/* Sends a message after the latency, in order with the messages before it. */
+static void sim_send(struct sim_worker *w, const char *data, size_t length)
+{
+	if(config.latency < 1) {
+		sim_write(w, data, length);
+		return;
+	}
+
+	struct sim_message *m = xxmalloc(sizeof(*m));
+	m->due = timestamp_get() + config.latency * 1000;
+	m->data = xxmalloc(length);
+	m->length = length;
+	memcpy(m->data, data, length);
+
+	list_push_tail(w->outbox, m);
+	sim_event_push(SIM_SEND, m->due, w, 0);
+}
+
+static void sim_flush_outbox(struct sim_worker *w, timestamp_t current)
+{
+	struct sim_message *m;
+
+	while((m = list_peek_head(w->outbox)) && m->due <= current) {
+		list_pop_head(w->outbox);
+		sim_write(w, m->data, m->length);
+		free(m->data);
+		free(m);
+	}
+}
+
+static void sim_report_ready(struct sim_worker *w)
+{
+	struct work_queue_resources r;
+	time_t stoptime = time(0) + SIM_TIMEOUT;
+	int i;
+
+	memset(&r, 0, sizeof(r));
+	r.workers.total = r.workers.smallest = r.workers.largest = 1;
+	r.cores.total   = r.cores.smallest   = r.cores.largest   = config.cores;
+	r.memory.total  = r.memory.smallest  = r.memory.largest  = config.memory;
+	r.disk.total    = r.disk.smallest    = r.disk.largest    = config.disk;
+	r.tag = 0;
+
+	link_putfstring(w->link, "workqueue %d sim-%d linux x86_64 %d.%d.%d\n", stoptime, WORK_QUEUE_PROTOCOL_VERSION, w->id, CCTOOLS_VERSION_MAJOR, CCTOOLS_VERSION_MINOR, CCTOOLS_VERSION_MICRO);
+	link_putfstring(w->link, "info worker-id sim-%d-%d\n", stoptime, (int) getpid(), w->id);
+
+	// The first workers hold the inputs as left by a previous master.
+	if(w->id < config.cached_fraction * config.workers) {
+		for(i = 0; i < config.inputs; i++) {
+			link_putfstring(w->link, "cache-update %s %" PRId64 "\n", stoptime, config.input_cached_names[i], config.input_size);
+		}
+	}
+
+	work_queue_resources_send(w->link, &r, stoptime);
+	link_putfstring(w->link, "info end_of_resource_update %d\n", stoptime, 0);
+	link_putfstring(w->link, "info tasks_running %d\n", stoptime, 0);
+}
+
+static int sim_recv_task(struct sim_worker *w, int taskid)
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	time_t stoptime = time(0) + SIM_TIMEOUT;
+	double seconds = 0;
+	int length;
+
+	while(link_readline(w->link, line, sizeof(line), stoptime)) {
+		if(!strcmp(line, "end")) {
+			struct sim_task *t = xxmalloc(sizeof(*t));
+			t->taskid = taskid;
+			t->duration = seconds * 1000000;
+			t->done = 0;
+			itable_insert(w->tasks, taskid, t);
+
+			sim_event_push(SIM_TASK_DONE, timestamp_get() + t->duration, w, taskid);
+			return 1;
+		} else if(sscanf(line, "cmd %d", &length) == 1) {
+			char *cmd = xxmalloc(length + 1);
+			if(link_read(w->link, cmd, length, stoptime) != length) {
+				free(cmd);
+				return 0;
+			}
+			cmd[length] = 0;
+			sscanf(cmd, "sleep %lf", &seconds);
+			free(cmd);
+		} else if(sscanf(line, "library %d", &length) == 1 || sscanf(line, "env %d", &length) == 1) {
+			if(link_soak(w->link, length + 1, stoptime) != length + 1)
+				return 0;
+		}
+	}
+
+	return 0;
+}
+
+static void sim_send_results(struct sim_worker *w)
+{
+	struct sim_task *t;
+	buffer_t B;
+
+	buffer_init(&B);
+
+	while((t = list_pop_head(w->results))) {
+		if(itable_lookup(w->tasks, t->taskid) == t) {
+			buffer_printf(&B, "result %d %d %d %" PRIu64 " %d\n", WORK_QUEUE_RESULT_SUCCESS, 0, 0, t->duration, t->taskid);
+		}
+	}
+	buffer_printf(&B, "end\n");
+
+	size_t length;
+	const char *data = buffer_tolstring(&B, &length);
+	sim_send(w, data, length);
+	buffer_free(&B);
+
+	w->notified = 0;
+}
+
+static void sim_send_output(struct sim_worker *w, const char *name)
+{
+	buffer_t B;
+	buffer_init(&B);
+
+	buffer_printf(&B, "file %s %" PRId64 " 0644\n", name, config.output_size);
+	if(config.output_size > 0) {
+		char *data = calloc(1, config.output_size);
+		buffer_putlstring(&B, data, config.output_size);
+		free(data);
+	}
+	buffer_printf(&B, "end\n");
+
+	size_t length;
+	const char *data = buffer_tolstring(&B, &length);
+	sim_send(w, data, length);
+	buffer_free(&B);
+}
+
+static void sim_handle_master(struct sim_worker *w)
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char name[WORK_QUEUE_LINE_MAX];
+	int64_t length;
+	int taskid, mode, n;
+
+	// Finish reading a file put by the master, as much as it arrived.
+	if(w->soak > 0) {
+		char buffer[65536];
+		ssize_t actual = link_read_avail(w->link, buffer, MIN(w->soak, (int64_t) sizeof(buffer)), time(0) + SIM_TIMEOUT);
+		if(actual <= 0) {
+			sim_worker_close(w);
+		} else {
+			w->soak -= actual;
+		}
+		return;
+	}
+
+	if(!link_readline(w->link, line, sizeof(line), time(0) + SIM_TIMEOUT)) {
+		sim_worker_close(w);
+		return;
+	}
+
+	if(sscanf(line, "task %d", &taskid) == 1) {
+		if(!sim_recv_task(w, taskid))
+			sim_worker_close(w);
+	} else if(sscanf(line, "put %s %" SCNd64 " %o", name, &length, &mode) == 3) {
+		w->soak = length;
+	} else if(sscanf(line, "send_results %d", &n) == 1) {
+		sim_send_results(w);
+	} else if(sscanf(line, "get %s", name) == 1) {
+		sim_send_output(w, name);
+	} else if(sscanf(line, "kill %d", &taskid) == 1) {
+		free(itable_remove(w->tasks, taskid));
+	} else if(!strcmp(line, "check")) {
+		sim_send(w, "alive\n", 6);
+	} else if(!strncmp(line, "release", 7) || !strncmp(line, "exit", 4)) {
+		sim_worker_close(w);
+	} else if(!strncmp(line, "zput ", 5) || !strncmp(line, "putdir ", 7) || !strncmp(line, "peer_get ", 9) || !strcmp(line, "peer_transfers") || !strcmp(line, "frames")) {
+		fprintf(stderr, "simulated worker %d was sent a message it did not offer to take: %s\n", w->id, line);
+		exit(1);
+	}
+
+	// Anything else, such as unlink, needs no answer.
+}
+
+static void sim_fire_event(struct sim_event *e)
+{
+	struct sim_worker *w = e->worker;
+
+	if(w->closed)
+		return;
+
+	if(e->type == SIM_SEND) {
+		sim_flush_outbox(w, timestamp_get());
+		return;
+	}
+
+	struct sim_task *t = itable_lookup(w->tasks, e->taskid);
+	if(!t || t->done)
+		return;
+
+	t->done = 1;
+	list_push_tail(w->results, t);
+
+	if(!w->notified) {
+		w->notified = 1;
+		sim_send(w, "available_results\n", 18);
+	}
+}
+
+static int simulate_workers(int port)
+{
+	struct sim_worker *workers = calloc(config.workers, sizeof(*workers));
+	struct link_set *set = link_set_create();
+	struct itable *by_fd = itable_create(0);
+	struct link_info ready[256];
+	int i;
+
+	sim_events = priority_queue_create();
+	sim_start = timestamp_get();
+
+	for(i = 0; i < config.workers; i++) {
+		struct sim_worker *w = &workers[i];
+		w->id = i;
+		w->link = link_connect("127.0.0.1", port, time(0) + SIM_TIMEOUT);
+		if(!w->link) {
+			fprintf(stderr, "simulated worker %d could not connect to port %d: %s\n", i, port, strerror(errno));
+			return 1;
+		}
+		w->tasks = itable_create(0);
+		w->results = list_create();
+		w->outbox = list_create();
+
+		sim_report_ready(w);
+		link_set_add(set, w->link, LINK_READ);
+		itable_insert(by_fd, link_fd(w->link), w);
+	}
+
+	int open_workers = config.workers;
+
+	while(open_workers > 0) {
+		timestamp_t current = timestamp_get();
+		struct sim_event *e;
+
+		while((e = priority_queue_peek_head(sim_events)) && e->due <= current) {
+			priority_queue_pop_head(sim_events);
+			sim_fire_event(e);
+			free(e);
+		}
+
+		int msec = 1000;
+		if(e) {
+			msec = MIN(msec, (int) ((e->due - current + 999) / 1000));
+		}
+
+		int n = link_set_wait(set, ready, sizeof(ready) / sizeof(*ready), msec);
+
+		for(i = 0; i < n; i++) {
+			struct sim_worker *w = itable_lookup(by_fd, link_fd(ready[i].link));
+			if(!w || w->closed)
+				continue;
+
+			int fd = link_fd(w->link);
+			sim_handle_master(w);
+
+			if(w->closed) {
+				itable_remove(by_fd, fd);
+				open_workers--;
+			}
+		}
+	}
+
+	link_set_delete(set);
+
+	return 0;
+}
+
+static int64_t resident_kb()
+{
+	FILE *file = fopen("/proc/self/statm", "r");
+	long pages = 0, resident = 0;
+
+	if(file) {
+		if(fscanf(file, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose(file);
+		return (int64_t) resident * (sysconf(_SC_PAGESIZE) / 1024);
+	}
+
+	/* without /proc, fall back to the peak, which is larger or equal. */
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+static double cpu_seconds(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static int compare_timestamps(const void *a, const void *b)
+{
+	timestamp_t x = *(const timestamp_t *) a;
+	timestamp_t y = *(const timestamp_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void create_inputs()
+{
+	int i;
+
+	config.input_cached_names = xxmalloc(MAX(config.inputs, 1) * sizeof(char *));
+
+	for(i = 0; i < config.inputs; i++) {
+		char *path = string_format("%s/input.%d", config.dir, i);
+		int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0)
+			fatal("could not create %s: %s", path, strerror(errno));
+
+		// Inputs differ in their contents, so that they have different names in the cache.
+		char *header = string_format("input %d\n", i);
+		write(fd, header, strlen(header));
+		free(header);
+
+		if(ftruncate(fd, config.input_size) < 0)
+			fatal("could not extend %s: %s", path, strerror(errno));
+		close(fd);
+
+		unsigned char digest[MD5_DIGEST_LENGTH];
+		md5_file(path, digest);
+		config.input_cached_names[i] = string_format("%s%s", WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX, md5_string(digest));
+
+		free(path);
+	}
+}
+
+static void submit_tasks(struct work_queue *q)
+{
+	int i;
+
+	for(i = 0; i < config.tasks; i++) {
+		double seconds = config.duration_min;
+		if(config.duration_max > config.duration_min)
+			seconds += (config.duration_max - config.duration_min) * random() / RAND_MAX;
+
+		char *command = string_format("sleep %.6f", seconds);
+		struct work_queue_task *t = work_queue_task_create(command);
+		free(command);
+
+		work_queue_task_specify_cores(t, config.task_cores);
+
+		if(config.inputs > 0) {
+			char *path = string_format("%s/input.%d", config.dir, i % config.inputs);
+			work_queue_task_specify_file(t, path, "input", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+			free(path);
+		}
+
+		if(config.output_size > 0) {
+			char *path = string_format("%s/output.%d", config.dir, i);
+			work_queue_task_specify_file(t, path, "output", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
+			free(path);
+		}
+
+		work_queue_submit(q, t);
+	}
+}
+
+static pid_t start_profiler()
+{
+	if(!config.profile_command)
+		return 0;
+
+	char *pid = string_format("%d", (int) getpid());
+	char *command = string_replace_percents(config.profile_command, pid);
+	free(pid);
+
+	pid_t profiler = fork();
+	if(profiler == 0) {
+		setpgid(0, 0);
+		execlp("sh", "sh", "-c", command, (char *) 0);
+		_exit(127);
+	}
+
+	free(command);
+
+	return profiler > 0 ? profiler : 0;
+}
+
+static void stop_profiler(pid_t profiler)
+{
+	if(profiler > 0) {
+		kill(-profiler, SIGINT);
+		waitpid(profiler, NULL, 0);
+	}
+}
+
+static int run_master(struct work_queue *q, pid_t simulator)
+{
+	struct work_queue_stats s;
+	struct rusage ru_start, ru_end;
+	int failed = 0;
+	int done = 0;
+
+	int64_t rss_empty = resident_kb();
+
+	// Wait for the simulated workers, which are not part of the measurement.
+	time_t stoptime = time(0) + SIM_TIMEOUT;
+	// With no tasks, work_queue_wait returns at once, so pace the polling.
+	do {
+		work_queue_wait(q, 1);
+		work_queue_get_stats(q, &s);
+		if(s.workers_connected < config.workers)
+			usleep(1000);
+	} while(s.workers_connected < config.workers && time(0) < stoptime);
+
+	int workers = s.workers_connected;
+	if(workers < config.workers) {
+		fprintf(stderr, "only %d of %d workers connected\n", workers, config.workers);
+	}
+
+	int64_t rss_workers = resident_kb();
+
+	submit_tasks(q);
+
+	int64_t rss_tasks = resident_kb();
+
+	pid_t profiler = start_profiler();
+
+	size_t calls = 0;
+	size_t calls_max = 1024;
+	timestamp_t *latencies = xxmalloc(calls_max * sizeof(*latencies));
+
+	getrusage(RUSAGE_SELF, &ru_start);
+	timestamp_t start = timestamp_get();
+
+	while(!work_queue_empty(q)) {
+		timestamp_t call_start = timestamp_get();
+		struct work_queue_task *t = work_queue_wait(q, 5);
+		timestamp_t call_end = timestamp_get();
+
+		if(calls == calls_max) {
+			calls_max *= 2;
+			latencies = realloc(latencies, calls_max * sizeof(*latencies));
+		}
+		latencies[calls++] = call_end - call_start;
+
+		if(t) {
+			if(t->result != WORK_QUEUE_RESULT_SUCCESS)
+				failed++;
+			done++;
+			work_queue_task_delete(t);
+		}
+
+		// Give up if the simulator is gone, rather than waiting forever.
+		if(waitpid(simulator, NULL, WNOHANG) == simulator) {
+			fprintf(stderr, "the simulated workers exited early\n");
+			failed++;
+			break;
+		}
+	}
+
+	timestamp_t elapsed = MAX(timestamp_get() - start, 1);
+	getrusage(RUSAGE_SELF, &ru_end);
+
+	stop_profiler(profiler);
+
+	work_queue_get_stats(q, &s);
+
+	qsort(latencies, calls, sizeof(*latencies), compare_timestamps);
+	timestamp_t total = 0;
+	size_t i;
+	for(i = 0; i < calls; i++)
+		total += latencies[i];
+
+	double cpu_user   = cpu_seconds(&ru_end.ru_utime) - cpu_seconds(&ru_start.ru_utime);
+	double cpu_system = cpu_seconds(&ru_end.ru_stime) - cpu_seconds(&ru_start.ru_stime);
+
+	printf("workers                  %d\n", workers);
+	printf("tasks_done               %d\n", done);
+	printf("tasks_failed             %d\n", failed);
+	printf("tasks_dispatched         %d\n", s.tasks_dispatched);
+	printf("elapsed_seconds          %.3f\n", elapsed / 1000000.0);
+	printf("tasks_per_second         %.1f\n", done * 1000000.0 / elapsed);
+	printf("dispatches_per_second    %.1f\n", s.tasks_dispatched * 1000000.0 / elapsed);
+	printf("wait_calls               %zu\n", calls);
+	if(calls > 0) {
+		printf("wait_latency_mean_us     %.1f\n", (double) total / calls);
+		printf("wait_latency_p50_us      %" PRIu64 "\n", latencies[calls / 2]);
+		printf("wait_latency_p99_us      %" PRIu64 "\n", latencies[MIN(calls - 1, calls * 99 / 100)]);
+		printf("wait_latency_max_us      %" PRIu64 "\n", latencies[calls - 1]);
+	}
+	printf("memory_per_worker_kb     %.2f\n", workers > 0 ? (double) (rss_workers - rss_empty) / workers : 0);
+	printf("memory_per_task_kb       %.2f\n", config.tasks > 0 ? (double) (rss_tasks - rss_workers) / config.tasks : 0);
+	printf("cpu_user_seconds         %.3f\n", cpu_user);
+	printf("cpu_system_seconds       %.3f\n", cpu_system);
+	printf("cpu_per_task_us          %.1f\n", done > 0 ? (cpu_user + cpu_system) * 1000000.0 / done : 0);
+
+	free(latencies);
+
+	return failed == 0 && done == config.tasks;
+}
+
+static int parse_range(const char *str, double *min, double *max)
+{
+	int n = sscanf(str, "%lf:%lf", min, max);
+
+	if(n == 1)
+		*max = *min;
+
+	*min /= 1000.0;
+	*max /= 1000.0;
+
+	return n >= 1 && *min >= 0 && *max >= *min;
+}
+
+static void show_help(const char *cmd)
+{
+	printf("Use: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf(" %-30s Number of simulated workers. (default: %d)\n", "-w,--workers=<n>", config.workers);
+	printf(" %-30s Cores of each worker. (default: %d)\n", "-c,--cores=<n>", config.cores);
+	printf(" %-30s Memory of each worker, in MB. (default: %" PRId64 ")\n", "-m,--memory=<mb>", config.memory);
+	printf(" %-30s Disk of each worker, in MB. (default: %" PRId64 ")\n", "-D,--disk=<mb>", config.disk);
+	printf(" %-30s Number of tasks. (default: %d)\n", "-n,--tasks=<n>", config.tasks);
+	printf(" %-30s Cores of each task. (default: %d)\n", "-C,--task-cores=<n>", config.task_cores);
+	printf(" %-30s Duration of the tasks, in ms, or a range to draw from. (default: 0)\n", "-t,--duration=<ms>[:<ms>]");
+	printf(" %-30s Latency of the messages from the workers, in ms. (default: 0)\n", "-l,--latency=<ms>");
+	printf(" %-30s Number of input files shared by the tasks. (default: %d)\n", "-f,--inputs=<n>", config.inputs);
+	printf(" %-30s Size of each input file, in KB. (default: %" PRId64 ")\n", "-i,--input-size=<kb>", config.input_size / 1024);
+	printf(" %-30s Size of the output file of each task, in KB. (default: no output file)\n", "-O,--output-size=<kb>");
+	printf(" %-30s Fraction of workers holding the inputs when they connect. (default: 0)\n", "-k,--cached=<fraction>");
+	printf(" %-30s Tune the master, as with work_queue_tune. May be repeated.\n", "-T,--tune=<name>=<value>");
+	printf(" %-30s Run this command during the measurement, with %%%% replaced by the pid of the master.\n", "-P,--profile=<command>");
+	printf(" %-30s Enable debugging for this subsystem.\n", "-d,--debug=<flag>");
+	printf(" %-30s Send debugging output to this file.\n", "-o,--debug-file=<file>");
+	printf(" %-30s Show version information.\n", "-v,--version");
+	printf(" %-30s Show this help screen.\n", "-h,--help");
+}
+
+int main(int argc, char *argv[])
+{
+	struct list *tunes = list_create();
+	int c;
+
+	config.workers = 100;
+	config.cores = 1;
+	config.memory = 1024;
+	config.disk = 10240;
+	config.tasks = 10000;
+	config.task_cores = 1;
+	config.inputs = 1;
+	config.input_size = 1024;
+
+	static const struct option long_options[] = {
+		{"workers", required_argument, 0, 'w'},
+		{"cores", required_argument, 0, 'c'},
+		{"memory", required_argument, 0, 'm'},
+		{"disk", required_argument, 0, 'D'},
+		{"tasks", required_argument, 0, 'n'},
+		{"task-cores", required_argument, 0, 'C'},
+		{"duration", required_argument, 0, 't'},
+		{"latency", required_argument, 0, 'l'},
+		{"inputs", required_argument, 0, 'f'},
+		{"input-size", required_argument, 0, 'i'},
+		{"output-size", required_argument, 0, 'O'},
+		{"cached", required_argument, 0, 'k'},
+		{"tune", required_argument, 0, 'T'},
+		{"profile", required_argument, 0, 'P'},
+		{"debug", required_argument, 0, 'd'},
+		{"debug-file", required_argument, 0, 'o'},
+		{"version", no_argument, 0, 'v'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while((c = getopt_long(argc, argv, "w:c:m:D:n:C:t:l:f:i:O:k:T:P:d:o:vh", long_options, NULL)) > -1) {
+		switch (c) {
+		case 'w':
+			config.workers = atoi(optarg);
+			break;
+		case 'c':
+			config.cores = atoi(optarg);
+			break;
+		case 'm':
+			config.memory = atoll(optarg);
+			break;
+		case 'D':
+			config.disk = atoll(optarg);
+			break;
+		case 'n':
+			config.tasks = atoi(optarg);
+			break;
+		case 'C':
+			config.task_cores = atoi(optarg);
+			break;
+		case 't':
+			if(!parse_range(optarg, &config.duration_min, &config.duration_max))
+				fatal("invalid duration: %s", optarg);
+			break;
+		case 'l':
+			config.latency = atoi(optarg);
+			break;
+		case 'f':
+			config.inputs = atoi(optarg);
+			break;
+		case 'i':
+			config.input_size = atoll(optarg) * 1024;
+			break;
+		case 'O':
+			config.output_size = atoll(optarg) * 1024;
+			break;
+		case 'k':
+			config.cached_fraction = atof(optarg);
+			break;
+		case 'T':
+			list_push_tail(tunes, optarg);
+			break;
+		case 'P':
+			config.profile_command = optarg;
+			break;
+		case 'd':
+			debug_flags_set(optarg);
+			break;
+		case 'o':
+			debug_config_file(optarg);
+			break;
+		case 'v':
+			cctools_version_print(stdout, argv[0]);
+			return EXIT_SUCCESS;
+		case 'h':
+			show_help(path_basename(argv[0]));
+			return EXIT_SUCCESS;
+		default:
+			show_help(path_basename(argv[0]));
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(config.workers < 1 || config.cores < 1 || config.tasks < 0 || config.task_cores < 1 || config.inputs < 0) {
+		show_help(path_basename(argv[0]));
+		return EXIT_FAILURE;
+	}
+
+	// Both the master and the simulator hold a connection for each worker.
+	if(!raise_fd_limit(config.workers + 64))
+		fatal("cannot open %d file descriptors, try a lower number of workers.", config.workers + 64);
+
+	snprintf(config.dir, sizeof(config.dir), "work_queue_bench.%d", (int) getpid());
+	if(!create_dir(config.dir, 0755))
+		fatal("could not create %s: %s", config.dir, strerror(errno));
+
+	create_inputs();
+
+	struct work_queue *q = work_queue_create(0);
+	if(!q)
+		fatal("couldn't listen on any port!");
+
+	// Workers holding the inputs find them by their contents.
+	if(config.cached_fraction > 0)
+		work_queue_tune(q, "content-addressed-cache", 1);
+
+	char *tune;
+	list_first_item(tunes);
+	while((tune = list_next_item(tunes))) {
+		char *value = strchr(tune, '=');
+		if(!value)
+			fatal("invalid tune: %s", tune);
+		*value = 0;
+		if(work_queue_tune(q, tune, atof(value + 1)) != 0)
+			fatal("unknown parameter: %s", tune);
+	}
+
+	fflush(NULL);
+
+	pid_t simulator = fork();
+	if(simulator < 0) {
+		fatal("could not fork the simulated workers: %s", strerror(errno));
+	} else if(simulator == 0) {
+		int port = work_queue_port(q);
+		_exit(simulate_workers(port));
+	}
+
+	int ok = run_master(q, simulator);
+
+	work_queue_delete(q);
+
+	// The simulated workers exit once the master released them.
+	int status;
+	if(waitpid(simulator, &status, 0) == simulator && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+		ok = 0;
+
+	unlink_recursive(config.dir);
+	list_delete(tunes);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,155 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "work_queue_compress.h"
+
+#include "debug.h"
+#include "full_io.h"
+#include "link.h"
+#include "macros.h"
+#include "xxmalloc.h"
+
+#include <zlib.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Room for the header line of a block. */
+#define HEADER_MAX 64
+
+/* A block is sent compressed only if it shrinks to this fraction or less. */
+#define COMPRESS_MIN_RATIO 0.9
+
+/* Maximum of blocks sent plain after one that did not compress. */
+#define BACKOFF_MAX 64
+
+void work_queue_compress_init(struct work_queue_compress *z)
+{
+	memset(z, 0, sizeof(*z));
+	z->backoff = 1;
+}
+
+size_t work_queue_compress_bound(size_t length)
+{
+	return HEADER_MAX + MAX((size_t) compressBound(length), length);
+}
+
+size_t work_queue_compress_block(struct work_queue_compress *z, const char *data, size_t length, char *out)
+{
+	char header[HEADER_MAX];
+	uLongf compressed_length = 0;
+	int header_length;
+
+	if(z->skip > 0) {
+		z->skip--;
+	} else {
+		compressed_length = compressBound(length);
+		if(compress2((Bytef *) out + HEADER_MAX, &compressed_length, (const Bytef *) data, length, Z_BEST_SPEED) != Z_OK || compressed_length > COMPRESS_MIN_RATIO * length) {
+			compressed_length = 0;
+			z->skip = z->backoff;
+			z->backoff = MIN(2 * z->backoff, BACKOFF_MAX);
+		} else {
+			z->backoff = 1;
+		}
+	}
+
+	header_length = snprintf(header, sizeof(header), "%zu %lu\n", length, (unsigned long) compressed_length);
+
+	/* the data is moved right after the header, which is known only now. */
+	if(compressed_length > 0) {
+		memmove(out + header_length, out + HEADER_MAX, compressed_length);
+	} else {
+		memcpy(out + header_length, data, length);
+	}
+	memcpy(out, header, header_length);
+
+	size_t block_length = header_length + (compressed_length > 0 ? compressed_length : length);
+
+	z->plain_bytes += length;
+	z->wire_bytes += block_length;
+
+	return block_length;
+}
+
+int64_t work_queue_compress_send(struct work_queue_compress *z, struct link *link, int fd, int64_t length, time_t stoptime)
+{
+	char *data = xxmalloc(WORK_QUEUE_COMPRESS_BLOCK);
+	char *out = xxmalloc(work_queue_compress_bound(WORK_QUEUE_COMPRESS_BLOCK));
+	int64_t total = 0;
+
+	while(total < length) {
+		ssize_t chunk = full_read(fd, data, MIN(length - total, WORK_QUEUE_COMPRESS_BLOCK));
+		if(chunk <= 0)
+			break;
+
+		size_t block_length = work_queue_compress_block(z, data, chunk, out);
+		if(link_putlstring(link, out, block_length, stoptime) != (ssize_t) block_length)
+			break;
+
+		total += chunk;
+	}
+
+	free(data);
+	free(out);
+
+	return total;
+}
+
+int64_t work_queue_compress_recv(struct link *link, int fd, int64_t length, time_t stoptime)
+{
+	char line[HEADER_MAX];
+	char *data = xxmalloc(WORK_QUEUE_COMPRESS_BLOCK);
+	char *compressed = xxmalloc(work_queue_compress_bound(WORK_QUEUE_COMPRESS_BLOCK));
+	int64_t total = 0;
+
+	while(total < length) {
+		int64_t plain_length, compressed_length;
+
+		if(!link_readline(link, line, sizeof(line), stoptime))
+			break;
+
+		if(sscanf(line, "%" SCNd64 " %" SCNd64, &plain_length, &compressed_length) != 2
+				|| plain_length < 1 || plain_length > MIN(length - total, WORK_QUEUE_COMPRESS_BLOCK)
+				|| compressed_length < 0 || compressed_length > (int64_t) compressBound(plain_length)) {
+			debug(D_WQ, "invalid compressed block header: %s", line);
+			total = -1;
+			break;
+		}
+
+		if(compressed_length == 0) {
+			int64_t actual = link_stream_to_fd(link, fd, plain_length, stoptime);
+			if(actual > 0)
+				total += actual;
+			if(actual != plain_length)
+				break;
+			continue;
+		}
+
+		if(link_read(link, compressed, compressed_length, stoptime) != compressed_length)
+			break;
+
+		uLongf actual_length = plain_length;
+		if(uncompress((Bytef *) data, &actual_length, (const Bytef *) compressed, compressed_length) != Z_OK || (int64_t) actual_length != plain_length) {
+			debug(D_WQ, "could not uncompress block of %" PRId64 " bytes", compressed_length);
+			total = -1;
+			break;
+		}
+
+		if(full_write(fd, data, plain_length) != plain_length)
+			break;
+
+		total += plain_length;
+	}
+
+	free(data);
+	free(compressed);
+
+	return total;
+}
+
+/* vim: set noexpandtab tabstop=4: */
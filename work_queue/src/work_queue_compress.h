@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef WORK_QUEUE_COMPRESS_H
+#define WORK_QUEUE_COMPRESS_H
+
+/** @file work_queue_compress.h
+Compressed file transfers between master and worker.
+A compressed transfer is a sequence of blocks. Each block is a header line
+"<length> <compressed length>" followed by the compressed data, or by the
+plain data if the compressed length is zero. Blocks that do not compress
+well are sent plain, and after such a block a few more are sent without
+trying, so that incompressible data costs little.
+This file should not be installed and should only be included by .c files.
+*/
+
+#include "link.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define WORK_QUEUE_COMPRESS_BLOCK (1<<20)  /**< Maximum of plain bytes in a block. */
+
+struct work_queue_compress {
+	int skip;              /**< Blocks left to send plain without trying to compress. */
+	int backoff;           /**< Blocks to skip after the next block that does not compress. */
+	int64_t plain_bytes;   /**< Bytes of the file sent so far. */
+	int64_t wire_bytes;    /**< Bytes written on the link so far. */
+};
+
+/** Initialize the state of a compressed transfer. */
+void work_queue_compress_init(struct work_queue_compress *z);
+
+/** Size of a buffer large enough for any block of at most length plain bytes. */
+size_t work_queue_compress_bound(size_t length);
+
+/** Encode data as a single block into out, of at least @ref work_queue_compress_bound bytes.
+@return The size of the block in out.
+*/
+size_t work_queue_compress_block(struct work_queue_compress *z, const char *data, size_t length, char *out);
+
+/** Send length bytes from fd as compressed blocks.
+@return The number of bytes of the file sent.
+*/
+int64_t work_queue_compress_send(struct work_queue_compress *z, struct link *link, int fd, int64_t length, time_t stoptime);
+
+/** Receive length bytes sent with @ref work_queue_compress_send, and write them to fd.
+@return The number of bytes written to fd, or -1 if the blocks are malformed.
+*/
+int64_t work_queue_compress_recv(struct link *link, int fd, int64_t length, time_t stoptime);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "work_queue_frame.h"
+
+#include "debug.h"
+#include "link.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+/* Number of fields of each type of frame. */
+static const int frame_fields[WORK_QUEUE_FRAME_TYPE_MAX] = {
+	[WORK_QUEUE_FRAME_NONE]      = 0,
+	[WORK_QUEUE_FRAME_CHECK]     = 0,
+	[WORK_QUEUE_FRAME_ALIVE]     = WORK_QUEUE_FRAME_ALIVE_FIELDS,
+	[WORK_QUEUE_FRAME_RESOURCES] = WORK_QUEUE_FRAME_RESOURCES_FIELDS,
+	[WORK_QUEUE_FRAME_TASK]      = WORK_QUEUE_FRAME_TASK_FIELDS,
+	[WORK_QUEUE_FRAME_RESULT]    = WORK_QUEUE_FRAME_RESULT_FIELDS,
+};
+
+static const char *frame_names[WORK_QUEUE_FRAME_TYPE_MAX] = {
+	[WORK_QUEUE_FRAME_NONE]      = "frame none",
+	[WORK_QUEUE_FRAME_CHECK]     = "frame check",
+	[WORK_QUEUE_FRAME_ALIVE]     = "frame alive",
+	[WORK_QUEUE_FRAME_RESOURCES] = "frame resources",
+	[WORK_QUEUE_FRAME_TASK]      = "frame task",
+	[WORK_QUEUE_FRAME_RESULT]    = "frame result",
+};
+
+void work_queue_frame_init(struct work_queue_frame *f, work_queue_frame_type_t type)
+{
+	memset(f, 0, sizeof(*f));
+	f->type = type;
+	f->count = frame_fields[type];
+}
+
+const char *work_queue_frame_name(work_queue_frame_type_t type)
+{
+	if(type < 0 || type >= WORK_QUEUE_FRAME_TYPE_MAX)
+		return "frame unknown";
+
+	return frame_names[type];
+}
+
+size_t work_queue_frame_encode(const struct work_queue_frame *f, char *out)
+{
+	unsigned char *p = (unsigned char *) out;
+	int i, j;
+
+	*p++ = WORK_QUEUE_FRAME_MAGIC;
+	*p++ = f->type;
+	*p++ = (f->count >> 8) & 0xff;
+	*p++ = f->count & 0xff;
+
+	for(i = 0; i < f->count; i++) {
+		uint64_t v = f->fields[i];
+		for(j = 7; j >= 0; j--) {
+			*p++ = (v >> (8*j)) & 0xff;
+		}
+	}
+
+	return (char *) p - out;
+}
+
+int work_queue_frame_send(struct link *link, const struct work_queue_frame *f, time_t stoptime)
+{
+	char data[WORK_QUEUE_FRAME_MAX];
+	size_t length = work_queue_frame_encode(f, data);
+
+	return link_putlstring(link, data, length, stoptime) == (ssize_t) length;
+}
+
+static int frame_recv_body(struct link *link, struct work_queue_frame *f, time_t stoptime)
+{
+	unsigned char data[8*WORK_QUEUE_FRAME_FIELDS_MAX];
+	int i, j;
+
+	/* the magic byte was already read. */
+	if(link_read(link, (char *) data, WORK_QUEUE_FRAME_HEADER - 1, stoptime) != WORK_QUEUE_FRAME_HEADER - 1)
+		return 0;
+
+	int type = data[0];
+	int count = (data[1] << 8) | data[2];
+
+	if(type <= WORK_QUEUE_FRAME_NONE || type >= WORK_QUEUE_FRAME_TYPE_MAX || count != frame_fields[type]) {
+		debug(D_WQ, "invalid frame of type %d with %d fields", type, count);
+		return 0;
+	}
+
+	if(count > 0 && link_read(link, (char *) data, 8*count, stoptime) != 8*count)
+		return 0;
+
+	f->type = type;
+	f->count = count;
+
+	for(i = 0; i < count; i++) {
+		uint64_t v = 0;
+		for(j = 0; j < 8; j++) {
+			v = (v << 8) | data[8*i + j];
+		}
+		f->fields[i] = (int64_t) v;
+	}
+
+	return 1;
+}
+
+int work_queue_frame_recv(struct link *link, struct work_queue_frame *f, char *line, size_t length, time_t stoptime)
+{
+	char c;
+
+	if(f)
+		f->type = WORK_QUEUE_FRAME_NONE;
+
+	if(length < 2 || link_read(link, &c, 1, stoptime) != 1)
+		return 0;
+
+	if((unsigned char) c == WORK_QUEUE_FRAME_MAGIC) {
+		if(!f) {
+			debug(D_WQ, "unexpected frame");
+			return 0;
+		}
+
+		if(!frame_recv_body(link, f, stoptime))
+			return 0;
+
+		strncpy(line, work_queue_frame_name(f->type), length - 1);
+		line[length - 1] = '\0';
+
+		return 1;
+	}
+
+	/* a text line, of which c is the first character. */
+	if(c == '\n') {
+		line[0] = '\0';
+		return 1;
+	} else if(c == '\r') {
+		return link_readline(link, line, length, stoptime);
+	}
+
+	line[0] = c;
+	return link_readline(link, line + 1, length - 1, stoptime);
+}
+
+void work_queue_frame_from_resources(struct work_queue_frame *f, const struct work_queue_resources *r)
+{
+	const struct work_queue_resource *rs[] = { &r->workers, &r->disk, &r->memory, &r->gpus, &r->cores };
+	int i;
+
+	work_queue_frame_init(f, WORK_QUEUE_FRAME_RESOURCES);
+
+	for(i = 0; i < 5; i++) {
+		f->fields[3*i]     = rs[i]->total;
+		f->fields[3*i + 1] = rs[i]->smallest;
+		f->fields[3*i + 2] = rs[i]->largest;
+	}
+
+	f->fields[15] = r->tag;
+}
+
+void work_queue_frame_to_resources(const struct work_queue_frame *f, struct work_queue_resources *r)
+{
+	struct work_queue_resource *rs[] = { &r->workers, &r->disk, &r->memory, &r->gpus, &r->cores };
+	int i;
+
+	for(i = 0; i < 5; i++) {
+		rs[i]->total    = f->fields[3*i];
+		rs[i]->smallest = f->fields[3*i + 1];
+		rs[i]->largest  = f->fields[3*i + 2];
+	}
+
+	r->tag = f->fields[15];
+}
+
+/* vim: set noexpandtab tabstop=4: */
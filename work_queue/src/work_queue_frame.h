@@ -0,0 +1,108 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef WORK_QUEUE_FRAME_H
+#define WORK_QUEUE_FRAME_H
+
+/** @file work_queue_frame.h
+Binary frames for the frequent messages between master and worker.
+A frame is a magic byte, a type byte, and a two byte count of fields,
+followed by that many 64 bit fields, all in network byte order. The magic
+byte never starts a text message, so frames and text lines may be freely
+mixed on a link, and a reader tells them apart by their first byte.
+A worker offers frames with "info frames <version>", and may send them
+only after the master answers "frames". The master sends frames only to
+workers that offered them, so either side falls back to text messages
+when talking to an older peer.
+This file should not be installed and should only be included by .c files.
+*/
+
+#include "link.h"
+#include "work_queue_resources.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define WORK_QUEUE_FRAME_VERSION 1          /**< Version of the frames offered by a worker. */
+#define WORK_QUEUE_FRAME_MAGIC 0x80         /**< First byte of a frame. */
+#define WORK_QUEUE_FRAME_HEADER 4           /**< Bytes of a frame before its fields. */
+#define WORK_QUEUE_FRAME_FIELDS_MAX 16      /**< Maximum of fields in a frame. */
+#define WORK_QUEUE_FRAME_MAX (WORK_QUEUE_FRAME_HEADER + 8*WORK_QUEUE_FRAME_FIELDS_MAX)  /**< Maximum size of an encoded frame. */
+
+typedef enum {
+	WORK_QUEUE_FRAME_NONE = 0,   /**< Not a frame, but a text line. */
+	WORK_QUEUE_FRAME_CHECK,      /**< Keepalive check from the master. No fields. */
+	WORK_QUEUE_FRAME_ALIVE,      /**< Keepalive answer from the worker. */
+	WORK_QUEUE_FRAME_RESOURCES,  /**< Resources of the worker. */
+	WORK_QUEUE_FRAME_TASK,       /**< Start of a task from the master, followed by the command and the text lines of the task. */
+	WORK_QUEUE_FRAME_RESULT,     /**< Result of a task from the worker, followed by its output. */
+	WORK_QUEUE_FRAME_TYPE_MAX
+} work_queue_frame_type_t;
+
+/* Fields of an alive frame. */
+#define WORK_QUEUE_FRAME_ALIVE_TASKS_RUNNING 0
+#define WORK_QUEUE_FRAME_ALIVE_FIELDS 1
+
+/* Fields of a resources frame: total, smallest and largest of each resource, and the tag. */
+#define WORK_QUEUE_FRAME_RESOURCES_FIELDS 16
+
+/* Fields of a task frame. Limits that are not given are -1. */
+#define WORK_QUEUE_FRAME_TASK_TASKID 0
+#define WORK_QUEUE_FRAME_TASK_COMMAND_LENGTH 1
+#define WORK_QUEUE_FRAME_TASK_CORES 2
+#define WORK_QUEUE_FRAME_TASK_MEMORY 3
+#define WORK_QUEUE_FRAME_TASK_DISK 4
+#define WORK_QUEUE_FRAME_TASK_GPUS 5
+#define WORK_QUEUE_FRAME_TASK_END_TIME 6
+#define WORK_QUEUE_FRAME_TASK_WALL_TIME 7
+#define WORK_QUEUE_FRAME_TASK_FIELDS 8
+
+/* Fields of a result frame, as in the text result message. */
+#define WORK_QUEUE_FRAME_RESULT_STATUS 0
+#define WORK_QUEUE_FRAME_RESULT_EXIT_STATUS 1
+#define WORK_QUEUE_FRAME_RESULT_OUTPUT_LENGTH 2
+#define WORK_QUEUE_FRAME_RESULT_EXECUTION_TIME 3
+#define WORK_QUEUE_FRAME_RESULT_TASKID 4
+#define WORK_QUEUE_FRAME_RESULT_FIELDS 5
+
+struct work_queue_frame {
+	work_queue_frame_type_t type;
+	int count;
+	int64_t fields[WORK_QUEUE_FRAME_FIELDS_MAX];
+};
+
+/** Set f to an empty frame of the given type, with the number of fields of that type, all zero. */
+void work_queue_frame_init(struct work_queue_frame *f, work_queue_frame_type_t type);
+
+/** Name of a type of frame, for debugging. */
+const char *work_queue_frame_name(work_queue_frame_type_t type);
+
+/** Encode f into out, of at least @ref WORK_QUEUE_FRAME_MAX bytes.
+@return The size of the encoded frame.
+*/
+size_t work_queue_frame_encode(const struct work_queue_frame *f, char *out);
+
+/** Send f on link.
+@return 1 on success, 0 on failure.
+*/
+int work_queue_frame_send(struct link *link, const struct work_queue_frame *f, time_t stoptime);
+
+/** Receive either a frame or a text line.
+If a text line is read, it is written to line and f->type is @ref WORK_QUEUE_FRAME_NONE.
+If a frame is read, it is written to f, and line is set to its name.
+@param f The frame read, or NULL if frames are not expected, in which case a frame is an error.
+@return 1 on success, 0 on failure or on a malformed frame.
+*/
+int work_queue_frame_recv(struct link *link, struct work_queue_frame *f, char *line, size_t length, time_t stoptime);
+
+/** Set f to a resources frame with the total, smallest and largest of r, and its tag. */
+void work_queue_frame_from_resources(struct work_queue_frame *f, const struct work_queue_resources *r);
+
+/** Copy the total, smallest and largest of each resource, and the tag, from a resources frame into r. Other members of r are kept. */
+void work_queue_frame_to_resources(const struct work_queue_frame *f, struct work_queue_resources *r);
+
+#endif
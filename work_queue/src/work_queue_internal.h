@@ -41,6 +41,9 @@ int work_queue_submit_internal(struct work_queue *q, struct work_queue_task *t);
 /** Same as @ref work_queue_invalidate_cached_file, but takes filename as face value, rather than computing cached_name. */
 void work_queue_invalidate_cached_file_internal(struct work_queue *q, const char *filename);
 
+/** Same as @ref work_queue_remove_cached_file, but takes filename as face value, rather than computing cached_name. */
+void work_queue_remove_cached_file_internal(struct work_queue *q, const char *filename);
+
 void release_all_workers(struct work_queue *q);
 
 void update_catalog(struct work_queue *q, struct link *foreman_uplink, int force_update );
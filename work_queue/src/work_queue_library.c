@@ -0,0 +1,224 @@
+#include "work_queue_library.h"
+#include "work_queue_protocol.h"
+
+#include "debug.h"
+#include "create_dir.h"
+#include "delete_dir.h"
+#include "link.h"
+#include "macros.h"
+#include "path.h"
+#include "rmonitor_poll_internal.h"
+#include "stringtools.h"
+#include "timestamp.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static const char invocation_output_template[] = "./worker.stdout.XXXXXX";
+
+struct work_queue_library *work_queue_library_create( const char *command, const char *dir )
+{
+	int fds[2];
+
+	if(!create_dir(dir, 0777)) {
+		debug(D_WQ, "could not create library directory %s: %s", dir, strerror(errno));
+		return NULL;
+	}
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		debug(D_WQ, "could not create socket for library: %s", strerror(errno));
+		return NULL;
+	}
+
+	// Only the library holds its end of the socket, so that neither tasks
+	// nor other libraries keep it open.
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+	fflush(NULL);
+
+	pid_t pid = fork();
+
+	if(pid < 0) {
+		debug(D_WQ, "couldn't create new process: %s\n", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return NULL;
+	} else if(pid == 0) {
+		setpgid(0, 0);
+
+		if(chdir(dir))
+			fatal("could not change directory into %s: %s", dir, strerror(errno));
+
+		int fd = open("library.stderr", O_WRONLY | O_CREAT | O_APPEND, 0666);
+		if(fd == -1)
+			fatal("could not open library.stderr: %s", strerror(errno));
+
+		if(dup2(fds[1], STDIN_FILENO) == -1 || dup2(fds[1], STDOUT_FILENO) == -1 || dup2(fd, STDERR_FILENO) == -1)
+			fatal("could not dup socket to library: %s", strerror(errno));
+
+		close(fd);
+		close(fds[0]);
+		close(fds[1]);
+
+		execlp("sh", "sh", "-c", command, (char *) 0);
+		_exit(127);
+	}
+
+	// As with tasks, the library leads its own process group, so that it is
+	// killed together with the processes it forks. Both parent and child set
+	// the group, so that it is set before either goes on.
+	setpgid(pid, 0);
+	close(fds[1]);
+
+	struct work_queue_library *l = xxmalloc(sizeof(*l));
+	memset(l, 0, sizeof(*l));
+
+	l->command = xxstrdup(command);
+	l->dir = xxstrdup(dir);
+	l->pid = pid;
+	l->link = link_attach_to_fd(fds[0]);
+
+	debug(D_WQ, "started library %d: %s", pid, command);
+
+	return l;
+}
+
+int work_queue_library_invoke( struct work_queue_library *l, struct work_queue_process *p, time_t stoptime )
+{
+	char sandbox[PATH_MAX];
+	const char *args = p->task->command_line;
+	size_t length = strlen(args);
+
+	path_absolute(p->sandbox, sandbox, 0);
+
+	p->output_file_name = xxstrdup(invocation_output_template);
+	p->output_fd = mkstemp(p->output_file_name);
+	if(p->output_fd == -1) {
+		debug(D_WQ, "Could not open worker stdout: %s", strerror(errno));
+		return 0;
+	}
+
+	p->execution_start = timestamp_get();
+
+	struct rmonitor_cpu_time_info cpu;
+	l->cpu_time_start = rmonitor_get_cpu_time_usage(l->pid, &cpu) == 0 ? cpu.accumulated : 0;
+
+	char *header = string_format("invoke %d %zu %zu\n", p->task->taskid, strlen(sandbox), length);
+	int ok = link_putstring(l->link, header, stoptime) == (ssize_t) strlen(header)
+		&& link_putstring(l->link, sandbox, stoptime) == (ssize_t) strlen(sandbox)
+		&& link_putlstring(l->link, args, length, stoptime) == (ssize_t) length;
+	free(header);
+
+	// A library that cannot take the invocation is ended, and then the
+	// invocation fails as the worker finds that the library exited.
+	if(!ok) {
+		debug(D_WQ, "could not send task %d to library %d: %s", p->task->taskid, l->pid, strerror(errno));
+		kill(-l->pid, SIGKILL);
+	}
+
+	p->pid = l->pid;
+	p->library = l;
+	l->current = p;
+	l->invocations++;
+
+	debug(D_WQ, "invoked library %d for task %d: %s", l->pid, p->task->taskid, args);
+
+	return 1;
+}
+
+/*
+Record in the rusage of p the cpu time the library used since the invocation
+started, as user time, and the peak resident memory of the library.
+*/
+
+static void measure_invocation( struct work_queue_library *l, struct work_queue_process *p )
+{
+	struct rmonitor_cpu_time_info cpu;
+	struct rmonitor_mem_info mem;
+
+	memset(&p->rusage, 0, sizeof(p->rusage));
+
+	if(rmonitor_get_cpu_time_usage(l->pid, &cpu) == 0 && cpu.accumulated > l->cpu_time_start) {
+		uint64_t usecs = cpu.accumulated - l->cpu_time_start;
+		p->rusage.ru_utime.tv_sec  = usecs / USECOND;
+		p->rusage.ru_utime.tv_usec = usecs % USECOND;
+	}
+
+	if(rmonitor_get_mem_usage(l->pid, &mem) == 0) {
+		/* resident is in MB, and ru_maxrss in KB. */
+		p->rusage.ru_maxrss = mem.resident * 1024;
+	}
+}
+
+int work_queue_library_result_ready( struct work_queue_library *l )
+{
+	return link_usleep(l->link, 0, 1, 0) > 0;
+}
+
+int work_queue_library_result( struct work_queue_library *l, time_t stoptime )
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	int exit_status;
+	int64_t length;
+
+	struct work_queue_process *p = l->current;
+	l->current = NULL;
+	p->library = NULL;
+
+	p->execution_end = timestamp_get();
+	measure_invocation(l, p);
+
+	if(!link_readline(l->link, line, sizeof(line), stoptime)) {
+		debug(D_WQ, "library %d did not answer task %d", l->pid, p->task->taskid);
+		return 0;
+	}
+
+	if(sscanf(line, "result %d %" SCNd64, &exit_status, &length) != 2 || length < 0) {
+		debug(D_WQ, "invalid answer from library %d: %s", l->pid, line);
+		return 0;
+	}
+
+	if(link_stream_to_fd(l->link, p->output_fd, length, stoptime) != length) {
+		debug(D_WQ, "could not read the output of task %d from library %d", p->task->taskid, l->pid);
+		return 0;
+	}
+
+	p->exit_status = exit_status;
+
+	debug(D_WQ, "task %d (library %d) exited normally with exit code %d, cpu time %ld.%06lds, peak memory %ldKB", p->task->taskid, l->pid, p->exit_status, (long) p->rusage.ru_utime.tv_sec, (long) p->rusage.ru_utime.tv_usec, (long) p->rusage.ru_maxrss);
+
+	return 1;
+}
+
+void work_queue_library_delete( struct work_queue_library *l )
+{
+	if(l->pid > 0) {
+		debug(D_WQ, "terminating library %d", l->pid);
+		kill(-l->pid, SIGKILL);
+		waitpid(l->pid, NULL, 0);
+	}
+
+	if(l->current)
+		l->current->library = NULL;
+
+	link_close(l->link);
+	delete_dir(l->dir);
+
+	free(l->command);
+	free(l->dir);
+	free(l);
+}
+
+/* vim: set noexpandtab tabstop=4: */
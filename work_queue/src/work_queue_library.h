@@ -0,0 +1,54 @@
+#ifndef WORK_QUEUE_LIBRARY_H
+#define WORK_QUEUE_LIBRARY_H
+
+#include "work_queue_process.h"
+#include "link.h"
+
+#include <time.h>
+#include <sys/types.h>
+
+/*
+work_queue_library is a long running process started on the worker to serve
+the invocations of tasks created with work_queue_task_specify_library, so
+that the cost of starting a program, such as loading an interpreter and its
+modules, is paid once per library rather than once per task. An instance
+serves one invocation at a time, so a worker runs one instance for each
+invocation running at once.
+
+The library is started with sh -c in a directory of its own, with its
+standard input and output connected to the worker. For each invocation, the
+worker writes the line:
+
+invoke <taskid> <sandbox_length> <length>
+
+followed by sandbox_length bytes with the absolute path of the sandbox of the
+task, and then by length bytes of arguments, which are the command line of the
+task. The sandbox is the directory with the input files of the task, where
+output files are expected. Its path is sent apart from the line, as it may
+contain spaces. The library answers with the line:
+
+result <exit_status> <length>
+
+followed by length bytes of output, which become the output of the task.
+The cpu time and memory of the library while serving an invocation are
+recorded in the rusage of its process.
+This object is private to the work_queue_worker.
+*/
+
+struct work_queue_library {
+	char *command;                       // command that starts the library.
+	char *dir;                           // directory where the library runs.
+	pid_t pid;
+	struct link *link;                   // to write invocations and read results.
+	struct work_queue_process *current;  // invocation being served, or NULL if idle.
+	int64_t invocations;                 // invocations served so far.
+	uint64_t cpu_time_start;             // cpu time of the library when the current invocation started, in usecs.
+};
+
+struct work_queue_library *work_queue_library_create( const char *command, const char *dir );
+int  work_queue_library_invoke( struct work_queue_library *l, struct work_queue_process *p, time_t stoptime );
+int  work_queue_library_result_ready( struct work_queue_library *l );
+int  work_queue_library_result( struct work_queue_library *l, time_t stoptime );
+void work_queue_library_delete( struct work_queue_library *l );
+
+#endif
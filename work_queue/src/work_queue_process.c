@@ -239,6 +239,10 @@ pid_t work_queue_process_execute(struct work_queue_process *p, int container_mod
 		return p->pid;
 
 	} else {
+		// Also set the process group from the child, as the call in the
+		// parent fails if the child has already called exec.
+		setpgid(0, 0);
+
 		if(chdir(p->sandbox)) {
 			printf("The sandbox dir is %s", p->sandbox);
 			fatal("could not change directory into %s: %s", p->sandbox, strerror(errno));
@@ -16,6 +16,8 @@
 
 #define MAX_BUFFER_SIZE 4096
 
+struct work_queue_library;
+
 /*
 work_queue_process is a running instance of a work_queue_task.
 This object is private to the work_queue_worker.
@@ -50,6 +52,9 @@ struct work_queue_process {
 	struct path_disk_size_info *disk_measurement_state;
 
 	char container_id[MAX_BUFFER_SIZE];
+
+	/* library serving the process, if the task is an invocation of a library. */
+	struct work_queue_library *library;
 };
 
 struct work_queue_process * work_queue_process_create( struct work_queue_task *task, int disk_allocation );
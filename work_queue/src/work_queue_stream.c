@@ -0,0 +1,194 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "work_queue_stream.h"
+
+#include "debug.h"
+#include "full_io.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+void work_queue_stream_init(struct work_queue_stream *s, struct link *link, int compress, int timeout)
+{
+	memset(s, 0, sizeof(*s));
+	s->link = link;
+	buffer_init(&s->buffer);
+	buffer_abortonfailure(&s->buffer, 1);
+	s->data = xxmalloc(WORK_QUEUE_STREAM_BUFFER);
+	s->compress = compress;
+	if(compress) {
+		work_queue_compress_init(&s->z);
+		s->block = xxmalloc(work_queue_compress_bound(WORK_QUEUE_STREAM_BUFFER));
+	}
+	s->timeout = timeout;
+}
+
+void work_queue_stream_delete(struct work_queue_stream *s)
+{
+	buffer_free(&s->buffer);
+	free(s->data);
+	free(s->block);
+}
+
+int work_queue_stream_flush(struct work_queue_stream *s)
+{
+	size_t length;
+	const char *data = buffer_tolstring(&s->buffer, &length);
+
+	if(length < 1)
+		return 1;
+
+	if(link_putlstring(s->link, data, length, time(0) + s->timeout) != (ssize_t) length) {
+		debug(D_WQ, "failed to write %zu bytes of stream: %s", length, strerror(errno));
+		return -1;
+	}
+
+	s->wire_bytes += length;
+	buffer_rewind(&s->buffer, 0);
+
+	return 1;
+}
+
+static int stream_missing(struct work_queue_stream *s, const char *name, int errnum)
+{
+	debug(D_WQ, "could not stream %s: %s", name, strerror(errnum));
+	buffer_printf(&s->buffer, "missing %s %d\n", name, errnum);
+	s->items++;
+	return 0;
+}
+
+static int stream_file(struct work_queue_stream *s, const char *path, const char *name, struct stat *info)
+{
+	int64_t length = info->st_size;
+	int mode = info->st_mode & 0777;
+
+	int fd = open(path, O_RDONLY, 0);
+	if(fd < 0)
+		return stream_missing(s, name, errno);
+
+	const char *type = s->compress ? "zfile" : "file";
+
+	/* small files are copied into the buffer, along with their header. */
+	if(length <= WORK_QUEUE_STREAM_BUFFER) {
+		ssize_t actual = full_read(fd, s->data, length);
+		int errnum = errno;
+		close(fd);
+
+		if(actual != length)
+			return stream_missing(s, name, actual < 0 ? errnum : EIO);
+
+		buffer_printf(&s->buffer, "%s %s %" PRId64 " 0%o\n", type, name, length, mode);
+
+		if(s->compress && length > 0) {
+			size_t block_length = work_queue_compress_block(&s->z, s->data, length, s->block);
+			buffer_putlstring(&s->buffer, s->block, block_length);
+		} else {
+			buffer_putlstring(&s->buffer, s->data, length);
+		}
+
+		s->items++;
+		s->plain_bytes += length;
+
+		if(buffer_pos(&s->buffer) > WORK_QUEUE_STREAM_BUFFER)
+			return work_queue_stream_flush(s);
+
+		return 1;
+	}
+
+	/* large files are written straight from the file, after the entries before them. */
+	buffer_printf(&s->buffer, "%s %s %" PRId64 " 0%o\n", type, name, length, mode);
+	s->items++;
+
+	if(work_queue_stream_flush(s) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	int64_t actual;
+	if(s->compress) {
+		int64_t wire_bytes = s->z.wire_bytes;
+		actual = work_queue_compress_send(&s->z, s->link, fd, length, time(0) + s->timeout);
+		s->wire_bytes += s->z.wire_bytes - wire_bytes;
+	} else {
+		actual = link_stream_from_fd(s->link, fd, length, time(0) + s->timeout);
+		if(actual > 0)
+			s->wire_bytes += actual;
+	}
+	close(fd);
+
+	if(actual != length) {
+		debug(D_WQ, "failed to stream %s: %" PRId64 " of %" PRId64 " bytes sent", name, actual, length);
+		return -1;
+	}
+
+	s->plain_bytes += length;
+
+	return 1;
+}
+
+static int stream_dir(struct work_queue_stream *s, const char *path, const char *name, struct stat *info, int recursive)
+{
+	DIR *dir = opendir(path);
+	if(!dir)
+		return stream_missing(s, name, errno);
+
+	buffer_printf(&s->buffer, "dir %s 0%o\n", name, (int) (info->st_mode & 0777));
+	s->items++;
+
+	int result = 1;
+	struct dirent *d;
+
+	while(recursive && (d = readdir(dir))) {
+		if(!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+
+		char *subpath = string_format("%s/%s", path, d->d_name);
+		char *subname = string_format("%s/%s", name, d->d_name);
+
+		int r = work_queue_stream_put(s, subpath, subname, recursive);
+
+		free(subpath);
+		free(subname);
+
+		if(r < 0) {
+			result = -1;
+			break;
+		} else if(r == 0) {
+			result = 0;
+		}
+	}
+
+	closedir(dir);
+
+	return result;
+}
+
+int work_queue_stream_put(struct work_queue_stream *s, const char *path, const char *name, int recursive)
+{
+	struct stat info;
+
+	if(stat(path, &info) != 0)
+		return stream_missing(s, name, errno);
+
+	if(S_ISDIR(info.st_mode)) {
+		return stream_dir(s, path, name, &info, recursive);
+	} else {
+		return stream_file(s, path, name, &info);
+	}
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,66 @@
+/*
+Copyright (C) 2017- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef WORK_QUEUE_STREAM_H
+#define WORK_QUEUE_STREAM_H
+
+/** @file work_queue_stream.h
+Streaming of files and directory trees between master and worker.
+An item is written as a sequence of entries, each a header line optionally
+followed by the contents of a file:
+<pre>
+dir $NAME $MODE
+file $NAME $LENGTH $MODE
+$$ CONTENTS $$
+zfile $NAME $LENGTH $MODE
+$$ CONTENTS IN THE FORMAT OF work_queue_compress_send $$
+missing $NAME $ERRNO
+</pre>
+Entries are gathered into a buffer, and small files are copied into it, so
+that a tree of many small files takes few writes to the link and no round
+trips. Mode bits are octal.
+This file should not be installed and should only be included by .c files.
+*/
+
+#include "work_queue_compress.h"
+
+#include "buffer.h"
+#include "link.h"
+
+#include <stdint.h>
+
+#define WORK_QUEUE_STREAM_BUFFER (1<<16)  /**< Files up to this size are buffered, and the buffer is written when it grows over it. */
+
+struct work_queue_stream {
+	struct link *link;
+	buffer_t buffer;                /**< Entries not yet written to the link. */
+	char *data;                     /**< Contents of the file being buffered. */
+	char *block;                    /**< Contents of the file being buffered, compressed. */
+	int compress;                   /**< If set, files are sent as zfile entries. */
+	struct work_queue_compress z;
+	int timeout;                    /**< Seconds allowed for each write to the link. */
+	int64_t items;                  /**< Entries written so far. */
+	int64_t plain_bytes;            /**< Bytes of file contents written so far. */
+	int64_t wire_bytes;             /**< Bytes written to the link so far. */
+};
+
+/** Initialize a stream to a link. Release it with @ref work_queue_stream_delete. */
+void work_queue_stream_init(struct work_queue_stream *s, struct link *link, int compress, int timeout);
+
+/** Release the buffers of a stream. Entries still buffered are discarded. */
+void work_queue_stream_delete(struct work_queue_stream *s);
+
+/** Write the file or directory at path as name. If recursive, the contents of a directory are written too.
+@return 1 on success, 0 if some item could not be read and was written as missing, or -1 if writing to the link failed.
+*/
+int work_queue_stream_put(struct work_queue_stream *s, const char *path, const char *name, int recursive);
+
+/** Write all buffered entries to the link.
+@return 1 on success, or -1 on failure.
+*/
+int work_queue_stream_flush(struct work_queue_stream *s);
+
+#endif
@@ -13,6 +13,7 @@ See the file COPYING for details.
 #include "itable.h"
 #include "list.h"
 #include "get_line.h"
+#include "timestamp.h"
 
 #include <errno.h>
 #include <limits.h>
@@ -24,6 +25,14 @@ See the file COPYING for details.
 #include <sys/types.h>
 #include <unistd.h>
 
+/* Resources of the tasks submitted. Memory and disk are in MB, and -1 means the whole worker. */
+static int task_cores = 1;
+static int task_memory = -1;
+static int task_disk = -1;
+
+/* Library of which the tasks submitted are invocations, if any. */
+static char task_library[1024] = "";
+
 int submit_tasks(struct work_queue *q, int input_size, int run_time, int output_size, int count, char *category )
 {
 	static int ntasks=0;
@@ -52,7 +61,13 @@ int submit_tasks(struct work_queue *q, int input_size, int run_time, int output_
 		struct work_queue_task *t = work_queue_task_create(command);
 		work_queue_task_specify_file(t, input_file, "infile", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
 		work_queue_task_specify_file(t, output_file, "outfile", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
-		work_queue_task_specify_cores(t,1);
+		work_queue_task_specify_cores(t,task_cores);
+		if(task_memory >= 0)
+			work_queue_task_specify_memory(t,task_memory);
+		if(task_disk >= 0)
+			work_queue_task_specify_disk(t,task_disk);
+		if(task_library[0])
+			work_queue_task_specify_library(t,task_library);
 
 		if(category && strlen(category) > 0)
 			work_queue_task_specify_category(t, category);
@@ -63,6 +78,77 @@ int submit_tasks(struct work_queue *q, int input_size, int run_time, int output_
 	return 1;
 }
 
+int submit_tree_tasks(struct work_queue *q, int entries, int count)
+{
+	static int ntrees=0;
+	char input_dir[128];
+	char output_dir[128];
+	char path[256];
+	int i;
+
+	/*
+	The tree has directories of up to 1000 small files each,
+	and every tenth file is executable, so that modes are checked too.
+	*/
+
+	sprintf(input_dir, "input_tree.%d", ntrees);
+	mkdir(input_dir, 0755);
+
+	for(i=0;i<entries;i++) {
+		if(i%1000==0) {
+			sprintf(path, "%s/%d", input_dir, i/1000);
+			mkdir(path, 0755);
+		}
+
+		sprintf(path, "%s/%d/%d", input_dir, i/1000, i);
+		FILE *file = fopen(path, "w");
+		if(!file) {
+			fprintf(stderr, "couldn't create %s: %s\n", path, strerror(errno));
+			return 0;
+		}
+		fprintf(file, "%d\n", i);
+		fclose(file);
+		chmod(path, i%10==0 ? 0755 : 0644);
+	}
+
+	for(i=0;i<count;i++) {
+		sprintf(output_dir, "output_tree.%d", ntrees);
+
+		ntrees++;
+
+		struct work_queue_task *t = work_queue_task_create("cp -rp intree outtree");
+		work_queue_task_specify_file(t, input_dir, "intree", WORK_QUEUE_INPUT, WORK_QUEUE_NOCACHE);
+		work_queue_task_specify_file(t, output_dir, "outtree", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
+		work_queue_task_specify_cores(t,1);
+
+		work_queue_submit(q, t);
+	}
+
+	return 1;
+}
+
+int submit_copy_tasks(struct work_queue *q, const char *input_file, int count)
+{
+	static int ncopies=0;
+	char output_file[128];
+	int i;
+
+	for(i=0;i<count;i++) {
+		sprintf(output_file, "output_copy.%d", ncopies);
+
+		ncopies++;
+
+		struct work_queue_task *t = work_queue_task_create("cat infile > outfile");
+		work_queue_task_specify_file(t, input_file, "infile", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+		work_queue_task_specify_file(t, output_file, "outfile", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
+		work_queue_task_specify_cores(t,1);
+
+		work_queue_submit(q, t);
+	}
+
+	return 1;
+}
+
 void wait_for_all_tasks( struct work_queue *q )
 {
 	struct work_queue_task *t;
@@ -77,7 +163,10 @@ void work_queue_mainloop( struct work_queue *q )
 	char line[1024];
 	char category[1024];
 
-	int sleep_time, run_time, input_size, output_size, count;
+	int sleep_time, run_time, input_size, output_size, count, entries;
+	char name[1024];
+	char path[1024];
+	double value;
 
 	while(1) {
 		printf("work_queue_test > ");
@@ -96,10 +185,28 @@ void work_queue_mainloop( struct work_queue *q )
 			sleep(sleep_time);
 		} else if(!strcmp(line,"wait")) {
 			printf("waiting for all tasks...\n");
+			timestamp_t start = timestamp_get();
 			wait_for_all_tasks(q);
+			printf("waited %.3lf seconds\n", (timestamp_get() - start) / 1000000.0);
 		} else if(sscanf(line, "submit %d %d %d %d %s",&input_size, &run_time, &output_size, &count, category) >= 4) {
 			printf("submitting %d tasks...\n",count);
 			submit_tasks(q,input_size,run_time,output_size,count,category);
+		} else if(sscanf(line, "submit_tree %d %d", &entries, &count) == 2) {
+			printf("submitting %d tasks...\n",count);
+			submit_tree_tasks(q,entries,count);
+		} else if(sscanf(line, "submit_copy %1023s %d", path, &count) == 2) {
+			printf("submitting %d tasks...\n",count);
+			submit_copy_tasks(q,path,count);
+		} else if(sscanf(line, "resources %d %d %d", &task_cores, &task_memory, &task_disk) == 3) {
+			printf("tasks will use %d cores, %d MB of memory and %d MB of disk...\n", task_cores, task_memory, task_disk);
+		} else if(sscanf(line, "library %1023[^\n]", task_library) == 1) {
+			printf("tasks will be invocations of library %s...\n", task_library);
+		} else if(sscanf(line, "speculation %lf %d", &value, &count) == 2) {
+			printf("duplicating tasks slower than the percentile %g of their category, up to %d at once...\n", value, count);
+			work_queue_activate_speculation(q, value, count);
+		} else if(sscanf(line, "tune %s %lf", name, &value) == 2) {
+			printf("tuning %s to %g...\n", name, value);
+			work_queue_tune(q, name, value);
 		} else if(!strcmp(line,"quit") || !strcmp(line,"exit")) {
 			break;
 		} else if(!strcmp(line,"help")) {
@@ -108,6 +215,17 @@ void work_queue_mainloop( struct work_queue *q )
 			printf("wait                    Wait for all submitted tasks to finish.\n");
 			printf("submit <I> <T> <O> <N>  Submit N tasks that read I MB input,\n");
 			printf("                        run for T seconds, and produce O MB of output.\n");
+			printf("submit_tree <E> <N>     Submit N tasks that read a directory tree\n");
+			printf("                        of E small files, and write back a copy of it.\n");
+			printf("submit_copy <F> <N>     Submit N tasks that read file F, and write back\n");
+			printf("                        a copy of it.\n");
+			printf("resources <C> <M> <D>   Tasks submitted after use C cores, M MB of memory\n");
+			printf("                        and D MB of disk, or the whole worker if -1.\n");
+			printf("library <cmd>           Tasks submitted after are invocations of the library\n");
+			printf("                        started with cmd, rather than shell commands.\n");
+			printf("tune <name> <value>     Tune a parameter of the queue, as in work_queue_tune.\n");
+			printf("speculation <P> <N>     Duplicate tasks slower than the percentile P of\n");
+			printf("                        their category, with up to N duplicates at once.\n");
 			printf("quit, exit              Wait for all tasks to complete, then exit.\n");
 			printf("\n");
 		} else {
@@ -0,0 +1,56 @@
+#!/bin/sh
+
+# Measure how fast directory trees of small files move between master and
+# worker. For each size, a task reads a tree of that many files and writes a
+# copy of it back, so every file crosses the link twice.
+#
+# Usage: work_queue_tree_benchmark.sh [entries ...]
+# Extra arguments for the master, such as "tune compress-transfers 1", may be
+# given one per line in the environment variable WQ_BENCHMARK_TUNE.
+
+bindir=$(cd "$(dirname "$0")" && pwd)
+PATH="$bindir:$PATH"
+
+sizes=${*:-1000 10000 100000}
+
+workdir=$(mktemp -d "${TMPDIR:-/tmp}/wq-tree-benchmark.XXXXXX") || exit 1
+trap 'rm -rf "$workdir"' EXIT INT TERM
+
+cd "$workdir" || exit 1
+
+printf "%10s %10s %12s\n" entries seconds files/s
+
+for entries in $sizes
+do
+	rm -rf input_tree.* output_tree.* master.port
+
+	{
+		echo "$WQ_BENCHMARK_TUNE"
+		echo "submit_tree $entries 1"
+		echo "wait"
+		echo "quit"
+	} > master.script
+
+	work_queue_test -Z master.port < master.script > master.out 2>&1 &
+	master=$!
+
+	while [ ! -s master.port ]
+	do
+		sleep 0.1
+	done
+
+	# the worker waits while the master creates the tree.
+	work_queue_worker localhost `cat master.port` --timeout 900 --cores 1 --single-shot > worker.out 2>&1
+	wait $master
+
+	if ! diff -r input_tree.0 output_tree.0 > /dev/null
+	then
+		echo "tree of $entries entries did not come back whole" 1>&2
+		exit 1
+	fi
+
+	seconds=`sed -n 's/.*waited \([0-9.]*\) seconds.*/\1/p' master.out`
+	echo $entries $seconds | awk '{ printf "%10d %10.3f %12.0f\n", $1, $2, 2 * $1 / $2 }'
+done
+
+# vim: set noexpandtab tabstop=4:
@@ -11,13 +11,19 @@ See the file COPYING for details.
 #include "work_queue_process.h"
 #include "work_queue_catalog.h"
 #include "work_queue_watcher.h"
+#include "work_queue_compress.h"
+#include "work_queue_frame.h"
+#include "work_queue_library.h"
+#include "work_queue_stream.h"
 
 #include "cctools.h"
 #include "macros.h"
 #include "catalog_query.h"
 #include "domain_name_cache.h"
 #include "jx.h"
+#include "buffer.h"
 #include "copy_stream.h"
+#include "full_io.h"
 #include "host_memory_info.h"
 #include "host_disk_info.h"
 #include "path_disk_size_info.h"
@@ -35,6 +41,7 @@ See the file COPYING for details.
 #include "create_dir.h"
 #include "delete_dir.h"
 #include "itable.h"
+#include "hash_table.h"
 #include "random.h"
 #include "url_encode.h"
 #include "md5.h"
@@ -200,6 +207,10 @@ static struct list   *procs_waiting = NULL;
 // These are additional pointers into procs_table.
 static struct itable *procs_complete = NULL;
 
+// List of all the libraries started, idle or serving an invocation.
+static struct list *libraries = NULL;
+static int libraries_started = 0;
+
 static int results_to_be_sent_msg = 0;
 
 static timestamp_t total_task_execution_time = 0;
@@ -208,6 +219,71 @@ static int total_tasks_executed = 0;
 static const char *project_regex = 0;
 static int released_by_master = 0;
 
+// Cached files are served to other workers from this port, by a child process.
+// The worker offers to serve them, and starts the server only when the master
+// enables transfers between workers, or when --peer-transfers is given.
+static int peer_transfers_enabled = 1;
+static int peer_transfers_at_start = 0;
+static int transfer_port_option = 0;
+static int transfer_port = 0;
+static pid_t transfer_server_pid = 0;
+
+// Maximum time to wait for a connection to another worker when fetching a file.
+static const int peer_connect_timeout = 30;
+
+// Cached files being fetched from another worker, or that could not be, and
+// that the master will send instead. Tasks that need them wait until they arrive.
+static struct hash_table *missing_cache_files = NULL;
+
+// Children fetching files from other workers, by pid.
+struct peer_fetch {
+	char *filename;
+	int64_t length;
+};
+
+static struct itable *peer_fetches = NULL;
+
+// Exit status of a child fetching a file from another worker. The master only
+// stops using a source for the failures of the source.
+enum { PEER_FETCH_DONE = 0, PEER_FETCH_LOCAL_FAILURE, PEER_FETCH_SOURCE_FAILURE };
+
+// Index of the objects in the cache directory, by their top level name in
+// it, so that the disk used by the cache is known without walking it, and
+// cold objects are evicted when the cache goes over its budget.
+struct cache_entry {
+	int64_t size;          // bytes of the object.
+	int64_t files;         // files of the object.
+	timestamp_t last_use;  // when last stored or needed by a task.
+	int64_t epoch;         // tasks received when last stored or needed.
+	int pins;              // tasks in procs_table that need the object.
+};
+
+static struct hash_table *cache_entries = NULL;
+static int64_t cache_bytes = 0;
+static int64_t cache_files = 0;
+
+// Number of tasks received. Objects stored since the last task may belong to
+// a task still on its way from the master, so they are not yet evicted.
+static int64_t cache_epoch = 0;
+
+// Budget of the cache, in MB. Unlimited if 0.
+static int64_t cache_budget = 0;
+
+// Objects evicted from the cache, of which the master was told with a
+// cache-invalid message. A task that needs one of them waits until the
+// master sends it again.
+static struct hash_table *cache_evicted = NULL;
+
+// Tasks whose sandbox is set up once the missing objects they need arrive,
+// indexed by taskid. These are additional pointers into procs_table.
+static struct itable *procs_unstaged = NULL;
+
+// Set once the current master accepts binary frames for frequent messages.
+static int master_frames = 0;
+
+// Outputs of tasks up to this size are sent in the same write as their results.
+#define RESULT_BATCH_OUTPUT_MAX (1<<16)
+
 __attribute__ (( format(printf,2,3) ))
 static void send_master_message( struct link *master, const char *fmt, ... )
 {
@@ -226,9 +302,20 @@ static void send_master_message( struct link *master, const char *fmt, ... )
 	va_end(va);
 }
 
-static int recv_master_message( struct link *master, char *line, int length, time_t stoptime )
+static void send_master_frame( struct link *master, const struct work_queue_frame *f )
+{
+	debug(D_WQ, "tx to master: %s", work_queue_frame_name(f->type));
+	work_queue_frame_send(master, f, time(0)+active_timeout);
+}
+
+/*
+Read a message from the master. If frame is not null, the message may also be
+a binary frame, which is then written to frame, with its name in line.
+*/
+
+static int recv_master_message( struct link *master, char *line, int length, struct work_queue_frame *frame, time_t stoptime )
 {
-	int result = link_readline(master,line,length,stoptime);
+	int result = work_queue_frame_recv(master,frame,line,length,stoptime);
 	if(result) debug(D_WQ,"rx from master: %s",line);
 	return result;
 }
@@ -244,35 +331,263 @@ void reset_idle_timer()
 }
 
 /*
-   Measure the disk used by the worker. We only manually measure the cache directory, as processes measure themselves.
-   */
+Path of a file of the cache, relative to the cache directory. The given path
+is relative either to the cache directory, or to the workspace when it starts
+with "cache/". The object that holds the file is the first component of its
+path in the cache.
+*/
 
-int64_t measure_worker_disk() {
-	static struct path_disk_size_info *state = NULL;
+static const char *cache_path( const char *path )
+{
+	while(!strncmp(path, "./", 2)) {
+		path += 2;
+	}
+
+	if(!strncmp(path, "cache/", 6)) {
+		path += 6;
+	}
+
+	return path;
+}
+
+static char *cache_object_name( const char *path )
+{
+	char *name = xxstrdup(cache_path(path));
+	char *slash = strchr(name, '/');
+	if(slash) *slash = '\0';
+
+	return name;
+}
+
+static struct cache_entry *cache_entry_get( const char *name )
+{
+	struct cache_entry *e = hash_table_lookup(cache_entries, name);
+	if(!e) {
+		e = calloc(1, sizeof(*e));
+		hash_table_insert(cache_entries, name, e);
+	}
+
+	return e;
+}
+
+static void cache_entry_use( struct cache_entry *e )
+{
+	e->last_use = timestamp_get();
+	e->epoch = cache_epoch;
+}
+
+static void cache_entry_remove( const char *name )
+{
+	struct cache_entry *e = hash_table_lookup(cache_entries, name);
+	if(!e) return;
+
+	cache_bytes -= e->size;
+	cache_files -= e->files;
+
+	// the tasks that need the object still count on the entry.
+	if(e->pins > 0) {
+		e->size  = 0;
+		e->files = 0;
+	} else {
+		hash_table_remove(cache_entries, name);
+		free(e);
+	}
+}
+
+/*
+Account for size bytes in files stored at path in the cache. A path that is
+the whole object sets its size, and a path within the object, as sent by
+putdir, adds to it.
+*/
+
+static void cache_update( const char *path, int64_t size, int64_t files )
+{
+	char *name = cache_object_name(path);
+	struct cache_entry *e = cache_entry_get(name);
+
+	if(!strchr(cache_path(path), '/')) {
+		cache_bytes -= e->size;
+		cache_files -= e->files;
+		e->size  = 0;
+		e->files = 0;
+	}
+
+	e->size  += size;
+	e->files += files;
+	cache_bytes += size;
+	cache_files += files;
+
+	cache_entry_use(e);
+	hash_table_remove(cache_evicted, name);
+
+	free(name);
+}
+
+/*
+Measure the object of the cache that holds path, when its size is not known
+from the transfer that stored it, as for outputs of tasks and urls.
+*/
+
+static void cache_measure( const char *path )
+{
+	char *name = cache_object_name(path);
+	char *cached_path = string_format("cache/%s", name);
+	struct stat info;
+
+	if(lstat(cached_path, &info) != 0) {
+		cache_entry_remove(name);
+	} else if(S_ISDIR(info.st_mode)) {
+		int64_t size, files;
+		path_disk_size_info_get(cached_path, &size, &files);
+		cache_update(name, MAX(size, 0), MAX(files, 0));
+	} else {
+		cache_update(name, info.st_size, 1);
+	}
+
+	free(cached_path);
+	free(name);
+}
+
+static void cache_clear()
+{
+	char *name;
+	struct cache_entry *e;
+
+	hash_table_firstkey(cache_entries);
+	while(hash_table_nextkey(cache_entries, &name, (void **) &e)) {
+		free(e);
+	}
+	hash_table_clear(cache_entries);
+	hash_table_clear(cache_evicted);
+
+	cache_bytes = 0;
+	cache_files = 0;
+}
+
+/*
+Index again the objects in the cache directory, as when connecting to a
+master after files named after their contents were kept from the previous one.
+*/
+
+static void cache_rescan()
+{
+	cache_clear();
+
+	DIR *dir = opendir("cache");
+	if(!dir) return;
 
-	path_disk_size_info_get_r("./cache", max_time_on_measurement, &state);
+	struct dirent *d;
+	while((d = readdir(dir))) {
+		// tmp is the scratch directory of tasks, and not an object.
+		if(!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..") || !strcmp(d->d_name, "tmp")) continue;
+		cache_measure(d->d_name);
+	}
+
+	closedir(dir);
+}
+
+/*
+Pin (delta 1) or unpin (delta -1) the objects that a task reads or writes,
+so that they are not evicted while the task is known to the worker.
+*/
+
+static void cache_pin_task( struct work_queue_process *p, int delta )
+{
+	struct list *lists[] = { p->task->input_files, p->task->output_files };
+	struct work_queue_file *f;
+	int i;
+
+	for(i = 0; i < 2; i++) {
+		if(!lists[i]) continue;
+
+		list_first_item(lists[i]);
+		while((f = list_next_item(lists[i]))) {
+			if(f->type == WORK_QUEUE_DIRECTORY) continue;
+
+			char *name = cache_object_name(f->payload);
+
+			if(delta > 0) {
+				struct cache_entry *e = cache_entry_get(name);
+				e->pins++;
+				cache_entry_use(e);
+			} else {
+				struct cache_entry *e = hash_table_lookup(cache_entries, name);
+				if(e && --e->pins < 1 && e->size == 0 && e->files == 0) {
+					// an output that was never written.
+					cache_entry_remove(name);
+				}
+			}
 
-	int64_t disk_measured = 0;
-	if(state->last_byte_size_complete >= 0) {
-		disk_measured = (int64_t) ceil(state->last_byte_size_complete/(1.0*MEGA));
+			free(name);
+		}
 	}
+}
 
-	files_counted = state->last_file_count_complete;
+/*
+Evict the least recently used objects that no task needs, until the cache is
+within its budget. The master is told of each with a cache-invalid message,
+so that it no longer counts on the object, and sends it again if a task on
+its way to this worker needs it.
+*/
 
-	if(state->complete_measurement) {
-		/* if a complete measurement has been done, then update
-		 * for the found value, and add the known values of the processes. */
+static void cache_evict( struct link *master )
+{
+	if(cache_budget < 1 || worker_mode == WORKER_MODE_FOREMAN)
+		return;
 
-		struct work_queue_process *p;
-		uint64_t taskid;
+	while(cache_bytes > cache_budget * MEGA) {
+		char *name, *victim = NULL;
+		struct cache_entry *e, *victim_entry = NULL;
 
-		itable_firstkey(procs_table);
-		while(itable_nextkey(procs_table,&taskid,(void**)&p)) {
-			if(p->sandbox_size > 0) {
-				disk_measured += p->sandbox_size;
-				files_counted += p->sandbox_file_count;
+		hash_table_firstkey(cache_entries);
+		while(hash_table_nextkey(cache_entries, &name, (void **) &e)) {
+			if(e->pins > 0 || e->epoch >= cache_epoch) continue;
+			if(!victim_entry || e->last_use < victim_entry->last_use) {
+				victim = name;
+				victim_entry = e;
 			}
 		}
+
+		if(!victim) {
+			debug(D_WQ, "cache uses %" PRId64 " bytes over its budget of %" PRId64 " MB, but all of its objects are in use", cache_bytes, cache_budget);
+			return;
+		}
+
+		victim = xxstrdup(victim);
+
+		debug(D_WQ, "evicting %s (%" PRId64 " bytes) from the cache", victim, victim_entry->size);
+
+		char *cached_path = string_format("cache/%s", victim);
+		delete_dir(cached_path);
+		free(cached_path);
+
+		cache_entry_remove(victim);
+		hash_table_insert(cache_evicted, victim, (void *) 1);
+		send_master_message(master, "cache-invalid %s\n", victim);
+
+		free(victim);
+	}
+}
+
+/*
+Measure the disk used by the worker. The cache is known from its index, and
+processes measure their own sandboxes.
+*/
+
+int64_t measure_worker_disk() {
+	int64_t disk_measured = (int64_t) ceil(cache_bytes/(1.0*MEGA));
+
+	files_counted = cache_files;
+
+	struct work_queue_process *p;
+	uint64_t taskid;
+
+	itable_firstkey(procs_table);
+	while(itable_nextkey(procs_table,&taskid,(void**)&p)) {
+		if(p->sandbox_size > 0) {
+			disk_measured += p->sandbox_size;
+			files_counted += p->sandbox_file_count;
+		}
 	}
 
 	return disk_measured;
@@ -350,8 +665,28 @@ static void send_resource_update(struct link *master)
 		total_resources->disk.smallest = MAX(0, local_resources->disk.smallest - disk_avail_threshold);
 	}
 
-	work_queue_resources_send(master,total_resources,stoptime);
-	send_master_message(master, "info end_of_resource_update %d\n", 0);
+	if(master_frames) {
+		struct work_queue_frame f;
+		work_queue_frame_from_resources(&f, total_resources);
+		work_queue_resources_debug(total_resources);
+		send_master_frame(master, &f);
+	} else {
+		work_queue_resources_send(master,total_resources,stoptime);
+		send_master_message(master, "info end_of_resource_update %d\n", 0);
+	}
+}
+
+/*
+With binary frames, the count of running tasks is sent in an alive frame,
+which also serves as the answer to a keepalive check.
+*/
+
+static void send_alive_frame(struct link *master)
+{
+	struct work_queue_frame f;
+	work_queue_frame_init(&f, WORK_QUEUE_FRAME_ALIVE);
+	f.fields[WORK_QUEUE_FRAME_ALIVE_TASKS_RUNNING] = itable_size(procs_running);
+	send_master_frame(master, &f);
 }
 
 /*
@@ -390,6 +725,9 @@ static void send_stats_update(struct link *master)
 		send_master_message(master, "info bytes_sent %lld\n", (long long) s.bytes_sent);
 		send_master_message(master, "info bytes_received %lld\n", (long long) s.bytes_received);
 	}
+	else if(master_frames) {
+		send_alive_frame(master);
+	}
 	else {
 		send_master_message(master, "info tasks_running %lld\n", (long long) itable_size(procs_running));
 	}
@@ -397,7 +735,11 @@ static void send_stats_update(struct link *master)
 
 static int send_keepalive(struct link *master, int force_resources){
 
-	send_master_message(master, "alive\n");
+	if(master_frames) {
+		send_alive_frame(master);
+	} else {
+		send_master_message(master, "alive\n");
+	}
 
 	/* for regular workers we only send resources on special ocassions, thus
 	 * the force_resources. */
@@ -405,11 +747,39 @@ static int send_keepalive(struct link *master, int force_resources){
 		send_resource_update(master);
 	}
 
-	send_stats_update(master);
+	/* the alive frame of a regular worker already has its stats. */
+	if(!master_frames || worker_mode == WORKER_MODE_FOREMAN) {
+		send_stats_update(master);
+	}
 
 	return 1;
 }
 
+/*
+Files named after their contents are kept in the cache from one master to the
+next, so tell a new master which ones are already here.
+*/
+
+static void report_content_cached_files( struct link *master )
+{
+	DIR *dir = opendir("cache");
+	if(!dir) return;
+
+	struct dirent *d;
+	while((d = readdir(dir))) {
+		struct stat info;
+		if(!string_prefix_is(d->d_name, WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX)) continue;
+
+		char *path = string_format("cache/%s", d->d_name);
+		if(stat(path, &info) == 0 && S_ISREG(info.st_mode)) {
+			send_master_message(master, "cache-update %s %"PRId64"\n", d->d_name, (int64_t) info.st_size);
+		}
+		free(path);
+	}
+
+	closedir(dir);
+}
+
 /*
 Send the initial "ready" message to the master with the version and so forth.
 The master will not start sending tasks until this message is recevied.
@@ -421,6 +791,15 @@ static void report_worker_ready( struct link *master )
 	domain_name_cache_guess(hostname);
 	send_master_message(master,"workqueue %d %s %s %s %d.%d.%d\n",WORK_QUEUE_PROTOCOL_VERSION,hostname,os_name,arch_name,CCTOOLS_VERSION_MAJOR,CCTOOLS_VERSION_MINOR,CCTOOLS_VERSION_MICRO);
 	send_master_message(master, "info worker-id %s\n", worker_id);
+	send_master_message(master, "info frames %d\n", WORK_QUEUE_FRAME_VERSION);
+	send_master_message(master, "info putdir 1\n");
+	send_master_message(master, "info compress 1\n");
+	if(transfer_port > 0) {
+		send_master_message(master, "info transfer-port %d\n", transfer_port);
+	} else if(peer_transfers_enabled && worker_mode != WORKER_MODE_FOREMAN) {
+		send_master_message(master, "info peer-transfers 1\n");
+	}
+	report_content_cached_files(master);
 	send_keepalive(master, 1);
 }
 
@@ -494,6 +873,129 @@ int link_recursive( const char *source, const char *target )
 	}
 }
 
+/*
+Remove a library from the libraries of the worker, and terminate it.
+*/
+
+static void remove_library( struct work_queue_library *l )
+{
+	list_remove(libraries, l);
+	work_queue_library_delete(l);
+}
+
+static void remove_all_libraries()
+{
+	struct work_queue_library *l;
+
+	while((l = list_pop_head(libraries))) {
+		work_queue_library_delete(l);
+	}
+}
+
+/*
+Find an idle instance of the library with the given command,
+dropping the idle instances that exited since they were last used.
+*/
+
+static struct work_queue_library *find_idle_library( const char *command )
+{
+	struct work_queue_library *l;
+
+	list_first_item(libraries);
+	while((l = list_next_item(libraries))) {
+		if(l->current || strcmp(l->command, command))
+			continue;
+
+		if(waitpid(l->pid, NULL, WNOHANG) != 0) {
+			debug(D_WQ, "library %d exited while idle", l->pid);
+			l->pid = 0;
+			remove_library(l);
+			list_first_item(libraries);
+			continue;
+		}
+
+		return l;
+	}
+
+	return NULL;
+}
+
+/*
+The worker runs at most as many instances of libraries as it has cores.
+*/
+
+static int libraries_full()
+{
+	return list_size(libraries) >= MAX(1, local_resources->cores.total);
+}
+
+/*
+Return the oldest idle instance of any library, or NULL if all are busy.
+*/
+
+static struct work_queue_library *find_any_idle_library()
+{
+	struct work_queue_library *l;
+
+	list_first_item(libraries);
+	while((l = list_next_item(libraries))) {
+		if(!l->current)
+			return l;
+	}
+
+	return NULL;
+}
+
+/*
+Return true if the task of p can be invoked now: either it is not an
+invocation, an instance of its library is idle, or there is room for a new
+instance. Otherwise the invocation waits until some instance finishes.
+*/
+
+static int library_available( struct work_queue_process *p )
+{
+	if(!p->task->library)
+		return 1;
+
+	return find_idle_library(p->task->library) || !libraries_full() || find_any_idle_library();
+}
+
+/*
+Invoke an instance of the library of the task of p, starting a new instance
+if all are busy. An instance serves one invocation at a time, and the oldest
+idle instance of another library makes room for a new one when the worker
+already runs as many instances as it has cores. The caller checks first with
+library_available that there is an instance or room for one.
+*/
+
+static pid_t invoke_library( struct work_queue_process *p )
+{
+	struct work_queue_library *l = find_idle_library(p->task->library);
+
+	if(!l) {
+		if(libraries_full()) {
+			struct work_queue_library *idle = find_any_idle_library();
+			if(!idle)
+				return -1;
+			remove_library(idle);
+		}
+
+		char *dir = string_format("library.%d", ++libraries_started);
+		l = work_queue_library_create(p->task->library, dir);
+		free(dir);
+
+		if(!l)
+			return -1;
+
+		list_push_tail(libraries, l);
+	}
+
+	if(!work_queue_library_invoke(l, p, time(0) + active_timeout))
+		return -1;
+
+	return p->pid;
+}
+
 /*
 Start executing the given process on the local host,
 accounting for the resources as necessary.
@@ -504,7 +1006,9 @@ static int start_process( struct work_queue_process *p )
 
 	pid_t pid;
 
-	if (container_mode == DOCKER)
+	if(p->task->library)
+		pid = invoke_library(p);
+	else if (container_mode == DOCKER)
 		pid = work_queue_process_execute(p, container_mode, img_name);
 	else if (container_mode == DOCKER_PRESERVE)
 		pid = work_queue_process_execute(p, container_mode, container_name);
@@ -525,13 +1029,55 @@ static int start_process( struct work_queue_process *p )
 	return 1;
 }
 
+/*
+Send the header of a result, which is followed by the output of the task.
+If batch is not null, the header is added to it instead, as a frame.
+*/
+
+static void send_result( struct link *master, buffer_t *batch, int status, int exit_status, int64_t output_length, timestamp_t execution_time, int taskid )
+{
+	if(master_frames) {
+		struct work_queue_frame f;
+		work_queue_frame_init(&f, WORK_QUEUE_FRAME_RESULT);
+		f.fields[WORK_QUEUE_FRAME_RESULT_STATUS]         = status;
+		f.fields[WORK_QUEUE_FRAME_RESULT_EXIT_STATUS]    = exit_status;
+		f.fields[WORK_QUEUE_FRAME_RESULT_OUTPUT_LENGTH]  = output_length;
+		f.fields[WORK_QUEUE_FRAME_RESULT_EXECUTION_TIME] = execution_time;
+		f.fields[WORK_QUEUE_FRAME_RESULT_TASKID]         = taskid;
+
+		if(batch) {
+			char data[WORK_QUEUE_FRAME_MAX];
+			debug(D_WQ, "tx to master: %s", work_queue_frame_name(f.type));
+			buffer_putlstring(batch, data, work_queue_frame_encode(&f, data));
+		} else {
+			send_master_frame(master, &f);
+		}
+	} else {
+		send_master_message(master, "result %d %d %lld %llu %d\n", status, exit_status, (long long) output_length, (unsigned long long) execution_time, taskid);
+	}
+}
+
+/* Write the results gathered in batch to the master. */
+static void flush_result_batch( struct link *master, buffer_t *batch )
+{
+	size_t length;
+	const char *data = buffer_tolstring(batch, &length);
+
+	if(length > 0) {
+		link_putlstring(master, data, length, time(0)+active_timeout);
+		buffer_rewind(batch, 0);
+	}
+}
+
 /*
 Transmit the results of the given process to the master.
 If a local worker, stream the output from disk.
 If a foreman, send the outputs contained in the task structure.
+If batch is not null, the result is added to it, and so is its output if it
+is small. The caller then sends the batch and the stats update.
 */
 
-static void report_task_complete( struct link *master, struct work_queue_process *p )
+static void report_task_complete( struct link *master, struct work_queue_process *p, buffer_t *batch )
 {
 	int64_t output_length;
 	struct stat st;
@@ -540,8 +1086,21 @@ static void report_task_complete( struct link *master, struct work_queue_process
 		fstat(p->output_fd, &st);
 		output_length = st.st_size;
 		lseek(p->output_fd, 0, SEEK_SET);
-		send_master_message(master, "result %d %d %lld %llu %d\n", p->task_status, p->exit_status, (long long) output_length, (unsigned long long) p->execution_end-p->execution_start, p->task->taskid);
-		link_stream_from_fd(master, p->output_fd, output_length, time(0)+active_timeout);
+		send_result(master, batch, p->task_status, p->exit_status, output_length, p->execution_end-p->execution_start, p->task->taskid);
+
+		if(batch && output_length <= RESULT_BATCH_OUTPUT_MAX) {
+			char *data = xxmalloc(output_length + 1);
+			ssize_t actual = full_read(p->output_fd, data, output_length);
+			if(actual < output_length) {
+				/* the master expects output_length bytes, so pad a short read. */
+				memset(data + MAX(actual, 0), 0, output_length - MAX(actual, 0));
+			}
+			buffer_putlstring(batch, data, output_length);
+			free(data);
+		} else {
+			if(batch) flush_result_batch(master, batch);
+			link_stream_from_fd(master, p->output_fd, output_length, time(0)+active_timeout);
+		}
 
 		total_task_execution_time += (p->execution_end - p->execution_start);
 		total_tasks_executed++;
@@ -552,16 +1111,23 @@ static void report_task_complete( struct link *master, struct work_queue_process
 		} else {
 			output_length = 0;
 		}
-		send_master_message(master, "result %d %d %lld %llu %d\n", t->result, t->return_status, (long long) output_length, (unsigned long long) t->time_workers_execute_last, t->taskid);
+		send_result(master, batch, t->result, t->return_status, output_length, t->time_workers_execute_last, t->taskid);
 		if(output_length) {
-			link_putlstring(master, t->output, output_length, time(0)+active_timeout);
+			if(batch && output_length <= RESULT_BATCH_OUTPUT_MAX) {
+				buffer_putlstring(batch, t->output, output_length);
+			} else {
+				if(batch) flush_result_batch(master, batch);
+				link_putlstring(master, t->output, output_length, time(0)+active_timeout);
+			}
 		}
 
 		total_task_execution_time += t->time_workers_execute_last;
 		total_tasks_executed++;
 	}
 
-	send_stats_update(master);
+	if(!batch) {
+		send_stats_update(master);
+	}
 }
 
 /*
@@ -591,7 +1157,7 @@ static void report_tasks_complete( struct link *master )
 	struct work_queue_process *p;
 
 	while((p=itable_pop(procs_complete))) {
-		report_task_complete(master,p);
+		report_task_complete(master,p,NULL);
 	}
 
 	work_queue_watcher_send_changes(watcher,master,time(0)+active_timeout);
@@ -601,10 +1167,44 @@ static void report_tasks_complete( struct link *master )
 	results_to_be_sent_msg = 0;
 }
 
+/*
+A master that accepted binary frames takes the results of tasks as soon as
+they are complete, without asking for them. The results found complete at
+once are written in a single batch, followed by a single stats update.
+*/
+
+static void push_tasks_complete( struct link *master )
+{
+	struct work_queue_process *p;
+	buffer_t batch;
+
+	if(itable_size(procs_complete) < 1)
+		return;
+
+	buffer_init(&batch);
+	buffer_abortonfailure(&batch, 1);
+
+	while((p=itable_pop(procs_complete))) {
+		report_task_complete(master,p,&batch);
+	}
+
+	flush_result_batch(master, &batch);
+	buffer_free(&batch);
+
+	send_stats_update(master);
+}
+
 static void expire_procs_running() {
+	static time_t last_check_time = 0;
+
 	struct work_queue_process *p;
 	uint64_t pid;
 
+	/* End times are checked at most once a second, rather than every time
+	 * a process completes. */
+	if(time(0) == last_check_time) return;
+	last_check_time = time(0);
+
 	timestamp_t current_time = timestamp_get();
 
 	itable_firstkey(procs_running);
@@ -618,93 +1218,218 @@ static void expire_procs_running() {
 }
 
 /*
-Scan over all of the processes known by the worker,
-and if they have exited, move them into the procs_complete table
-for later processing.
+Account for the end of the process p with the given wait status, and move it
+into the procs_complete table for later processing.
 */
 
-static int handle_tasks(struct link *master)
+static void complete_process( struct work_queue_process *p, int status )
 {
-	struct work_queue_process *p;
-	pid_t pid;
-	int status;
+	if (!WIFEXITED(status)){
+		p->exit_status = WTERMSIG(status);
+		debug(D_WQ, "task %d (pid %d) exited abnormally with signal %d",p->task->taskid,p->pid,p->exit_status);
+	} else {
+		p->exit_status = WEXITSTATUS(status);
+		FILE *loop_full_check;
+		char *buf = malloc(PATH_MAX);
+		char *pwd = getcwd(buf, PATH_MAX);
+		char *disk_alloc_filename = work_queue_generate_disk_alloc_full_filename(pwd, p->task->taskid);
+		if(p->loop_mount == 1 && (loop_full_check = fopen(disk_alloc_filename, "r"))) {
+			p->task_status = WORK_QUEUE_RESULT_DISK_ALLOC_FULL;
+			p->task->disk_allocation_exhausted = 1;
+			fclose(loop_full_check);
+			unlink(disk_alloc_filename);
+		}
 
-	itable_firstkey(procs_running);
-	while(itable_nextkey(procs_running, (uint64_t*)&pid, (void**)&p)) {
-		int result = wait4(pid, &status, WNOHANG, &p->rusage);
-		if(result==0) {
-			// pid is still going
-		} else if(result<0) {
-			debug(D_WQ, "wait4 on pid %d returned an error: %s",pid,strerror(errno));
-		} else if(result>0) {
-			if (!WIFEXITED(status)){
-				p->exit_status = WTERMSIG(status);
-				debug(D_WQ, "task %d (pid %d) exited abnormally with signal %d",p->task->taskid,p->pid,p->exit_status);
-			} else {
-				p->exit_status = WEXITSTATUS(status);
-				FILE *loop_full_check;
-				char *buf = malloc(PATH_MAX);
-				char *pwd = getcwd(buf, PATH_MAX);
-				char *disk_alloc_filename = work_queue_generate_disk_alloc_full_filename(pwd, p->task->taskid);
-				if(p->loop_mount == 1 && (loop_full_check = fopen(disk_alloc_filename, "r"))) {
-					p->task_status = WORK_QUEUE_RESULT_DISK_ALLOC_FULL;
-					p->task->disk_allocation_exhausted = 1;
-					fclose(loop_full_check);
-					unlink(disk_alloc_filename);
-				}
+		free(buf);
+		free(disk_alloc_filename);
+
+		debug(D_WQ, "task %d (pid %d) exited normally with exit code %d",p->task->taskid,p->pid,p->exit_status);
+	}
+
+	p->execution_end = timestamp_get();
+
+	cores_allocated  -= p->task->resources_requested->cores;
+	memory_allocated -= p->task->resources_requested->memory;
+	disk_allocated   -= p->task->resources_requested->disk;
+	gpus_allocated   -= p->task->resources_requested->gpus;
 
-				free(buf);
-				free(disk_alloc_filename);
+	itable_remove(procs_running, p->pid);
 
-				debug(D_WQ, "task %d (pid %d) exited normally with exit code %d",p->task->taskid,p->pid,p->exit_status);
+	// Output files must be moved back into the cache directory.
+
+	struct work_queue_file *f;
+	list_first_item(p->task->output_files);
+	while((f = list_next_item(p->task->output_files))) {
+
+		char *sandbox_name = string_format("%s/%s",p->sandbox,f->remote_name);
+
+		debug(D_WQ,"moving output file from %s to %s",sandbox_name,f->payload);
+
+		/* First we try a cheap rename. It that does not work, we try to copy the file. */
+		if(rename(sandbox_name,f->payload) == -1) {
+			debug(D_WQ, "could not rename output file %s to %s: %s",sandbox_name,f->payload,strerror(errno));
+			if(copy_file_to_file(sandbox_name, f->payload)  == -1) {
+				debug(D_WQ, "could not copy output file %s to %s: %s",sandbox_name,f->payload,strerror(errno));
 			}
+		}
 
-			p->execution_end = timestamp_get();
+		cache_measure(f->payload);
 
-			cores_allocated  -= p->task->resources_requested->cores;
-			memory_allocated -= p->task->resources_requested->memory;
-			disk_allocated   -= p->task->resources_requested->disk;
-			gpus_allocated   -= p->task->resources_requested->gpus;
+		free(sandbox_name);
+	}
 
-			itable_remove(procs_running, p->pid);
-			itable_firstkey(procs_running);
+	itable_insert(procs_complete, p->task->taskid, p);
+}
 
-			// Output files must be moved back into the cache directory.
+/*
+Complete the invocations of libraries that answered. A library that sends a
+malformed answer is removed, and its invocation fails as if killed.
+*/
 
-			struct work_queue_file *f;
-			list_first_item(p->task->output_files);
-			while((f = list_next_item(p->task->output_files))) {
+static void handle_library_results()
+{
+	struct work_queue_library *l;
 
-				char *sandbox_name = string_format("%s/%s",p->sandbox,f->remote_name);
+	list_first_item(libraries);
+	while((l = list_next_item(libraries))) {
+		if(!l->current || !work_queue_library_result_ready(l))
+			continue;
 
-				debug(D_WQ,"moving output file from %s to %s",sandbox_name,f->payload);
+		struct work_queue_process *p = l->current;
 
-				/* First we try a cheap rename. It that does not work, we try to copy the file. */
-				if(rename(sandbox_name,f->payload) == -1) {
-					debug(D_WQ, "could not rename output file %s to %s: %s",sandbox_name,f->payload,strerror(errno));
-					if(copy_file_to_file(sandbox_name, f->payload)  == -1) {
-						debug(D_WQ, "could not copy output file %s to %s: %s",sandbox_name,f->payload,strerror(errno));
-					}
-				}
+		if(work_queue_library_result(l, time(0) + active_timeout)) {
+			complete_process(p, W_EXITCODE(p->exit_status, 0));
+		} else {
+			remove_library(l);
+			complete_process(p, W_EXITCODE(0, SIGKILL));
+			list_first_item(libraries);
+		}
+	}
+}
 
-				free(sandbox_name);
-			}
+/*
+Find the library with the given pid, or NULL if there is none.
+*/
+
+static struct work_queue_library *find_library_by_pid( pid_t pid )
+{
+	struct work_queue_library *l;
+
+	list_first_item(libraries);
+	while((l = list_next_item(libraries))) {
+		if(l->pid == pid)
+			return l;
+	}
+
+	return NULL;
+}
+
+/*
+A child fetching a file from another worker exited. If the file arrived it may
+be used and served, otherwise the master is told why and sends the file itself.
+Files unlinked by the master while being fetched are forgotten.
+*/
+
+static void finish_peer_fetch( struct link *master, struct peer_fetch *f, int status )
+{
+	int fetched = WIFEXITED(status) && WEXITSTATUS(status) == PEER_FETCH_DONE;
+	int source_failed = WIFEXITED(status) && WEXITSTATUS(status) == PEER_FETCH_SOURCE_FAILURE;
+
+	if(hash_table_lookup(missing_cache_files, f->filename)) {
+		if(fetched) {
+			debug(D_WQ, "Fetched file %s from another worker\n", f->filename);
+			hash_table_remove(missing_cache_files, f->filename);
+			cache_update(f->filename, f->length, 1);
+			send_master_message(master, "cache-update %s %"PRId64"\n", f->filename, f->length);
+		} else {
+			char *cached_filename = string_format("cache/%s", f->filename);
+			unlink(cached_filename);
+			free(cached_filename);
+			send_master_message(master, "peer-failed %s %s\n", f->filename, source_failed ? "source" : "local");
+		}
+	}
+
+	free(f->filename);
+	free(f);
+}
+
+static void peer_fetches_stop()
+{
+	struct peer_fetch *f;
+	uint64_t pid;
+
+	itable_firstkey(peer_fetches);
+	while(itable_nextkey(peer_fetches, &pid, (void **) &f)) {
+		kill((pid_t) pid, SIGKILL);
+		waitpid((pid_t) pid, NULL, 0);
+		free(f->filename);
+		free(f);
+	}
+
+	itable_clear(peer_fetches);
+}
+
+/*
+Reap the children that exited since the last call, and complete their
+processes. The main loop is woken by SIGCHLD, and each exited child is
+found by wait4 and looked up by its pid, so the cost does not grow with the
+number of processes running.
+*/
+
+static int handle_tasks(struct link *master)
+{
+	struct work_queue_process *p;
+	struct work_queue_library *l;
+	struct peer_fetch *f;
+	struct rusage rusage;
+	pid_t pid;
+	int status;
+
+	handle_library_results();
 
-			itable_insert(procs_complete, p->task->taskid, p);
+	while((pid = wait4(-1, &status, WNOHANG, &rusage)) > 0) {
+		p = itable_lookup(procs_running, pid);
+		l = find_library_by_pid(pid);
 
+		if(l) {
+			debug(D_WQ, "library %d exited%s", pid, l->current ? " while serving a task" : "");
+			l->pid = 0;
+			remove_library(l);
+		}
+
+		if(p) {
+			p->rusage = rusage;
+			complete_process(p, status);
+		} else if(!l) {
+			if((f = itable_remove(peer_fetches, pid))) {
+				finish_peer_fetch(master, f, status);
+			} else if(pid == transfer_server_pid) {
+				debug(D_WQ, "file transfer server %d exited", pid);
+				transfer_server_pid = 0;
+			} else {
+				debug(D_WQ, "reaped unknown child process %d", pid);
+			}
 		}
+	}
 
+	if(pid < 0 && errno != ECHILD) {
+		debug(D_WQ, "wait4 returned an error: %s", strerror(errno));
 	}
+
 	return 1;
 }
 
 /**
  * Stream file/directory contents for the rget protocol.
  * Format:
- * 		for a directory: a new line in the format of "dir $DIR_NAME 0"
- * 		for a file: a new line in the format of "file $FILE_NAME $FILE_LENGTH"
+ * 		for a directory: a new line in the format of "dir $DIR_NAME $MODE"
+ * 		for a file: a new line in the format of "file $FILE_NAME $FILE_LENGTH $MODE"
  * 					then file contents.
  * 		string "end" at the end of the stream (on a new line).
+ * If compress is set, files are sent as "zfile $FILE_NAME $FILE_LENGTH $MODE"
+ * followed by the contents in the format of work_queue_compress_send.
+ * The entries are written by work_queue_stream_put, which gathers small
+ * files into large writes.
  *
  * Example:
  * Assume we have the following directory structure:
@@ -718,75 +1443,39 @@ static int handle_tasks(struct link *master)
  *
  * The stream contents would be:
  *
- * dir mydir 0
- * file 1.txt $file_len
+ * dir mydir 0755
+ * file mydir/1.txt $file_len 0644
  * $$ FILE 1.txt's CONTENTS $$
- * file 2.txt $file_len
+ * file mydir/2.txt $file_len 0644
  * $$ FILE 2.txt's CONTENTS $$
- * dir mysubdir 0
- * file mysubdir/a.txt $file_len
+ * dir mydir/mysubdir 0755
+ * file mydir/mysubdir/a.txt $file_len 0644
  * $$ FILE mysubdir/a.txt's CONTENTS $$
- * file mysubdir/b.txt $file_len
+ * file mydir/mysubdir/b.txt $file_len 0644
  * $$ FILE mysubdir/b.txt's CONTENTS $$
- * file z.jpg $file_len
+ * file mydir/z.jpg $file_len 0644
  * $$ FILE z.jpg's CONTENTS $$
  * end
  *
  */
-static int stream_output_item(struct link *master, const char *filename, int recursive)
+static int stream_output_item(struct link *master, const char *filename, int recursive, int compress)
 {
-	DIR *dir;
-	struct dirent *dent;
-	char dentline[WORK_QUEUE_LINE_MAX];
 	char cached_filename[WORK_QUEUE_LINE_MAX];
-	struct stat info;
-	int64_t actual, length;
-	int fd;
+	struct work_queue_stream s;
 
 	sprintf(cached_filename, "cache/%s", filename);
 
-	if(stat(cached_filename, &info) != 0) {
-		goto failure;
-	}
-
-	if(S_ISDIR(info.st_mode)) {
-		// stream a directory
-		dir = opendir(cached_filename);
-		if(!dir) {
-			goto failure;
-		}
-		send_master_message(master, "dir %s 0\n", filename);
+	work_queue_stream_init(&s, master, compress, active_timeout);
 
-		while(recursive && (dent = readdir(dir))) {
-			if(!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
-				continue;
-			sprintf(dentline, "%s/%s", filename, dent->d_name);
-			stream_output_item(master, dentline, recursive);
-		}
+	int result = work_queue_stream_put(&s, cached_filename, filename, recursive);
+	if(result >= 0 && work_queue_stream_flush(&s) < 0)
+		result = -1;
 
-		closedir(dir);
-	} else {
-		// stream a file
-		fd = open(cached_filename, O_RDONLY, 0);
-		if(fd >= 0) {
-			length = info.st_size;
-			send_master_message(master, "file %s %"PRId64"\n", filename, length);
-			actual = link_stream_from_fd(master, fd, length, time(0) + active_timeout);
-			close(fd);
-			if(actual != length) {
-				debug(D_WQ, "Sending back output file - %s failed: bytes to send = %"PRId64" and bytes actually sent = %"PRId64".", filename, length, actual);
-				return 0;
-			}
-		} else {
-			goto failure;
-		}
-	}
+	debug(D_WQ, "Sent back %s: %"PRId64" items, %"PRId64" bytes", filename, s.items, s.wire_bytes);
 
-	return 1;
+	work_queue_stream_delete(&s);
 
-failure:
-	send_master_message(master, "missing %s %d\n", filename, errno);
-	return 0;
+	return result > 0;
 }
 
 /*
@@ -830,184 +1519,607 @@ int setup_sandbox( struct work_queue_process *p )
 		if(!result) return 0;
 	}
 
-	return 1;
+	return 1;
+}
+
+/*
+For a task run locally, if the resources are all set to -1,
+then assume that the task occupies all worker resources.
+Otherwise, just make sure all values are non-zero.
+*/
+
+static void normalize_resources( struct work_queue_process *p )
+{
+	struct work_queue_task *t = p->task;
+
+	if(t->resources_requested->cores < 0 && t->resources_requested->memory < 0 && t->resources_requested->disk < 0 && t->resources_requested->gpus < 0) {
+		t->resources_requested->cores = local_resources->cores.total;
+		t->resources_requested->memory = local_resources->memory.total;
+		t->resources_requested->disk = local_resources->disk.total;
+		t->resources_requested->gpus = local_resources->gpus.total;
+	} else {
+		t->resources_requested->cores = MAX(t->resources_requested->cores, 0);
+		t->resources_requested->memory = MAX(t->resources_requested->memory, 0);
+		t->resources_requested->disk = MAX(t->resources_requested->disk, 0);
+		t->resources_requested->gpus = MAX(t->resources_requested->gpus, 0);
+	}
+}
+
+/*
+Return true if the task needs cached objects that are not in place yet:
+objects being fetched from another worker, or that were evicted from the
+cache, and that the master sends again. Evicted objects are held as missing
+too, so that only the tasks that need missing objects wait for them.
+*/
+
+static int task_needs_missing_files( struct work_queue_process *p )
+{
+	struct work_queue_file *f;
+	int needed = 0;
+
+	list_first_item(p->task->input_files);
+	while((f = list_next_item(p->task->input_files))) {
+		if(f->type == WORK_QUEUE_DIRECTORY) continue;
+
+		char *name = cache_object_name(f->payload);
+		if(hash_table_lookup(missing_cache_files, name)) {
+			needed = 1;
+		} else if(hash_table_lookup(cache_evicted, name) && access(f->payload, F_OK) != 0) {
+			debug(D_WQ, "task %d waits for %s, which was evicted from the cache", p->task->taskid, name);
+			hash_table_insert(missing_cache_files, name, (void *) 1);
+			needed = 1;
+		}
+		free(name);
+	}
+
+	return needed;
+}
+
+/*
+A foreman gives the files of its workers the names that the master gave them,
+so that a file is known by one name at every tier. A file then crosses the
+link from the master once, is kept in the cache of the foreman, and is sent
+from there to the workers of the foreman, which keep it under the same name.
+Invalidations from the master, and files named after their contents, apply
+unchanged to the copies of the workers.
+*/
+
+static void keep_master_cached_name( struct list *files, const char *cached_name )
+{
+	if(worker_mode != WORKER_MODE_FOREMAN)
+		return;
+
+	struct work_queue_file *f = list_peek_tail(files);
+	free(f->cached_name);
+	f->cached_name = xxstrdup(cached_name);
+}
+
+/*
+Handle an incoming task message from the master.
+Generate a work_queue_process wrapped around a work_queue_task,
+and deposit it into the waiting list or the foreman_q as appropriate.
+*/
+
+static int do_task( struct link *master, int taskid, const struct work_queue_frame *frame, time_t stoptime )
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char filename[WORK_QUEUE_LINE_MAX];
+	char localname[WORK_QUEUE_LINE_MAX];
+	char taskname[WORK_QUEUE_LINE_MAX];
+	char taskname_encoded[WORK_QUEUE_LINE_MAX];
+	char category[WORK_QUEUE_LINE_MAX];
+	int flags, length;
+	int64_t n;
+	int disk_alloc = disk_allocation;
+
+	timestamp_t nt;
+
+	struct work_queue_task *task = work_queue_task_create(0);
+	task->taskid = taskid;
+
+	if(frame) {
+		length = frame->fields[WORK_QUEUE_FRAME_TASK_COMMAND_LENGTH];
+		char *cmd = malloc(length+1);
+		link_read(master,cmd,length,stoptime);
+		cmd[length] = 0;
+		work_queue_task_specify_command(task,cmd);
+		debug(D_WQ,"rx from master: %s",cmd);
+		free(cmd);
+
+		work_queue_task_specify_cores(task, frame->fields[WORK_QUEUE_FRAME_TASK_CORES]);
+		work_queue_task_specify_memory(task, frame->fields[WORK_QUEUE_FRAME_TASK_MEMORY]);
+		work_queue_task_specify_disk(task, frame->fields[WORK_QUEUE_FRAME_TASK_DISK]);
+		work_queue_task_specify_gpus(task, frame->fields[WORK_QUEUE_FRAME_TASK_GPUS]);
+		work_queue_task_specify_end_time(task, frame->fields[WORK_QUEUE_FRAME_TASK_END_TIME]);
+		work_queue_task_specify_running_time(task, frame->fields[WORK_QUEUE_FRAME_TASK_WALL_TIME]);
+	}
+
+	while(recv_master_message(master,line,sizeof(line),NULL,stoptime)) {
+		if(!strcmp(line,"end")) {
+			break;
+		} else if(sscanf(line, "category %s",category)) {
+			work_queue_task_specify_category(task, category);
+		} else if(sscanf(line,"cmd %d",&length)==1) {
+			char *cmd = malloc(length+1);
+			link_read(master,cmd,length,stoptime);
+			cmd[length] = 0;
+			work_queue_task_specify_command(task,cmd);
+			debug(D_WQ,"rx from master: %s",cmd);
+			free(cmd);
+		} else if(sscanf(line,"infile %s %s %d", filename, taskname_encoded, &flags)) {
+			sprintf(localname, "cache/%s", filename);
+			url_decode(taskname_encoded, taskname, WORK_QUEUE_LINE_MAX);
+			if(work_queue_task_specify_file(task, localname, taskname, WORK_QUEUE_INPUT, flags)) {
+				keep_master_cached_name(task->input_files, filename);
+			}
+		} else if(sscanf(line,"outfile %s %s %d", filename, taskname_encoded, &flags)) {
+			sprintf(localname, "cache/%s", filename);
+			url_decode(taskname_encoded, taskname, WORK_QUEUE_LINE_MAX);
+			if(work_queue_task_specify_file(task, localname, taskname, WORK_QUEUE_OUTPUT, flags)) {
+				keep_master_cached_name(task->output_files, filename);
+			}
+		} else if(sscanf(line, "dir %s", filename)) {
+			work_queue_task_specify_directory(task, filename, filename, WORK_QUEUE_INPUT, 0700, 0);
+		} else if(sscanf(line,"cores %" PRId64,&n)) {
+				work_queue_task_specify_cores(task, n);
+		} else if(sscanf(line,"memory %" PRId64,&n)) {
+				work_queue_task_specify_memory(task, n);
+		} else if(sscanf(line,"disk %" PRId64,&n)) {
+				work_queue_task_specify_disk(task, n);
+		} else if(sscanf(line,"gpus %" PRId64,&n)) {
+			work_queue_task_specify_gpus(task, n);
+		} else if(sscanf(line,"wall_time %" PRIu64,&nt)) {
+			work_queue_task_specify_running_time(task, nt);
+		} else if(sscanf(line,"end_time %" PRIu64,&nt)) {
+			work_queue_task_specify_end_time(task, nt);
+		} else if(sscanf(line,"library %d",&length)==1) {
+			char *library = malloc(length+2); /* +2 for \n and \0 */
+			link_read(master, library, length+1, stoptime);
+			library[length] = 0;              /* replace \n with \0 */
+			work_queue_task_specify_library(task, library);
+			free(library);
+		} else if(sscanf(line,"env %d",&length)==1) {
+			char *env = malloc(length+2); /* +2 for \n and \0 */
+			link_read(master, env, length+1, stoptime);
+			env[length] = 0;              /* replace \n with \0 */
+			char *value = strchr(env,'=');
+			if(value) {
+				*value = 0;
+				value++;
+				work_queue_task_specify_enviroment_variable(task,env,value);
+			}
+			free(env);
+		} else {
+			debug(D_WQ|D_NOTICE,"invalid command from master: %s",line);
+			return 0;
+		}
+	}
+
+	last_task_received = task->taskid;
+
+	struct work_queue_process *p = work_queue_process_create(task, disk_alloc);
+
+	if(!p) {
+		return 0;
+	}
+
+	// Every received task goes into procs_table.
+	itable_insert(procs_table,taskid,p);
+
+	cache_pin_task(p, 1);
+	cache_epoch++;
+
+	if(worker_mode==WORKER_MODE_FOREMAN) {
+		work_queue_submit_internal(foreman_q,task);
+	} else if(task_needs_missing_files(p)) {
+		itable_insert(procs_unstaged,taskid,p);
+		normalize_resources(p);
+		list_push_tail(procs_waiting,p);
+	} else {
+		// XXX sandbox setup should be done in task execution,
+		// so that it can be returned cleanly as a failure to execute.
+		if(!setup_sandbox(p)) {
+			itable_remove(procs_table,taskid);
+			cache_pin_task(p, -1);
+			work_queue_process_delete(p);
+			return 0;
+		}
+		normalize_resources(p);
+		list_push_tail(procs_waiting,p);
+	}
+
+	work_queue_watcher_add_process(watcher,p);
+
+	return 1;
+}
+
+/*
+Open the file for filename in the cache for writing, creating its parent
+directories as needed. Returns the file descriptor, or -1 on failure.
+*/
+
+static int open_cache_file( const char *filename, int mode, char *cached_filename )
+{
+	char *cur_pos;
+
+	while(!strncmp(filename, "./", 2)) {
+		filename += 2;
+	}
+
+	sprintf(cached_filename, "cache/%s", filename);
+
+	cur_pos = strrchr(cached_filename, '/');
+	if(cur_pos) {
+		*cur_pos = '\0';
+		if(!create_dir(cached_filename, mode | 0700)) {
+			debug(D_WQ, "Could not create directory - %s (%s)\n", cached_filename, strerror(errno));
+			return -1;
+		}
+		*cur_pos = '/';
+	}
+
+	int fd = open(cached_filename, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if(fd < 0) {
+		debug(D_WQ, "Could not open %s for writing. (%s)\n", filename, strerror(errno));
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+A file named after the md5 of its contents is checked against its name when it
+arrives, so that a damaged copy is neither used by tasks nor served to other
+workers. Returns 0 if the contents do not match the name.
+*/
+
+static int verify_content_cached_file( const char *filename, const char *cached_filename )
+{
+	unsigned char digest[MD5_DIGEST_LENGTH];
+
+	filename = skip_dotslash(filename);
+	if(!string_prefix_is(filename, WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX)) {
+		return 1;
+	}
+
+	if(!md5_file(cached_filename, digest)) {
+		debug(D_WQ, "Could not compute the hash of %s: %s\n", cached_filename, strerror(errno));
+		return 0;
+	}
+
+	if(strcmp(filename + strlen(WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX), md5_string(digest))) {
+		debug(D_WQ, "Contents of %s do not match its name (md5 %s), rejecting it\n", filename, md5_string(digest));
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+Handle an incoming "put" message from the master,
+which places a file into the cache directory.
+*/
+
+static int do_put( struct link *master, char *filename, int64_t length, int mode, int flags, int compressed )
+{
+	char cached_filename[WORK_QUEUE_LINE_MAX];
+
+	debug(D_WQ, "Putting file %s into workspace\n", filename);
+	if(!check_disk_space_for_filesize(".", length, disk_avail_threshold)) {
+		debug(D_WQ, "Could not put file %s, not enough disk space (%"PRId64" bytes needed)\n", filename, length);
+		return 0;
+	}
+
+
+	mode = mode | 0600;
+
+	int fd = open_cache_file(filename, mode, cached_filename);
+	if(fd < 0) {
+		return 0;
+	}
+
+	int64_t actual;
+	if(compressed) {
+		actual = work_queue_compress_recv(master, fd, length, time(0) + active_timeout);
+	} else {
+		actual = link_stream_to_fd(master, fd, length, time(0) + active_timeout);
+	}
+	close(fd);
+	if(actual != length) {
+		debug(D_WQ, "Failed to put file - %s (%s)\n", filename, strerror(errno));
+		unlink(cached_filename);
+		return 0;
+	}
+
+	if(!verify_content_cached_file(filename, cached_filename)) {
+		unlink(cached_filename);
+		return 0;
+	}
+
+	hash_table_remove(missing_cache_files, filename);
+	cache_update(filename, length, 1);
+
+	// Tell the master that this file may now be served to other workers.
+	if(flags & WORK_QUEUE_CACHE && transfer_port > 0) {
+		send_master_message(master, "cache-update %s %"PRId64"\n", filename, length);
+	}
+
+	return 1;
+}
+
+/*
+Receive a directory sent as a stream of dir and file entries, as written by
+stream_output_item, and terminated by "end". Every entry must be within dirname.
+*/
+static int do_put_dir(struct link *master, const char *dirname)
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char name[WORK_QUEUE_LINE_MAX];
+	char cached_filename[WORK_QUEUE_LINE_MAX];
+	int64_t length;
+	int mode, errnum;
+	size_t dirname_length = strlen(dirname);
+
+	debug(D_WQ, "Putting directory %s into workspace\n", dirname);
+
+	while(recv_master_message(master, line, sizeof(line), NULL, time(0) + active_timeout)) {
+		int compressed = 0;
+
+		if(!strcmp(line, "end")) {
+			return 1;
+		} else if(sscanf(line, "missing %s %d", name, &errnum) == 2) {
+			debug(D_WQ, "Master could not send %s (%s)\n", name, strerror(errnum));
+			continue;
+		} else if(sscanf(line, "dir %s %o", name, &mode) == 2) {
+			length = 0;
+		} else if(sscanf(line, "file %s %" SCNd64 " %o", name, &length, &mode) == 3 || (compressed = sscanf(line, "zfile %s %" SCNd64 " %o", name, &length, &mode) == 3)) {
+			/* handled below, once the name is checked. */
+		} else {
+			debug(D_WQ, "Invalid entry while putting directory %s: %s\n", dirname, line);
+			return 0;
+		}
+
+		if(strncmp(name, dirname, dirname_length) || (name[dirname_length] != '/' && name[dirname_length] != '\0') || strstr(name, "..")) {
+			debug(D_WQ, "Path - %s is not within directory %s.", name, dirname);
+			return 0;
+		}
+
+		if(line[0] == 'd') {
+			sprintf(cached_filename, "cache/%s", name);
+			if(!create_dir(cached_filename, mode | 0700)) {
+				debug(D_WQ, "Could not create directory - %s (%s)\n", cached_filename, strerror(errno));
+				return 0;
+			}
+		} else if(!do_put(master, name, length, mode, 0, compressed)) {
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/*
+Answer a single request from another worker for a file in the cache.
+*/
+
+static void transfer_serve( struct link *peer )
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char filename[WORK_QUEUE_LINE_MAX];
+	int64_t length;
+	struct stat info;
+
+	time_t stoptime = time(0) + active_timeout;
+
+	if(password && !link_auth_password(peer, password, stoptime)) {
+		return;
+	}
+
+	if(!link_readline(peer, line, sizeof(line), stoptime) || sscanf(line, "get %s %" SCNd64, filename, &length) != 2) {
+		return;
+	}
+
+	// Only files in the cache may be requested.
+	if(filename[0] == '/' || strstr(filename, "..")) {
+		link_putliteral(peer, "missing\n", stoptime);
+		return;
+	}
+
+	char *cached_filename = string_format("cache/%s", skip_dotslash(filename));
+	int fd = open(cached_filename, O_RDONLY);
+	free(cached_filename);
+
+	// A file still being written by the master is not served.
+	if(fd < 0 || fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || info.st_size != length) {
+		link_putliteral(peer, "missing\n", stoptime);
+		if(fd >= 0) close(fd);
+		return;
+	}
+
+	debug(D_WQ, "serving file %s to another worker", filename);
+
+	link_putfstring(peer, "file %"PRId64"\n", stoptime, length);
+	link_stream_from_fd(peer, fd, length, stoptime);
+	close(fd);
 }
 
 /*
-For a task run locally, if the resources are all set to -1,
-then assume that the task occupies all worker resources.
-Otherwise, just make sure all values are non-zero.
+The transfer server runs in a child process, so that serving files to other
+workers does not hold up the worker itself. Each request is served by its
+own child. The server exits once the worker is gone.
 */
 
-static void normalize_resources( struct work_queue_process *p )
+static void transfer_server_start()
 {
-	struct work_queue_task *t = p->task;
+	char addr[LINK_ADDRESS_MAX];
 
-	if(t->resources_requested->cores < 0 && t->resources_requested->memory < 0 && t->resources_requested->disk < 0 && t->resources_requested->gpus < 0) {
-		t->resources_requested->cores = local_resources->cores.total;
-		t->resources_requested->memory = local_resources->memory.total;
-		t->resources_requested->disk = local_resources->disk.total;
-		t->resources_requested->gpus = local_resources->gpus.total;
-	} else {
-		t->resources_requested->cores = MAX(t->resources_requested->cores, 0);
-		t->resources_requested->memory = MAX(t->resources_requested->memory, 0);
-		t->resources_requested->disk = MAX(t->resources_requested->disk, 0);
-		t->resources_requested->gpus = MAX(t->resources_requested->gpus, 0);
+	struct link *server = link_serve(transfer_port_option);
+	if(!server) {
+		debug(D_NOTICE, "could not listen on port %d for transfers to other workers: %s", transfer_port_option, strerror(errno));
+		return;
 	}
-}
 
-/*
-Handle an incoming task message from the master.
-Generate a work_queue_process wrapped around a work_queue_task,
-and deposit it into the waiting list or the foreman_q as appropriate.
-*/
+	link_address_local(server, addr, &transfer_port);
 
-static int do_task( struct link *master, int taskid, time_t stoptime )
-{
-	char line[WORK_QUEUE_LINE_MAX];
-	char filename[WORK_QUEUE_LINE_MAX];
-	char localname[WORK_QUEUE_LINE_MAX];
-	char taskname[WORK_QUEUE_LINE_MAX];
-	char taskname_encoded[WORK_QUEUE_LINE_MAX];
-	char category[WORK_QUEUE_LINE_MAX];
-	int flags, length;
-	int64_t n;
-	int disk_alloc = disk_allocation;
+	pid_t worker_pid = getpid();
+	pid_t pid = fork();
 
-	timestamp_t nt;
+	if(pid < 0) {
+		debug(D_NOTICE, "could not start the server for transfers to other workers: %s", strerror(errno));
+		transfer_port = 0;
+	} else if(pid == 0) {
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGUSR1, SIG_DFL);
+		signal(SIGUSR2, SIG_DFL);
+		signal(SIGCHLD, SIG_IGN);
 
-	struct work_queue_task *task = work_queue_task_create(0);
-	task->taskid = taskid;
+		while(getppid() == worker_pid) {
+			struct link *peer = link_accept(server, time(0) + 5);
+			if(!peer) continue;
 
-	while(recv_master_message(master,line,sizeof(line),stoptime)) {
-		if(!strcmp(line,"end")) {
-			break;
-		} else if(sscanf(line, "category %s",category)) {
-			work_queue_task_specify_category(task, category);
-		} else if(sscanf(line,"cmd %d",&length)==1) {
-			char *cmd = malloc(length+1);
-			link_read(master,cmd,length,stoptime);
-			cmd[length] = 0;
-			work_queue_task_specify_command(task,cmd);
-			debug(D_WQ,"rx from master: %s",cmd);
-			free(cmd);
-		} else if(sscanf(line,"infile %s %s %d", filename, taskname_encoded, &flags)) {
-			sprintf(localname, "cache/%s", filename);
-			url_decode(taskname_encoded, taskname, WORK_QUEUE_LINE_MAX);
-			work_queue_task_specify_file(task, localname, taskname, WORK_QUEUE_INPUT, flags);
-		} else if(sscanf(line,"outfile %s %s %d", filename, taskname_encoded, &flags)) {
-			sprintf(localname, "cache/%s", filename);
-			url_decode(taskname_encoded, taskname, WORK_QUEUE_LINE_MAX);
-			work_queue_task_specify_file(task, localname, taskname, WORK_QUEUE_OUTPUT, flags);
-		} else if(sscanf(line, "dir %s", filename)) {
-			work_queue_task_specify_directory(task, filename, filename, WORK_QUEUE_INPUT, 0700, 0);
-		} else if(sscanf(line,"cores %" PRId64,&n)) {
-				work_queue_task_specify_cores(task, n);
-		} else if(sscanf(line,"memory %" PRId64,&n)) {
-				work_queue_task_specify_memory(task, n);
-		} else if(sscanf(line,"disk %" PRId64,&n)) {
-				work_queue_task_specify_disk(task, n);
-		} else if(sscanf(line,"gpus %" PRId64,&n)) {
-			work_queue_task_specify_gpus(task, n);
-		} else if(sscanf(line,"wall_time %" PRIu64,&nt)) {
-			work_queue_task_specify_running_time(task, nt);
-		} else if(sscanf(line,"end_time %" PRIu64,&nt)) {
-			work_queue_task_specify_end_time(task, nt);
-		} else if(sscanf(line,"env %d",&length)==1) {
-			char *env = malloc(length+2); /* +2 for \n and \0 */
-			link_read(master, env, length+1, stoptime);
-			env[length] = 0;              /* replace \n with \0 */
-			char *value = strchr(env,'=');
-			if(value) {
-				*value = 0;
-				value++;
-				work_queue_task_specify_enviroment_variable(task,env,value);
+			if(fork() == 0) {
+				link_close(server);
+				transfer_serve(peer);
+				link_close(peer);
+				_exit(0);
 			}
-			free(env);
-		} else {
-			debug(D_WQ|D_NOTICE,"invalid command from master: %s",line);
-			return 0;
+
+			link_close(peer);
 		}
-	}
 
-	last_task_received = task->taskid;
+		_exit(0);
+	} else {
+		debug(D_WQ, "serving cached files to other workers on port %d", transfer_port);
+		transfer_server_pid = pid;
+	}
 
-	struct work_queue_process *p = work_queue_process_create(task, disk_alloc);
+	link_close(server);
+}
 
-	if(!p) {
-		return 0;
+static void transfer_server_stop()
+{
+	if(transfer_server_pid > 0) {
+		kill(transfer_server_pid, SIGTERM);
+		waitpid(transfer_server_pid, NULL, 0);
+		transfer_server_pid = 0;
 	}
+}
 
-	// Every received task goes into procs_table.
-	itable_insert(procs_table,taskid,p);
+/*
+The master enabled transfers between workers: start serving cached files, and
+tell the master where. Cached files received from then on are announced with
+cache-update messages.
+*/
 
-	if(worker_mode==WORKER_MODE_FOREMAN) {
-		work_queue_submit_internal(foreman_q,task);
-	} else {
-		// XXX sandbox setup should be done in task execution,
-		// so that it can be returned cleanly as a failure to execute.
-		if(!setup_sandbox(p)) {
-			itable_remove(procs_table,taskid);
-			work_queue_process_delete(p);
-			return 0;
-		}
-		normalize_resources(p);
-		list_push_tail(procs_waiting,p);
+static int do_peer_transfers( struct link *master )
+{
+	if(!peer_transfers_enabled || worker_mode == WORKER_MODE_FOREMAN) {
+		return 1;
 	}
 
-	work_queue_watcher_add_process(watcher,p);
+	if(transfer_server_pid < 1) {
+		transfer_server_start();
+	}
+
+	if(transfer_port > 0) {
+		send_master_message(master, "info transfer-port %d\n", transfer_port);
+	}
 
 	return 1;
 }
 
 /*
-Handle an incoming "put" message from the master,
-which places a file into the cache directory.
+Fetch a cached file from the transfer port of another worker. The transfer is
+done by a child process, bounded by the active timeout, so that the worker
+keeps serving the master meanwhile. Tasks that need the file wait until it
+arrives, and if the transfer fails, the master is told so when the child is
+reaped, and sends the file itself.
 */
 
-static int do_put( struct link *master, char *filename, int64_t length, int mode )
+static int peer_fetch_file( const char *filename, int64_t length, int mode, const char *host, int port )
 {
 	char cached_filename[WORK_QUEUE_LINE_MAX];
-	char *cur_pos;
-
-	debug(D_WQ, "Putting file %s into workspace\n", filename);
-	if(!check_disk_space_for_filesize(".", length, disk_avail_threshold)) {
-		debug(D_WQ, "Could not put file %s, not enough disk space (%"PRId64" bytes needed)\n", filename, length);
-		return 0;
-	}
-
+	char line[WORK_QUEUE_LINE_MAX];
+	int64_t actual;
+	int64_t peer_length;
 
-	mode = mode | 0600;
+	time_t stoptime = time(0) + active_timeout;
 
-	cur_pos = filename;
+	struct link *peer = link_connect(host, port, time(0) + peer_connect_timeout);
+	if(!peer) {
+		debug(D_WQ, "Could not connect to worker %s:%d: %s\n", host, port, strerror(errno));
+		return PEER_FETCH_SOURCE_FAILURE;
+	}
 
-	while(!strncmp(cur_pos, "./", 2)) {
-		cur_pos += 2;
+	if(password && !link_auth_password(peer, password, stoptime)) {
+		debug(D_WQ, "Could not authenticate to worker %s:%d\n", host, port);
+		link_close(peer);
+		return PEER_FETCH_SOURCE_FAILURE;
 	}
 
-	sprintf(cached_filename, "cache/%s", cur_pos);
+	link_putfstring(peer, "get %s %"PRId64"\n", stoptime, filename, length);
 
-	cur_pos = strrchr(cached_filename, '/');
-	if(cur_pos) {
-		*cur_pos = '\0';
-		if(!create_dir(cached_filename, mode | 0700)) {
-			debug(D_WQ, "Could not create directory - %s (%s)\n", cached_filename, strerror(errno));
-			return 0;
-		}
-		*cur_pos = '/';
+	if(!link_readline(peer, line, sizeof(line), stoptime) || sscanf(line, "file %" SCNd64, &peer_length) != 1 || peer_length != length) {
+		debug(D_WQ, "Worker %s:%d does not have file %s\n", host, port, filename);
+		link_close(peer);
+		return PEER_FETCH_SOURCE_FAILURE;
 	}
 
-	int fd = open(cached_filename, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	int fd = open_cache_file(filename, mode | 0600, cached_filename);
 	if(fd < 0) {
-		debug(D_WQ, "Could not open %s for writing. (%s)\n", filename, strerror(errno));
-		return 0;
+		link_close(peer);
+		return PEER_FETCH_LOCAL_FAILURE;
 	}
 
-	int64_t actual = link_stream_to_fd(master, fd, length, time(0) + active_timeout);
+	actual = link_stream_to_fd(peer, fd, length, stoptime);
 	close(fd);
+	link_close(peer);
+
 	if(actual != length) {
-		debug(D_WQ, "Failed to put file - %s (%s)\n", filename, strerror(errno));
-		return 0;
+		debug(D_WQ, "Failed to fetch file %s from worker %s:%d (%s)\n", filename, host, port, strerror(errno));
+		unlink(cached_filename);
+		return PEER_FETCH_SOURCE_FAILURE;
+	}
+
+	if(!verify_content_cached_file(filename, cached_filename)) {
+		unlink(cached_filename);
+		return PEER_FETCH_SOURCE_FAILURE;
+	}
+
+	return PEER_FETCH_DONE;
+}
+
+static int do_peer_get( struct link *master, char *filename, int64_t length, int mode, const char *host, int port )
+{
+	debug(D_WQ, "Fetching file %s from worker %s:%d\n", filename, host, port);
+
+	hash_table_insert(missing_cache_files, filename, (void *) 1);
+
+	if(!check_disk_space_for_filesize(".", length, disk_avail_threshold)) {
+		debug(D_WQ, "Could not fetch file %s, not enough disk space (%"PRId64" bytes needed)\n", filename, length);
+		send_master_message(master, "peer-failed %s local\n", filename);
+		return 1;
+	}
+
+	pid_t pid = fork();
+	if(pid < 0) {
+		debug(D_WQ, "Could not fetch file %s: %s\n", filename, strerror(errno));
+		send_master_message(master, "peer-failed %s local\n", filename);
+	} else if(pid == 0) {
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGQUIT, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGUSR1, SIG_DFL);
+		signal(SIGUSR2, SIG_DFL);
+		signal(SIGCHLD, SIG_DFL);
+		_exit(peer_fetch_file(filename, length, mode, host, port));
+	} else {
+		struct peer_fetch *f = malloc(sizeof(*f));
+		f->filename = xxstrdup(filename);
+		f->length = length;
+		itable_insert(peer_fetches, pid, f);
 	}
 
 	return 1;
@@ -1037,14 +2149,27 @@ static int do_url(struct link* master, const char *filename, int length, int mod
 		char cache_name[WORK_QUEUE_LINE_MAX];
 		snprintf(cache_name,WORK_QUEUE_LINE_MAX, "cache/%s", filename);
 
-		return file_from_url(url, cache_name);
+		int result = file_from_url(url, cache_name);
+		cache_measure(filename);
+
+		return result;
 }
 
 static int do_unlink(const char *path) {
 	char cached_path[WORK_QUEUE_LINE_MAX];
+
+	// A foreman names the files of its workers as the master does, so the
+	// copies its workers hold are removed too.
+	if(worker_mode == WORKER_MODE_FOREMAN) {
+		work_queue_remove_cached_file_internal(foreman_q, path);
+	}
+
+	hash_table_remove(missing_cache_files, path);
 	sprintf(cached_path, "cache/%s", path);
 	//Use delete_dir() since it calls unlink() if path is a file.
-	if(delete_dir(cached_path) != 0) {
+	int result = delete_dir(cached_path);
+	cache_measure(path);
+	if(result != 0) {
 		struct stat buf;
 		if(stat(cached_path, &buf) != 0) {
 			if(errno == ENOENT) {
@@ -1058,8 +2183,8 @@ static int do_unlink(const char *path) {
 	return 1;
 }
 
-static int do_get(struct link *master, const char *filename, int recursive) {
-	stream_output_item(master, filename, recursive);
+static int do_get(struct link *master, const char *filename, int recursive, int compress) {
+	stream_output_item(master, filename, recursive, compress);
 	send_master_message(master, "end\n");
 	return 1;
 }
@@ -1120,6 +2245,9 @@ static int do_thirdget(int mode, char *filename, const char *path) {
 		}
 		break;
 	}
+
+	cache_measure(filename);
+
 	return 1;
 }
 
@@ -1205,8 +2333,16 @@ static int do_kill(int taskid)
 	if(worker_mode == WORKER_MODE_FOREMAN) {
 		work_queue_cancel_by_taskid(foreman_q, taskid);
 	} else {
-		if(itable_remove(procs_running, p->pid)) {
+		// Invocations of a library share its pid, so the process running
+		// under that pid may be a later invocation.
+		if(itable_lookup(procs_running, p->pid) == p) {
+			itable_remove(procs_running, p->pid);
 			work_queue_process_kill(p);
+			if(p->library) {
+				// the library was reaped together with the invocation.
+				p->library->pid = 0;
+				remove_library(p->library);
+			}
 			cores_allocated -= p->task->resources_requested->cores;
 			memory_allocated -= p->task->resources_requested->memory;
 			disk_allocated -= p->task->resources_requested->disk;
@@ -1215,8 +2351,11 @@ static int do_kill(int taskid)
 	}
 
 	itable_remove(procs_complete, p->task->taskid);
+	itable_remove(procs_unstaged, p->task->taskid);
 	list_remove(procs_waiting,p);
 
+	cache_pin_task(p, -1);
+
 	work_queue_watcher_remove_process(watcher,p);
 
 	work_queue_process_delete(p);
@@ -1330,9 +2469,15 @@ static int enforce_processes_limits() {
 /* We check maximum_running_time by itself (not in enforce_processes_limits),
  * as other running tasks should not be affected by a task timeout. */
 static void enforce_processes_max_running_time() {
+	static time_t last_check_time = 0;
+
 	struct work_queue_process *p;
 	pid_t pid;
 
+	/* As end times, running times are checked at most once a second. */
+	if(time(0) == last_check_time) return;
+	last_check_time = time(0);
+
 	timestamp_t now = timestamp_get();
 
 	itable_firstkey(procs_running);
@@ -1366,6 +2511,9 @@ static void disconnect_master(struct link *master) {
 	debug(D_WQ, "killing all outstanding tasks");
 	kill_all_tasks();
 
+	// Libraries hold code of the master, so they do not outlive it.
+	remove_all_libraries();
+
 	//KNOWN HACK: We remove all workers on a master disconnection to avoid
 	//returning old tasks to a new master.
 	if(foreman_q) {
@@ -1394,13 +2542,50 @@ static int handle_master(struct link *master) {
 	int64_t taskid = 0;
 	int flags = WORK_QUEUE_NOCACHE;
 	int mode, r, n;
+	struct work_queue_frame frame;
 
-	if(recv_master_message(master, line, sizeof(line), idle_stoptime )) {
-		if(sscanf(line,"task %" SCNd64, &taskid)==1) {
-			r = do_task(master, taskid,time(0)+active_timeout);
+	if(recv_master_message(master, line, sizeof(line), &frame, idle_stoptime )) {
+		if(frame.type == WORK_QUEUE_FRAME_TASK) {
+			r = do_task(master, frame.fields[WORK_QUEUE_FRAME_TASK_TASKID], &frame, time(0)+active_timeout);
+		} else if(frame.type == WORK_QUEUE_FRAME_CHECK) {
+			r = send_keepalive(master, 0);
+		} else if(frame.type != WORK_QUEUE_FRAME_NONE) {
+			debug(D_WQ, "Unrecognized master message: %s.\n", line);
+			r = 0;
+		} else if(sscanf(line,"task %" SCNd64, &taskid)==1) {
+			r = do_task(master, taskid, NULL, time(0)+active_timeout);
+		} else if(!strcmp(line, "frames")) {
+			master_frames = 1;
+			r = 1;
+		} else if(!strcmp(line, "peer_transfers")) {
+			r = do_peer_transfers(master);
 		} else if((n = sscanf(line, "put %s %" SCNd64 " %o %d", filename, &length, &mode, &flags)) >= 3) {
 			if(path_within_dir(filename, workspace)) {
-				r = do_put(master, filename, length, mode);
+				r = do_put(master, filename, length, mode, flags, 0);
+				reset_idle_timer();
+			} else {
+				debug(D_WQ, "Path - %s is not within workspace %s.", filename, workspace);
+				r = 0;
+			}
+		} else if(sscanf(line, "zput %s %" SCNd64 " %o %d", filename, &length, &mode, &flags) == 4) {
+			if(path_within_dir(filename, workspace)) {
+				r = do_put(master, filename, length, mode, flags, 1);
+				reset_idle_timer();
+			} else {
+				debug(D_WQ, "Path - %s is not within workspace %s.", filename, workspace);
+				r = 0;
+			}
+		} else if(sscanf(line, "putdir %s", filename) == 1) {
+			if(path_within_dir(filename, workspace)) {
+				r = do_put_dir(master, filename);
+				reset_idle_timer();
+			} else {
+				debug(D_WQ, "Path - %s is not within workspace %s.", filename, workspace);
+				r = 0;
+			}
+		} else if(sscanf(line, "peer_get %s %" SCNd64 " %o %s %d", filename, &length, &mode, path, &n) == 5) {
+			if(!strstr(filename, "..")) {
+				r = do_peer_get(master, filename, length, mode, path, n);
 				reset_idle_timer();
 			} else {
 				debug(D_WQ, "Path - %s is not within workspace %s.", filename, workspace);
@@ -1416,8 +2601,8 @@ static int handle_master(struct link *master) {
 				debug(D_WQ, "Path - %s is not within workspace %s.", filename, workspace);
 				r= 0;
 			}
-		} else if(sscanf(line, "get %s %d", filename, &mode) == 2) {
-			r = do_get(master, filename, mode);
+		} else if((n = sscanf(line, "get %s %d %d", filename, &mode, &flags)) >= 2) {
+			r = do_get(master, filename, mode, n > 2 && flags);
 		} else if(sscanf(line, "thirdget %o %s %[^\n]", &mode, filename, path) == 3) {
 			r = do_thirdget(mode, filename, path);
 		} else if(sscanf(line, "thirdput %o %s %[^\n]", &mode, filename, path) == 3) {
@@ -1561,6 +2746,56 @@ static int enforce_worker_promises(struct link *master) {
 	return 1;
 }
 
+/*
+Wait for up to msec for a message from the master, or for an answer from a
+library serving an invocation. As with link_usleep_mask, the signals in mask
+are unblocked only while waiting. Returns 1 if the master sent a message, 0
+if not, and -1 on error.
+*/
+
+static int wait_for_master(struct link *master, int msec, sigset_t *mask)
+{
+	struct work_queue_library *l;
+	struct link_info *links;
+	sigset_t cmask;
+	int n = 1;
+
+	list_first_item(libraries);
+	while((l = list_next_item(libraries))) {
+		if(l->current) n++;
+	}
+
+	if(n == 1)
+		return link_usleep_mask(master, msec*1000, mask, 1, 0);
+
+	links = xxmalloc(n * sizeof(*links));
+	links[0].link = master;
+	links[0].events = LINK_READ;
+
+	n = 1;
+	list_first_item(libraries);
+	while((l = list_next_item(libraries))) {
+		if(!l->current) continue;
+		links[n].link = l->link;
+		links[n].events = LINK_READ;
+		n++;
+	}
+
+	sigprocmask(SIG_UNBLOCK, mask, &cmask);
+	int result = link_poll(links, n, msec);
+	sigprocmask(SIG_SETMASK, &cmask, NULL);
+
+	if(result > 0) {
+		result = (links[0].revents & LINK_READ) ? 1 : 0;
+	} else if(result < 0 && errno == EINTR) {
+		result = 0;
+	}
+
+	free(links);
+
+	return result;
+}
+
 static void work_for_master(struct link *master) {
 	sigset_t mask;
 
@@ -1614,7 +2849,7 @@ static void work_for_master(struct link *master) {
 			sigchld_received_flag = 0;
 		}
 
-		int master_activity = link_usleep_mask(master, wait_msec*1000, &mask, 1, 0);
+		int master_activity = wait_for_master(master, wait_msec, &mask);
 		if(master_activity < 0) break;
 
 		int ok = 1;
@@ -1645,6 +2880,10 @@ static void work_for_master(struct link *master) {
 			finish_running_tasks(WORK_QUEUE_RESULT_RESOURCE_EXHAUSTION);
 		}
 
+		if(ok) {
+			cache_evict(master);
+		}
+
 		int task_event = 0;
 		if(ok) {
 			struct work_queue_process *p;
@@ -1655,7 +2894,12 @@ static void work_for_master(struct link *master) {
 				p = list_pop_head(procs_waiting);
 				if(!p) {
 					break;
-				} else if(task_resources_fit_now(p->task)) {
+				} else if(itable_lookup(procs_unstaged, p->task->taskid) && task_needs_missing_files(p)) {
+					list_push_tail(procs_waiting, p);
+				} else if(itable_remove(procs_unstaged, p->task->taskid) && !setup_sandbox(p)) {
+					forsake_waiting_process(master, p);
+					task_event++;
+				} else if(task_resources_fit_now(p->task) && library_available(p)) {
 					start_process(p);
 					task_event++;
 				} else if(task_resources_fit_eventually(p->task)) {
@@ -1671,6 +2915,10 @@ static void work_for_master(struct link *master) {
 			send_stats_update(master);
 		}
 
+		if(ok && master_frames) {
+			push_tasks_complete(master);
+		}
+
 		if(ok && !results_to_be_sent_msg) {
 			if(work_queue_watcher_check(watcher) || itable_size(procs_complete) > 0) {
 				send_master_message(master, "available_results\n");
@@ -1728,6 +2976,10 @@ static void foreman_for_master(struct link *master) {
 			result = 1;
 		}
 
+		if(master_frames) {
+			push_tasks_complete(master);
+		}
+
 		if(!results_to_be_sent_msg && itable_size(procs_complete) > 0)
 		{
 			send_master_message(master, "available_results\n");
@@ -1799,6 +3051,8 @@ static int workspace_prepare()
 	setenv("WORKER_TMPDIR", tmp_name, 1);
 	free(tmp_name);
 
+	cache_rescan();
+
 	return result;
 }
 
@@ -1810,7 +3064,37 @@ to remove any state left over from a previous run.
 static void workspace_cleanup()
 {
 	debug(D_WQ,"cleaning workspace %s",workspace);
-	delete_dir_contents(workspace);
+
+	// Files named after their contents stay valid for any master, so they
+	// are kept in the cache, and everything else is removed.
+	DIR *dir = opendir(workspace);
+	if(dir) {
+		struct dirent *d;
+		while((d = readdir(dir))) {
+			if(!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..") || !strcmp(d->d_name, "cache")) continue;
+			char *path = string_format("%s/%s", workspace, d->d_name);
+			delete_dir(path);
+			free(path);
+		}
+		closedir(dir);
+	}
+
+	char *cachedir = string_format("%s/cache", workspace);
+	dir = opendir(cachedir);
+	if(dir) {
+		struct dirent *d;
+		while((d = readdir(dir))) {
+			if(!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..") || string_prefix_is(d->d_name, WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX)) continue;
+			char *path = string_format("%s/%s", cachedir, d->d_name);
+			delete_dir(path);
+			free(path);
+		}
+		closedir(dir);
+	}
+	free(cachedir);
+
+	peer_fetches_stop();
+	hash_table_clear(missing_cache_files);
 }
 
 /*
@@ -1830,6 +3114,18 @@ static void workspace_delete()
 	if(procs_table)        itable_delete(procs_table);
 	if(procs_complete)     itable_delete(procs_complete);
 	if(procs_waiting)      list_delete(procs_waiting);
+	if(libraries) {
+		remove_all_libraries();
+		list_delete(libraries);
+	}
+	if(missing_cache_files) hash_table_delete(missing_cache_files);
+	if(peer_fetches)       itable_delete(peer_fetches);
+	if(cache_entries) {
+		cache_clear();
+		hash_table_delete(cache_entries);
+	}
+	if(cache_evicted)      hash_table_delete(cache_evicted);
+	if(procs_unstaged)     itable_delete(procs_unstaged);
 
 	if(watcher)            work_queue_watcher_delete(watcher);
 
@@ -1885,7 +3181,7 @@ static int serve_master_by_hostport( const char *host, int port, const char *ver
 		char line[WORK_QUEUE_LINE_MAX];
 		debug(D_WQ, "verifying master's project name");
 		send_master_message(master, "name\n");
-		if(!recv_master_message(master,line,sizeof(line),idle_stoptime)) {
+		if(!recv_master_message(master,line,sizeof(line),NULL,idle_stoptime)) {
 			debug(D_WQ,"no response from master while verifying name");
 			link_close(master);
 			return 0;
@@ -1916,6 +3212,7 @@ static int serve_master_by_hostport( const char *host, int port, const char *ver
 
 	last_task_received     = 0;
 	results_to_be_sent_msg = 0;
+	master_frames          = 0;
 
 	workspace_cleanup();
 	disconnect_master(master);
@@ -2152,6 +3449,7 @@ static void show_help(const char *cmd)
 	printf( " %-30s Select port to listen to at random and write to this file.  Implies --foreman.\n", "-Z,--foreman-port-file=<file>");
 	printf( " %-30s Set the fast abort multiplier for foreman (default=disabled).\n", "-F,--fast-abort=<mult>");
 	printf( " %-30s Send statistics about foreman to this file.\n", "--specify-log=<logfile>");
+	printf( " %-30s Foreman scheduling algorithm. (files|time|fcfs|rand|worst) (default=files)\n", "--foreman-schedule=<mode>");
 	printf( " %-30s Password file for authenticating to the master.\n", "-P,--password=<pwfile>");
 	printf( " %-30s Set both --idle-timeout and --connect-timeout.\n", "-t,--timeout=<time>");
 	printf( " %-30s Disconnect after this time if master sends no work. (default=%ds)\n", "   --idle-timeout=<time>", idle_timeout);
@@ -2181,6 +3479,10 @@ static void show_help(const char *cmd)
 	printf( " %-30s Use loop devices for task sandboxes (default=disabled, requires root access).\n", "--disk-allocation");
 	printf( " %-30s Set the maximum number of seconds the worker may be active. (in s).\n", "--wall-time=<s>");
 	printf( " %-30s Forbid the use of symlinks for cache management.\n", "--disable-symlinks");
+	printf( " %-30s Serve cached files to other workers on this port. (default=any)\n", "--transfer-port=<port>");
+	printf( " %-30s Serve cached files to other workers from the start, rather than when the master enables it.\n", "--peer-transfers");
+	printf( " %-30s Do not serve cached files to other workers.\n", "--disable-peer-transfers");
+	printf( " %-30s Evict the least recently used cached files when the cache is over this size (in MB). (default=unlimited)\n", "--cache-budget=<mb>");
 	printf(" %-30s Single-shot mode -- quit immediately after disconnection.\n", "--single-shot");
 	printf(" %-30s docker mode -- run each task with a container based on this docker image.\n", "--docker=<image>");
 	printf(" %-30s docker-preserve mode -- tasks execute by a worker share a container based on this docker image.\n", "--docker-preserve=<image>");
@@ -2193,7 +3495,8 @@ enum {LONG_OPT_DEBUG_FILESIZE = 256, LONG_OPT_VOLATILITY, LONG_OPT_BANDWIDTH,
 	  LONG_OPT_DISK, LONG_OPT_GPUS, LONG_OPT_FOREMAN, LONG_OPT_FOREMAN_PORT, LONG_OPT_DISABLE_SYMLINKS,
 	  LONG_OPT_IDLE_TIMEOUT, LONG_OPT_CONNECT_TIMEOUT, LONG_OPT_RUN_DOCKER, LONG_OPT_RUN_DOCKER_PRESERVE,
 	  LONG_OPT_BUILD_FROM_TAR, LONG_OPT_SINGLE_SHOT, LONG_OPT_WALL_TIME, LONG_OPT_DISK_ALLOCATION,
-	  LONG_OPT_MEMORY_THRESHOLD};
+	  LONG_OPT_MEMORY_THRESHOLD, LONG_OPT_TRANSFER_PORT, LONG_OPT_PEER_TRANSFERS, LONG_OPT_DISABLE_PEER_TRANSFERS,
+	  LONG_OPT_CACHE_BUDGET, LONG_OPT_FOREMAN_SCHEDULE};
 
 static const struct option long_options[] = {
 	{"advertise",           no_argument,        0,  'a'},
@@ -2209,6 +3512,7 @@ static const struct option long_options[] = {
 	{"measure-capacity",    no_argument,        0,  'c'},
 	{"fast-abort",          required_argument,  0,  'F'},
 	{"specify-log",         required_argument,  0,  LONG_OPT_SPECIFY_LOG},
+	{"foreman-schedule",    required_argument,  0,  LONG_OPT_FOREMAN_SCHEDULE},
 	{"master-name",         required_argument,  0,  'M'},
 	{"password",            required_argument,  0,  'P'},
 	{"timeout",             required_argument,  0,  't'},
@@ -2234,6 +3538,10 @@ static const struct option long_options[] = {
 	{"help",                no_argument,        0,  'h'},
 	{"version",             no_argument,        0,  'v'},
 	{"disable-symlinks",    no_argument,        0,  LONG_OPT_DISABLE_SYMLINKS},
+	{"transfer-port",       required_argument,  0,  LONG_OPT_TRANSFER_PORT},
+	{"peer-transfers",      no_argument,        0,  LONG_OPT_PEER_TRANSFERS},
+	{"disable-peer-transfers", no_argument,     0,  LONG_OPT_DISABLE_PEER_TRANSFERS},
+	{"cache-budget",        required_argument,  0,  LONG_OPT_CACHE_BUDGET},
 	{"docker",              required_argument,  0,  LONG_OPT_RUN_DOCKER},
 	{"docker-preserve",     required_argument,  0,  LONG_OPT_RUN_DOCKER_PRESERVE},
 	{"docker-tar",          required_argument,  0,  LONG_OPT_BUILD_FROM_TAR},
@@ -2251,6 +3559,7 @@ int main(int argc, char *argv[])
 	int enable_capacity = 1; // enabled by default
 	double fast_abort_multiplier = 0;
 	char *foreman_stats_filename = NULL;
+	work_queue_schedule_t foreman_algorithm = WORK_QUEUE_SCHEDULE_UNSET;
 	char * catalog_hosts = CATALOG_HOST;
 
 	worker_start_time = time(0);
@@ -2312,6 +3621,22 @@ int main(int argc, char *argv[])
 		case LONG_OPT_SPECIFY_LOG:
 			foreman_stats_filename = xxstrdup(optarg);
 			break;
+		case LONG_OPT_FOREMAN_SCHEDULE:
+			if(!strcmp(optarg, "files")) {
+				foreman_algorithm = WORK_QUEUE_SCHEDULE_FILES;
+			} else if(!strcmp(optarg, "time")) {
+				foreman_algorithm = WORK_QUEUE_SCHEDULE_TIME;
+			} else if(!strcmp(optarg, "fcfs")) {
+				foreman_algorithm = WORK_QUEUE_SCHEDULE_FCFS;
+			} else if(!strcmp(optarg, "rand")) {
+				foreman_algorithm = WORK_QUEUE_SCHEDULE_RAND;
+			} else if(!strcmp(optarg, "worst")) {
+				foreman_algorithm = WORK_QUEUE_SCHEDULE_WORST;
+			} else {
+				fprintf(stderr, "work_queue_worker: unknown scheduling mode %s\n", optarg);
+				exit(1);
+			}
+			break;
 		case 't':
 			connect_timeout = idle_timeout = string_time_parse(optarg);
 			break;
@@ -2426,6 +3751,18 @@ int main(int argc, char *argv[])
 		case LONG_OPT_DISABLE_SYMLINKS:
 			symlinks_enabled = 0;
 			break;
+		case LONG_OPT_TRANSFER_PORT:
+			transfer_port_option = atoi(optarg);
+			break;
+		case LONG_OPT_PEER_TRANSFERS:
+			peer_transfers_at_start = 1;
+			break;
+		case LONG_OPT_DISABLE_PEER_TRANSFERS:
+			peer_transfers_enabled = 0;
+			break;
+		case LONG_OPT_CACHE_BUDGET:
+			cache_budget = atoll(optarg);
+			break;
 		case LONG_OPT_SINGLE_SHOT:
 			single_shot_mode = 1;
 			break;
@@ -2587,6 +3924,14 @@ int main(int argc, char *argv[])
 		work_queue_activate_fast_abort(foreman_q, fast_abort_multiplier);
 		work_queue_specify_category_mode(foreman_q, NULL, WORK_QUEUE_ALLOCATION_MODE_FIXED);
 
+		// Unless told otherwise, tasks go to the workers that already hold
+		// their inputs, so that the cache of each worker is used before files
+		// are sent again.
+		if(foreman_algorithm == WORK_QUEUE_SCHEDULE_UNSET) {
+			foreman_algorithm = WORK_QUEUE_SCHEDULE_FILES;
+		}
+		work_queue_specify_algorithm(foreman_q, foreman_algorithm);
+
 		if(foreman_stats_filename) {
 			work_queue_specify_log(foreman_q, foreman_stats_filename);
 		}
@@ -2616,7 +3961,17 @@ int main(int argc, char *argv[])
 	procs_running  = itable_create(0);
 	procs_table    = itable_create(0);
 	procs_waiting  = list_create();
+	libraries      = list_create();
 	procs_complete = itable_create(0);
+	missing_cache_files = hash_table_create(0, 0);
+	peer_fetches   = itable_create(0);
+	cache_entries  = hash_table_create(0, 0);
+	cache_evicted  = hash_table_create(0, 0);
+	procs_unstaged = itable_create(0);
+
+	if(peer_transfers_at_start && peer_transfers_enabled && worker_mode != WORKER_MODE_FOREMAN) {
+		transfer_server_start();
+	}
 
 	watcher = work_queue_watcher_create();
 
@@ -2709,6 +4064,8 @@ int main(int argc, char *argv[])
 
 	}
 
+	transfer_server_stop();
+
 	workspace_delete();
 
 	return 0;
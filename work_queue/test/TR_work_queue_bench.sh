@@ -0,0 +1,43 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+TASKS=500
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	echo "running the benchmark with simulated workers"
+	if ! work_queue_bench -w 20 -n $TASKS -t 0:5 -l 1 -f 2 -k 0.5 -O 1 > bench.out
+	then
+		cat bench.out
+		echo "the benchmark failed!"
+		return 1
+	fi
+
+	cat bench.out
+
+	echo "checking that all the tasks completed"
+	if ! grep -q "^tasks_done  *$TASKS$" bench.out
+	then
+		echo "not all the tasks completed!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -rf bench.out work_queue_bench.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,68 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+CORES=4
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	# the first tasks measure how long tasks run, so that the later ones are
+	# sent in bundles. Tasks take little memory and disk, so that several fit in the
+	# worker at once.
+	cat > master.script << EOF
+resources 1 1 10
+submit 1 0 0 4
+wait
+submit 1 0 0 32
+wait
+quit
+EOF
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	echo "starting worker"
+	work_queue_worker -d all -o worker.log localhost `cat master.port` --timeout 10 --cores $CORES --memory-threshold 10 --memory 50 --single-shot
+
+	wait
+
+	echo "checking for output"
+	i=0
+	while [ $i -lt 36 ]
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			return 1
+		fi
+		i=$((i+1))
+	done
+
+	echo "checking that tasks were sent in bundles"
+	if ! cat master.log* | grep -q "Sending [2-9] task(s) to .* in one dispatch"
+	then
+		echo "tasks were not bundled!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -f master.script master.log* master.port worker.log* output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,75 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+TASKS=6
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	# each submit reads a cached input of 1 MB of its own, so that the
+	# inputs of the earlier tasks are evicted from a cache of 2 MB.
+	echo "" > master.script
+	i=0
+	while [ $i -lt $TASKS ]
+	do
+		echo "submit 1 0 0 2" >> master.script
+		i=$((i+1))
+	done
+	echo "wait" >> master.script
+	echo "quit" >> master.script
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	echo "starting worker"
+	work_queue_worker -d all -o worker.log localhost `cat master.port` --timeout 10 --cache-budget 2 --single-shot
+
+	wait
+
+	echo "checking for output"
+	i=0
+	while [ $i -lt $((2*TASKS)) ]
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			return 1
+		fi
+		i=$((i+1))
+	done
+
+	echo "checking that inputs were evicted"
+	if ! cat worker.log* | grep -q "evicting .*input\.[0-9]* (.*) from the cache"
+	then
+		echo "no input was evicted!"
+		return 1
+	fi
+
+	echo "checking that the master was told of the evictions"
+	if ! cat master.log* | grep -q "rx from .*: cache-invalid"
+	then
+		echo "the master was not told of the evictions!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -f master.script master.log* master.port worker.log* output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,89 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+prepare()
+{
+	# a file that compresses well, and one that does not, so that the
+	# blocks that do not shrink are sent plain.
+	seq 1 300000 > copy.text
+	dd if=/dev/urandom of=copy.random bs=1048576 count=2 2> /dev/null
+}
+
+run()
+{
+	cat > master.script << EOF2
+tune compress-transfers 1
+submit 3 0 2 2
+submit_copy copy.text 1
+submit_copy copy.random 1
+wait
+quit
+EOF2
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	echo "starting worker"
+	work_queue_worker -d all -o worker.log localhost `cat master.port` --timeout 10 --cores 1 --memory-threshold 10 --memory 50 --single-shot
+
+	echo "checking for output"
+	for i in 0 1
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			return 1
+		fi
+
+		size=`wc -c < output.$i`
+		if [ "$size" -ne 2097152 ]
+		then
+			echo "output.$i has $size bytes!"
+			return 1
+		fi
+	done
+
+	echo "checking that the copies are identical to the inputs"
+	if ! cmp copy.text output_copy.0 || ! cmp copy.random output_copy.1
+	then
+		echo "a file changed on its way through the worker!"
+		return 1
+	fi
+
+	echo "checking that the files were compressed"
+	if ! grep -q "tx to .*: zput " master.log || ! grep -q "rx from .*: zfile" master.log
+	then
+		echo "the files were not sent compressed!"
+		return 1
+	fi
+
+	# the input of zeros and copy.text shrink, and copy.random does not.
+	if [ `grep -c "was sent .*compressed to [1-8]\?[0-9]\.[0-9]%" master.log` -lt 2 ]
+	then
+		echo "copy.text was not compressed!"
+		return 1
+	fi
+
+	if ! grep -q "was sent .*compressed to 10[0-9]\.[0-9]%" master.log
+	then
+		echo "copy.random was not sent plain!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -f master.script master.log master.port worker.log output.* output_copy.* input.* copy.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
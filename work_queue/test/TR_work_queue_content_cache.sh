@@ -0,0 +1,60 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	# each submit line writes its own input file, but with the same contents.
+	cat > master.script << EOF2
+tune content-addressed-cache 1
+submit 1 0 0 2
+submit 1 0 0 2
+wait
+quit
+EOF2
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	echo "starting worker"
+	work_queue_worker -d all -o worker.log localhost `cat master.port` --timeout 10 --cores 1 --memory-threshold 10 --memory 50 --single-shot
+
+	echo "checking for output"
+	for i in 0 1 2 3
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			return 1
+		fi
+	done
+
+	echo "checking that the inputs were sent once"
+	sent=`grep -c "tx to .*: put hash-" master.log`
+	if [ "$sent" != 1 ]
+	then
+		echo "the inputs were sent $sent times!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -f master.script master.log master.port worker.log output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,62 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	cat > master.script << EOF2
+submit_tree 2500 1
+wait
+quit
+EOF2
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	echo "starting worker"
+	work_queue_worker -d all -o worker.log localhost `cat master.port` --timeout 10 --cores 1 --memory-threshold 10 --memory 50 --single-shot
+
+	echo "checking that the tree came back whole"
+	if ! diff -r input_tree.0 output_tree.0
+	then
+		echo "output_tree.0 differs from input_tree.0!"
+		return 1
+	fi
+
+	echo "checking that the modes were kept"
+	in=`cd input_tree.0 && find . -perm -0100 | sort | md5sum`
+	out=`cd output_tree.0 && find . -perm -0100 | sort | md5sum`
+	if [ "$in" != "$out" ]
+	then
+		echo "the modes of output_tree.0 differ from input_tree.0!"
+		return 1
+	fi
+
+	echo "checking that the tree was streamed"
+	if ! cat master.log* | grep -q "tx to .*: putdir "
+	then
+		echo "the tree was not sent as a stream!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -rf master.script master.log* master.port worker.log* input_tree.* output_tree.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,89 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+TASKS=12
+WORKERS=2
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	# all the tasks read the same cached input.
+	cat > master.script << EOF
+resources 1 1 10
+submit 1 0 0 $TASKS
+wait
+quit
+EOF
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	echo "starting foreman"
+	work_queue_worker -d all -o foreman.log --foreman -Z foreman.port localhost `cat master.port` --timeout 10 --single-shot &
+	wait_for_file_creation foreman.port 5
+
+	echo "starting workers"
+	i=0
+	while [ $i -lt $WORKERS ]
+	do
+		work_queue_worker -d all -o worker.$i.log localhost `cat foreman.port` --timeout 10 --cores 1 --memory-threshold 10 --memory 50 --single-shot &
+		i=$((i+1))
+	done
+
+	wait
+
+	echo "checking for output"
+	i=0
+	while [ $i -lt $TASKS ]
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			return 1
+		fi
+		i=$((i+1))
+	done
+
+	name=`sed -n 's/.*tx to .*: put \(file-0-[^ ]*-input\.0\) .*/\1/p' master.log* | head -1`
+	if [ -z "$name" ]
+	then
+		echo "the master did not send the input!"
+		return 1
+	fi
+
+	echo "checking that the input crossed from the master once"
+	sent=`cat master.log* | grep -c "tx to .*: put $name "`
+	if [ "$sent" != 1 ]
+	then
+		echo "the master sent the input $sent times!"
+		return 1
+	fi
+
+	echo "checking that the workers of the foreman know the input by the name given by the master"
+	if ! cat worker.*.log* | grep -q "rx from master: put $name "
+	then
+		echo "the workers do not use the name $name!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -f master.script master.log* master.port foreman.log* foreman.port worker.*.log* output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
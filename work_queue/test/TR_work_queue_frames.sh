@@ -0,0 +1,84 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+# run_master <frames> runs a few tasks with binary frames set to 1 or 0.
+run_master()
+{
+	rm -f master.port master.log* worker.log* output.*
+
+	cat > master.script << EOF
+tune binary-frames $1
+submit 1 0 1 4
+wait
+quit
+EOF
+
+	echo "starting master with binary-frames $1"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	echo "starting worker"
+	work_queue_worker -d all -o worker.log localhost `cat master.port` --timeout 10 --cores 1 --memory-threshold 10 --memory 50 --single-shot
+
+	wait
+
+	echo "checking for output"
+	for i in 0 1 2 3
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			return 1
+		fi
+	done
+
+	return 0
+}
+
+run()
+{
+	run_master 1 || return 1
+
+	echo "checking that tasks and results were sent as frames"
+	if ! cat master.log* | grep -q "tx to .*: frame task" || ! cat master.log* | grep -q "rx from .*: frame result" || ! cat master.log* | grep -q "rx from .*: frame alive"
+	then
+		echo "frames were not used!"
+		return 1
+	fi
+
+	run_master 0 || return 1
+
+	echo "checking that only text messages were sent"
+	if cat master.log* | grep -q ": frame "
+	then
+		echo "frames were used while disabled!"
+		return 1
+	fi
+
+	if ! cat master.log* | grep -q "rx from .*: result "
+	then
+		echo "results were not sent as text!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -f master.script master.log* master.port worker.log* output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
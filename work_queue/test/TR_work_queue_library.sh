@@ -0,0 +1,94 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+CORES=2
+TASKS=10
+
+prepare()
+{
+	# a library that runs the arguments of each invocation as a shell
+	# command in the sandbox of the task, and logs when it starts and what
+	# it serves.
+	cat > library.sh << 'EOF'
+#!/bin/sh
+echo "start $$" >> "$LIBRARY_LOG"
+while read request taskid sandbox_length length
+do
+	sandbox=$(dd bs=1 count=$sandbox_length 2>/dev/null)
+	args=$(dd bs=1 count=$length 2>/dev/null)
+	output=$(cd "$sandbox" && sh -c "$args" 2>&1)
+	status=$?
+	echo "invoke $$ $taskid" >> "$LIBRARY_LOG"
+	printf 'result %d %d\n%s' $status ${#output} "$output"
+done
+EOF
+	chmod 755 library.sh
+}
+
+run()
+{
+	export LIBRARY_LOG=`pwd`/library.log
+
+	cat > master.script << EOF
+resources 1 1 10
+library `pwd`/library.sh
+submit 1 0 0 $TASKS
+wait
+quit
+EOF
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	echo "starting worker in a directory with a space in its name"
+	mkdir -p "work space"
+	work_queue_worker -d all -o worker.log localhost `cat master.port` --timeout 10 --cores $CORES --memory-threshold 10 --memory 50 --single-shot --workdir "`pwd`/work space"
+
+	wait
+
+	echo "checking for output"
+	i=0
+	while [ $i -lt $TASKS ]
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			return 1
+		fi
+		i=$((i+1))
+	done
+
+	echo "checking that every task was an invocation of the library"
+	invocations=`grep -c "^invoke" library.log`
+	if [ "$invocations" != $TASKS ]
+	then
+		echo "$invocations invocations instead of $TASKS!"
+		return 1
+	fi
+
+	echo "checking that the library was started at most once per core"
+	starts=`grep -c "^start" library.log`
+	if [ "$starts" -lt 1 -o "$starts" -gt $CORES ]
+	then
+		echo "library was started $starts times for $CORES cores!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -rf "work space"
+	rm -f library.sh library.log master.script master.log* master.port worker.log* output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
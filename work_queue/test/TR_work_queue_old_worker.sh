@@ -0,0 +1,47 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+TASKS=200
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	# the simulated workers of work_queue_bench offer none of the optional
+	# features, as workers older than them, and stop if they are sent any of
+	# their messages. With every feature enabled at the master, they must
+	# still get and run all the tasks.
+	echo "running tasks on workers that offer no optional features"
+	if ! work_queue_bench -w 4 -n $TASKS -t 0:5 -f 2 -O 1 -T compress-transfers=1 -T binary-frames=1 -T peer-transfer-fanout=2 -T max-task-bundle=8 > bench.out
+	then
+		cat bench.out
+		echo "the benchmark failed!"
+		return 1
+	fi
+
+	cat bench.out
+
+	echo "checking that all the tasks completed"
+	if ! grep -q "^tasks_done  *$TASKS$" bench.out
+	then
+		echo "not all the tasks completed!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -rf bench.out work_queue_bench.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+TASKS=6
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	cat > master.script << EOF2
+tune peer-transfer-fanout 2
+submit 5 2 0 $TASKS
+wait
+quit
+EOF2
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+	port=`cat master.port`
+
+	# the first worker gets the input from the master, and the others
+	# join once it holds a copy to serve to them.
+	echo "starting workers"
+	work_queue_worker -d all -o worker.1.log localhost $port --timeout 10 --cores 1 --memory-threshold 10 --memory 50 --single-shot &
+	sleep 4
+	work_queue_worker -d all -o worker.2.log localhost $port --timeout 10 --cores 1 --memory-threshold 10 --memory 50 --single-shot &
+	work_queue_worker -d all -o worker.3.log localhost $port --timeout 10 --cores 1 --memory-threshold 10 --memory 50 --single-shot
+	wait
+
+	echo "checking for output"
+	i=0
+	while [ $i -lt $TASKS ]
+	do
+		file=output.$i
+		if [ ! -f $file ]
+		then
+			echo "$file is missing!"
+			return 1
+		fi
+		i=$((i+1))
+	done
+
+	echo "checking for transfers between workers"
+	if ! grep -q "fetches file" master.log
+	then
+		echo "no input was fetched from another worker!"
+		return 1
+	fi
+
+	if ! cat worker.*.log | grep -q "Fetched file"
+	then
+		echo "no fetch from another worker completed!"
+		return 1
+	fi
+
+	echo "all output present"
+	return 0
+}
+
+clean()
+{
+	rm -f master.script master.log master.port worker.*.log output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
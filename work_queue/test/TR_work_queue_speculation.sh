@@ -0,0 +1,92 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+TASKS=12
+SLOW=60
+
+prepare()
+{
+	# the tasks of the slow worker find a sleep that takes SLOW seconds.
+	mkdir -p slowbin
+	echo "#!/bin/sh" > slowbin/sleep
+	echo "exec `command -v sleep` $SLOW" >> slowbin/sleep
+	chmod 755 slowbin/sleep
+}
+
+run()
+{
+	cat > master.script << EOF
+speculation 90 1
+submit 0 0 0 $TASKS
+wait
+quit
+EOF
+
+	start=`date +%s`
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	echo "starting slow worker"
+	PATH=`pwd`/slowbin:$PATH work_queue_worker -d all -o slow.log localhost `cat master.port` --timeout 10 --cores 1 --single-shot &
+
+	echo "waiting for the slow worker to get a task"
+	sleep 3
+
+	echo "starting fast worker"
+	work_queue_worker -d all -o fast.log localhost `cat master.port` --timeout 10 --cores 1 --single-shot &
+
+	wait
+
+	elapsed=$((`date +%s` - start))
+	echo "tasks took $elapsed seconds"
+
+	echo "checking for output"
+	i=0
+	while [ $i -lt $TASKS ]
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			return 1
+		fi
+		i=$((i+1))
+	done
+
+	echo "checking that the slow task was duplicated"
+	if ! cat master.log* | grep -q "starting duplicate"
+	then
+		echo "no duplicate was started!"
+		return 1
+	fi
+
+	if ! cat master.log* | grep -q "Duplicate .* of task .* finished first"
+	then
+		echo "the duplicate did not give the result of the task!"
+		return 1
+	fi
+
+	if [ $elapsed -ge $SLOW ]
+	then
+		echo "the tasks waited for the slow worker!"
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -rf slowbin
+	rm -f master.script master.log* master.port slow.log* fast.log* output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4: